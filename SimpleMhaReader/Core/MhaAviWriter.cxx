@@ -0,0 +1,226 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+
+#include "MhaAviWriter.h"
+#include "MhaFileUtilities.h"
+
+// STD includes
+#include <cmath>
+#include <cstring>
+
+namespace
+{
+/// Little-endian fields of the RIFF chunks
+void appendFourCC(std::vector<unsigned char>& buffer, const char* fourcc)
+{
+  buffer.insert(buffer.end(), fourcc, fourcc + 4);
+}
+
+void appendInt32(std::vector<unsigned char>& buffer, unsigned int value)
+{
+  for(int i=0; i<4; i++)
+    buffer.push_back((unsigned char)(value >> (8*i)));
+}
+
+void appendInt16(std::vector<unsigned char>& buffer, unsigned int value)
+{
+  buffer.push_back((unsigned char)(value & 0xFF));
+  buffer.push_back((unsigned char)(value >> 8));
+}
+
+const long long maximumFileSize = 0xFFFFFFFFLL;
+const unsigned int keyFrameFlag = 0x10;
+const unsigned int hasIndexFlag = 0x10;
+}
+
+//----------------------------------------------------------------------------
+MhaAviWriter::MhaAviWriter()
+  : file(NULL), framesPerSecond(0.), fileSize(0), moviOffset(0), totalFramesOffset(0), lengthOffset(0),
+    maxBytesPerSecondOffset(0), avihBufferSizeOffset(0), strhBufferSizeOffset(0), largestFrame(0)
+{
+}
+
+//----------------------------------------------------------------------------
+MhaAviWriter::~MhaAviWriter()
+{
+  this->close();
+}
+
+//----------------------------------------------------------------------------
+int MhaAviWriter::open(const std::string& path, int width, int height, double framesPerSecond)
+{
+  this->close();
+  if(width <= 0 || height <= 0 || framesPerSecond <= 0.)
+    return 1;
+  this->file = fopen(path.c_str(), "wb");
+  if(!this->file)
+    return 1;
+  this->framesPerSecond = framesPerSecond;
+  this->frameSizes.clear();
+  this->largestFrame = 0;
+
+  // Sizes and counts are written as 0 and completed by close()
+  std::vector<unsigned char> header;
+  appendFourCC(header, "RIFF");
+  appendInt32(header, 0);
+  appendFourCC(header, "AVI ");
+  appendFourCC(header, "LIST");
+  appendInt32(header, 4 + 8 + 56 + 8 + 4 + 8 + 56 + 8 + 40);
+  appendFourCC(header, "hdrl");
+
+  appendFourCC(header, "avih");
+  appendInt32(header, 56);
+  appendInt32(header, (unsigned int)floor(1e6/framesPerSecond + 0.5));
+  this->maxBytesPerSecondOffset = (long long)header.size();
+  appendInt32(header, 0);
+  appendInt32(header, 0);
+  appendInt32(header, hasIndexFlag);
+  this->totalFramesOffset = (long long)header.size();
+  appendInt32(header, 0);
+  appendInt32(header, 0);
+  appendInt32(header, 1);
+  this->avihBufferSizeOffset = (long long)header.size();
+  appendInt32(header, 0);
+  appendInt32(header, (unsigned int)width);
+  appendInt32(header, (unsigned int)height);
+  for(int i=0; i<4; i++)
+    appendInt32(header, 0);
+
+  appendFourCC(header, "LIST");
+  appendInt32(header, 4 + 8 + 56 + 8 + 40);
+  appendFourCC(header, "strl");
+  appendFourCC(header, "strh");
+  appendInt32(header, 56);
+  appendFourCC(header, "vids");
+  appendFourCC(header, "MJPG");
+  appendInt32(header, 0);
+  appendInt32(header, 0);
+  appendInt32(header, 0);
+  // The rate is rate/scale frames per second
+  appendInt32(header, 1000);
+  appendInt32(header, (unsigned int)floor(framesPerSecond*1000. + 0.5));
+  appendInt32(header, 0);
+  this->lengthOffset = (long long)header.size();
+  appendInt32(header, 0);
+  this->strhBufferSizeOffset = (long long)header.size();
+  appendInt32(header, 0);
+  appendInt32(header, 0xFFFFFFFF);
+  appendInt32(header, 0);
+  appendInt16(header, 0);
+  appendInt16(header, 0);
+  appendInt16(header, (unsigned int)width);
+  appendInt16(header, (unsigned int)height);
+
+  appendFourCC(header, "strf");
+  appendInt32(header, 40);
+  appendInt32(header, 40);
+  appendInt32(header, (unsigned int)width);
+  appendInt32(header, (unsigned int)height);
+  appendInt16(header, 1);
+  appendInt16(header, 24);
+  appendFourCC(header, "MJPG");
+  appendInt32(header, (unsigned int)(width*height*3));
+  for(int i=0; i<4; i++)
+    appendInt32(header, 0);
+
+  appendFourCC(header, "LIST");
+  appendInt32(header, 0);
+  this->moviOffset = (long long)header.size();
+  appendFourCC(header, "movi");
+
+  this->fileSize = (long long)header.size();
+  if(fwrite(&header[0], 1, header.size(), this->file) != header.size())
+  {
+    fclose(this->file);
+    this->file = NULL;
+    return 1;
+  }
+  return 0;
+}
+
+//----------------------------------------------------------------------------
+int MhaAviWriter::appendFrame(const unsigned char* jpeg, size_t size)
+{
+  if(!this->file)
+    return 1;
+  size_t paddedSize = size + (size & 1);
+  // Room for this chunk and the index entries of every frame
+  if(this->fileSize + 8 + (long long)paddedSize + 8 + 16*(long long)(this->frameSizes.size() + 1) > maximumFileSize)
+    return 1;
+  std::vector<unsigned char> chunkHeader;
+  appendFourCC(chunkHeader, "00dc");
+  appendInt32(chunkHeader, (unsigned int)size);
+  static const unsigned char padding = 0;
+  if(fwrite(&chunkHeader[0], 1, 8, this->file) != 8
+    || fwrite(jpeg, 1, size, this->file) != size
+    || (paddedSize != size && fwrite(&padding, 1, 1, this->file) != 1))
+    return 1;
+  this->fileSize += 8 + (long long)paddedSize;
+  this->frameSizes.push_back((unsigned int)size);
+  if(size > this->largestFrame)
+    this->largestFrame = (unsigned int)size;
+  return 0;
+}
+
+//----------------------------------------------------------------------------
+int MhaAviWriter::writeAt(long long offset, unsigned int value)
+{
+  std::vector<unsigned char> buffer;
+  appendInt32(buffer, value);
+  return seekFile(this->file, offset) || fwrite(&buffer[0], 1, 4, this->file) != 4;
+}
+
+//----------------------------------------------------------------------------
+int MhaAviWriter::close()
+{
+  if(!this->file)
+    return 0;
+  // Offsets of the index count from the movi fourcc
+  std::vector<unsigned char> index;
+  appendFourCC(index, "idx1");
+  appendInt32(index, 16*(unsigned int)this->frameSizes.size());
+  long long frameOffset = 4;
+  long long totalBytes = 0;
+  for(size_t i=0; i<this->frameSizes.size(); i++)
+  {
+    appendFourCC(index, "00dc");
+    appendInt32(index, keyFrameFlag);
+    appendInt32(index, (unsigned int)frameOffset);
+    appendInt32(index, this->frameSizes[i]);
+    frameOffset += 8 + this->frameSizes[i] + (this->frameSizes[i] & 1);
+    totalBytes += this->frameSizes[i];
+  }
+  long long moviEnd = this->fileSize;
+  int failed = fwrite(&index[0], 1, index.size(), this->file) != index.size();
+  this->fileSize += (long long)index.size();
+
+  unsigned int frames = (unsigned int)this->frameSizes.size();
+  double seconds = frames/this->framesPerSecond;
+  unsigned int bytesPerSecond = seconds > 0. ? (unsigned int)(totalBytes/seconds) : 0;
+  failed = failed
+    || this->writeAt(4, (unsigned int)(this->fileSize - 8))
+    || this->writeAt(this->maxBytesPerSecondOffset, bytesPerSecond)
+    || this->writeAt(this->totalFramesOffset, frames)
+    || this->writeAt(this->avihBufferSizeOffset, this->largestFrame)
+    || this->writeAt(this->lengthOffset, frames)
+    || this->writeAt(this->strhBufferSizeOffset, this->largestFrame)
+    || this->writeAt(this->moviOffset - 4, (unsigned int)(moviEnd - this->moviOffset));
+  failed = fclose(this->file) != 0 || failed;
+  this->file = NULL;
+  return failed;
+}
@@ -0,0 +1,69 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+
+// .NAME MhaAviWriter - Motion JPEG AVI files
+// .SECTION Description
+// Writes an AVI 1.0 file with one video stream of JPEG frames, which common
+// players and ffmpeg open. Frames are appended as they come; the headers
+// are completed and the index written by close(). AVI 1.0 offsets are 32
+// bits, so a file stops at 4 GB.
+
+#ifndef __MhaAviWriter_h
+#define __MhaAviWriter_h
+
+// STD includes
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+class MhaAviWriter
+{
+public:
+  MhaAviWriter();
+  ~MhaAviWriter();
+
+  int open(const std::string& path, int width, int height, double framesPerSecond);
+  /// Appends one encoded JPEG frame
+  int appendFrame(const unsigned char* jpeg, size_t size);
+  int close();
+
+  bool isOpen() const { return this->file != NULL; }
+  int getNumberOfFrames() const { return (int)this->frameSizes.size(); }
+  long long getFileSize() const { return this->fileSize; }
+
+private:
+  MhaAviWriter(const MhaAviWriter&); // Not implemented
+  void operator=(const MhaAviWriter&); // Not implemented
+
+  int writeAt(long long offset, unsigned int value);
+
+  FILE* file;
+  double framesPerSecond;
+  long long fileSize;
+  /// Start of the movi list and of the header fields completed on close
+  long long moviOffset;
+  long long totalFramesOffset;
+  long long lengthOffset;
+  long long maxBytesPerSecondOffset;
+  long long avihBufferSizeOffset;
+  long long strhBufferSizeOffset;
+  std::vector<unsigned int> frameSizes;
+  unsigned int largestFrame;
+};
+
+#endif
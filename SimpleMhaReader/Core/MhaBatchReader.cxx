@@ -0,0 +1,393 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+#include "MhaBatchReader.h"
+#include "MhaFileUtilities.h"
+#include "MhaSequenceIndex.h"
+
+// STD includes
+#include <cstdlib>
+#include <cstring>
+
+#ifdef __linux__
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#endif
+
+#ifdef __linux__
+//----------------------------------------------------------------------------
+// Submission and completion rings shared with the kernel
+struct MhaBatchReader::Ring
+{
+  int fd;
+  void* submissionMap;
+  size_t submissionMapSize;
+  void* completionMap;
+  size_t completionMapSize;
+  io_uring_sqe* entries;
+  size_t entriesSize;
+  unsigned int* submissionTail;
+  unsigned int* submissionMask;
+  unsigned int* submissionArray;
+  unsigned int* completionHead;
+  unsigned int* completionTail;
+  unsigned int* completionMask;
+  io_uring_cqe* completions;
+  bool fixedBuffers;
+  std::vector<iovec> vectors;
+
+  Ring() : fd(-1), submissionMap(MAP_FAILED), submissionMapSize(0), completionMap(MAP_FAILED),
+    completionMapSize(0), entries((io_uring_sqe*)MAP_FAILED), entriesSize(0), fixedBuffers(false) {}
+
+  ~Ring()
+  {
+    if(this->entries != MAP_FAILED)
+      munmap(this->entries, this->entriesSize);
+    if(this->completionMap != MAP_FAILED && this->completionMap != this->submissionMap)
+      munmap(this->completionMap, this->completionMapSize);
+    if(this->submissionMap != MAP_FAILED)
+      munmap(this->submissionMap, this->submissionMapSize);
+    if(this->fd >= 0)
+      close(this->fd);
+  }
+
+  int setup(unsigned int depth)
+  {
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    this->fd = (int)syscall(__NR_io_uring_setup, depth, &params);
+    if(this->fd < 0)
+      return 1;
+
+    this->submissionMapSize = params.sq_off.array + params.sq_entries*sizeof(unsigned int);
+    this->completionMapSize = params.cq_off.cqes + params.cq_entries*sizeof(io_uring_cqe);
+    bool singleMap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if(singleMap && this->completionMapSize > this->submissionMapSize)
+      this->submissionMapSize = this->completionMapSize;
+    this->submissionMap = mmap(NULL, this->submissionMapSize, PROT_READ | PROT_WRITE,
+      MAP_SHARED | MAP_POPULATE, this->fd, IORING_OFF_SQ_RING);
+    if(this->submissionMap == MAP_FAILED)
+      return 1;
+    this->completionMap = singleMap ? this->submissionMap : mmap(NULL, this->completionMapSize,
+      PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, this->fd, IORING_OFF_CQ_RING);
+    if(this->completionMap == MAP_FAILED)
+      return 1;
+    this->entriesSize = params.sq_entries*sizeof(io_uring_sqe);
+    this->entries = (io_uring_sqe*)mmap(NULL, this->entriesSize, PROT_READ | PROT_WRITE,
+      MAP_SHARED | MAP_POPULATE, this->fd, IORING_OFF_SQES);
+    if(this->entries == MAP_FAILED)
+      return 1;
+
+    char* submission = (char*)this->submissionMap;
+    this->submissionTail = (unsigned int*)(submission + params.sq_off.tail);
+    this->submissionMask = (unsigned int*)(submission + params.sq_off.ring_mask);
+    this->submissionArray = (unsigned int*)(submission + params.sq_off.array);
+    char* completion = (char*)this->completionMap;
+    this->completionHead = (unsigned int*)(completion + params.cq_off.head);
+    this->completionTail = (unsigned int*)(completion + params.cq_off.tail);
+    this->completionMask = (unsigned int*)(completion + params.cq_off.ring_mask);
+    this->completions = (io_uring_cqe*)(completion + params.cq_off.cqes);
+    return 0;
+  }
+
+  /// Buffers the kernel maps once instead of on every read; needs enough
+  /// locked memory allowance, reads use readv otherwise
+  void registerBuffers(unsigned char* buffers, size_t slotSize, int count)
+  {
+    this->vectors.resize(count);
+    for(int i=0; i<count; i++)
+    {
+      this->vectors[i].iov_base = buffers + slotSize*i;
+      this->vectors[i].iov_len = slotSize;
+    }
+    this->fixedBuffers = syscall(__NR_io_uring_register, this->fd, IORING_REGISTER_BUFFERS,
+      &this->vectors[0], (unsigned int)count) == 0;
+  }
+
+  void queueRead(int file, int slot, long long offset, unsigned char* data, unsigned int size)
+  {
+    unsigned int tail = *this->submissionTail;
+    unsigned int index = tail & *this->submissionMask;
+    io_uring_sqe* entry = &this->entries[index];
+    memset(entry, 0, sizeof(*entry));
+    entry->fd = file;
+    entry->off = (unsigned long long)offset;
+    entry->user_data = (unsigned long long)slot;
+    if(this->fixedBuffers)
+    {
+      entry->opcode = IORING_OP_READ_FIXED;
+      entry->addr = (unsigned long long)data;
+      entry->len = size;
+      entry->buf_index = (unsigned short)slot;
+    }
+    else
+    {
+      // The vector stays alive until the read completes
+      iovec& vector = this->vectors[slot];
+      vector.iov_base = data;
+      vector.iov_len = size;
+      entry->opcode = IORING_OP_READV;
+      entry->addr = (unsigned long long)&vector;
+      entry->len = 1;
+    }
+    this->submissionArray[index] = index;
+    __atomic_store_n(this->submissionTail, tail + 1, __ATOMIC_RELEASE);
+  }
+
+  int enter(unsigned int toSubmit, unsigned int minimumCompletions)
+  {
+    while(true)
+    {
+      long result = syscall(__NR_io_uring_enter, this->fd, toSubmit, minimumCompletions,
+        minimumCompletions ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+      if(result >= 0)
+        return 0;
+      if(errno != EINTR && errno != EAGAIN)
+        return 1;
+    }
+  }
+};
+#else
+struct MhaBatchReader::Ring
+{
+};
+#endif
+
+//----------------------------------------------------------------------------
+MhaBatchReader::MhaBatchReader(const std::shared_ptr<const MhaSequenceIndex>& index, int queueDepth,
+  Backend backend, bool direct)
+  : index(index)
+{
+  this->queueDepth = queueDepth < 1 ? 1 : (queueDepth > 1024 ? 1024 : queueDepth);
+  this->fd = index && direct ? openFileForDirectReading(index->getPath()) : -1;
+  this->direct = this->fd >= 0;
+  if(index && this->fd < 0)
+    this->fd = openFileForReading(index->getPath());
+  size_t frameSize = index ? index->getFrameSize() : 0;
+  // A span starts up to one block before its frame
+  if(this->direct)
+    frameSize += directIOAlignment - 1;
+  this->slotSize = (frameSize + directIOAlignment - 1)/directIOAlignment*directIOAlignment;
+  this->buffers = this->slotSize ? allocateAlignedBuffer(this->slotSize*this->queueDepth) : NULL;
+  this->ring = NULL;
+
+  #ifdef __linux__
+  if(backend != Synchronous && this->fd >= 0 && this->buffers && this->slotSize < (1u << 31))
+  {
+    this->ring = new Ring;
+    if(this->ring->setup((unsigned int)this->queueDepth))
+    {
+      delete this->ring;
+      this->ring = NULL;
+    }
+    else
+      this->ring->registerBuffers(this->buffers, this->slotSize, this->queueDepth);
+  }
+  #else
+  (void)backend;
+  #endif
+}
+
+//----------------------------------------------------------------------------
+MhaBatchReader::~MhaBatchReader()
+{
+  delete this->ring;
+  if(this->buffers)
+    freeAlignedBuffer(this->buffers);
+  if(this->fd >= 0)
+    closeFile(this->fd);
+}
+
+//----------------------------------------------------------------------------
+int MhaBatchReader::readFrames(const std::vector<int>& frames, const Consumer& consumer, bool inOrder)
+{
+  if(this->fd < 0 || !this->buffers)
+    return 1;
+  for(size_t i=0; i<frames.size(); i++)
+  {
+    if(frames[i] < 0 || frames[i] >= this->index->getNumberOfFrames())
+      return 1;
+  }
+  if(frames.empty())
+    return 0;
+  if(this->ring)
+    return this->readFramesAsynchronously(frames, consumer, inOrder);
+  return this->readFramesSynchronously(frames, consumer);
+}
+
+//----------------------------------------------------------------------------
+int MhaBatchReader::readFrameStack(int first, int count, int stride, unsigned char* pixels)
+{
+  if(this->fd < 0 || first < 0 || count <= 0 || stride < 1
+    || first + (long long)(count - 1)*stride >= this->index->getNumberOfFrames())
+    return 1;
+  size_t frameSize = this->index->getFrameSize();
+  // Straight into the stack, reads of up to 1 GB each
+  if(stride == 1 && !this->direct)
+    return readFileAt(this->fd, this->index->getFrameOffset(first), pixels, frameSize*(size_t)count);
+
+  std::vector<int> frames(count);
+  for(int i=0; i<count; i++)
+    frames[i] = first + i*stride;
+  return this->readFrames(frames, [&](int frame, const unsigned char* data)
+  {
+    memcpy(pixels + (size_t)((frame - first)/stride)*frameSize, data, frameSize);
+  });
+}
+
+//----------------------------------------------------------------------------
+void MhaBatchReader::getFrameSpan(int frame, long long& offset, size_t& size, size_t& skip) const
+{
+  long long frameOffset = this->index->getFrameOffset(frame);
+  if(this->direct)
+    getDirectIOSpan(frameOffset, this->index->getFrameSize(), offset, size);
+  else
+  {
+    offset = frameOffset;
+    size = this->index->getFrameSize();
+  }
+  skip = (size_t)(frameOffset - offset);
+}
+
+//----------------------------------------------------------------------------
+int MhaBatchReader::readFramesSynchronously(const std::vector<int>& frames, const Consumer& consumer)
+{
+  for(size_t i=0; i<frames.size(); i++)
+  {
+    long long offset;
+    size_t size, skip;
+    this->getFrameSpan(frames[i], offset, size, skip);
+    if(readFileSpanAt(this->fd, offset, this->buffers, size, skip + this->index->getFrameSize()))
+      return 1;
+    consumer(frames[i], this->buffers + skip);
+  }
+  return 0;
+}
+
+//----------------------------------------------------------------------------
+int MhaBatchReader::readFramesAsynchronously(const std::vector<int>& frames, const Consumer& consumer, bool inOrder)
+{
+  #ifdef __linux__
+  struct Slot
+  {
+    int position;
+    long long offset;
+    size_t size;
+    size_t skip;
+    size_t bytesRead;
+    bool complete;
+  };
+  Ring* ring = this->ring;
+  const size_t frameSize = this->index->getFrameSize();
+  const int count = (int)frames.size();
+  std::vector<Slot> slots(this->queueDepth);
+  std::vector<int> freeSlots;
+  for(int slot = this->queueDepth - 1; slot >= 0; slot--)
+    freeSlots.push_back(slot);
+  // Slots whose read came back short and must continue
+  std::vector<int> partialSlots;
+  std::vector<int> slotOfPosition(count, -1);
+  int nextPosition = 0;
+  int nextDelivery = 0;
+  int delivered = 0;
+  int inFlight = 0;
+  bool failed = false;
+
+  while(delivered < count)
+  {
+    unsigned int toSubmit = 0;
+    for(size_t i=0; i<partialSlots.size(); i++)
+    {
+      int slot = partialSlots[i];
+      Slot& state = slots[slot];
+      ring->queueRead(this->fd, slot, state.offset + (long long)state.bytesRead,
+        this->buffers + this->slotSize*slot + state.bytesRead, (unsigned int)(state.size - state.bytesRead));
+      toSubmit++;
+    }
+    partialSlots.clear();
+    while(!failed && nextPosition < count && !freeSlots.empty())
+    {
+      int slot = freeSlots.back();
+      freeSlots.pop_back();
+      Slot& state = slots[slot];
+      state.position = nextPosition;
+      this->getFrameSpan(frames[nextPosition], state.offset, state.size, state.skip);
+      state.bytesRead = 0;
+      state.complete = false;
+      slotOfPosition[nextPosition] = slot;
+      ring->queueRead(this->fd, slot, state.offset, this->buffers + this->slotSize*slot, (unsigned int)state.size);
+      nextPosition++;
+      toSubmit++;
+    }
+    inFlight += (int)toSubmit;
+    if(inFlight == 0)
+      break;
+    if(ring->enter(toSubmit, 1))
+      return 1;
+
+    unsigned int head = *ring->completionHead;
+    unsigned int tail = __atomic_load_n(ring->completionTail, __ATOMIC_ACQUIRE);
+    for(; head != tail; head++)
+    {
+      const io_uring_cqe& completion = ring->completions[head & *ring->completionMask];
+      int slot = (int)completion.user_data;
+      Slot& state = slots[slot];
+      inFlight--;
+      if(completion.res <= 0)
+      {
+        failed = true;
+        freeSlots.push_back(slot);
+        continue;
+      }
+      // A direct span may end past the end of the file, its frame does not
+      state.bytesRead += (size_t)completion.res;
+      if(state.bytesRead < state.skip + frameSize)
+      {
+        partialSlots.push_back(slot);
+        continue;
+      }
+      state.complete = true;
+      if(!inOrder && !failed)
+      {
+        consumer(frames[state.position], this->buffers + this->slotSize*slot + state.skip);
+        freeSlots.push_back(slot);
+        delivered++;
+      }
+    }
+    __atomic_store_n(ring->completionHead, head, __ATOMIC_RELEASE);
+
+    while(inOrder && !failed && nextDelivery < nextPosition && slots[slotOfPosition[nextDelivery]].complete)
+    {
+      int slot = slotOfPosition[nextDelivery];
+      consumer(frames[nextDelivery], this->buffers + this->slotSize*slot + slots[slot].skip);
+      slots[slot].complete = false;
+      freeSlots.push_back(slot);
+      nextDelivery++;
+      delivered++;
+    }
+    // Reads already queued still write into the buffers, wait for them
+    if(failed && inFlight == 0 && partialSlots.empty())
+      return 1;
+  }
+  return failed ? 1 : 0;
+  #else
+  (void)inOrder;
+  return this->readFramesSynchronously(frames, consumer);
+  #endif
+}
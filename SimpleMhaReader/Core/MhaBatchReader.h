@@ -0,0 +1,86 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+// .NAME MhaBatchReader - batched asynchronous frame reads
+// .SECTION Description
+// Keeps many frame reads in flight at once so that NVMe queues stay busy
+// during prefetch, export and analysis. On Linux the reads go through
+// io_uring, driven with the raw system calls, into buffers registered with
+// the kernel. Elsewhere, or when io_uring is unavailable (old kernel,
+// seccomp policy, memlock limit), plain positioned reads are used.
+//
+// Direct batch readers bypass the page cache like direct frame cursors:
+// each slot receives the block-aligned span around its frame.
+
+#ifndef __MhaBatchReader_h
+#define __MhaBatchReader_h
+
+// STD includes
+#include <functional>
+#include <memory>
+#include <vector>
+
+class MhaSequenceIndex;
+
+class MhaBatchReader
+{
+public:
+  enum Backend { Automatic, Synchronous, IoUring };
+  /// Receives a frame number and its pixels, valid during the call only
+  typedef std::function<void(int, const unsigned char*)> Consumer;
+
+  /// queueDepth frames are read concurrently at most. With direct, reads
+  /// bypass the page cache where the file system allows.
+  MhaBatchReader(const std::shared_ptr<const MhaSequenceIndex>& index, int queueDepth = 32,
+    Backend backend = Automatic, bool direct = false);
+  ~MhaBatchReader();
+
+  /// Backend actually in use
+  Backend getBackend() const { return this->ring ? IoUring : Synchronous; }
+  /// False if direct reads were requested but are not supported
+  bool isDirect() const { return this->direct; }
+
+  /// Reads frames and hands each to consumer on the calling thread, in the
+  /// order of frames or, when inOrder is false, as soon as its read completes
+  int readFrames(const std::vector<int>& frames, const Consumer& consumer, bool inOrder = false);
+  /// Reads count frames, every stride-th from first, into consecutive
+  /// frame-sized slices of pixels. Consecutive frames are read in a few large
+  /// requests, strided ones in batches.
+  int readFrameStack(int first, int count, int stride, unsigned char* pixels);
+
+private:
+  MhaBatchReader(const MhaBatchReader&); // Not implemented
+  void operator=(const MhaBatchReader&); // Not implemented
+
+  struct Ring;
+
+  int readFramesSynchronously(const std::vector<int>& frames, const Consumer& consumer);
+  int readFramesAsynchronously(const std::vector<int>& frames, const Consumer& consumer, bool inOrder);
+
+  /// Span read for frame, pixels start skip bytes into it
+  void getFrameSpan(int frame, long long& offset, size_t& size, size_t& skip) const;
+
+  std::shared_ptr<const MhaSequenceIndex> index;
+  bool direct;
+  int fd;
+  int queueDepth;
+  size_t slotSize;
+  unsigned char* buffers;
+  Ring* ring;
+};
+
+#endif
@@ -0,0 +1,122 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+// .NAME MhaChunkedArray - growable per-frame array of shared chunks
+// .SECTION Description
+// Items of Width contiguous elements, stored in chunks of ChunkItems items.
+// Copies of an array share its chunks; a chunk is copied before it is
+// written while another array still holds it. Copying an index of a long
+// sequence and appending frames to it therefore costs the chunk pointers
+// and the last chunk only, whatever the number of frames already indexed.
+
+#ifndef __MhaChunkedArray_h
+#define __MhaChunkedArray_h
+
+// STD includes
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+template<typename T, int Width = 1>
+class MhaChunkedArray
+{
+public:
+  enum { ChunkShift = 10, ChunkItems = 1 << ChunkShift };
+
+  MhaChunkedArray() : numberOfItems(0) {}
+
+  size_t size() const { return this->numberOfItems; }
+  bool empty() const { return this->numberOfItems == 0; }
+
+  /// The Width elements of item
+  const T* get(size_t item) const
+  {
+    return &(*this->chunks[item >> ChunkShift])[(item & (ChunkItems - 1))*Width];
+  }
+  const T& operator[](size_t item) const { return *this->get(item); }
+  const T& front() const { return *this->get(0); }
+  const T& back() const { return *this->get(this->numberOfItems - 1); }
+
+  /// Writable elements of item, its chunk is copied first if it is shared
+  T* edit(size_t item)
+  {
+    this->makeUnique(item >> ChunkShift);
+    return &(*this->chunks[item >> ChunkShift])[(item & (ChunkItems - 1))*Width];
+  }
+
+  /// Items added are filled with value
+  void resize(size_t count, const T& value = T())
+  {
+    size_t numberOfChunks = (count + ChunkItems - 1) >> ChunkShift;
+    if(count < this->numberOfItems)
+    {
+      this->chunks.resize(numberOfChunks);
+      if(count & (ChunkItems - 1))
+      {
+        this->makeUnique(numberOfChunks - 1);
+        this->chunks.back()->resize((count & (ChunkItems - 1))*Width);
+      }
+      this->numberOfItems = count;
+      return;
+    }
+    while(this->numberOfItems < count)
+    {
+      size_t chunk = this->numberOfItems >> ChunkShift;
+      if(chunk == this->chunks.size())
+        this->chunks.push_back(std::make_shared<std::vector<T> >());
+      else
+        this->makeUnique(chunk);
+      size_t end = std::min(count, (chunk + 1) << ChunkShift);
+      this->chunks[chunk]->resize((end - (chunk << ChunkShift))*Width, value);
+      this->numberOfItems = end;
+    }
+  }
+  void assign(size_t count, const T& value)
+  {
+    this->clear();
+    this->resize(count, value);
+  }
+  void push_back(const T& value) { this->resize(this->numberOfItems + 1, value); }
+  void clear()
+  {
+    this->chunks.clear();
+    this->numberOfItems = 0;
+  }
+
+  /// Heap bytes, chunks shared with other arrays included
+  size_t getMemorySize() const
+  {
+    size_t size = this->chunks.capacity()*sizeof(this->chunks[0]);
+    for(size_t i=0; i<this->chunks.size(); i++)
+      size += sizeof(std::vector<T>) + this->chunks[i]->capacity()*sizeof(T);
+    return size;
+  }
+
+private:
+  void makeUnique(size_t chunk)
+  {
+    // Every other holder keeps the chunk alive, so a count of 1 cannot be
+    // stale while this array holds it
+    if(this->chunks[chunk].use_count() > 1)
+      this->chunks[chunk] = std::make_shared<std::vector<T> >(*this->chunks[chunk]);
+  }
+
+  std::vector<std::shared_ptr<std::vector<T> > > chunks;
+  size_t numberOfItems;
+};
+
+#endif
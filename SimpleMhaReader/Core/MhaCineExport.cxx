@@ -0,0 +1,236 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+
+#include "MhaCineExport.h"
+#include "MhaAviWriter.h"
+#include "MhaBatchReader.h"
+#include "MhaJpegEncoder.h"
+#include "MhaSequenceIndex.h"
+
+// STD includes
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace
+{
+bool hasExtension(const std::string& path, const std::string& extension)
+{
+  if(path.size() < extension.size())
+    return false;
+  for(size_t i=0; i<extension.size(); i++)
+  {
+    char c = path[path.size() - extension.size() + i];
+    if(c >= 'A' && c <= 'Z')
+      c = (char)(c - 'A' + 'a');
+    if(c != extension[i])
+      return false;
+  }
+  return true;
+}
+
+/// A frame between the stages; frame n uses slot n % number of slots, so
+/// the reader waits until frame n - number of slots has been written
+struct CineSlot
+{
+  CineSlot() : frame(-1), encoded(false) {}
+
+  int frame;
+  std::vector<unsigned char> pixels;
+  std::vector<unsigned char> jpeg;
+  bool encoded;
+};
+
+double getSecondsSince(std::chrono::steady_clock::time_point beginTime)
+{
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - beginTime).count();
+}
+}
+
+//----------------------------------------------------------------------------
+int exportCine(const std::shared_ptr<const MhaSequenceIndex>& index, const std::string& path,
+  const MhaCineOptions& options, MhaCineResult& result)
+{
+  result = MhaCineResult();
+  if(!index || index->getNumberOfFrames() <= 0 || options.framesPerSecond <= 0.)
+    return 1;
+  int numberOfFrames = index->getNumberOfFrames();
+  int width = index->getWidth();
+  int height = index->getHeight();
+  int firstFrame = std::max(options.firstFrame, 0);
+  int lastFrame = options.lastFrame < 0 ? numberOfFrames - 1 : std::min(options.lastFrame, numberOfFrames - 1);
+  int stride = std::max(options.stride, 1);
+  if(lastFrame < firstFrame)
+    return 1;
+
+  int extent[4] = { 0, width-1, 0, height-1 };
+  if(options.crop)
+  {
+    extent[0] = std::max(options.cropExtent[0], 0);
+    extent[1] = std::min(options.cropExtent[1], width-1);
+    extent[2] = std::max(options.cropExtent[2], 0);
+    extent[3] = std::min(options.cropExtent[3], height-1);
+    if(extent[1] < extent[0] || extent[3] < extent[2])
+      return 1;
+  }
+  int outWidth = extent[1] - extent[0] + 1;
+  int outHeight = extent[3] - extent[2] + 1;
+  std::vector<int> frames;
+  for(int frameIndex = firstFrame; frameIndex <= lastFrame; frameIndex += stride)
+    frames.push_back(frameIndex);
+
+  std::chrono::steady_clock::time_point beginTime = std::chrono::steady_clock::now();
+  bool avi = hasExtension(path, ".avi");
+  std::string prefix = hasExtension(path, ".jpg") ? path.substr(0, path.size() - 4) : path;
+  MhaAviWriter aviWriter;
+  if(avi && aviWriter.open(path, outWidth, outHeight, options.framesPerSecond))
+    return 1;
+
+  int numberOfThreads = options.numberOfThreads > 0 ? options.numberOfThreads : (int)std::thread::hardware_concurrency();
+  numberOfThreads = std::max(numberOfThreads, 1);
+  result.numberOfThreads = numberOfThreads;
+  // Enough frames in flight to keep every encoder busy while one is written
+  std::vector<CineSlot> slots(2*numberOfThreads + 2);
+  int numberOfSlots = (int)slots.size();
+  std::mutex mutex;
+  std::condition_variable slotFree;
+  std::condition_variable frameRead;
+  std::condition_variable frameEncoded;
+  int framesRead = 0;
+  int framesEncoding = 0;
+  int framesWritten = 0;
+  bool readingDone = false;
+  bool failed = false;
+  double encodeSeconds = 0.;
+
+  std::vector<std::thread> encoders;
+  for(int thread=0; thread<numberOfThreads; thread++)
+  {
+    encoders.push_back(std::thread([&]()
+    {
+      MhaJpegEncoder encoder(options.quality);
+      double seconds = 0.;
+      std::unique_lock<std::mutex> lock(mutex);
+      for(;;)
+      {
+        frameRead.wait(lock, [&]() { return framesEncoding < framesRead || readingDone || failed; });
+        if(framesEncoding == framesRead || failed)
+          break;
+        CineSlot& slot = slots[framesEncoding % numberOfSlots];
+        framesEncoding++;
+        lock.unlock();
+        std::chrono::steady_clock::time_point encodeTime = std::chrono::steady_clock::now();
+        int encodeFailed = encoder.encode(&slot.pixels[0], outWidth, outHeight, slot.jpeg);
+        seconds += getSecondsSince(encodeTime);
+        lock.lock();
+        slot.encoded = true;
+        failed = failed || encodeFailed;
+        frameEncoded.notify_all();
+      }
+      encodeSeconds += seconds;
+      frameEncoded.notify_all();
+    }));
+  }
+
+  long long bytesWritten = 0;
+  double writeSeconds = 0.;
+  std::thread writer([&]()
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    for(;;)
+    {
+      CineSlot& slot = slots[framesWritten % numberOfSlots];
+      frameEncoded.wait(lock, [&]() { return (framesWritten < framesRead && slot.encoded) || failed
+        || (readingDone && framesWritten == framesRead); });
+      if(failed || framesWritten == framesRead)
+        break;
+      lock.unlock();
+      std::chrono::steady_clock::time_point writeTime = std::chrono::steady_clock::now();
+      int writeFailed = 0;
+      if(avi)
+        writeFailed = aviWriter.appendFrame(&slot.jpeg[0], slot.jpeg.size());
+      else
+      {
+        char fileName[32];
+        sprintf(fileName, "%04d.jpg", slot.frame);
+        FILE* file = fopen((prefix + fileName).c_str(), "wb");
+        writeFailed = !file || fwrite(&slot.jpeg[0], 1, slot.jpeg.size(), file) != slot.jpeg.size();
+        writeFailed = (file && fclose(file) != 0) || writeFailed;
+      }
+      bytesWritten += (long long)slot.jpeg.size();
+      writeSeconds += getSecondsSince(writeTime);
+      lock.lock();
+      slot.encoded = false;
+      failed = failed || writeFailed;
+      framesWritten++;
+      slotFree.notify_one();
+    }
+    slotFree.notify_one();
+  });
+
+  MhaFilterChain filterChain;
+  configureFilterChain(filterChain, options.filters);
+  double filterSeconds = 0.;
+  // Reads stay queued while the frames before them are filtered
+  MhaBatchReader reader(index, 32, MhaBatchReader::Automatic, options.directIO);
+  bool readFailed = reader.readFrames(frames, [&](int frameIndex, const unsigned char* pixels)
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    slotFree.wait(lock, [&]() { return framesRead - framesWritten < numberOfSlots || failed; });
+    if(failed)
+      return;
+    CineSlot& slot = slots[framesRead % numberOfSlots];
+    lock.unlock();
+    std::chrono::steady_clock::time_point filterTime = std::chrono::steady_clock::now();
+    pixels = filterChain.process(pixels, width, height, frameIndex);
+    slot.pixels.resize((size_t)outWidth*(size_t)outHeight);
+    for(int y=0; y<outHeight; y++)
+      memcpy(&slot.pixels[(size_t)y*outWidth], &pixels[(size_t)(y+extent[2])*width + extent[0]], outWidth);
+    slot.frame = frameIndex;
+    filterSeconds += getSecondsSince(filterTime);
+    lock.lock();
+    framesRead++;
+    frameRead.notify_one();
+  }, true) != 0;
+
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    readingDone = true;
+    failed = failed || readFailed;
+  }
+  frameRead.notify_all();
+  frameEncoded.notify_all();
+  for(size_t i=0; i<encoders.size(); i++)
+    encoders[i].join();
+  writer.join();
+  if(avi && aviWriter.close())
+    failed = true;
+
+  result.framesWritten = framesWritten;
+  result.bytesWritten = avi ? aviWriter.getFileSize() : bytesWritten;
+  result.seconds = getSecondsSince(beginTime);
+  result.filterSeconds = filterSeconds;
+  result.encodeSeconds = encodeSeconds;
+  result.writeSeconds = writeSeconds;
+  return failed ? 1 : 0;
+}
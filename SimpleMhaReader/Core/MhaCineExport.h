@@ -0,0 +1,90 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+
+// .NAME MhaCineExport - frame range to a video clip or a JPEG series
+// .SECTION Description
+// Shared by the Slicer module and the command-line tool. Reading,
+// filtering, encoding and writing overlap: frames are read and filtered in
+// order on the calling thread (the filters keep state across frames),
+// encoded by a set of worker threads and written in order by another, with
+// a bounded number of frames in flight between the stages. A path ending
+// in .avi gives a Motion JPEG AVI; otherwise frames are written as
+// <path>NNNN.jpg, numbered by source frame, a .jpg extension of path
+// being dropped.
+
+#ifndef __MhaCineExport_h
+#define __MhaCineExport_h
+
+// STD includes
+#include <memory>
+#include <string>
+
+#include "MhaFilterChain.h"
+
+class MhaSequenceIndex;
+
+struct MhaCineOptions
+{
+  MhaCineOptions()
+    : firstFrame(0), lastFrame(-1), stride(1), framesPerSecond(30.), crop(false), quality(85),
+      numberOfThreads(0), directIO(false)
+  {
+    cropExtent[0] = cropExtent[1] = cropExtent[2] = cropExtent[3] = 0;
+  }
+
+  int firstFrame;
+  /// -1 for the last frame of the sequence
+  int lastFrame;
+  int stride;
+  /// Play rate written in the AVI header
+  double framesPerSecond;
+  bool crop;
+  /// {xmin, xmax, ymin, ymax} in pixels, inclusive
+  int cropExtent[4];
+  MhaFilterSettings filters;
+  /// JPEG quality, 1 to 100
+  int quality;
+  /// Encoding threads, 0 for one per hardware thread
+  int numberOfThreads;
+  bool directIO;
+};
+
+struct MhaCineResult
+{
+  MhaCineResult()
+    : framesWritten(0), bytesWritten(0), numberOfThreads(0), seconds(0.), filterSeconds(0.), encodeSeconds(0.),
+      writeSeconds(0.)
+  {
+  }
+
+  int framesWritten;
+  long long bytesWritten;
+  int numberOfThreads;
+  /// End to end
+  double seconds;
+  /// Busy time of each stage, summed over the encoding threads
+  double filterSeconds;
+  double encodeSeconds;
+  double writeSeconds;
+};
+
+/// Reads through its own cursor, so it can run on any thread
+int exportCine(const std::shared_ptr<const MhaSequenceIndex>& index, const std::string& path,
+  const MhaCineOptions& options, MhaCineResult& result);
+
+#endif
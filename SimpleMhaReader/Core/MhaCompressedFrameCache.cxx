@@ -0,0 +1,268 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+
+#include "MhaCompressedFrameCache.h"
+#include "MhaFrameCursor.h"
+#include "MhaSequenceIndex.h"
+#include "MhaThreadPool.h"
+
+// STD includes
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+
+//----------------------------------------------------------------------------
+MhaCompressedFrameCache::MhaCompressedFrameCache()
+{
+  this->width = 0;
+  this->height = 0;
+  this->numberOfFrames = 0;
+  this->keyframeInterval = 1;
+  this->numberOfGroups = 0;
+  this->directIO = false;
+  this->compressedBytes = 0;
+  this->framesHeld = 0;
+  this->decodedFrame = -1;
+  this->running = false;
+  this->ready = false;
+  this->cancelled = false;
+  this->groupsDone = 0;
+  this->elapsedSeconds = 0.;
+}
+
+//----------------------------------------------------------------------------
+MhaCompressedFrameCache::~MhaCompressedFrameCache()
+{
+  this->cancel();
+}
+
+//----------------------------------------------------------------------------
+int MhaCompressedFrameCache::start(const std::shared_ptr<const MhaSequenceIndex>& index, int numberOfThreads,
+  int keyframeInterval)
+{
+  this->cancel();
+  if(!index || index->getNumberOfFrames() <= 0 || keyframeInterval < 1)
+    return 1;
+
+  const MhaSequenceIndex* previous = this->index.get();
+  if(!previous || index->getPath() != previous->getPath() || index->getDataOffset() != previous->getDataOffset()
+    || index->getFrameSize() != previous->getFrameSize() || index->getNumberOfFrames() != previous->getNumberOfFrames()
+    || keyframeInterval != this->keyframeInterval)
+  {
+    this->clear();
+    this->index = index;
+    this->width = index->getWidth();
+    this->height = index->getHeight();
+    this->numberOfFrames = index->getNumberOfFrames();
+    this->keyframeInterval = keyframeInterval;
+    this->numberOfGroups = (this->numberOfFrames + keyframeInterval - 1)/keyframeInterval;
+    this->frames.resize(this->numberOfFrames);
+    this->groupsReady.reset(new std::atomic<bool>[this->numberOfGroups]);
+    for(int group = 0; group < this->numberOfGroups; group++)
+      this->groupsReady[group] = false;
+  }
+  this->index = index;
+
+  int held = 0;
+  for(int group = 0; group < this->numberOfGroups; group++)
+    held += this->groupsReady[group] ? 1 : 0;
+  this->groupsDone = held;
+  this->cancelled = false;
+  this->elapsedSeconds = 0.;
+  this->running = true;
+  this->thread = std::thread(&MhaCompressedFrameCache::build, this, numberOfThreads);
+  return 0;
+}
+
+//----------------------------------------------------------------------------
+void MhaCompressedFrameCache::cancel()
+{
+  this->cancelled = true;
+  if(this->thread.joinable())
+    this->thread.join();
+  this->running = false;
+}
+
+//----------------------------------------------------------------------------
+void MhaCompressedFrameCache::clear()
+{
+  this->cancel();
+  this->ready = false;
+  this->index.reset();
+  this->numberOfFrames = 0;
+  this->numberOfGroups = 0;
+  std::vector<std::vector<unsigned char> >().swap(this->frames);
+  this->groupsReady.reset();
+  this->compressedBytes = 0;
+  this->framesHeld = 0;
+  this->groupsDone = 0;
+  std::vector<unsigned char>().swap(this->decoded);
+  this->decodedFrame = -1;
+}
+
+//----------------------------------------------------------------------------
+double MhaCompressedFrameCache::getProgress() const
+{
+  if(this->numberOfGroups <= 0)
+    return 0.;
+  return (double)this->groupsDone/(double)this->numberOfGroups;
+}
+
+//----------------------------------------------------------------------------
+bool MhaCompressedFrameCache::hasFrame(int frame) const
+{
+  return frame >= 0 && frame < this->numberOfFrames && this->groupsReady[frame/this->keyframeInterval];
+}
+
+//----------------------------------------------------------------------------
+int MhaCompressedFrameCache::readFrame(int frame, unsigned char* pixels)
+{
+  if(!this->hasFrame(frame))
+    return 1;
+  size_t frameSize = (size_t)this->width*this->height;
+  if(this->decoded.size() != frameSize)
+  {
+    this->decoded.resize(frameSize);
+    this->decodedFrame = -1;
+  }
+
+  // Forward from the frame decoded last when it is in the same group,
+  // otherwise from the start of the group
+  int first = frame - frame % this->keyframeInterval;
+  if(this->decodedFrame < first || this->decodedFrame > frame)
+    this->decodedFrame = first - 1;
+  for(int next = this->decodedFrame + 1; next <= frame; next++)
+  {
+    const std::vector<unsigned char>& encoded = this->frames[next];
+    if(this->decoder.decode(&encoded[0], encoded.size(), next > first ? &this->decoded[0] : NULL,
+      this->width, this->height, &this->decoded[0]))
+    {
+      this->decodedFrame = -1;
+      return 1;
+    }
+    this->decodedFrame = next;
+  }
+  memcpy(pixels, &this->decoded[0], frameSize);
+  return 0;
+}
+
+//----------------------------------------------------------------------------
+size_t MhaCompressedFrameCache::getMemorySize() const
+{
+  return (size_t)this->compressedBytes + this->frames.capacity()*sizeof(std::vector<unsigned char>)
+    + this->decoded.capacity();
+}
+
+//----------------------------------------------------------------------------
+size_t MhaCompressedFrameCache::getUncompressedSize() const
+{
+  return (size_t)this->framesHeld*this->width*this->height;
+}
+
+//----------------------------------------------------------------------------
+size_t MhaCompressedFrameCache::evict(size_t bytes, int keepFrame)
+{
+  this->cancel();
+  if(this->numberOfGroups <= 0)
+    return 0;
+  int keepGroup = std::min(std::max(keepFrame, 0), this->numberOfFrames - 1)/this->keyframeInterval;
+  std::vector<int> order;
+  for(int group = 0; group < this->numberOfGroups; group++)
+    if(group != keepGroup && this->groupsReady[group])
+      order.push_back(group);
+  std::sort(order.begin(), order.end(), [keepGroup](int a, int b)
+  {
+    return std::abs(a - keepGroup) > std::abs(b - keepGroup);
+  });
+
+  long long before = this->compressedBytes;
+  for(size_t i = 0; i < order.size() && (size_t)(before - this->compressedBytes) < bytes; i++)
+    this->freeGroup(order[i]);
+  this->ready = false;
+  return (size_t)(before - this->compressedBytes);
+}
+
+//----------------------------------------------------------------------------
+void MhaCompressedFrameCache::freeGroup(int group)
+{
+  int first = group*this->keyframeInterval;
+  int last = std::min(first + this->keyframeInterval, this->numberOfFrames);
+  this->groupsReady[group] = false;
+  this->groupsDone--;
+  for(int frame = first; frame < last; frame++)
+  {
+    this->compressedBytes -= (long long)this->frames[frame].size();
+    std::vector<unsigned char>().swap(this->frames[frame]);
+  }
+  this->framesHeld -= last - first;
+}
+
+//----------------------------------------------------------------------------
+void MhaCompressedFrameCache::build(int numberOfThreads)
+{
+  std::chrono::steady_clock::time_point beginTime = std::chrono::steady_clock::now();
+  size_t frameSize = this->index->getFrameSize();
+
+  MhaThreadPool pool(numberOfThreads);
+  int threads = pool.getNumberOfThreads();
+  std::vector<std::unique_ptr<MhaFrameCursor> > cursors(threads);
+  std::vector<std::vector<unsigned char> > buffers(threads);
+  std::vector<MhaFrameCodec> encoders(threads);
+  std::atomic<bool> failed(false);
+
+  // Groups are handed out in order, playback from the start can use the
+  // cache long before the build is complete
+  pool.parallelFor(this->numberOfGroups, [&](int group, int thread)
+  {
+    if(this->cancelled || failed || this->groupsReady[group])
+      return;
+    std::unique_ptr<MhaFrameCursor>& cursor = cursors[thread];
+    if(!cursor)
+      cursor.reset(new MhaFrameCursor(this->index, this->directIO));
+
+    int first = group*this->keyframeInterval;
+    int count = std::min(this->keyframeInterval, this->numberOfFrames - first);
+    std::vector<unsigned char>& buffer = buffers[thread];
+    if(buffer.size() < count*frameSize)
+      buffer.resize(count*frameSize);
+    if(cursor->readFrames(first, count, &buffer[0]))
+    {
+      failed = true;
+      return;
+    }
+    long long bytes = 0;
+    for(int i = 0; i < count; i++)
+    {
+      const unsigned char* pixels = &buffer[i*frameSize];
+      encoders[thread].encode(pixels, i > 0 ? pixels - frameSize : NULL, this->width, this->height,
+        this->frames[first + i]);
+      bytes += (long long)this->frames[first + i].size();
+    }
+    // The frames are in memory now, the page cache copy is not needed
+    cursor->dropFrames(first, count);
+    this->compressedBytes += bytes;
+    this->framesHeld += count;
+    this->groupsReady[group] = true;
+    this->groupsDone++;
+  });
+
+  this->elapsedSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - beginTime).count();
+  this->ready = !failed && !this->cancelled && this->groupsDone == this->numberOfGroups;
+  this->running = false;
+}
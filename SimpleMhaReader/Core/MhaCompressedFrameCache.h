@@ -0,0 +1,116 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+
+// .NAME MhaCompressedFrameCache - whole sequence held in memory, compressed
+// .SECTION Description
+// Compresses every frame of a sequence with MhaFrameCodec on a thread pool
+// in the background, so that sequences larger than memory can be played
+// without touching the disk. Frames are coded in groups of
+// keyframeInterval: the first frame of a group decodes on its own, the
+// others may depend on the frame before them. Playing forward decodes one
+// frame per step; any other jump decodes from the start of its group.
+// Frames are available group by group while the build runs. Reading is for
+// one thread at a time.
+
+#ifndef __MhaCompressedFrameCache_h
+#define __MhaCompressedFrameCache_h
+
+// STD includes
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "MhaFrameCodec.h"
+
+class MhaSequenceIndex;
+
+class MhaCompressedFrameCache
+{
+public:
+  MhaCompressedFrameCache();
+  ~MhaCompressedFrameCache();
+
+  /// Starts compressing the frames of index in the background, cancelling a
+  /// running build. Frames already held for the same frames of the same
+  /// file are kept, others are freed.
+  int start(const std::shared_ptr<const MhaSequenceIndex>& index, int numberOfThreads = 0, int keyframeInterval = 8);
+  /// Stops a running build, the frames compressed so far stay available
+  void cancel();
+  /// Stops a running build and frees every frame
+  void clear();
+
+  bool isRunning() const { return this->running; }
+  /// Every frame of the sequence is held
+  bool isReady() const { return this->ready; }
+  double getProgress() const;
+  double getElapsedSeconds() const { return this->elapsedSeconds; }
+  /// Frames are read bypassing the page cache from the next start on
+  void setDirectIO(bool direct) { this->directIO = direct; }
+
+  int getNumberOfFrames() const { return this->numberOfFrames; }
+  int getKeyframeInterval() const { return this->keyframeInterval; }
+  bool hasFrame(int frame) const;
+  /// Decodes frame into pixels, which holds width*height bytes
+  int readFrame(int frame, unsigned char* pixels);
+
+  /// Compressed frames plus the decoding buffers
+  size_t getMemorySize() const;
+  /// What the frames held would take uncompressed
+  size_t getUncompressedSize() const;
+  /// Stops a running build and frees the groups of frames farthest from
+  /// keepFrame until at least bytes are freed; the group of keepFrame stays.
+  /// Returns the bytes freed.
+  size_t evict(size_t bytes, int keepFrame);
+
+private:
+  MhaCompressedFrameCache(const MhaCompressedFrameCache&); // Not implemented
+  void operator=(const MhaCompressedFrameCache&); // Not implemented
+
+  void build(int numberOfThreads);
+  void freeGroup(int group);
+
+  std::shared_ptr<const MhaSequenceIndex> index;
+  int width;
+  int height;
+  int numberOfFrames;
+  int keyframeInterval;
+  int numberOfGroups;
+  bool directIO;
+
+  /// Encoded frames, written by the build before the group is marked ready
+  std::vector<std::vector<unsigned char> > frames;
+  std::unique_ptr<std::atomic<bool>[]> groupsReady;
+  std::atomic<long long> compressedBytes;
+  std::atomic<int> framesHeld;
+
+  /// Last decoded frame, the reference of the next one
+  MhaFrameCodec decoder;
+  std::vector<unsigned char> decoded;
+  int decodedFrame;
+
+  std::thread thread;
+  std::atomic<bool> running;
+  std::atomic<bool> ready;
+  std::atomic<bool> cancelled;
+  std::atomic<int> groupsDone;
+  double elapsedSeconds;
+};
+
+#endif
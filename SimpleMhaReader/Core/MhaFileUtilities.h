@@ -0,0 +1,240 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+// .NAME MhaFileUtilities - large file helpers shared by readers and writers
+
+#ifndef __MhaFileUtilities_h
+#define __MhaFileUtilities_h
+
+// STD includes
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <fcntl.h>
+#ifdef WIN32
+#include <io.h>
+#include <malloc.h>
+#else
+#include <unistd.h>
+#endif
+
+inline int seekFile(FILE* file, long long offset)
+{
+  #ifdef WIN32
+  return _fseeki64(file, (__int64)offset, SEEK_SET);
+  #else
+  return fseeko(file, (off_t)offset, SEEK_SET);
+  #endif
+}
+
+inline long long getFileSize(const std::string& filename)
+{
+  #ifdef WIN32
+  struct _stat64 fileStat;
+  if(_stat64(filename.c_str(), &fileStat))
+    return -1;
+  #else
+  struct stat fileStat;
+  if(stat(filename.c_str(), &fileStat))
+    return -1;
+  #endif
+  return (long long)fileStat.st_size;
+}
+
+inline long long getFileModificationTime(const std::string& filename)
+{
+  #ifdef WIN32
+  struct _stat64 fileStat;
+  if(_stat64(filename.c_str(), &fileStat))
+    return -1;
+  #else
+  struct stat fileStat;
+  if(stat(filename.c_str(), &fileStat))
+    return -1;
+  #endif
+  return (long long)fileStat.st_mtime;
+}
+
+/// Read-only descriptor, -1 on failure
+inline int openFileForReading(const std::string& filename)
+{
+  #ifdef WIN32
+  return _open(filename.c_str(), _O_RDONLY | _O_BINARY);
+  #else
+  return open(filename.c_str(), O_RDONLY);
+  #endif
+}
+
+inline void closeFile(int fd)
+{
+  #ifdef WIN32
+  _close(fd);
+  #else
+  close(fd);
+  #endif
+}
+
+/// Direct I/O transfers must start, end and land on multiples of this
+const size_t directIOAlignment = 4096;
+
+/// Memory aligned for direct I/O, NULL on failure
+inline unsigned char* allocateAlignedBuffer(size_t size)
+{
+  #ifdef WIN32
+  return (unsigned char*)_aligned_malloc(size, directIOAlignment);
+  #else
+  void* memory = NULL;
+  return posix_memalign(&memory, directIOAlignment, size) ? NULL : (unsigned char*)memory;
+  #endif
+}
+
+inline void freeAlignedBuffer(unsigned char* buffer)
+{
+  #ifdef WIN32
+  _aligned_free(buffer);
+  #else
+  free(buffer);
+  #endif
+}
+
+/// Reads from offset until at least minimumSize of size bytes are in. A
+/// direct read of a block-aligned span may end early at the end of the file.
+/// pread keeps no file position, so one descriptor can serve several
+/// threads; on Windows each reader needs its own.
+inline int readFileSpanAt(int fd, long long offset, void* data, size_t size, size_t minimumSize)
+{
+  char* target = (char*)data;
+  size_t done = 0;
+  #ifdef WIN32
+  if(_lseeki64(fd, offset, SEEK_SET) < 0)
+    return 1;
+  #endif
+  while(done < minimumSize)
+  {
+    // At most 1 GB per call, larger reads fail on some systems
+    size_t remaining = size - done;
+    unsigned int chunk = remaining < (1u << 30) ? (unsigned int)remaining : (1u << 30);
+    #ifdef WIN32
+    int count = _read(fd, target + done, chunk);
+    #else
+    ssize_t count = pread(fd, target + done, chunk, (off_t)(offset + (long long)done));
+    if(count < 0 && errno == EINTR)
+      continue;
+    #endif
+    if(count <= 0)
+      return 1;
+    done += (size_t)count;
+  }
+  return 0;
+}
+
+/// Reads size bytes at offset
+inline int readFileAt(int fd, long long offset, void* data, size_t size)
+{
+  return readFileSpanAt(fd, offset, data, size, size);
+}
+
+/// Read-only descriptor that bypasses the page cache, -1 where the platform
+/// or file system does not support it. Reads through it must use aligned
+/// offsets, sizes and buffers.
+inline int openFileForDirectReading(const std::string& filename)
+{
+  #if defined(O_DIRECT) && !defined(WIN32)
+  int fd = open(filename.c_str(), O_RDONLY | O_DIRECT);
+  if(fd < 0)
+    return -1;
+  // Some file systems accept the flag and reject the reads
+  unsigned char* probe = allocateAlignedBuffer(directIOAlignment);
+  bool supported = probe && (pread(fd, probe, directIOAlignment, 0) >= 0 || errno != EINVAL);
+  if(probe)
+    freeAlignedBuffer(probe);
+  if(!supported)
+  {
+    close(fd);
+    return -1;
+  }
+  return fd;
+  #elif defined(F_NOCACHE)
+  int fd = open(filename.c_str(), O_RDONLY);
+  if(fd >= 0 && fcntl(fd, F_NOCACHE, 1) < 0)
+  {
+    close(fd);
+    return -1;
+  }
+  return fd;
+  #else
+  (void)filename;
+  return -1;
+  #endif
+}
+
+/// First offset and length of the block-aligned span covering size bytes at offset
+inline void getDirectIOSpan(long long offset, size_t size, long long& spanOffset, size_t& spanSize)
+{
+  spanOffset = offset - offset % (long long)directIOAlignment;
+  size_t end = (size_t)(offset - spanOffset) + size;
+  spanSize = (end + directIOAlignment - 1)/directIOAlignment*directIOAlignment;
+}
+
+/// Readahead of the kernel for a descriptor: Random turns it off for access
+/// patterns it cannot follow, Sequential makes it more aggressive
+enum MhaFileAccess { MhaNormalAccess, MhaSequentialAccess, MhaRandomAccess };
+
+inline void adviseFileAccess(int fd, MhaFileAccess access)
+{
+  #if defined(POSIX_FADV_NORMAL) && !defined(WIN32)
+  int advice = access == MhaSequentialAccess ? POSIX_FADV_SEQUENTIAL :
+    (access == MhaRandomAccess ? POSIX_FADV_RANDOM : POSIX_FADV_NORMAL);
+  posix_fadvise(fd, 0, 0, advice);
+  #else
+  (void)fd; (void)access;
+  #endif
+}
+
+/// Starts reading the given range into the page cache without waiting for
+/// it (no-op where unsupported). Linux reads at most the device readahead
+/// size per request, longer ranges have to be split.
+inline void prefetchFile(int fd, long long offset, long long length)
+{
+  #if defined(__linux__)
+  readahead(fd, (off64_t)offset, (size_t)length);
+  #elif defined(POSIX_FADV_WILLNEED) && !defined(WIN32)
+  posix_fadvise(fd, (off_t)offset, (off_t)length, POSIX_FADV_WILLNEED);
+  #elif defined(F_RDADVISE)
+  struct radvisory advisory;
+  advisory.ra_offset = (off_t)offset;
+  advisory.ra_count = length < (1 << 30) ? (int)length : (1 << 30);
+  fcntl(fd, F_RDADVISE, &advisory);
+  #else
+  (void)fd; (void)offset; (void)length;
+  #endif
+}
+
+/// Tells the OS the given range will not be read again (no-op where unsupported)
+inline void dropFileCache(int fd, long long offset, long long length)
+{
+  #if defined(POSIX_FADV_DONTNEED) && !defined(WIN32)
+  posix_fadvise(fd, (off_t)offset, (off_t)length, POSIX_FADV_DONTNEED);
+  #else
+  (void)fd; (void)offset; (void)length;
+  #endif
+}
+
+#endif
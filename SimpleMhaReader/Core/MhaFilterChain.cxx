@@ -0,0 +1,128 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+#include "MhaFilterChain.h"
+#include "MhaFrameFilters.h"
+#include "MhaThreadPool.h"
+
+namespace
+{
+// Rows per tile: enough work per task, small enough to balance the threads
+const int tileRows = 32;
+}
+
+//----------------------------------------------------------------------------
+MhaFilterChain::MhaFilterChain(int numberOfThreads)
+{
+  this->pool = NULL;
+  this->numberOfThreads = numberOfThreads;
+}
+
+//----------------------------------------------------------------------------
+MhaFilterChain::~MhaFilterChain()
+{
+  this->clear();
+  delete this->pool;
+}
+
+//----------------------------------------------------------------------------
+void MhaFilterChain::addFilter(MhaFrameFilter* filter)
+{
+  this->filters.push_back(filter);
+}
+
+//----------------------------------------------------------------------------
+void MhaFilterChain::clear()
+{
+  for(size_t i=0; i<this->filters.size(); i++)
+    delete this->filters[i];
+  this->filters.clear();
+}
+
+//----------------------------------------------------------------------------
+const unsigned char* MhaFilterChain::process(const unsigned char* input, int width, int height, int frame)
+{
+  if(this->filters.empty() || !input || width <= 0 || height <= 0)
+    return input;
+  // Threads are only started once filtering is actually used
+  if(!this->pool)
+    this->pool = new MhaThreadPool(this->numberOfThreads);
+
+  size_t frameSize = (size_t)width*(size_t)height;
+  for(int i=0; i<2; i++)
+  {
+    if(this->buffers[i].size() != frameSize)
+      this->buffers[i].resize(frameSize);
+  }
+
+  int numberOfTiles = (height + tileRows - 1)/tileRows;
+  const unsigned char* source = input;
+  for(size_t i=0; i<this->filters.size(); i++)
+  {
+    MhaFrameFilter* filter = this->filters[i];
+    unsigned char* target = &this->buffers[i % 2][0];
+    filter->beginFrame(frame, width, height);
+    // Tiles of one filter are independent, filters run one after the other
+    // since neighbourhood filters read rows of the previous output
+    this->pool->parallelFor(numberOfTiles, [&](int tile, int)
+    {
+      int firstRow = tile*tileRows;
+      int lastRow = firstRow + tileRows < height ? firstRow + tileRows : height;
+      filter->processRows(source, target, width, height, firstRow, lastRow);
+    });
+    filter->endFrame();
+    source = target;
+  }
+  return source;
+}
+
+//----------------------------------------------------------------------------
+void MhaFilterChain::reset()
+{
+  for(size_t i=0; i<this->filters.size(); i++)
+    this->filters[i]->reset();
+}
+
+//----------------------------------------------------------------------------
+void configureFilterChain(MhaFilterChain& chain, const MhaFilterSettings& settings)
+{
+  chain.clear();
+  if(settings.median)
+    chain.addFilter(new MhaMedianFilter);
+  if(settings.gaussian)
+    chain.addFilter(new MhaGaussianFilter);
+  if(settings.temporalAverageFrames > 1)
+    chain.addFilter(new MhaTemporalAverageFilter(settings.temporalAverageFrames));
+  if(settings.nearGain != 0. || settings.farGain != 0.)
+  {
+    MhaGainFilter* gain = new MhaGainFilter;
+    std::vector<double> curve;
+    curve.push_back(settings.nearGain);
+    curve.push_back(settings.farGain);
+    gain->setCurve(curve);
+    chain.addFilter(gain);
+  }
+}
+
+//----------------------------------------------------------------------------
+size_t MhaFilterChain::getMemorySize() const
+{
+  size_t size = this->buffers[0].capacity() + this->buffers[1].capacity();
+  for(size_t i=0; i<this->filters.size(); i++)
+    size += this->filters[i]->getMemorySize();
+  return size;
+}
@@ -0,0 +1,88 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+// .NAME MhaFilterChain - ordered list of frame filters run on a thread pool
+// .SECTION Description
+// Each filter processes the whole frame in row tiles spread over the pool,
+// then hands its output to the next one. Two buffers are used in turn, so a
+// chain of any length needs no allocation once the frame size is known.
+
+#ifndef __MhaFilterChain_h
+#define __MhaFilterChain_h
+
+// STD includes
+#include <cstddef>
+#include <vector>
+
+class MhaFrameFilter;
+class MhaThreadPool;
+
+/// What the module panel exposes; configureFilterChain() builds the chain
+struct MhaFilterSettings
+{
+  MhaFilterSettings()
+    : median(false), gaussian(false), temporalAverageFrames(1), nearGain(0.), farGain(0.) {}
+  bool isEmpty() const
+  {
+    return !this->median && !this->gaussian && this->temporalAverageFrames <= 1
+      && this->nearGain == 0. && this->farGain == 0.;
+  }
+
+  bool median;
+  bool gaussian;
+  /// 1 disables temporal averaging
+  int temporalAverageFrames;
+  /// Gain in dB at the first and last rows
+  double nearGain;
+  double farGain;
+};
+
+class MhaFilterChain
+{
+public:
+  /// 0 threads means one per hardware thread
+  explicit MhaFilterChain(int numberOfThreads = 0);
+  ~MhaFilterChain();
+
+  /// Takes ownership of the filter
+  void addFilter(MhaFrameFilter* filter);
+  void clear();
+  bool isEmpty() const { return this->filters.empty(); }
+
+  /// Runs every filter on the frame. Returns the filtered pixels, valid until
+  /// the next call, or input itself when the chain is empty.
+  const unsigned char* process(const unsigned char* input, int width, int height, int frame);
+  /// Forgets the temporal state of every filter
+  void reset();
+  /// Heap bytes of the output buffers and of the filter states
+  size_t getMemorySize() const;
+
+private:
+  MhaFilterChain(const MhaFilterChain&); // Not implemented
+  void operator=(const MhaFilterChain&); // Not implemented
+
+  std::vector<MhaFrameFilter*> filters;
+  MhaThreadPool* pool;
+  int numberOfThreads;
+  std::vector<unsigned char> buffers[2];
+};
+
+/// Replaces the filters of chain with the ones enabled in settings, in the
+/// order median, gaussian, temporal average, gain
+void configureFilterChain(MhaFilterChain& chain, const MhaFilterSettings& settings);
+
+#endif
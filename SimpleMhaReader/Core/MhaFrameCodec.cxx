@@ -0,0 +1,302 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+
+#include "MhaFrameCodec.h"
+#include "MhaFrameKernels.h"
+
+// STD includes
+#include <cstring>
+
+namespace
+{
+// Hash table of the compressor, indexed by the top bits of the hashed next
+// four bytes
+const int hashBits = 16;
+// Matches are at least this long and reach at most this far back
+const size_t minimumMatch = 4;
+const size_t maximumOffset = 65535;
+// The block format ends with literals: the last match starts at least
+// matchStartMargin and ends at least lastLiterals bytes before the end
+const size_t matchStartMargin = 12;
+const size_t lastLiterals = 5;
+
+inline unsigned int read32(const unsigned char* data)
+{
+  unsigned int value;
+  memcpy(&value, data, sizeof(value));
+  return value;
+}
+
+inline unsigned int hashSequence(unsigned int sequence)
+{
+  return (sequence*2654435761u) >> (32 - hashBits);
+}
+
+// Number of equal bytes of p and match before limit
+inline size_t countMatch(const unsigned char* p, const unsigned char* match, const unsigned char* limit)
+{
+  const unsigned char* start = p;
+#if defined(__GNUC__) && defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+  while(p + 8 <= limit)
+  {
+    unsigned long long a, b;
+    memcpy(&a, p, sizeof(a));
+    memcpy(&b, match, sizeof(b));
+    if(a != b)
+      return (size_t)(p - start) + (size_t)(__builtin_ctzll(a ^ b) >> 3);
+    p += 8;
+    match += 8;
+  }
+#endif
+  while(p < limit && *p == *match)
+  {
+    p++;
+    match++;
+  }
+  return (size_t)(p - start);
+}
+
+inline unsigned char* writeLength(unsigned char* output, size_t length)
+{
+  for(; length >= 255; length -= 255)
+    *output++ = 255;
+  *output++ = (unsigned char)length;
+  return output;
+}
+
+inline int readLength(const unsigned char*& input, const unsigned char* end, size_t& length)
+{
+  unsigned char byte;
+  do
+  {
+    if(input >= end)
+      return 1;
+    byte = *input++;
+    length += byte;
+  }
+  while(byte == 255);
+  return 0;
+}
+
+inline unsigned char* writeSequence(unsigned char* output, const unsigned char* literals, size_t literalLength,
+  size_t offset, size_t matchLength)
+{
+  unsigned char* token = output++;
+  *token = (unsigned char)((literalLength < 15 ? literalLength : 15) << 4);
+  if(literalLength >= 15)
+    output = writeLength(output, literalLength - 15);
+  memcpy(output, literals, literalLength);
+  output += literalLength;
+  if(matchLength == 0)
+    return output;
+  *output++ = (unsigned char)(offset & 0xff);
+  *output++ = (unsigned char)(offset >> 8);
+  matchLength -= minimumMatch;
+  *token |= (unsigned char)(matchLength < 15 ? matchLength : 15);
+  if(matchLength >= 15)
+    output = writeLength(output, matchLength - 15);
+  return output;
+}
+}
+
+//----------------------------------------------------------------------------
+size_t getCompressBound(size_t size)
+{
+  return size + size/255 + 16;
+}
+
+//----------------------------------------------------------------------------
+size_t compressBytes(const unsigned char* input, size_t size, unsigned char* output, unsigned int* hashTable)
+{
+  const unsigned char* anchor = input;
+  unsigned char* op = output;
+  if(size > matchStartMargin)
+  {
+    memset(hashTable, 0, sizeof(unsigned int) << hashBits);
+    const unsigned char* ip = input;
+    const unsigned char* matchStartLimit = input + size - matchStartMargin;
+    const unsigned char* matchLimit = input + size - lastLiterals;
+    // Runs without a match are skipped faster and faster, incompressible
+    // data then costs little more than a copy
+    unsigned int misses = 0;
+    while(ip < matchStartLimit)
+    {
+      unsigned int sequence = read32(ip);
+      unsigned int& entry = hashTable[hashSequence(sequence)];
+      const unsigned char* match = input + entry;
+      entry = (unsigned int)(ip - input);
+      if(match >= ip || (size_t)(ip - match) > maximumOffset || read32(match) != sequence)
+      {
+        ip += 1 + (misses++ >> 6);
+        continue;
+      }
+      misses = 0;
+      while(ip > anchor && match > input && ip[-1] == match[-1])
+      {
+        ip--;
+        match--;
+      }
+      size_t matchLength = minimumMatch + countMatch(ip + minimumMatch, match + minimumMatch, matchLimit);
+      op = writeSequence(op, anchor, (size_t)(ip - anchor), (size_t)(ip - match), matchLength);
+      ip += matchLength;
+      anchor = ip;
+    }
+  }
+  op = writeSequence(op, anchor, (size_t)(input + size - anchor), 0, 0);
+  return (size_t)(op - output);
+}
+
+//----------------------------------------------------------------------------
+int decompressBytes(const unsigned char* input, size_t compressedSize, unsigned char* output, size_t size)
+{
+  const unsigned char* ip = input;
+  const unsigned char* iend = input + compressedSize;
+  unsigned char* op = output;
+  unsigned char* oend = output + size;
+  while(ip < iend)
+  {
+    unsigned int token = *ip++;
+    size_t literalLength = token >> 4;
+    if(literalLength == 15 && readLength(ip, iend, literalLength))
+      return 1;
+    if(literalLength > (size_t)(iend - ip) || literalLength > (size_t)(oend - op))
+      return 1;
+    // Short runs are copied 16 bytes at a time where both buffers have room
+    if(literalLength <= 16 && ip + 16 <= iend && op + 16 <= oend)
+      memcpy(op, ip, 16);
+    else
+      memcpy(op, ip, literalLength);
+    ip += literalLength;
+    op += literalLength;
+    // The last sequence has no match
+    if(ip == iend)
+      break;
+
+    if(iend - ip < 2)
+      return 1;
+    size_t offset = (size_t)ip[0] | ((size_t)ip[1] << 8);
+    ip += 2;
+    size_t matchLength = token & 15;
+    if(matchLength == 15 && readLength(ip, iend, matchLength))
+      return 1;
+    matchLength += minimumMatch;
+    if(offset == 0 || offset > (size_t)(op - output) || matchLength > (size_t)(oend - op))
+      return 1;
+    const unsigned char* match = op - offset;
+    if(offset == 1)
+      memset(op, *match, matchLength);
+    else if(offset >= 16 && op + matchLength + 16 <= oend)
+    {
+      // Every 16 byte block reads bytes written before it
+      for(size_t i = 0; i < matchLength; i += 16)
+        memcpy(op + i, match + i, 16);
+    }
+    else
+    {
+      for(size_t i = 0; i < matchLength; i++)
+        op[i] = match[i];
+    }
+    op += matchLength;
+  }
+  return op == oend ? 0 : 1;
+}
+
+//----------------------------------------------------------------------------
+MhaFrameCodec::MhaFrameCodec()
+{
+}
+
+//----------------------------------------------------------------------------
+void MhaFrameCodec::encode(const unsigned char* frame, const unsigned char* previous, int width, int height,
+  std::vector<unsigned char>& encoded)
+{
+  size_t size = (size_t)width*height;
+  size_t bound = getCompressBound(size);
+  if(this->deltas.size() < size)
+    this->deltas.resize(size);
+  if(this->compressed.size() < bound)
+  {
+    this->compressed.resize(bound);
+    this->otherCompressed.resize(bound);
+  }
+  if(this->hashTable.empty())
+    this->hashTable.resize((size_t)1 << hashBits);
+
+  // Row deltas: the first row as is, every other one minus the row above
+  memcpy(&this->deltas[0], frame, width);
+  subtractFrames(frame + width, frame, &this->deltas[width], size - width);
+  size_t compressedSize = compressBytes(&this->deltas[0], size, &this->compressed[0], &this->hashTable[0]);
+  FrameType type = RowDelta;
+  if(previous)
+  {
+    subtractFrames(frame, previous, &this->deltas[0], size);
+    size_t frameDeltaSize = compressBytes(&this->deltas[0], size, &this->otherCompressed[0], &this->hashTable[0]);
+    if(frameDeltaSize < compressedSize)
+    {
+      this->compressed.swap(this->otherCompressed);
+      compressedSize = frameDeltaSize;
+      type = FrameDelta;
+    }
+  }
+
+  if(compressedSize >= size)
+  {
+    encoded.resize(size + 1);
+    encoded[0] = (unsigned char)Stored;
+    memcpy(&encoded[1], frame, size);
+    return;
+  }
+  encoded.resize(compressedSize + 1);
+  encoded[0] = (unsigned char)type;
+  memcpy(&encoded[1], &this->compressed[0], compressedSize);
+}
+
+//----------------------------------------------------------------------------
+int MhaFrameCodec::decode(const unsigned char* encoded, size_t encodedSize, const unsigned char* previous,
+  int width, int height, unsigned char* frame)
+{
+  size_t size = (size_t)width*height;
+  if(encodedSize < 1)
+    return 1;
+  switch(encoded[0])
+  {
+    case Stored:
+      if(encodedSize != size + 1)
+        return 1;
+      memcpy(frame, encoded + 1, size);
+      return 0;
+    case RowDelta:
+      if(decompressBytes(encoded + 1, encodedSize - 1, frame, size))
+        return 1;
+      for(int row = 1; row < height; row++)
+        addFrames(frame + (size_t)row*width, frame + (size_t)(row - 1)*width, frame + (size_t)row*width, width);
+      return 0;
+    case FrameDelta:
+      // Through the scratch buffer, previous may be frame
+      if(!previous)
+        return 1;
+      if(this->deltas.size() < size)
+        this->deltas.resize(size);
+      if(decompressBytes(encoded + 1, encodedSize - 1, &this->deltas[0], size))
+        return 1;
+      addFrames(&this->deltas[0], previous, frame, size);
+      return 0;
+    default:
+      return 1;
+  }
+}
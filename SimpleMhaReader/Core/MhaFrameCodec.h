@@ -0,0 +1,71 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+
+// .NAME MhaFrameCodec - fast lossless compression of 8-bit frames
+// .SECTION Description
+// A frame is stored as its difference from the previous frame (static
+// regions and frozen frames become zeros) or, where that does not pay, as
+// the difference of each row from the row above (the black borders around
+// the fan become zeros); whichever compresses smaller is kept. The deltas
+// are then packed by a byte-oriented LZ77 codec in the LZ4 block format,
+// without entropy coding, so decoding is a few memory copies per match and
+// a vectorized add. A codec keeps its scratch buffers and is used by one
+// thread at a time.
+
+#ifndef __MhaFrameCodec_h
+#define __MhaFrameCodec_h
+
+// STD includes
+#include <cstddef>
+#include <vector>
+
+/// Largest output of compressBytes() for size bytes
+size_t getCompressBound(size_t size);
+/// LZ4 block of input, returns its size; output holds getCompressBound(size)
+size_t compressBytes(const unsigned char* input, size_t size, unsigned char* output, unsigned int* hashTable);
+/// Decodes a block of compressedSize bytes into exactly size bytes, 1 if
+/// the block is damaged or does not decode to size bytes
+int decompressBytes(const unsigned char* input, size_t compressedSize, unsigned char* output, size_t size);
+
+class MhaFrameCodec
+{
+public:
+  enum FrameType { RowDelta = 0, FrameDelta = 1, Stored = 2 };
+
+  MhaFrameCodec();
+
+  /// Replaces encoded with frame; previous is the frame before it, NULL to
+  /// make a frame that decodes on its own
+  void encode(const unsigned char* frame, const unsigned char* previous, int width, int height,
+    std::vector<unsigned char>& encoded);
+  /// Decodes into frame, which may be previous; previous must be the frame
+  /// before it if the encoded frame depends on it. 1 if the data is damaged.
+  int decode(const unsigned char* encoded, size_t encodedSize, const unsigned char* previous, int width, int height,
+    unsigned char* frame);
+
+  /// FrameDelta frames need the previous frame to decode
+  static FrameType getFrameType(const unsigned char* encoded) { return (FrameType)encoded[0]; }
+
+private:
+  std::vector<unsigned char> deltas;
+  std::vector<unsigned char> compressed;
+  std::vector<unsigned char> otherCompressed;
+  std::vector<unsigned int> hashTable;
+};
+
+#endif
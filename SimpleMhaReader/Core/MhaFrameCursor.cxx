@@ -0,0 +1,148 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+#include "MhaFrameCursor.h"
+#include "MhaFileUtilities.h"
+
+// STD includes
+#include <algorithm>
+#include <cstring>
+
+namespace
+{
+// Direct reads of many frames go through the buffer in pieces of this size
+const size_t directChunkSize = 4*1024*1024;
+}
+
+//----------------------------------------------------------------------------
+MhaFrameCursor::MhaFrameCursor(const std::shared_ptr<const MhaSequenceIndex>& index, bool direct)
+  : index(index)
+{
+  this->direct = direct;
+  this->fd = -1;
+  this->frame = -1;
+  this->pixels = NULL;
+  this->buffer = NULL;
+  this->bufferSize = 0;
+}
+
+//----------------------------------------------------------------------------
+MhaFrameCursor::~MhaFrameCursor()
+{
+  if(this->fd >= 0)
+    closeFile(this->fd);
+  if(this->buffer)
+    freeAlignedBuffer(this->buffer);
+}
+
+//----------------------------------------------------------------------------
+int MhaFrameCursor::openFile()
+{
+  if(this->fd >= 0)
+    return 0;
+  if(!this->index)
+    return 1;
+  if(this->direct)
+    this->fd = openFileForDirectReading(this->index->getPath());
+  // Cached reads where direct ones are not supported (tmpfs, network shares)
+  if(this->fd < 0)
+  {
+    this->direct = false;
+    this->fd = openFileForReading(this->index->getPath());
+  }
+  return this->fd >= 0 ? 0 : 1;
+}
+
+//----------------------------------------------------------------------------
+int MhaFrameCursor::reserveBuffer(size_t size)
+{
+  if(size <= this->bufferSize)
+    return 0;
+  if(this->buffer)
+    freeAlignedBuffer(this->buffer);
+  this->buffer = allocateAlignedBuffer(size);
+  this->bufferSize = this->buffer ? size : 0;
+  return this->buffer ? 0 : 1;
+}
+
+//----------------------------------------------------------------------------
+const unsigned char* MhaFrameCursor::readDirect(long long offset, size_t size)
+{
+  long long spanOffset;
+  size_t spanSize;
+  getDirectIOSpan(offset, size, spanOffset, spanSize);
+  size_t skip = (size_t)(offset - spanOffset);
+  if(this->reserveBuffer(spanSize)
+    || readFileSpanAt(this->fd, spanOffset, this->buffer, spanSize, skip + size))
+    return NULL;
+  return this->buffer + skip;
+}
+
+//----------------------------------------------------------------------------
+const unsigned char* MhaFrameCursor::readFrame(int frame)
+{
+  if(frame == this->frame)
+    return this->pixels;
+  this->frame = -1;
+  if(!this->index || frame < 0 || frame >= this->index->getNumberOfFrames() || this->openFile())
+    return NULL;
+  size_t frameSize = this->index->getFrameSize();
+  if(this->direct)
+    this->pixels = this->readDirect(this->index->getFrameOffset(frame), frameSize);
+  else if(this->reserveBuffer(frameSize) || readFileAt(this->fd, this->index->getFrameOffset(frame), this->buffer, frameSize))
+    this->pixels = NULL;
+  else
+    this->pixels = this->buffer;
+  if(this->pixels)
+    this->frame = frame;
+  return this->pixels;
+}
+
+//----------------------------------------------------------------------------
+int MhaFrameCursor::readFrames(int first, int count, unsigned char* pixels)
+{
+  if(!this->index || first < 0 || count <= 0 || first + count > this->index->getNumberOfFrames())
+    return 1;
+  if(this->openFile())
+    return 1;
+  long long offset = this->index->getFrameOffset(first);
+  size_t size = this->index->getFrameSize()*(size_t)count;
+  if(!this->direct)
+    return readFileAt(this->fd, offset, pixels, size);
+
+  // The buffer contents change, forget the frame it held
+  this->frame = -1;
+  while(size > 0)
+  {
+    size_t chunk = std::min(size, directChunkSize);
+    const unsigned char* data = this->readDirect(offset, chunk);
+    if(!data)
+      return 1;
+    memcpy(pixels, data, chunk);
+    pixels += chunk;
+    offset += (long long)chunk;
+    size -= chunk;
+  }
+  return 0;
+}
+
+//----------------------------------------------------------------------------
+void MhaFrameCursor::dropFrames(int first, int count)
+{
+  if(this->fd >= 0 && !this->direct && count > 0)
+    dropFileCache(this->fd, this->index->getFrameOffset(first), (long long)this->index->getFrameSize()*count);
+}
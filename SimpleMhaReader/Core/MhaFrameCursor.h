@@ -0,0 +1,80 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+// .NAME MhaFrameCursor - reads frames of a shared MhaSequenceIndex
+// .SECTION Description
+// A cursor owns its file descriptor and frame buffer and reads with
+// positioned reads, so cursors on the same index work concurrently without
+// any lock. Cursors are cheap: the file is opened on the first read. A
+// cursor is used by one thread at a time.
+//
+// A direct cursor bypasses the page cache, for single passes over sequences
+// larger than memory that would otherwise evict everything else. Frames
+// start anywhere after the header, so it reads the enclosing block-aligned
+// span into an aligned buffer.
+
+#ifndef __MhaFrameCursor_h
+#define __MhaFrameCursor_h
+
+// STD includes
+#include <memory>
+
+#include "MhaSequenceIndex.h"
+
+class MhaFrameCursor
+{
+public:
+  /// With direct, reads bypass the page cache where the file system allows
+  explicit MhaFrameCursor(const std::shared_ptr<const MhaSequenceIndex>& index, bool direct = false);
+  ~MhaFrameCursor();
+
+  /// Reads frame into the cursor buffer. Returns the pixels, valid until the
+  /// next read, or NULL on failure.
+  const unsigned char* readFrame(int frame);
+  /// Reads count consecutive frames starting at first into pixels
+  int readFrames(int first, int count, unsigned char* pixels);
+  /// Frame currently in the buffer, -1 if none
+  int getFrame() const { return this->frame; }
+  /// False once the file is open if direct reads were requested but are not supported
+  bool isDirect() const { return this->direct; }
+  /// -1 until the first read opens the file
+  int getFileDescriptor() const { return this->fd; }
+
+  /// Tells the OS that frames [first, first+count) will not be read again
+  void dropFrames(int first, int count);
+
+  const std::shared_ptr<const MhaSequenceIndex>& getIndex() const { return this->index; }
+
+private:
+  MhaFrameCursor(const MhaFrameCursor&); // Not implemented
+  void operator=(const MhaFrameCursor&); // Not implemented
+
+  int openFile();
+  int reserveBuffer(size_t size);
+  const unsigned char* readDirect(long long offset, size_t size);
+
+  std::shared_ptr<const MhaSequenceIndex> index;
+  bool direct;
+  int fd;
+  int frame;
+  const unsigned char* pixels;
+  /// Aligned, holds at least one frame span
+  unsigned char* buffer;
+  size_t bufferSize;
+};
+
+#endif
@@ -0,0 +1,345 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+#include "MhaFrameFilters.h"
+#include "MhaFrameKernels.h"
+
+// STD includes
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+
+#ifdef MHA_USE_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace
+{
+inline void sortPair(unsigned char& a, unsigned char& b)
+{
+  unsigned char low = std::min(a, b);
+  b = std::max(a, b);
+  a = low;
+}
+
+// Median of 9 with 19 compare-exchanges
+inline unsigned char median9(unsigned char p[9])
+{
+  sortPair(p[1], p[2]); sortPair(p[4], p[5]); sortPair(p[7], p[8]);
+  sortPair(p[0], p[1]); sortPair(p[3], p[4]); sortPair(p[6], p[7]);
+  sortPair(p[1], p[2]); sortPair(p[4], p[5]); sortPair(p[7], p[8]);
+  sortPair(p[0], p[3]); sortPair(p[5], p[8]); sortPair(p[4], p[7]);
+  sortPair(p[3], p[6]); sortPair(p[1], p[4]); sortPair(p[2], p[5]);
+  sortPair(p[4], p[7]); sortPair(p[4], p[2]); sortPair(p[6], p[4]);
+  sortPair(p[4], p[2]);
+  return p[4];
+}
+
+#ifdef MHA_USE_SSE2
+inline void sortPair(__m128i& a, __m128i& b)
+{
+  __m128i low = _mm_min_epu8(a, b);
+  b = _mm_max_epu8(a, b);
+  a = low;
+}
+#endif
+
+inline int clampRow(int row, int height)
+{
+  return row < 0 ? 0 : (row >= height ? height - 1 : row);
+}
+}
+
+//----------------------------------------------------------------------------
+void MhaMedianFilter::processRows(const unsigned char* input, unsigned char* output, int width, int height, int firstRow, int lastRow)
+{
+  for(int row = firstRow; row < lastRow; row++)
+  {
+    const unsigned char* center = input + (size_t)row*width;
+    unsigned char* out = output + (size_t)row*width;
+    // Border pixels are kept as they are
+    if(row == 0 || row == height - 1 || width < 3)
+    {
+      memcpy(out, center, width);
+      continue;
+    }
+    const unsigned char* above = center - width;
+    const unsigned char* below = center + width;
+    out[0] = center[0];
+    out[width-1] = center[width-1];
+
+    int x = 1;
+#ifdef MHA_USE_SSE2
+    for(; x + 17 <= width; x += 16)
+    {
+      __m128i p[9];
+      const unsigned char* rows[3] = { above, center, below };
+      for(int r=0; r<3; r++)
+      {
+        p[3*r] = _mm_loadu_si128((const __m128i*)(rows[r] + x - 1));
+        p[3*r+1] = _mm_loadu_si128((const __m128i*)(rows[r] + x));
+        p[3*r+2] = _mm_loadu_si128((const __m128i*)(rows[r] + x + 1));
+      }
+      sortPair(p[1], p[2]); sortPair(p[4], p[5]); sortPair(p[7], p[8]);
+      sortPair(p[0], p[1]); sortPair(p[3], p[4]); sortPair(p[6], p[7]);
+      sortPair(p[1], p[2]); sortPair(p[4], p[5]); sortPair(p[7], p[8]);
+      sortPair(p[0], p[3]); sortPair(p[5], p[8]); sortPair(p[4], p[7]);
+      sortPair(p[3], p[6]); sortPair(p[1], p[4]); sortPair(p[2], p[5]);
+      sortPair(p[4], p[7]); sortPair(p[4], p[2]); sortPair(p[6], p[4]);
+      sortPair(p[4], p[2]);
+      _mm_storeu_si128((__m128i*)(out + x), p[4]);
+    }
+#endif
+    for(; x < width - 1; x++)
+    {
+      unsigned char p[9] = { above[x-1], above[x], above[x+1],
+                             center[x-1], center[x], center[x+1],
+                             below[x-1], below[x], below[x+1] };
+      out[x] = median9(p);
+    }
+  }
+}
+
+//----------------------------------------------------------------------------
+void MhaGaussianFilter::processRows(const unsigned char* input, unsigned char* output, int width, int height, int firstRow, int lastRow)
+{
+  // Vertical pass of one row, with two replicated columns on each side
+  std::vector<unsigned short> vertical(width + 4 + 8);
+  unsigned short* v = &vertical[2];
+  for(int row = firstRow; row < lastRow; row++)
+  {
+    const unsigned char* r0 = input + (size_t)clampRow(row - 2, height)*width;
+    const unsigned char* r1 = input + (size_t)clampRow(row - 1, height)*width;
+    const unsigned char* r2 = input + (size_t)row*width;
+    const unsigned char* r3 = input + (size_t)clampRow(row + 1, height)*width;
+    const unsigned char* r4 = input + (size_t)clampRow(row + 2, height)*width;
+    unsigned char* out = output + (size_t)row*width;
+
+    int x = 0;
+#ifdef MHA_USE_SSE2
+    const __m128i zero = _mm_setzero_si128();
+    for(; x + 8 <= width; x += 8)
+    {
+      __m128i a = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(r0 + x)), zero);
+      __m128i b = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(r1 + x)), zero);
+      __m128i c = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(r2 + x)), zero);
+      __m128i d = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(r3 + x)), zero);
+      __m128i e = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(r4 + x)), zero);
+      __m128i sum = _mm_add_epi16(_mm_add_epi16(a, e), _mm_slli_epi16(_mm_add_epi16(b, d), 2));
+      sum = _mm_add_epi16(sum, _mm_add_epi16(_mm_slli_epi16(c, 2), _mm_slli_epi16(c, 1)));
+      _mm_storeu_si128((__m128i*)(v + x), sum);
+    }
+#endif
+    for(; x < width; x++)
+      v[x] = (unsigned short)(r0[x] + 4*r1[x] + 6*r2[x] + 4*r3[x] + r4[x]);
+    v[-2] = v[-1] = v[0];
+    v[width] = v[width+1] = v[width-1];
+
+    x = 0;
+#ifdef MHA_USE_SSE2
+    const __m128i rounding = _mm_set1_epi16(128);
+    for(; x + 8 <= width; x += 8)
+    {
+      __m128i a = _mm_loadu_si128((const __m128i*)(v + x - 2));
+      __m128i b = _mm_loadu_si128((const __m128i*)(v + x - 1));
+      __m128i c = _mm_loadu_si128((const __m128i*)(v + x));
+      __m128i d = _mm_loadu_si128((const __m128i*)(v + x + 1));
+      __m128i e = _mm_loadu_si128((const __m128i*)(v + x + 2));
+      __m128i sum = _mm_add_epi16(_mm_add_epi16(a, e), _mm_slli_epi16(_mm_add_epi16(b, d), 2));
+      sum = _mm_add_epi16(sum, _mm_add_epi16(_mm_slli_epi16(c, 2), _mm_slli_epi16(c, 1)));
+      sum = _mm_srli_epi16(_mm_add_epi16(sum, rounding), 8);
+      _mm_storel_epi64((__m128i*)(out + x), _mm_packus_epi16(sum, sum));
+    }
+#endif
+    for(; x < width; x++)
+      out[x] = (unsigned char)((v[x-2] + 4*v[x-1] + 6*v[x] + 4*v[x+1] + v[x+2] + 128) >> 8);
+  }
+}
+
+//----------------------------------------------------------------------------
+MhaGainFilter::MhaGainFilter()
+{
+  this->curve.push_back(0.);
+}
+
+//----------------------------------------------------------------------------
+void MhaGainFilter::setCurve(const std::vector<double>& gainsInDecibels)
+{
+  this->curve = gainsInDecibels;
+  if(this->curve.empty())
+    this->curve.push_back(0.);
+  this->rowGains.clear();
+}
+
+//----------------------------------------------------------------------------
+void MhaGainFilter::beginFrame(int, int, int height)
+{
+  if((int)this->rowGains.size() == height)
+    return;
+  this->rowGains.resize(height);
+  for(int row = 0; row < height; row++)
+  {
+    double position = height > 1 ? (double)row/(height - 1)*(this->curve.size() - 1) : 0.;
+    size_t index = std::min((size_t)position, this->curve.size() - 1);
+    size_t next = std::min(index + 1, this->curve.size() - 1);
+    double fraction = position - (double)index;
+    double decibels = this->curve[index]*(1. - fraction) + this->curve[next]*fraction;
+    double gain = pow(10., decibels/20.)*256.;
+    this->rowGains[row] = (unsigned short)std::min(gain + 0.5, 65535.);
+  }
+}
+
+//----------------------------------------------------------------------------
+void MhaGainFilter::processRows(const unsigned char* input, unsigned char* output, int width, int, int firstRow, int lastRow)
+{
+  for(int row = firstRow; row < lastRow; row++)
+  {
+    const unsigned char* in = input + (size_t)row*width;
+    unsigned char* out = output + (size_t)row*width;
+    unsigned int gain = this->rowGains[row];
+    int x = 0;
+#ifdef MHA_USE_SSE2
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i multiplier = _mm_set1_epi16((short)gain);
+    const __m128i saturation = _mm_set1_epi16((short)0xFF00);
+    for(; x + 16 <= width; x += 16)
+    {
+      __m128i v = _mm_loadu_si128((const __m128i*)(in + x));
+      // (value << 8) * gain >> 16 is value * gain in 8.8 fixed point
+      __m128i low = _mm_mulhi_epu16(_mm_unpacklo_epi8(zero, v), multiplier);
+      __m128i high = _mm_mulhi_epu16(_mm_unpackhi_epi8(zero, v), multiplier);
+      // Unsigned saturation to 255 before packing
+      low = _mm_subs_epu16(_mm_adds_epu16(low, saturation), saturation);
+      high = _mm_subs_epu16(_mm_adds_epu16(high, saturation), saturation);
+      _mm_storeu_si128((__m128i*)(out + x), _mm_packus_epi16(low, high));
+    }
+#endif
+    for(; x < width; x++)
+    {
+      unsigned int value = (in[x]*gain) >> 8;
+      out[x] = (unsigned char)(value > 255 ? 255 : value);
+    }
+  }
+}
+
+//----------------------------------------------------------------------------
+MhaTemporalAverageFilter::MhaTemporalAverageFilter(int numberOfFrames)
+{
+  // 128 frames of 255 still fit the 16 bit running sum
+  this->numberOfFrames = std::max(1, std::min(numberOfFrames, 128));
+  this->width = 0;
+  this->height = 0;
+  this->reset();
+}
+
+//----------------------------------------------------------------------------
+void MhaTemporalAverageFilter::reset()
+{
+  this->lastFrame = -2;
+  this->count = 0;
+  this->slot = 0;
+  this->replacing = false;
+}
+
+//----------------------------------------------------------------------------
+void MhaTemporalAverageFilter::beginFrame(int frame, int width, int height)
+{
+  // Forward and backward playback both keep the window, seeking restarts it
+  if(width != this->width || height != this->height || std::abs(frame - this->lastFrame) != 1)
+  {
+    this->reset();
+    this->width = width;
+    this->height = height;
+    size_t frameSize = (size_t)width*(size_t)height;
+    this->history.resize(frameSize*this->numberOfFrames);
+    this->sum.assign(frameSize, 0);
+  }
+  this->lastFrame = frame;
+  this->replacing = this->count == this->numberOfFrames;
+  if(!this->replacing)
+    this->count++;
+}
+
+//----------------------------------------------------------------------------
+void MhaTemporalAverageFilter::processRows(const unsigned char* input, unsigned char* output, int width, int, int firstRow, int lastRow)
+{
+  size_t frameSize = (size_t)this->width*(size_t)this->height;
+  size_t begin = (size_t)firstRow*width;
+  size_t end = (size_t)lastRow*width;
+  unsigned char* slotPixels = &this->history[frameSize*this->slot];
+  unsigned short* sum = &this->sum[0];
+  // sum/count as a multiplication, 16 bit reciprocal
+  unsigned int reciprocal = (65536 + this->count - 1)/this->count;
+
+  size_t i = begin;
+  if(this->count == 1)
+  {
+    for(; i < end; i++)
+      sum[i] = input[i];
+    memcpy(slotPixels + begin, input + begin, end - begin);
+    memcpy(output + begin, input + begin, end - begin);
+    return;
+  }
+
+#ifdef MHA_USE_SSE2
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i multiplier = _mm_set1_epi16((short)reciprocal);
+  const __m128i rounding = _mm_set1_epi16((short)(this->count/2));
+  for(; i + 16 <= end; i += 16)
+  {
+    __m128i in = _mm_loadu_si128((const __m128i*)(input + i));
+    __m128i old = this->replacing ? _mm_loadu_si128((const __m128i*)(slotPixels + i)) : zero;
+    __m128i sumLow = _mm_loadu_si128((const __m128i*)(sum + i));
+    __m128i sumHigh = _mm_loadu_si128((const __m128i*)(sum + i + 8));
+    sumLow = _mm_sub_epi16(_mm_add_epi16(sumLow, _mm_unpacklo_epi8(in, zero)), _mm_unpacklo_epi8(old, zero));
+    sumHigh = _mm_sub_epi16(_mm_add_epi16(sumHigh, _mm_unpackhi_epi8(in, zero)), _mm_unpackhi_epi8(old, zero));
+    _mm_storeu_si128((__m128i*)(sum + i), sumLow);
+    _mm_storeu_si128((__m128i*)(sum + i + 8), sumHigh);
+    _mm_storeu_si128((__m128i*)(slotPixels + i), in);
+    __m128i low = _mm_mulhi_epu16(_mm_add_epi16(sumLow, rounding), multiplier);
+    __m128i high = _mm_mulhi_epu16(_mm_add_epi16(sumHigh, rounding), multiplier);
+    _mm_storeu_si128((__m128i*)(output + i), _mm_packus_epi16(low, high));
+  }
+#endif
+  for(; i < end; i++)
+  {
+    unsigned char old = this->replacing ? slotPixels[i] : 0;
+    sum[i] = (unsigned short)(sum[i] + input[i] - old);
+    slotPixels[i] = input[i];
+    unsigned int value = ((sum[i] + this->count/2)*reciprocal) >> 16;
+    output[i] = (unsigned char)(value > 255 ? 255 : value);
+  }
+}
+
+//----------------------------------------------------------------------------
+void MhaTemporalAverageFilter::endFrame()
+{
+  this->slot = (this->slot + 1) % this->numberOfFrames;
+}
+
+//----------------------------------------------------------------------------
+size_t MhaGainFilter::getMemorySize() const
+{
+  return this->curve.capacity()*sizeof(double) + this->rowGains.capacity()*sizeof(unsigned short);
+}
+
+//----------------------------------------------------------------------------
+size_t MhaTemporalAverageFilter::getMemorySize() const
+{
+  return this->history.capacity() + this->sum.capacity()*sizeof(unsigned short);
+}
@@ -0,0 +1,105 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+// .NAME MhaFrameFilters - per-frame filters of the display and export pipeline
+// .SECTION Description
+// Filters work on 8 bit frames, a band of rows at a time, so that a frame
+// is split in row tiles processed on several threads (see MhaFilterChain).
+// Kernels use SSE2 where available.
+
+#ifndef __MhaFrameFilters_h
+#define __MhaFrameFilters_h
+
+// STD includes
+#include <cstddef>
+#include <vector>
+
+class MhaFrameFilter
+{
+public:
+  virtual ~MhaFrameFilter() {}
+
+  /// Called once per frame before its rows are processed
+  virtual void beginFrame(int, int, int) {}
+  /// Filters rows [firstRow, lastRow) of input into output; may run concurrently
+  /// for disjoint row ranges of the same frame
+  virtual void processRows(const unsigned char* input, unsigned char* output, int width, int height, int firstRow, int lastRow) = 0;
+  /// Called once per frame after all its rows are processed
+  virtual void endFrame() {}
+  /// Forgets any state kept from previous frames
+  virtual void reset() {}
+  /// Heap bytes held between frames
+  virtual size_t getMemorySize() const { return 0; }
+};
+
+/// 3x3 median, reduces speckle
+class MhaMedianFilter : public MhaFrameFilter
+{
+public:
+  virtual void processRows(const unsigned char* input, unsigned char* output, int width, int height, int firstRow, int lastRow);
+};
+
+/// 5x5 binomial smoothing (sigma about 1 pixel)
+class MhaGaussianFilter : public MhaFrameFilter
+{
+public:
+  virtual void processRows(const unsigned char* input, unsigned char* output, int width, int height, int firstRow, int lastRow);
+};
+
+/// Depth dependent gain: gains in dB at evenly spaced depths from the first
+/// row to the last one, interpolated linearly in between
+class MhaGainFilter : public MhaFrameFilter
+{
+public:
+  MhaGainFilter();
+  void setCurve(const std::vector<double>& gainsInDecibels);
+  virtual void beginFrame(int frame, int width, int height);
+  virtual void processRows(const unsigned char* input, unsigned char* output, int width, int height, int firstRow, int lastRow);
+  virtual size_t getMemorySize() const;
+
+private:
+  std::vector<double> curve;
+  /// Per row multiplier, 8.8 fixed point
+  std::vector<unsigned short> rowGains;
+};
+
+/// Mean of the last N frames (at most 128), kept up to date with a running
+/// sum. The history restarts whenever frames are not consecutive.
+class MhaTemporalAverageFilter : public MhaFrameFilter
+{
+public:
+  explicit MhaTemporalAverageFilter(int numberOfFrames);
+  virtual void beginFrame(int frame, int width, int height);
+  virtual void processRows(const unsigned char* input, unsigned char* output, int width, int height, int firstRow, int lastRow);
+  virtual void endFrame();
+  virtual void reset();
+  virtual size_t getMemorySize() const;
+
+private:
+  int numberOfFrames;
+  int lastFrame;
+  int width;
+  int height;
+  /// Frames in the window, and the ring slot the current frame replaces
+  int count;
+  int slot;
+  bool replacing;
+  std::vector<unsigned char> history;
+  std::vector<unsigned short> sum;
+};
+
+#endif
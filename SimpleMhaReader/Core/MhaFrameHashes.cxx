@@ -0,0 +1,111 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+#include "MhaFrameHashes.h"
+#include "MhaFileUtilities.h"
+
+// STD includes
+#include <cstring>
+
+namespace
+{
+const char magic[8] = { 'M', 'H', 'A', 'H', 'A', 'S', 'H', '1' };
+}
+
+//----------------------------------------------------------------------------
+bool MhaFrameHashesKey::operator==(const MhaFrameHashesKey& other) const
+{
+  return this->fileSize == other.fileSize
+    && this->modificationTime == other.modificationTime
+    && this->dataOffset == other.dataOffset
+    && this->width == other.width
+    && this->height == other.height
+    && this->numberOfFrames == other.numberOfFrames;
+}
+
+//----------------------------------------------------------------------------
+int makeFrameHashesKey(const std::string& path, long long dataOffset, int width, int height, int numberOfFrames, MhaFrameHashesKey& key)
+{
+  key.fileSize = getFileSize(path);
+  key.modificationTime = getFileModificationTime(path);
+  key.dataOffset = dataOffset;
+  key.width = width;
+  key.height = height;
+  key.numberOfFrames = numberOfFrames;
+  return key.fileSize < 0 ? 1 : 0;
+}
+
+//----------------------------------------------------------------------------
+std::string getFrameHashesPath(const std::string& path)
+{
+  return path + ".hashes";
+}
+
+//----------------------------------------------------------------------------
+int saveFrameHashes(const std::string& hashesPath, const MhaFrameHashesKey& key, const std::vector<unsigned long long>& hashes)
+{
+  if(hashes.size() != (size_t)key.numberOfFrames)
+    return 1;
+  FILE* file = fopen(hashesPath.c_str(), "wb");
+  if(!file)
+    return 1;
+  bool failed = fwrite(magic, 1, sizeof(magic), file) != sizeof(magic)
+    || fwrite(&key, sizeof(key), 1, file) != 1
+    || (!hashes.empty() && fwrite(&hashes[0], sizeof(unsigned long long), hashes.size(), file) != hashes.size());
+  failed = fclose(file) != 0 || failed;
+  if(failed)
+    remove(hashesPath.c_str());
+  return failed ? 1 : 0;
+}
+
+//----------------------------------------------------------------------------
+int loadFrameHashes(const std::string& hashesPath, const MhaFrameHashesKey& key, std::vector<unsigned long long>& hashes)
+{
+  FILE* file = fopen(hashesPath.c_str(), "rb");
+  if(!file)
+    return 1;
+  char fileMagic[sizeof(magic)];
+  MhaFrameHashesKey fileKey;
+  bool failed = fread(fileMagic, 1, sizeof(fileMagic), file) != sizeof(fileMagic)
+    || memcmp(fileMagic, magic, sizeof(magic))
+    || fread(&fileKey, sizeof(fileKey), 1, file) != 1
+    || !(fileKey == key);
+  if(!failed)
+  {
+    hashes.resize((size_t)key.numberOfFrames);
+    failed = !hashes.empty() && fread(&hashes[0], sizeof(unsigned long long), hashes.size(), file) != hashes.size();
+  }
+  fclose(file);
+  if(failed)
+    hashes.clear();
+  return failed ? 1 : 0;
+}
+
+//----------------------------------------------------------------------------
+void findDuplicateRuns(const std::vector<unsigned long long>& hashes, std::vector<std::pair<int, int> >& runs)
+{
+  runs.clear();
+  size_t first = 0;
+  for(size_t i=1; i<=hashes.size(); i++)
+  {
+    if(i < hashes.size() && hashes[i] == hashes[first])
+      continue;
+    if(i - first >= 2)
+      runs.push_back(std::make_pair((int)first, (int)(i - first)));
+    first = i;
+  }
+}
@@ -0,0 +1,56 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+// .NAME MhaFrameHashes - persisted per-frame content hashes
+// .SECTION Description
+// Hashes are stored next to the sequence in <file>.hashes together with a
+// key describing the file they were computed from, so they are reused as
+// long as the sequence is unchanged.
+
+#ifndef __MhaFrameHashes_h
+#define __MhaFrameHashes_h
+
+// STD includes
+#include <string>
+#include <utility>
+#include <vector>
+
+struct MhaFrameHashesKey
+{
+  long long fileSize;
+  long long modificationTime;
+  long long dataOffset;
+  long long width;
+  long long height;
+  long long numberOfFrames;
+
+  bool operator==(const MhaFrameHashesKey& other) const;
+};
+
+int makeFrameHashesKey(const std::string& path, long long dataOffset, int width, int height, int numberOfFrames, MhaFrameHashesKey& key);
+
+std::string getFrameHashesPath(const std::string& path);
+
+int saveFrameHashes(const std::string& hashesPath, const MhaFrameHashesKey& key, const std::vector<unsigned long long>& hashes);
+
+/// Fails if the file is missing or was written for another key
+int loadFrameHashes(const std::string& hashesPath, const MhaFrameHashesKey& key, std::vector<unsigned long long>& hashes);
+
+/// Runs of consecutive identical frames as (first frame, length), length >= 2
+void findDuplicateRuns(const std::vector<unsigned long long>& hashes, std::vector<std::pair<int, int> >& runs);
+
+#endif
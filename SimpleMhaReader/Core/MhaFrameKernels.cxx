@@ -0,0 +1,260 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+#include "MhaFrameKernels.h"
+
+// STD includes
+#include <cstring>
+
+#ifdef MHA_USE_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace
+{
+const unsigned long long prime1 = 11400714785074694791ULL;
+const unsigned long long prime2 = 14029467366897019727ULL;
+const unsigned long long prime3 = 1609587929392839161ULL;
+const unsigned long long prime4 = 9650029242287828579ULL;
+const unsigned long long prime5 = 2870177450012600261ULL;
+
+inline unsigned long long rotateLeft(unsigned long long value, int bits)
+{
+  return (value << bits) | (value >> (64 - bits));
+}
+
+inline unsigned long long read64(const unsigned char* data)
+{
+  unsigned long long value;
+  memcpy(&value, data, sizeof(value));
+  return value;
+}
+
+inline unsigned int read32(const unsigned char* data)
+{
+  unsigned int value;
+  memcpy(&value, data, sizeof(value));
+  return value;
+}
+
+inline unsigned long long hashRound(unsigned long long accumulator, unsigned long long input)
+{
+  accumulator += input*prime2;
+  accumulator = rotateLeft(accumulator, 31);
+  return accumulator*prime1;
+}
+
+inline unsigned long long hashMerge(unsigned long long hash, unsigned long long accumulator)
+{
+  hash ^= hashRound(0, accumulator);
+  return hash*prime1 + prime4;
+}
+}
+
+//----------------------------------------------------------------------------
+void computeFrameMoments(const unsigned char* pixels, size_t size, MhaFrameMoments& moments)
+{
+  unsigned char minimum = 255;
+  unsigned char maximum = 0;
+  unsigned long long sum = 0;
+  unsigned long long sumOfSquares = 0;
+  size_t i = 0;
+
+#ifdef MHA_USE_SSE2
+  const __m128i zero = _mm_setzero_si128();
+  __m128i minimum16 = _mm_set1_epi8((char)255);
+  __m128i maximum16 = zero;
+  __m128i sum64 = zero;
+  __m128i squares64 = zero;
+  while(i + 16 <= size)
+  {
+    // 32 bit square sums take at most 8192 blocks of 16 pixels before overflowing
+    size_t blockEnd = size - i > 8192*16 ? i + 8192*16 : size;
+    __m128i squares32 = zero;
+    for(; i + 16 <= blockEnd; i += 16)
+    {
+      __m128i v = _mm_loadu_si128((const __m128i*)(pixels + i));
+      minimum16 = _mm_min_epu8(minimum16, v);
+      maximum16 = _mm_max_epu8(maximum16, v);
+      sum64 = _mm_add_epi64(sum64, _mm_sad_epu8(v, zero));
+      __m128i low = _mm_unpacklo_epi8(v, zero);
+      __m128i high = _mm_unpackhi_epi8(v, zero);
+      squares32 = _mm_add_epi32(squares32, _mm_madd_epi16(low, low));
+      squares32 = _mm_add_epi32(squares32, _mm_madd_epi16(high, high));
+    }
+    squares64 = _mm_add_epi64(squares64, _mm_unpacklo_epi32(squares32, zero));
+    squares64 = _mm_add_epi64(squares64, _mm_unpackhi_epi32(squares32, zero));
+  }
+  unsigned char lanes[16];
+  _mm_storeu_si128((__m128i*)lanes, minimum16);
+  for(int j=0; j<16; j++)
+    minimum = lanes[j] < minimum ? lanes[j] : minimum;
+  _mm_storeu_si128((__m128i*)lanes, maximum16);
+  for(int j=0; j<16; j++)
+    maximum = lanes[j] > maximum ? lanes[j] : maximum;
+  unsigned long long wide[2];
+  _mm_storeu_si128((__m128i*)wide, sum64);
+  sum = wide[0] + wide[1];
+  _mm_storeu_si128((__m128i*)wide, squares64);
+  sumOfSquares = wide[0] + wide[1];
+#endif
+
+  for(; i < size; i++)
+  {
+    unsigned char value = pixels[i];
+    minimum = value < minimum ? value : minimum;
+    maximum = value > maximum ? value : maximum;
+    sum += value;
+    sumOfSquares += (unsigned int)value*value;
+  }
+
+  moments.minimum = size ? minimum : 0;
+  moments.maximum = maximum;
+  moments.sum = sum;
+  moments.sumOfSquares = sumOfSquares;
+}
+
+//----------------------------------------------------------------------------
+unsigned long long computeSumOfAbsoluteDifferences(const unsigned char* a, const unsigned char* b, size_t size)
+{
+  unsigned long long sum = 0;
+  size_t i = 0;
+
+#ifdef MHA_USE_SSE2
+  __m128i sum64 = _mm_setzero_si128();
+  for(; i + 16 <= size; i += 16)
+  {
+    __m128i va = _mm_loadu_si128((const __m128i*)(a + i));
+    __m128i vb = _mm_loadu_si128((const __m128i*)(b + i));
+    sum64 = _mm_add_epi64(sum64, _mm_sad_epu8(va, vb));
+  }
+  unsigned long long wide[2];
+  _mm_storeu_si128((__m128i*)wide, sum64);
+  sum = wide[0] + wide[1];
+#endif
+
+  for(; i < size; i++)
+    sum += a[i] > b[i] ? a[i] - b[i] : b[i] - a[i];
+  return sum;
+}
+
+//----------------------------------------------------------------------------
+void subtractFrames(const unsigned char* a, const unsigned char* b, unsigned char* output, size_t size)
+{
+  size_t i = 0;
+
+#ifdef MHA_USE_SSE2
+  for(; i + 16 <= size; i += 16)
+  {
+    __m128i va = _mm_loadu_si128((const __m128i*)(a + i));
+    __m128i vb = _mm_loadu_si128((const __m128i*)(b + i));
+    _mm_storeu_si128((__m128i*)(output + i), _mm_sub_epi8(va, vb));
+  }
+#endif
+
+  for(; i < size; i++)
+    output[i] = (unsigned char)(a[i] - b[i]);
+}
+
+//----------------------------------------------------------------------------
+void addFrames(const unsigned char* a, const unsigned char* b, unsigned char* output, size_t size)
+{
+  size_t i = 0;
+
+#ifdef MHA_USE_SSE2
+  for(; i + 16 <= size; i += 16)
+  {
+    __m128i va = _mm_loadu_si128((const __m128i*)(a + i));
+    __m128i vb = _mm_loadu_si128((const __m128i*)(b + i));
+    _mm_storeu_si128((__m128i*)(output + i), _mm_add_epi8(va, vb));
+  }
+#endif
+
+  for(; i < size; i++)
+    output[i] = (unsigned char)(a[i] + b[i]);
+}
+
+//----------------------------------------------------------------------------
+void accumulateHistogram(const unsigned char* pixels, size_t size, unsigned int histogram[256])
+{
+  // Four partial histograms avoid stalls on runs of equal pixels
+  unsigned int partial[4][256];
+  memset(partial, 0, sizeof(partial));
+  size_t i = 0;
+  for(; i + 4 <= size; i += 4)
+  {
+    partial[0][pixels[i]]++;
+    partial[1][pixels[i+1]]++;
+    partial[2][pixels[i+2]]++;
+    partial[3][pixels[i+3]]++;
+  }
+  for(; i < size; i++)
+    partial[0][pixels[i]]++;
+  for(int j=0; j<256; j++)
+    histogram[j] += partial[0][j] + partial[1][j] + partial[2][j] + partial[3][j];
+}
+
+//----------------------------------------------------------------------------
+unsigned long long computeFrameHash(const unsigned char* pixels, size_t size, unsigned long long seed)
+{
+  const unsigned char* end = pixels + size;
+  unsigned long long hash;
+
+  if(size >= 32)
+  {
+    // Four independent lanes keep the multipliers busy
+    unsigned long long lane1 = seed + prime1 + prime2;
+    unsigned long long lane2 = seed + prime2;
+    unsigned long long lane3 = seed;
+    unsigned long long lane4 = seed - prime1;
+    const unsigned char* limit = end - 32;
+    do
+    {
+      lane1 = hashRound(lane1, read64(pixels));
+      lane2 = hashRound(lane2, read64(pixels + 8));
+      lane3 = hashRound(lane3, read64(pixels + 16));
+      lane4 = hashRound(lane4, read64(pixels + 24));
+      pixels += 32;
+    }
+    while(pixels <= limit);
+    hash = rotateLeft(lane1, 1) + rotateLeft(lane2, 7) + rotateLeft(lane3, 12) + rotateLeft(lane4, 18);
+    hash = hashMerge(hash, lane1);
+    hash = hashMerge(hash, lane2);
+    hash = hashMerge(hash, lane3);
+    hash = hashMerge(hash, lane4);
+  }
+  else
+    hash = seed + prime5;
+
+  hash += (unsigned long long)size;
+  for(; pixels + 8 <= end; pixels += 8)
+    hash = rotateLeft(hash ^ hashRound(0, read64(pixels)), 27)*prime1 + prime4;
+  if(pixels + 4 <= end)
+  {
+    hash = rotateLeft(hash ^ ((unsigned long long)read32(pixels)*prime1), 23)*prime2 + prime3;
+    pixels += 4;
+  }
+  for(; pixels < end; pixels++)
+    hash = rotateLeft(hash ^ ((unsigned long long)*pixels*prime5), 11)*prime1;
+
+  hash ^= hash >> 33;
+  hash *= prime2;
+  hash ^= hash >> 29;
+  hash *= prime3;
+  hash ^= hash >> 32;
+  return hash;
+}
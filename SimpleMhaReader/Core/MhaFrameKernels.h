@@ -0,0 +1,55 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+// .NAME MhaFrameKernels - vectorized per-frame pixel kernels
+// .SECTION Description
+// SSE2 implementations with scalar fallbacks for 8 bit frames.
+
+#ifndef __MhaFrameKernels_h
+#define __MhaFrameKernels_h
+
+// STD includes
+#include <cstddef>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define MHA_USE_SSE2
+#endif
+
+struct MhaFrameMoments
+{
+  unsigned char minimum;
+  unsigned char maximum;
+  unsigned long long sum;
+  unsigned long long sumOfSquares;
+};
+
+void computeFrameMoments(const unsigned char* pixels, size_t size, MhaFrameMoments& moments);
+
+unsigned long long computeSumOfAbsoluteDifferences(const unsigned char* a, const unsigned char* b, size_t size);
+
+/// output = a - b and output = a + b byte by byte, wrapping around; output
+/// may be a or b. Deltas between frames or rows for MhaFrameCodec.
+void subtractFrames(const unsigned char* a, const unsigned char* b, unsigned char* output, size_t size);
+void addFrames(const unsigned char* a, const unsigned char* b, unsigned char* output, size_t size);
+
+/// Adds the pixel counts of the frame to histogram
+void accumulateHistogram(const unsigned char* pixels, size_t size, unsigned int histogram[256]);
+
+/// Fast non-cryptographic 64 bit hash of a frame (XXH64)
+unsigned long long computeFrameHash(const unsigned char* pixels, size_t size, unsigned long long seed = 0);
+
+#endif
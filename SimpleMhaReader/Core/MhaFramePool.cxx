@@ -0,0 +1,241 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+#include "MhaFramePool.h"
+
+// STD includes
+#include <algorithm>
+#include <cstdlib>
+
+#ifdef WIN32
+#include <malloc.h>
+#else
+#include <sys/mman.h>
+#endif
+
+namespace
+{
+// Largest arena, unless a single slab is larger
+const size_t arenaSize = 8*1024*1024;
+const size_t hugePageSize = 2*1024*1024;
+const size_t pageSize = 4096;
+const size_t cacheLineSize = 64;
+
+unsigned char* allocateMemory(size_t size, size_t alignment)
+{
+  #ifdef WIN32
+  return (unsigned char*)_aligned_malloc(size, alignment);
+  #else
+  void* memory = NULL;
+  return posix_memalign(&memory, alignment, size) ? NULL : (unsigned char*)memory;
+  #endif
+}
+
+void freeMemory(unsigned char* memory)
+{
+  #ifdef WIN32
+  _aligned_free(memory);
+  #else
+  free(memory);
+  #endif
+}
+
+size_t roundUp(size_t size, size_t alignment)
+{
+  return (size + alignment - 1)/alignment*alignment;
+}
+}
+
+//----------------------------------------------------------------------------
+double MhaFramePoolStatistics::getFragmentation() const
+{
+  if(this->reservedBytes <= 0)
+    return 0.;
+  return 1. - (double)this->frameBytesInUse/(double)this->reservedBytes;
+}
+
+//----------------------------------------------------------------------------
+MhaFramePool::MhaFramePool()
+{
+  this->hugePages = false;
+  this->frameSize = 0;
+  this->slabSize = 0;
+}
+
+//----------------------------------------------------------------------------
+MhaFramePool::~MhaFramePool()
+{
+  while(!this->arenas.empty())
+    this->freeArena(this->arenas.size() - 1);
+}
+
+//----------------------------------------------------------------------------
+void MhaFramePool::setHugePages(bool enabled)
+{
+  std::lock_guard<std::mutex> lock(this->mutex);
+  this->hugePages = enabled;
+}
+
+//----------------------------------------------------------------------------
+void MhaFramePool::setFrameSize(size_t frameSize)
+{
+  std::lock_guard<std::mutex> lock(this->mutex);
+  this->frameSize = frameSize;
+  this->statistics.frameSize = frameSize;
+  // Slabs that fit with less than half of them wasted are kept
+  if(frameSize > 0 && frameSize <= this->slabSize && 2*frameSize >= this->slabSize)
+    return;
+  this->slabSize = frameSize == 0 ? 0 : roundUp(frameSize, frameSize >= pageSize ? pageSize : cacheLineSize);
+  this->statistics.slabSize = this->slabSize;
+  // Arenas of the old geometry go once their last slab is released
+  this->freeSlabs.clear();
+  this->freeUnusedArenas();
+}
+
+//----------------------------------------------------------------------------
+int MhaFramePool::addArena()
+{
+  // Arenas double up to arenaSize, a single frame buffer takes a single slab
+  size_t reservedSlabs = 0;
+  for(size_t i=0; i<this->arenas.size(); i++)
+  {
+    if(this->arenas[i].slabSize == this->slabSize)
+      reservedSlabs += this->arenas[i].size/this->slabSize;
+  }
+  size_t slabs = std::max(std::min(reservedSlabs, arenaSize/this->slabSize), (size_t)1);
+  size_t size = slabs*this->slabSize;
+  size_t alignment = pageSize;
+  if(this->hugePages)
+  {
+    size = roundUp(size, hugePageSize);
+    alignment = hugePageSize;
+  }
+  Arena arena;
+  arena.memory = allocateMemory(size, alignment);
+  if(!arena.memory)
+    return 1;
+  arena.size = size;
+  arena.slabSize = this->slabSize;
+  arena.slabsInUse = 0;
+  arena.hugePages = false;
+  #ifdef MADV_HUGEPAGE
+  if(this->hugePages)
+    arena.hugePages = madvise(arena.memory, size, MADV_HUGEPAGE) == 0;
+  #endif
+  this->arenas.push_back(arena);
+
+  // Lowest addresses are handed out first
+  for(size_t i = size/this->slabSize; i > 0; i--)
+    this->freeSlabs.push_back(arena.memory + (i-1)*this->slabSize);
+  this->statistics.systemAllocations++;
+  this->statistics.hugePageArenas += arena.hugePages ? 1 : 0;
+  this->statistics.reservedBytes += (long long)size;
+  this->statistics.highWaterBytes = std::max(this->statistics.highWaterBytes, this->statistics.reservedBytes);
+  return 0;
+}
+
+//----------------------------------------------------------------------------
+void MhaFramePool::freeArena(size_t arena)
+{
+  Arena& freed = this->arenas[arena];
+  if(freed.slabSize == this->slabSize)
+  {
+    unsigned char* begin = freed.memory;
+    unsigned char* end = freed.memory + freed.size;
+    this->freeSlabs.erase(std::remove_if(this->freeSlabs.begin(), this->freeSlabs.end(),
+      [&](unsigned char* slab) { return slab >= begin && slab < end; }), this->freeSlabs.end());
+  }
+  freeMemory(freed.memory);
+  this->statistics.reservedBytes -= (long long)freed.size;
+  this->statistics.hugePageArenas -= freed.hugePages ? 1 : 0;
+  this->arenas.erase(this->arenas.begin() + arena);
+}
+
+//----------------------------------------------------------------------------
+void MhaFramePool::freeUnusedArenas()
+{
+  for(size_t i = this->arenas.size(); i > 0; i--)
+  {
+    if(this->arenas[i-1].slabsInUse == 0)
+      this->freeArena(i-1);
+  }
+}
+
+//----------------------------------------------------------------------------
+unsigned char* MhaFramePool::acquire()
+{
+  std::lock_guard<std::mutex> lock(this->mutex);
+  if(this->slabSize == 0 || (this->freeSlabs.empty() && this->addArena()))
+    return NULL;
+  unsigned char* slab = this->freeSlabs.back();
+  this->freeSlabs.pop_back();
+  for(size_t i=0; i<this->arenas.size(); i++)
+  {
+    Arena& arena = this->arenas[i];
+    if(slab >= arena.memory && slab < arena.memory + arena.size)
+    {
+      arena.slabsInUse++;
+      break;
+    }
+  }
+  this->statistics.acquisitions++;
+  this->statistics.slabsInUse++;
+  this->statistics.highWaterSlabs = std::max(this->statistics.highWaterSlabs, this->statistics.slabsInUse);
+  return slab;
+}
+
+//----------------------------------------------------------------------------
+void MhaFramePool::release(unsigned char* slab)
+{
+  if(!slab)
+    return;
+  std::lock_guard<std::mutex> lock(this->mutex);
+  for(size_t i=0; i<this->arenas.size(); i++)
+  {
+    Arena& arena = this->arenas[i];
+    if(slab < arena.memory || slab >= arena.memory + arena.size)
+      continue;
+    arena.slabsInUse--;
+    this->statistics.slabsInUse--;
+    if(arena.slabSize == this->slabSize)
+      this->freeSlabs.push_back(slab);
+    else if(arena.slabsInUse == 0)
+      this->freeArena(i);
+    return;
+  }
+}
+
+//----------------------------------------------------------------------------
+void MhaFramePool::trim()
+{
+  std::lock_guard<std::mutex> lock(this->mutex);
+  this->freeUnusedArenas();
+}
+
+//----------------------------------------------------------------------------
+MhaFramePoolStatistics MhaFramePool::getStatistics() const
+{
+  std::lock_guard<std::mutex> lock(this->mutex);
+  MhaFramePoolStatistics statistics = this->statistics;
+  statistics.slabsFree = (int)this->freeSlabs.size();
+  for(size_t i=0; i<this->arenas.size(); i++)
+  {
+    if(this->arenas[i].slabSize == this->slabSize)
+      statistics.frameBytesInUse += (long long)this->arenas[i].slabsInUse*(long long)this->frameSize;
+  }
+  return statistics;
+}
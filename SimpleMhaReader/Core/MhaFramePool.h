@@ -0,0 +1,117 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+// .NAME MhaFramePool - fixed-size aligned frame buffers, reused
+// .SECTION Description
+// Hands out slabs of one size, that of the current frame geometry rounded
+// up to a page (a cache line for tiny frames), carved from arenas that
+// double in size up to 8 MB. Released slabs go to a free list and are
+// handed out again, so frame buffers are allocated from the system only
+// while the working set grows. Opening a file whose frames still fit the
+// slabs with little waste keeps them. Arenas can ask for transparent huge pages, which cuts TLB misses
+// when filters sweep whole frames. Safe to use from several threads.
+
+#ifndef __MhaFramePool_h
+#define __MhaFramePool_h
+
+// STD includes
+#include <cstddef>
+#include <mutex>
+#include <vector>
+
+struct MhaFramePoolStatistics
+{
+  MhaFramePoolStatistics()
+    : frameSize(0), slabSize(0), slabsInUse(0), slabsFree(0), highWaterSlabs(0), frameBytesInUse(0),
+      reservedBytes(0), highWaterBytes(0), acquisitions(0), systemAllocations(0), hugePageArenas(0) {}
+
+  size_t frameSize;
+  size_t slabSize;
+  int slabsInUse;
+  int slabsFree;
+  /// Most slabs in use at once
+  int highWaterSlabs;
+  /// Frame data in slabs of the current geometry
+  long long frameBytesInUse;
+  /// Held from the system, slabs in use or free
+  long long reservedBytes;
+  long long highWaterBytes;
+  unsigned long long acquisitions;
+  /// Arenas allocated, acquisitions that were not served from the free list
+  unsigned long long systemAllocations;
+  /// Arenas the kernel was asked to back with huge pages
+  int hugePageArenas;
+
+  /// Share of reserved memory not holding frames: slab padding, free slabs
+  /// and slabs of an earlier geometry still in use
+  double getFragmentation() const;
+};
+
+class MhaFramePool
+{
+public:
+  MhaFramePool();
+  /// Every slab has to be released before
+  ~MhaFramePool();
+
+  /// Arenas allocated from now on are backed by transparent huge pages
+  /// where the system supports them
+  void setHugePages(bool enabled);
+  bool getHugePages() const { return this->hugePages; }
+
+  /// Slabs acquired from now on hold frameSize bytes. Slabs in use stay
+  /// valid until released; free ones of a geometry that no longer fits are
+  /// returned to the system.
+  void setFrameSize(size_t frameSize);
+  size_t getFrameSize() const { return this->frameSize; }
+
+  /// A slab of getFrameSize() bytes, NULL on failure or while no size is set
+  unsigned char* acquire();
+  void release(unsigned char* slab);
+  /// Returns arenas with no slab in use to the system
+  void trim();
+
+  MhaFramePoolStatistics getStatistics() const;
+
+private:
+  MhaFramePool(const MhaFramePool&); // Not implemented
+  void operator=(const MhaFramePool&); // Not implemented
+
+  struct Arena
+  {
+    unsigned char* memory;
+    size_t size;
+    size_t slabSize;
+    int slabsInUse;
+    bool hugePages;
+  };
+
+  int addArena();
+  void freeArena(size_t arena);
+  void freeUnusedArenas();
+
+  mutable std::mutex mutex;
+  bool hugePages;
+  size_t frameSize;
+  size_t slabSize;
+  std::vector<Arena> arenas;
+  /// Free slabs of the current slab size
+  std::vector<unsigned char*> freeSlabs;
+  MhaFramePoolStatistics statistics;
+};
+
+#endif
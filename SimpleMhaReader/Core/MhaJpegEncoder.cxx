@@ -0,0 +1,319 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+
+#include "MhaJpegEncoder.h"
+
+// STD includes
+#include <algorithm>
+#include <cstring>
+
+namespace
+{
+/// Natural index of each coefficient in zigzag order
+const unsigned char zigzag[64] = {
+  0, 1, 8, 16, 9, 2, 3, 10, 17, 24, 32, 25, 18, 11, 4, 5,
+  12, 19, 26, 33, 40, 48, 41, 34, 27, 20, 13, 6, 7, 14, 21, 28,
+  35, 42, 49, 56, 57, 50, 43, 36, 29, 22, 15, 23, 30, 37, 44, 51,
+  58, 59, 52, 45, 38, 31, 39, 46, 53, 60, 61, 54, 47, 55, 62, 63 };
+
+/// Luminance quantization of Annex K, natural order
+const unsigned char luminanceQuantization[64] = {
+  16, 11, 10, 16, 24, 40, 51, 61,
+  12, 12, 14, 19, 26, 58, 60, 55,
+  14, 13, 16, 24, 40, 57, 69, 56,
+  14, 17, 22, 29, 51, 87, 80, 62,
+  18, 22, 37, 56, 68, 109, 103, 77,
+  24, 35, 55, 64, 81, 104, 113, 92,
+  49, 64, 78, 87, 103, 121, 120, 101,
+  72, 92, 95, 98, 112, 100, 103, 99 };
+
+/// Luminance Huffman tables of Annex K: code counts per length, then symbols
+const unsigned char dcBits[16] = { 0, 1, 5, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0 };
+const unsigned char dcSymbols[12] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11 };
+const unsigned char acBits[16] = { 0, 2, 1, 3, 3, 2, 4, 3, 5, 5, 4, 4, 0, 0, 1, 0x7d };
+const unsigned char acSymbols[162] = {
+  0x01, 0x02, 0x03, 0x00, 0x04, 0x11, 0x05, 0x12, 0x21, 0x31, 0x41, 0x06, 0x13, 0x51, 0x61, 0x07,
+  0x22, 0x71, 0x14, 0x32, 0x81, 0x91, 0xa1, 0x08, 0x23, 0x42, 0xb1, 0xc1, 0x15, 0x52, 0xd1, 0xf0,
+  0x24, 0x33, 0x62, 0x72, 0x82, 0x09, 0x0a, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x25, 0x26, 0x27, 0x28,
+  0x29, 0x2a, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49,
+  0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69,
+  0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89,
+  0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5, 0xa6, 0xa7,
+  0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3, 0xc4, 0xc5,
+  0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda, 0xe1, 0xe2,
+  0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+  0xf9, 0xfa };
+
+/// Code and length of every symbol of a table
+struct HuffmanCodes
+{
+  unsigned short codes[256];
+  unsigned char lengths[256];
+};
+
+void buildHuffmanCodes(const unsigned char bits[16], const unsigned char* symbols, HuffmanCodes& table)
+{
+  memset(&table, 0, sizeof(table));
+  unsigned short code = 0;
+  int k = 0;
+  for(int length=1; length<=16; length++)
+  {
+    for(int i=0; i<bits[length-1]; i++, k++)
+    {
+      table.codes[symbols[k]] = code++;
+      table.lengths[symbols[k]] = (unsigned char)length;
+    }
+    code <<= 1;
+  }
+}
+
+struct HuffmanTables
+{
+  HuffmanTables()
+  {
+    buildHuffmanCodes(dcBits, dcSymbols, this->dc);
+    buildHuffmanCodes(acBits, acSymbols, this->ac);
+  }
+  HuffmanCodes dc;
+  HuffmanCodes ac;
+};
+
+const HuffmanTables& getHuffmanTables()
+{
+  static const HuffmanTables tables;
+  return tables;
+}
+
+/// Entropy coded bits with the 0xFF stuffing of the format
+class BitWriter
+{
+public:
+  explicit BitWriter(std::vector<unsigned char>& output) : output(output), buffer(0), count(0) {}
+
+  void write(unsigned int bits, int length)
+  {
+    this->buffer = (this->buffer << length) | (bits & ((1u << length) - 1));
+    this->count += length;
+    while(this->count >= 8)
+    {
+      unsigned char byte = (unsigned char)(this->buffer >> (this->count - 8));
+      this->output.push_back(byte);
+      if(byte == 0xFF)
+        this->output.push_back(0);
+      this->count -= 8;
+    }
+  }
+
+  /// Pads the last byte with ones
+  void flush()
+  {
+    if(this->count > 0)
+      this->write(0x7F, 8 - this->count);
+  }
+
+private:
+  std::vector<unsigned char>& output;
+  unsigned int buffer;
+  int count;
+};
+
+/// Scaled 8-point DCT of Arai, Agui and Nakajima on every stride-th value;
+/// the scaling is folded into the quantization
+inline void forwardDCT(float* d, int stride)
+{
+  float tmp0 = d[0] + d[7*stride];
+  float tmp7 = d[0] - d[7*stride];
+  float tmp1 = d[stride] + d[6*stride];
+  float tmp6 = d[stride] - d[6*stride];
+  float tmp2 = d[2*stride] + d[5*stride];
+  float tmp5 = d[2*stride] - d[5*stride];
+  float tmp3 = d[3*stride] + d[4*stride];
+  float tmp4 = d[3*stride] - d[4*stride];
+
+  // Even part
+  float tmp10 = tmp0 + tmp3;
+  float tmp13 = tmp0 - tmp3;
+  float tmp11 = tmp1 + tmp2;
+  float tmp12 = tmp1 - tmp2;
+  d[0] = tmp10 + tmp11;
+  d[4*stride] = tmp10 - tmp11;
+  float z1 = (tmp12 + tmp13)*0.707106781f;
+  d[2*stride] = tmp13 + z1;
+  d[6*stride] = tmp13 - z1;
+
+  // Odd part
+  tmp10 = tmp4 + tmp5;
+  tmp11 = tmp5 + tmp6;
+  tmp12 = tmp6 + tmp7;
+  float z5 = (tmp10 - tmp12)*0.382683433f;
+  float z2 = tmp10*0.541196100f + z5;
+  float z4 = tmp12*1.306562965f + z5;
+  float z3 = tmp11*0.707106781f;
+  float z11 = tmp7 + z3;
+  float z13 = tmp7 - z3;
+  d[5*stride] = z13 + z2;
+  d[3*stride] = z13 - z2;
+  d[stride] = z11 + z4;
+  d[7*stride] = z11 - z4;
+}
+
+/// Magnitude category of a coefficient and its bits as the format stores them
+inline int getCategory(int value, unsigned int& bits)
+{
+  int magnitude = value < 0 ? -value : value;
+  int category = 0;
+  while(magnitude >> category)
+    category++;
+  bits = (unsigned int)(value < 0 ? value - 1 : value);
+  return category;
+}
+
+void writeMarker(std::vector<unsigned char>& output, unsigned char marker, int length)
+{
+  output.push_back(0xFF);
+  output.push_back(marker);
+  output.push_back((unsigned char)(length >> 8));
+  output.push_back((unsigned char)(length & 0xFF));
+}
+}
+
+//----------------------------------------------------------------------------
+MhaJpegEncoder::MhaJpegEncoder(int quality)
+{
+  this->setQuality(quality);
+}
+
+//----------------------------------------------------------------------------
+void MhaJpegEncoder::setQuality(int quality)
+{
+  this->quality = std::min(std::max(quality, 1), 100);
+  int scale = this->quality < 50 ? 5000/this->quality : 200 - 2*this->quality;
+  // Scale factors of the AAN DCT outputs, which also carry its factor of 8
+  static const float dctScales[8] = {
+    1.f, 1.387039845f, 1.306562965f, 1.175875602f, 1.f, 0.785694958f, 0.541196100f, 0.275899379f };
+  for(int k=0; k<64; k++)
+  {
+    int natural = zigzag[k];
+    int value = std::min(std::max((luminanceQuantization[natural]*scale + 50)/100, 1), 255);
+    this->quantization[k] = (unsigned char)value;
+    this->scales[natural] = 1.f/(value*dctScales[natural/8]*dctScales[natural%8]*8.f);
+  }
+}
+
+//----------------------------------------------------------------------------
+int MhaJpegEncoder::encode(const unsigned char* pixels, int width, int height, std::vector<unsigned char>& jpeg)
+{
+  jpeg.clear();
+  if(!pixels || width <= 0 || height <= 0 || width > 65535 || height > 65535)
+    return 1;
+  const HuffmanTables& huffman = getHuffmanTables();
+  // Most frames compress to a fraction of their size
+  jpeg.reserve((size_t)width*(size_t)height/4 + 1024);
+
+  static const unsigned char jfif[14] = { 'J', 'F', 'I', 'F', 0, 1, 1, 0, 0, 1, 0, 1, 0, 0 };
+  jpeg.push_back(0xFF);
+  jpeg.push_back(0xD8);
+  writeMarker(jpeg, 0xE0, 2 + sizeof(jfif));
+  jpeg.insert(jpeg.end(), jfif, jfif + sizeof(jfif));
+  writeMarker(jpeg, 0xDB, 2 + 1 + 64);
+  jpeg.push_back(0);
+  jpeg.insert(jpeg.end(), this->quantization, this->quantization + 64);
+  writeMarker(jpeg, 0xC0, 2 + 6 + 3);
+  const unsigned char frameHeader[9] = { 8, (unsigned char)(height >> 8), (unsigned char)(height & 0xFF),
+    (unsigned char)(width >> 8), (unsigned char)(width & 0xFF), 1, 1, 0x11, 0 };
+  jpeg.insert(jpeg.end(), frameHeader, frameHeader + 9);
+  writeMarker(jpeg, 0xC4, 2 + 1 + 16 + sizeof(dcSymbols) + 1 + 16 + sizeof(acSymbols));
+  jpeg.push_back(0x00);
+  jpeg.insert(jpeg.end(), dcBits, dcBits + 16);
+  jpeg.insert(jpeg.end(), dcSymbols, dcSymbols + sizeof(dcSymbols));
+  jpeg.push_back(0x10);
+  jpeg.insert(jpeg.end(), acBits, acBits + 16);
+  jpeg.insert(jpeg.end(), acSymbols, acSymbols + sizeof(acSymbols));
+  writeMarker(jpeg, 0xDA, 2 + 1 + 2 + 3);
+  const unsigned char scanHeader[6] = { 1, 1, 0x00, 0, 63, 0 };
+  jpeg.insert(jpeg.end(), scanHeader, scanHeader + 6);
+
+  BitWriter bits(jpeg);
+  float block[64];
+  int previousDC = 0;
+  for(int blockY=0; blockY<height; blockY+=8)
+  {
+    for(int blockX=0; blockX<width; blockX+=8)
+    {
+      // Blocks over the right and bottom edges repeat the last column and row
+      for(int y=0; y<8; y++)
+      {
+        const unsigned char* row = pixels + (size_t)std::min(blockY + y, height - 1)*(size_t)width;
+        if(blockX + 8 <= width)
+        {
+          for(int x=0; x<8; x++)
+            block[8*y + x] = (float)row[blockX + x] - 128.f;
+        }
+        else
+        {
+          for(int x=0; x<8; x++)
+            block[8*y + x] = (float)row[std::min(blockX + x, width - 1)] - 128.f;
+        }
+      }
+      for(int i=0; i<8; i++)
+        forwardDCT(block + 8*i, 1);
+      for(int i=0; i<8; i++)
+        forwardDCT(block + i, 8);
+
+      int coefficients[64];
+      for(int k=0; k<64; k++)
+      {
+        float value = block[zigzag[k]]*this->scales[zigzag[k]];
+        coefficients[k] = (int)(value < 0.f ? value - 0.5f : value + 0.5f);
+      }
+      // The AC table has no code past category 10, reached at quality 100
+      for(int k=1; k<64; k++)
+        coefficients[k] = std::min(std::max(coefficients[k], -1023), 1023);
+
+      unsigned int valueBits;
+      int category = getCategory(coefficients[0] - previousDC, valueBits);
+      previousDC = coefficients[0];
+      bits.write(huffman.dc.codes[category], huffman.dc.lengths[category]);
+      if(category)
+        bits.write(valueBits, category);
+
+      int run = 0;
+      for(int k=1; k<64; k++)
+      {
+        if(coefficients[k] == 0)
+        {
+          run++;
+          continue;
+        }
+        for(; run >= 16; run -= 16)
+          bits.write(huffman.ac.codes[0xF0], huffman.ac.lengths[0xF0]);
+        category = getCategory(coefficients[k], valueBits);
+        int symbol = (run << 4) | category;
+        bits.write(huffman.ac.codes[symbol], huffman.ac.lengths[symbol]);
+        bits.write(valueBits, category);
+        run = 0;
+      }
+      if(run > 0)
+        bits.write(huffman.ac.codes[0x00], huffman.ac.lengths[0x00]);
+    }
+  }
+  bits.flush();
+  jpeg.push_back(0xFF);
+  jpeg.push_back(0xD9);
+  return 0;
+}
@@ -0,0 +1,51 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+
+// .NAME MhaJpegEncoder - baseline JPEG encoding of 8-bit frames
+// .SECTION Description
+// Writes grayscale baseline JFIF images with the example tables of the
+// JPEG specification, the quantization scaled by a quality from 1 to 100
+// as libjpeg scales it. An encoder keeps its tables and is meant to be
+// used by one thread; parallel encoding uses one encoder per thread.
+
+#ifndef __MhaJpegEncoder_h
+#define __MhaJpegEncoder_h
+
+// STD includes
+#include <vector>
+
+class MhaJpegEncoder
+{
+public:
+  explicit MhaJpegEncoder(int quality = 85);
+
+  void setQuality(int quality);
+  int getQuality() const { return this->quality; }
+
+  /// Replaces jpeg with the encoded frame, 1 if the size is not encodable
+  int encode(const unsigned char* pixels, int width, int height, std::vector<unsigned char>& jpeg);
+
+private:
+  int quality;
+  /// Quantization in zigzag order, as written in the file
+  unsigned char quantization[64];
+  /// Reciprocal quantization with the scaling of the DCT, natural order
+  float scales[64];
+};
+
+#endif
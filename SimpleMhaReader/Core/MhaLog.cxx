@@ -0,0 +1,142 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+#include "MhaLog.h"
+
+// STD includes
+#include <cstring>
+
+//----------------------------------------------------------------------------
+MhaLog::MhaLog(int capacity)
+{
+  unsigned long long size = 1;
+  while(size < (unsigned long long)(capacity > 1 ? capacity : 1))
+    size *= 2;
+  this->slots = new Slot[size];
+  for(unsigned long long i = 0; i < size; i++)
+    this->slots[i].sequence.store(i, std::memory_order_relaxed);
+  this->mask = size - 1;
+  this->writePosition.store(0);
+  this->readPosition = 0;
+  this->level.store(MhaLogInfo);
+  this->rateLimit.store(100);
+  this->rateSecond.store(-1);
+  this->rateCount.store(0);
+  this->dropped.store(0);
+  this->startTime = std::chrono::steady_clock::now();
+}
+
+//----------------------------------------------------------------------------
+MhaLog::~MhaLog()
+{
+  delete[] this->slots;
+}
+
+//----------------------------------------------------------------------------
+const char* MhaLog::getLevelName(MhaLogLevel level)
+{
+  switch(level)
+  {
+    case MhaLogDebug: return "debug";
+    case MhaLogInfo: return "info";
+    case MhaLogWarning: return "warning";
+    default: return "error";
+  }
+}
+
+//----------------------------------------------------------------------------
+bool MhaLog::isRateLimited(double time)
+{
+  int limit = this->rateLimit.load(std::memory_order_relaxed);
+  if(limit <= 0)
+    return false;
+  // One window per second; writers racing at a window change may let a
+  // few extra messages through
+  long long second = (long long)time;
+  long long current = this->rateSecond.load(std::memory_order_relaxed);
+  if(second != current && this->rateSecond.compare_exchange_strong(current, second))
+    this->rateCount.store(0, std::memory_order_relaxed);
+  return this->rateCount.fetch_add(1, std::memory_order_relaxed) >= limit;
+}
+
+//----------------------------------------------------------------------------
+bool MhaLog::write(MhaLogLevel level, const std::string& message)
+{
+  if(level < this->level.load(std::memory_order_relaxed))
+    return false;
+  double time = std::chrono::duration<double>(std::chrono::steady_clock::now() - this->startTime).count();
+  if(level < MhaLogError && this->isRateLimited(time))
+  {
+    this->dropped.fetch_add(1, std::memory_order_relaxed);
+    return false;
+  }
+
+  // Claims a position whose slot has been drained
+  unsigned long long position = this->writePosition.load(std::memory_order_relaxed);
+  Slot* slot;
+  for(;;)
+  {
+    slot = &this->slots[position & this->mask];
+    unsigned long long sequence = slot->sequence.load(std::memory_order_acquire);
+    if(sequence == position)
+    {
+      if(this->writePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+        break;
+    }
+    else if(sequence < position)
+    {
+      this->dropped.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+    else
+      position = this->writePosition.load(std::memory_order_relaxed);
+  }
+
+  size_t length = message.size();
+  if(length > 0 && message[length - 1] == '\n')
+    length--;
+  if(length > MessageSize - 1)
+    length = MessageSize - 1;
+  memcpy(slot->message, message.data(), length);
+  slot->message[length] = '\0';
+  slot->level = level;
+  slot->time = time;
+  slot->sequence.store(position + 1, std::memory_order_release);
+  return true;
+}
+
+//----------------------------------------------------------------------------
+int MhaLog::drain(std::vector<MhaLogEntry>& entries, int maximumEntries)
+{
+  int count = 0;
+  while(maximumEntries < 0 || count < maximumEntries)
+  {
+    Slot& slot = this->slots[this->readPosition & this->mask];
+    if(slot.sequence.load(std::memory_order_acquire) != this->readPosition + 1)
+      break;
+    MhaLogEntry entry;
+    entry.level = slot.level;
+    entry.time = slot.time;
+    entry.message = slot.message;
+    entries.push_back(entry);
+    // Hands the slot to the writer of the next lap
+    slot.sequence.store(this->readPosition + this->mask + 1, std::memory_order_release);
+    this->readPosition++;
+    count++;
+  }
+  return count;
+}
@@ -0,0 +1,99 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+// .NAME MhaLog - bounded log channel writable from any thread
+// .SECTION Description
+// Messages go into a fixed ring of slots without locks or allocation, so
+// that worker threads and the frame loop can log as freely as the UI. A
+// single consumer, typically a UI timer, drains the ring. Messages below
+// the level threshold are dropped, and below MhaLogError at most
+// rateLimit messages per second are kept; when the ring is full new
+// messages are dropped. Dropped messages are counted.
+
+#ifndef __MhaLog_h
+#define __MhaLog_h
+
+// STD includes
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <vector>
+
+enum MhaLogLevel { MhaLogDebug, MhaLogInfo, MhaLogWarning, MhaLogError };
+
+struct MhaLogEntry
+{
+  MhaLogLevel level;
+  /// Seconds since the log was created
+  double time;
+  std::string message;
+};
+
+class MhaLog
+{
+public:
+  /// capacity is rounded up to a power of two
+  explicit MhaLog(int capacity = 1024);
+  ~MhaLog();
+
+  /// Any thread. Messages longer than a slot are truncated, a trailing
+  /// newline is removed. Returns false when the message was dropped.
+  bool write(MhaLogLevel level, const std::string& message);
+
+  /// Consumer thread only: appends at most maximumEntries (all if negative)
+  /// messages in the order they were written, returns their number
+  int drain(std::vector<MhaLogEntry>& entries, int maximumEntries = -1);
+
+  void setLevel(MhaLogLevel level) { this->level = level; }
+  MhaLogLevel getLevel() const { return this->level; }
+  /// Messages per second below MhaLogError, 0 for no limit
+  void setRateLimit(int messagesPerSecond) { this->rateLimit = messagesPerSecond; }
+  /// Messages dropped (full ring or rate limit) since the previous call
+  long long takeNumberOfDropped() { return this->dropped.exchange(0); }
+
+  static const char* getLevelName(MhaLogLevel level);
+
+private:
+  MhaLog(const MhaLog&); // Not implemented
+  void operator=(const MhaLog&); // Not implemented
+
+  enum { MessageSize = 256 };
+  /// A slot is free for the writer of position p when sequence == p, and
+  /// holds the message of position p once sequence == p + 1
+  struct Slot
+  {
+    std::atomic<unsigned long long> sequence;
+    MhaLogLevel level;
+    double time;
+    char message[MessageSize];
+  };
+
+  bool isRateLimited(double time);
+
+  Slot* slots;
+  unsigned long long mask;
+  std::atomic<unsigned long long> writePosition;
+  unsigned long long readPosition;
+  std::atomic<MhaLogLevel> level;
+  std::atomic<int> rateLimit;
+  std::atomic<long long> rateSecond;
+  std::atomic<int> rateCount;
+  std::atomic<long long> dropped;
+  std::chrono::steady_clock::time_point startTime;
+};
+
+#endif
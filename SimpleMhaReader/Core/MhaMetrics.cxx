@@ -0,0 +1,171 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+#include "MhaMetrics.h"
+
+//----------------------------------------------------------------------------
+MhaMetrics::MhaMetrics(int maximumTimers)
+{
+  this->maximumTimers = maximumTimers > 0 ? maximumTimers : 1;
+  this->timers = new Timer[this->maximumTimers];
+  for(int i = 0; i < this->maximumTimers; i++)
+  {
+    this->timers[i].count.store(0);
+    this->timers[i].total.store(0);
+    this->timers[i].maximum.store(0);
+    this->timers[i].last.store(0);
+  }
+  this->numberOfTimers.store(0);
+  this->accounts = new MemoryAccount[this->maximumTimers];
+  for(int i = 0; i < this->maximumTimers; i++)
+  {
+    this->accounts[i].bytes.store(0);
+    this->accounts[i].peak.store(0);
+  }
+  this->numberOfAccounts.store(0);
+  this->totalMemory.store(0);
+  this->peakTotalMemory.store(0);
+  this->memorySoftLimit.store(0);
+}
+
+//----------------------------------------------------------------------------
+MhaMetrics::~MhaMetrics()
+{
+  delete[] this->timers;
+  delete[] this->accounts;
+}
+
+//----------------------------------------------------------------------------
+int MhaMetrics::getTimer(const std::string& name)
+{
+  std::lock_guard<std::mutex> lock(this->namesMutex);
+  for(size_t i = 0; i < this->names.size(); i++)
+    if(this->names[i] == name)
+      return (int)i;
+  if((int)this->names.size() >= this->maximumTimers)
+    return -1;
+  this->names.push_back(name);
+  this->numberOfTimers.store((int)this->names.size(), std::memory_order_release);
+  return (int)this->names.size() - 1;
+}
+
+//----------------------------------------------------------------------------
+void MhaMetrics::record(int timer, double milliseconds)
+{
+  if(timer < 0 || timer >= this->numberOfTimers.load(std::memory_order_acquire))
+    return;
+  Timer& target = this->timers[timer];
+  long long nanoseconds = (long long)(milliseconds*1e6);
+  target.count.fetch_add(1, std::memory_order_relaxed);
+  target.total.fetch_add(nanoseconds, std::memory_order_relaxed);
+  target.last.store(nanoseconds, std::memory_order_relaxed);
+  long long maximum = target.maximum.load(std::memory_order_relaxed);
+  while(nanoseconds > maximum && !target.maximum.compare_exchange_weak(maximum, nanoseconds, std::memory_order_relaxed))
+    ;
+}
+
+//----------------------------------------------------------------------------
+void MhaMetrics::getSummaries(std::vector<MhaTimerSummary>& summaries, bool reset)
+{
+  summaries.clear();
+  std::lock_guard<std::mutex> lock(this->namesMutex);
+  for(size_t i = 0; i < this->names.size(); i++)
+  {
+    Timer& timer = this->timers[i];
+    long long count = reset ? timer.count.exchange(0) : timer.count.load();
+    long long total = reset ? timer.total.exchange(0) : timer.total.load();
+    long long maximum = reset ? timer.maximum.exchange(0) : timer.maximum.load();
+    if(count <= 0)
+      continue;
+    MhaTimerSummary summary;
+    summary.name = this->names[i];
+    summary.count = count;
+    summary.lastMilliseconds = 1e-6*timer.last.load();
+    summary.meanMilliseconds = 1e-6*total/count;
+    summary.maximumMilliseconds = 1e-6*maximum;
+    summaries.push_back(summary);
+  }
+}
+
+//----------------------------------------------------------------------------
+int MhaMetrics::getMemoryAccount(const std::string& name)
+{
+  std::lock_guard<std::mutex> lock(this->namesMutex);
+  for(size_t i = 0; i < this->accountNames.size(); i++)
+    if(this->accountNames[i] == name)
+      return (int)i;
+  if((int)this->accountNames.size() >= this->maximumTimers)
+    return -1;
+  this->accountNames.push_back(name);
+  this->numberOfAccounts.store((int)this->accountNames.size(), std::memory_order_release);
+  return (int)this->accountNames.size() - 1;
+}
+
+//----------------------------------------------------------------------------
+void MhaMetrics::setMemory(int account, long long bytes)
+{
+  if(account < 0 || account >= this->numberOfAccounts.load(std::memory_order_acquire))
+    return;
+  MemoryAccount& target = this->accounts[account];
+  long long previous = target.bytes.exchange(bytes, std::memory_order_relaxed);
+  long long total = this->totalMemory.fetch_add(bytes - previous, std::memory_order_relaxed) + bytes - previous;
+  long long peak = target.peak.load(std::memory_order_relaxed);
+  while(bytes > peak && !target.peak.compare_exchange_weak(peak, bytes, std::memory_order_relaxed))
+    ;
+  peak = this->peakTotalMemory.load(std::memory_order_relaxed);
+  while(total > peak && !this->peakTotalMemory.compare_exchange_weak(peak, total, std::memory_order_relaxed))
+    ;
+}
+
+//----------------------------------------------------------------------------
+void MhaMetrics::getMemorySummaries(std::vector<MhaMemorySummary>& summaries)
+{
+  summaries.clear();
+  std::lock_guard<std::mutex> lock(this->namesMutex);
+  for(size_t i = 0; i < this->accountNames.size(); i++)
+  {
+    MhaMemorySummary summary;
+    summary.name = this->accountNames[i];
+    summary.bytes = this->accounts[i].bytes.load();
+    summary.peakBytes = this->accounts[i].peak.load();
+    summaries.push_back(summary);
+  }
+}
+
+//----------------------------------------------------------------------------
+void MhaMetrics::addMemoryEvictor(const std::function<void()>& evictor)
+{
+  std::lock_guard<std::mutex> lock(this->namesMutex);
+  this->evictors.push_back(evictor);
+}
+
+//----------------------------------------------------------------------------
+int MhaMetrics::enforceMemoryLimit()
+{
+  long long limit = this->memorySoftLimit.load();
+  if(limit <= 0 || this->totalMemory.load() <= limit)
+    return 0;
+  std::vector<std::function<void()> > evictors;
+  {
+    std::lock_guard<std::mutex> lock(this->namesMutex);
+    evictors = this->evictors;
+  }
+  int count = 0;
+  for(size_t i = 0; i < evictors.size() && this->totalMemory.load() > limit; i++, count++)
+    evictors[i]();
+  return count;
+}
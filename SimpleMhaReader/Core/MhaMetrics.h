@@ -0,0 +1,127 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+// .NAME MhaMetrics - named timings and memory use recorded from any thread
+// .SECTION Description
+// Timers are registered once by name and then fed without locks, which
+// keeps per-frame measurements (read, filter, publish) out of the log.
+// Each timer keeps its number of samples, their total, the maximum and the
+// last one since it was last reset.
+// Memory accounts are registered the same way; each subsystem sets the
+// bytes it holds and the account keeps its peak. Over a soft limit, the
+// evictors added by the owner of the caches free memory in their order.
+
+#ifndef __MhaMetrics_h
+#define __MhaMetrics_h
+
+// STD includes
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+struct MhaTimerSummary
+{
+  std::string name;
+  long long count;
+  double lastMilliseconds;
+  double meanMilliseconds;
+  double maximumMilliseconds;
+};
+
+struct MhaMemorySummary
+{
+  std::string name;
+  long long bytes;
+  long long peakBytes;
+};
+
+class MhaMetrics
+{
+public:
+  /// maximumTimers is the number of timer names that can be registered,
+  /// and of memory account names
+  explicit MhaMetrics(int maximumTimers = 64);
+  ~MhaMetrics();
+
+  /// Identifier of the named timer, registering it on first use; -1 once
+  /// all timers are taken. Takes a lock, call it once and keep the result.
+  int getTimer(const std::string& name);
+  /// Any thread, lock free; ignores negative timers
+  void record(int timer, double milliseconds);
+
+  /// Timers with samples, in registration order. reset starts new counts;
+  /// samples recorded while it runs may be lost.
+  void getSummaries(std::vector<MhaTimerSummary>& summaries, bool reset = false);
+
+  /// Identifier of the named memory account, registering it on first use;
+  /// -1 once all accounts are taken. Takes a lock like getTimer().
+  int getMemoryAccount(const std::string& name);
+  /// Any thread, lock free: the bytes the account holds now. The peak of
+  /// the total is exact while each account is set by one thread at a time.
+  void setMemory(int account, long long bytes);
+  /// Accounts in registration order with their current and peak bytes
+  void getMemorySummaries(std::vector<MhaMemorySummary>& summaries);
+  long long getTotalMemory() const { return this->totalMemory.load(); }
+  long long getPeakTotalMemory() const { return this->peakTotalMemory.load(); }
+
+  /// Bytes over which enforceMemoryLimit() evicts, 0 for no limit
+  void setMemorySoftLimit(long long bytes) { this->memorySoftLimit.store(bytes > 0 ? bytes : 0); }
+  long long getMemorySoftLimit() const { return this->memorySoftLimit.load(); }
+  /// Evictors free what they can and set their accounts; they run in the
+  /// order they were added, the caches cheapest to rebuild first
+  void addMemoryEvictor(const std::function<void()>& evictor);
+  /// Runs evictors on the calling thread, which should own the caches,
+  /// until the total is under the soft limit. Returns the number that ran.
+  int enforceMemoryLimit();
+
+private:
+  MhaMetrics(const MhaMetrics&); // Not implemented
+  void operator=(const MhaMetrics&); // Not implemented
+
+  /// Durations are kept in nanoseconds to stay integral
+  struct Timer
+  {
+    std::atomic<long long> count;
+    std::atomic<long long> total;
+    std::atomic<long long> maximum;
+    std::atomic<long long> last;
+  };
+
+  struct MemoryAccount
+  {
+    std::atomic<long long> bytes;
+    std::atomic<long long> peak;
+  };
+
+  std::mutex namesMutex;
+  std::vector<std::string> names;
+  Timer* timers;
+  int maximumTimers;
+  std::atomic<int> numberOfTimers;
+
+  std::vector<std::string> accountNames;
+  MemoryAccount* accounts;
+  std::atomic<int> numberOfAccounts;
+  std::atomic<long long> totalMemory;
+  std::atomic<long long> peakTotalMemory;
+  std::atomic<long long> memorySoftLimit;
+  std::vector<std::function<void()> > evictors;
+};
+
+#endif
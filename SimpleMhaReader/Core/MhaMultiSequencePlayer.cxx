@@ -0,0 +1,270 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+#include "MhaMultiSequencePlayer.h"
+
+// STD includes
+#include <algorithm>
+#include <cmath>
+
+//----------------------------------------------------------------------------
+MhaMultiSequencePlayer::MhaMultiSequencePlayer()
+{
+  this->defaultFrameRate = 30.;
+  this->startTime = 0.;
+  this->endTime = 0.;
+  this->time = 0.;
+  this->stopping = false;
+  this->maximumConcurrentReads = 2;
+  this->readsRunning = 0;
+  this->nextReader = 0;
+}
+
+//----------------------------------------------------------------------------
+MhaMultiSequencePlayer::~MhaMultiSequencePlayer()
+{
+  this->close();
+}
+
+//----------------------------------------------------------------------------
+void MhaMultiSequencePlayer::close()
+{
+  {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->stopping = true;
+  }
+  this->requested.notify_all();
+  for(size_t i = 0; i < this->sequences.size(); i++)
+    if(this->sequences[i]->loader.joinable())
+      this->sequences[i]->loader.join();
+  this->sequences.clear();
+  this->waitingReaders.clear();
+  this->stopping = false;
+  this->startTime = 0.;
+  this->endTime = 0.;
+  this->time = 0.;
+}
+
+//----------------------------------------------------------------------------
+int MhaMultiSequencePlayer::open(const std::vector<std::string>& paths)
+{
+  this->close();
+  for(size_t i = 0; i < paths.size(); i++)
+  {
+    std::unique_ptr<Sequence> sequence(new Sequence);
+    if(sequence->reader.open(paths[i]) || sequence->reader.getNumberOfFrames() <= 0)
+    {
+      this->sequences.clear();
+      return 1;
+    }
+    int numberOfFrames = sequence->reader.getNumberOfFrames();
+    const MhaChunkedArray<double>& timestamps = sequence->reader.getTransformTable().timestamps;
+    bool timed = (int)timestamps.size() == numberOfFrames;
+    for(int frame = 0; timed && frame < numberOfFrames; frame++)
+      timed = !std::isnan(timestamps[frame]) && (frame == 0 || timestamps[frame] >= timestamps[frame - 1]);
+    sequence->times.resize(numberOfFrames);
+    for(int frame = 0; frame < numberOfFrames; frame++)
+      sequence->times[frame] = timed ? timestamps[frame] : frame/this->defaultFrameRate;
+    sequence->requestedFrame = -1;
+    sequence->loadingFrame = -1;
+    sequence->loadedFrame = -1;
+    sequence->readyFrame = -1;
+    sequence->dropped = 0;
+    sequence->loaded = 0;
+    sequence->ready.resize(sequence->reader.getFrameSize());
+    sequence->spare.resize(sequence->reader.getFrameSize());
+    this->sequences.push_back(std::move(sequence));
+  }
+  if(this->sequences.empty())
+    return 0;
+
+  this->startTime = this->sequences[0]->times.front();
+  this->endTime = this->sequences[0]->times.back();
+  for(size_t i = 1; i < this->sequences.size(); i++)
+  {
+    this->startTime = std::min(this->startTime, this->sequences[i]->times.front());
+    this->endTime = std::max(this->endTime, this->sequences[i]->times.back());
+  }
+  this->waitingReaders.assign(this->sequences.size(), false);
+  this->nextReader = 0;
+  for(size_t i = 0; i < this->sequences.size(); i++)
+    this->sequences[i]->loader = std::thread(&MhaMultiSequencePlayer::loaderLoop, this, (int)i);
+  this->setTime(this->startTime);
+  return 0;
+}
+
+//----------------------------------------------------------------------------
+std::shared_ptr<const MhaSequenceIndex> MhaMultiSequencePlayer::getIndex(int sequence) const
+{
+  if(sequence < 0 || sequence >= (int)this->sequences.size())
+    return std::shared_ptr<const MhaSequenceIndex>();
+  return this->sequences[sequence]->reader.getIndex();
+}
+
+//----------------------------------------------------------------------------
+void MhaMultiSequencePlayer::setMaximumConcurrentReads(int reads)
+{
+  std::lock_guard<std::mutex> lock(this->readMutex);
+  this->maximumConcurrentReads = std::max(reads, 1);
+  this->readTurn.notify_all();
+}
+
+//----------------------------------------------------------------------------
+int MhaMultiSequencePlayer::getFrameAtTime(int sequence, double time) const
+{
+  if(sequence < 0 || sequence >= (int)this->sequences.size())
+    return -1;
+  const std::vector<double>& times = this->sequences[sequence]->times;
+  return (int)(std::upper_bound(times.begin(), times.end(), time) - times.begin()) - 1;
+}
+
+//----------------------------------------------------------------------------
+void MhaMultiSequencePlayer::setTime(double time)
+{
+  this->time = time;
+  {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    for(size_t i = 0; i < this->sequences.size(); i++)
+    {
+      Sequence& sequence = *this->sequences[i];
+      int frame = this->getFrameAtTime((int)i, time);
+      if(frame < 0 || frame == sequence.requestedFrame)
+        continue;
+      // A request that was neither read nor started is superseded; a frame
+      // read and already taken is not ready any more, but was not dropped
+      if(sequence.requestedFrame >= 0 && sequence.requestedFrame != sequence.loadingFrame &&
+        sequence.requestedFrame != sequence.loadedFrame)
+        sequence.dropped++;
+      sequence.requestedFrame = frame;
+    }
+  }
+  this->requested.notify_all();
+}
+
+//----------------------------------------------------------------------------
+int MhaMultiSequencePlayer::takeFrame(int sequence, std::vector<unsigned char>& pixels)
+{
+  if(sequence < 0 || sequence >= (int)this->sequences.size())
+    return -1;
+  std::lock_guard<std::mutex> lock(this->mutex);
+  Sequence& target = *this->sequences[sequence];
+  int frame = target.readyFrame;
+  if(frame < 0)
+    return -1;
+  pixels.swap(target.ready);
+  target.readyFrame = -1;
+  return frame;
+}
+
+//----------------------------------------------------------------------------
+long long MhaMultiSequencePlayer::getNumberOfDroppedFrames(int sequence) const
+{
+  std::lock_guard<std::mutex> lock(this->mutex);
+  return sequence >= 0 && sequence < (int)this->sequences.size() ? this->sequences[sequence]->dropped : 0;
+}
+
+//----------------------------------------------------------------------------
+long long MhaMultiSequencePlayer::getNumberOfLoadedFrames(int sequence) const
+{
+  std::lock_guard<std::mutex> lock(this->mutex);
+  return sequence >= 0 && sequence < (int)this->sequences.size() ? this->sequences[sequence]->loaded : 0;
+}
+
+//----------------------------------------------------------------------------
+void MhaMultiSequencePlayer::beginRead(int sequence)
+{
+  std::unique_lock<std::mutex> lock(this->readMutex);
+  this->waitingReaders[sequence] = true;
+  int count = (int)this->waitingReaders.size();
+  for(;;)
+  {
+    if(this->readsRunning < this->maximumConcurrentReads)
+    {
+      // First waiting sequence from nextReader on, round robin
+      int turn = this->nextReader;
+      while(!this->waitingReaders[turn])
+        turn = (turn + 1) % count;
+      if(turn == sequence)
+        break;
+    }
+    this->readTurn.wait(lock);
+  }
+  this->waitingReaders[sequence] = false;
+  this->readsRunning++;
+  this->nextReader = (sequence + 1) % count;
+  // Another sequence may be in turn with a read still free
+  this->readTurn.notify_all();
+}
+
+//----------------------------------------------------------------------------
+void MhaMultiSequencePlayer::endRead()
+{
+  {
+    std::lock_guard<std::mutex> lock(this->readMutex);
+    this->readsRunning--;
+  }
+  this->readTurn.notify_all();
+}
+
+//----------------------------------------------------------------------------
+void MhaMultiSequencePlayer::loaderLoop(int index)
+{
+  Sequence& sequence = *this->sequences[index];
+  std::unique_lock<std::mutex> lock(this->mutex);
+  for(;;)
+  {
+    while(!this->stopping && (sequence.requestedFrame < 0 || sequence.requestedFrame == sequence.loadedFrame))
+      this->requested.wait(lock);
+    if(this->stopping)
+      return;
+    int frame = sequence.requestedFrame;
+    sequence.loadingFrame = frame;
+    lock.unlock();
+
+    this->beginRead(index);
+    int failed = sequence.reader.readFrame(frame, &sequence.spare[0]);
+    this->endRead();
+
+    lock.lock();
+    sequence.loadingFrame = -1;
+    sequence.loadedFrame = frame;
+    if(failed)
+      continue;
+    // A frame not taken yet is replaced by the newer one
+    if(sequence.readyFrame >= 0)
+      sequence.dropped++;
+    sequence.ready.swap(sequence.spare);
+    // takeFrame() hands back buffers of any size
+    sequence.spare.resize(sequence.ready.size());
+    sequence.readyFrame = frame;
+    sequence.loaded++;
+  }
+}
+
+//----------------------------------------------------------------------------
+size_t MhaMultiSequencePlayer::getMemorySize() const
+{
+  std::lock_guard<std::mutex> lock(this->mutex);
+  size_t size = 0;
+  for(size_t i=0; i<this->sequences.size(); i++)
+  {
+    const Sequence& sequence = *this->sequences[i];
+    size += sequence.ready.capacity() + sequence.spare.capacity() + sequence.times.capacity()*sizeof(double)
+      + sequence.reader.getIndex()->getMemorySize();
+  }
+  return size;
+}
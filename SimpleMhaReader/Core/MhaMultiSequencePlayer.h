@@ -0,0 +1,127 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+// .NAME MhaMultiSequencePlayer - plays sequences recorded together from one clock
+// .SECTION Description
+// Sequences are aligned on the Timestamp fields of their frames (sequences
+// without them run at a default frame rate from time 0). setTime() moves
+// the shared clock, and every sequence then loads the last frame at or
+// before that time on its own thread, with its own readahead. Loaders only
+// ever go for the newest requested frame: a sequence that cannot keep up
+// skips frames instead of holding the others back. Reads of all sequences
+// go through one scheduler that lets a bounded number run at once and
+// serves waiting sequences in turn, so that they share the bandwidth.
+
+#ifndef __MhaMultiSequencePlayer_h
+#define __MhaMultiSequencePlayer_h
+
+// STD includes
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "MhaSequenceReader.h"
+
+class MhaMultiSequencePlayer
+{
+public:
+  MhaMultiSequencePlayer();
+  ~MhaMultiSequencePlayer();
+
+  /// Opens the sequences in place of the current ones, 1 if one of them
+  /// cannot be read (then none is open)
+  int open(const std::vector<std::string>& paths);
+  void close();
+  int getNumberOfSequences() const { return (int)this->sequences.size(); }
+  std::shared_ptr<const MhaSequenceIndex> getIndex(int sequence) const;
+
+  /// Heap bytes of the indexes and the loaded and spare frames of every sequence
+  size_t getMemorySize() const;
+
+  /// Frames per second of sequences without timestamps, taken at open()
+  void setDefaultFrameRate(double framesPerSecond) { this->defaultFrameRate = framesPerSecond; }
+  /// Reads running at once over all sequences, at least 1
+  void setMaximumConcurrentReads(int reads);
+
+  /// Span of the clock over all sequences
+  double getStartTime() const { return this->startTime; }
+  double getEndTime() const { return this->endTime; }
+  /// Moves the clock; sequences load their frame at that time in the background
+  void setTime(double time);
+  double getTime() const { return this->time; }
+  /// Last frame of sequence at or before time, -1 before its first frame
+  int getFrameAtTime(int sequence, double time) const;
+
+  /// Swaps the newest loaded frame of sequence into pixels and returns its
+  /// number, -1 if no frame was loaded since the previous call. The previous
+  /// content of pixels is reused by the loader.
+  int takeFrame(int sequence, std::vector<unsigned char>& pixels);
+  /// Requested frames replaced by a newer request before they were read
+  long long getNumberOfDroppedFrames(int sequence) const;
+  long long getNumberOfLoadedFrames(int sequence) const;
+
+private:
+  MhaMultiSequencePlayer(const MhaMultiSequencePlayer&); // Not implemented
+  void operator=(const MhaMultiSequencePlayer&); // Not implemented
+
+  struct Sequence
+  {
+    MhaSequenceReader reader;
+    /// Clock time of every frame, increasing
+    std::vector<double> times;
+    std::thread loader;
+    /// Frame the clock is on, and the one being read (-1 when idle)
+    int requestedFrame;
+    int loadingFrame;
+    /// Frame read last, taken or not, -1 before the first read
+    int loadedFrame;
+    /// Frame in ready, -1 when it was taken
+    int readyFrame;
+    std::vector<unsigned char> ready;
+    std::vector<unsigned char> spare;
+    long long dropped;
+    long long loaded;
+  };
+
+  void loaderLoop(int sequence);
+  /// Fair share of the reads: blocks until it is the turn of sequence
+  void beginRead(int sequence);
+  void endRead();
+
+  std::vector<std::unique_ptr<Sequence> > sequences;
+  double defaultFrameRate;
+  double startTime;
+  double endTime;
+  double time;
+  bool stopping;
+  /// Guards the request and ready state of every sequence
+  mutable std::mutex mutex;
+  std::condition_variable requested;
+
+  std::mutex readMutex;
+  std::condition_variable readTurn;
+  int maximumConcurrentReads;
+  int readsRunning;
+  /// Next sequence in turn, and the ones waiting to read
+  int nextReader;
+  std::vector<bool> waitingReaders;
+};
+
+#endif
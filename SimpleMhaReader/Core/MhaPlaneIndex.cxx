@@ -0,0 +1,403 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+#include "MhaPlaneIndex.h"
+#include "MhaPoseTrack.h"
+
+// STD includes
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace
+{
+// Rectangles per leaf
+const int leafSize = 4;
+
+double dot(const double* a, const double* b)
+{
+  return a[0]*b[0] + a[1]*b[1] + a[2]*b[2];
+}
+
+double squaredDistanceToSegment(const double point[3], const double origin[3], const double edge[3])
+{
+  double offset[3] = { point[0] - origin[0], point[1] - origin[1], point[2] - origin[2] };
+  double length = dot(edge, edge);
+  double t = length > 0. ? std::min(std::max(dot(offset, edge)/length, 0.), 1.) : 0.;
+  double squaredDistance = 0.;
+  for(int i=0; i<3; i++)
+  {
+    double d = offset[i] - t*edge[i];
+    squaredDistance += d*d;
+  }
+  return squaredDistance;
+}
+
+// rectangle is a corner and its two edges
+double squaredDistanceToRectangle(const double point[3], const double* rectangle)
+{
+  const double* origin = rectangle;
+  const double* u = rectangle + 3;
+  const double* v = rectangle + 6;
+  double offset[3] = { point[0] - origin[0], point[1] - origin[1], point[2] - origin[2] };
+  double uu = dot(u, u), uv = dot(u, v), vv = dot(v, v);
+  double du = dot(offset, u), dv = dot(offset, v);
+  double determinant = uu*vv - uv*uv;
+  if(determinant > 0.)
+  {
+    double s = (du*vv - dv*uv)/determinant;
+    double t = (dv*uu - du*uv)/determinant;
+    if(s >= 0. && s <= 1. && t >= 0. && t <= 1.)
+    {
+      double squaredDistance = 0.;
+      for(int i=0; i<3; i++)
+      {
+        double d = offset[i] - s*u[i] - t*v[i];
+        squaredDistance += d*d;
+      }
+      return squaredDistance;
+    }
+  }
+  // Otherwise the nearest point is on the border
+  double opposite[3] = { origin[0] + u[0] + v[0], origin[1] + u[1] + v[1], origin[2] + u[2] + v[2] };
+  double minusU[3] = { -u[0], -u[1], -u[2] };
+  double minusV[3] = { -v[0], -v[1], -v[2] };
+  return std::min(std::min(squaredDistanceToSegment(point, origin, u), squaredDistanceToSegment(point, origin, v)),
+    std::min(squaredDistanceToSegment(point, opposite, minusU), squaredDistanceToSegment(point, opposite, minusV)));
+}
+
+double squaredDistanceToBounds(const double point[3], const double bounds[6])
+{
+  double squaredDistance = 0.;
+  for(int i=0; i<3; i++)
+  {
+    double d = point[i] < bounds[2*i] ? bounds[2*i] - point[i] : (point[i] > bounds[2*i+1] ? point[i] - bounds[2*i+1] : 0.);
+    squaredDistance += d*d;
+  }
+  return squaredDistance;
+}
+
+bool boundsOverlap(const double a[6], const double b[6])
+{
+  return a[0] <= b[1] && b[0] <= a[1] && a[2] <= b[3] && b[2] <= a[3] && a[4] <= b[5] && b[4] <= a[5];
+}
+
+// Separating axis test of a rectangle against a box: the box axes, the
+// normal of the rectangle and the cross products of the edges with the
+// box axes
+bool rectangleIntersectsBox(const double* rectangle, const double bounds[6])
+{
+  const double* origin = rectangle;
+  const double* u = rectangle + 3;
+  const double* v = rectangle + 6;
+  double center[3], halfSize[3];
+  for(int i=0; i<3; i++)
+  {
+    center[i] = 0.5*(bounds[2*i] + bounds[2*i+1]);
+    halfSize[i] = 0.5*(bounds[2*i+1] - bounds[2*i]);
+  }
+  double axes[13][3];
+  int numberOfAxes = 0;
+  for(int i=0; i<3; i++, numberOfAxes++)
+    for(int j=0; j<3; j++)
+      axes[numberOfAxes][j] = i == j ? 1. : 0.;
+  axes[numberOfAxes][0] = u[1]*v[2] - u[2]*v[1];
+  axes[numberOfAxes][1] = u[2]*v[0] - u[0]*v[2];
+  axes[numberOfAxes][2] = u[0]*v[1] - u[1]*v[0];
+  numberOfAxes++;
+  const double* edges[2] = { u, v };
+  for(int e=0; e<2; e++)
+  {
+    const double* edge = edges[e];
+    for(int i=0; i<3; i++, numberOfAxes++)
+    {
+      // edge x unit axis i
+      double unit[3] = { 0., 0., 0. };
+      unit[i] = 1.;
+      axes[numberOfAxes][0] = edge[1]*unit[2] - edge[2]*unit[1];
+      axes[numberOfAxes][1] = edge[2]*unit[0] - edge[0]*unit[2];
+      axes[numberOfAxes][2] = edge[0]*unit[1] - edge[1]*unit[0];
+    }
+  }
+  for(int a=0; a<numberOfAxes; a++)
+  {
+    const double* axis = axes[a];
+    double offset[3] = { origin[0] - center[0], origin[1] - center[1], origin[2] - center[2] };
+    double p0 = dot(offset, axis), pu = dot(u, axis), pv = dot(v, axis);
+    double minimum = p0 + std::min(pu, 0.) + std::min(pv, 0.);
+    double maximum = p0 + std::max(pu, 0.) + std::max(pv, 0.);
+    double radius = halfSize[0]*fabs(axis[0]) + halfSize[1]*fabs(axis[1]) + halfSize[2]*fabs(axis[2]);
+    if(minimum > radius || maximum < -radius)
+      return false;
+  }
+  return true;
+}
+}
+
+//----------------------------------------------------------------------------
+MhaPlaneIndex::MhaPlaneIndex()
+{
+  this->width = 0;
+  this->height = 0;
+  for(int i=0; i<16; i++)
+    this->imageToProbe[i] = i % 5 == 0 ? 1. : 0.;
+}
+
+//----------------------------------------------------------------------------
+void MhaPlaneIndex::clear()
+{
+  // Swapped out so that the memory is returned, clear() is also used to evict
+  std::vector<int>().swap(this->frames);
+  std::vector<float>().swap(this->poses);
+  std::vector<double>().swap(this->rectangles);
+  std::vector<Node>().swap(this->nodes);
+}
+
+//----------------------------------------------------------------------------
+void MhaPlaneIndex::build(const MhaPoseTrack& poses, int width, int height, const double imageToProbe[16],
+  const std::vector<unsigned char>* outliers)
+{
+  this->clear();
+  this->width = width;
+  this->height = height;
+  memcpy(this->imageToProbe, imageToProbe, sizeof(this->imageToProbe));
+
+  int numberOfFrames = poses.getNumberOfFrames();
+  if(numberOfFrames <= 0)
+    return;
+  std::vector<double> queries(numberOfFrames);
+  for(int frame = 0; frame < numberOfFrames; frame++)
+    queries[frame] = frame;
+  std::vector<float> matrices(12*(size_t)numberOfFrames);
+  std::vector<unsigned char> valid(numberOfFrames);
+  poses.interpolateFrames(&queries[0], numberOfFrames, &matrices[0], &valid[0]);
+  // Frames recorded INVALID or missing have no plane, however near their
+  // neighbours are; outliers are placed where the filter puts them
+  std::vector<int> validFrames;
+  for(int frame = 0; frame < numberOfFrames; frame++)
+  {
+    bool outlier = outliers && frame < (int)outliers->size() && (*outliers)[frame];
+    if(valid[frame] && (poses.isValid(frame) || outlier))
+      validFrames.push_back(frame);
+  }
+  int count = (int)validFrames.size();
+  if(count == 0)
+    return;
+  this->frames = validFrames;
+  this->poses.resize(12*(size_t)count);
+  for(int i = 0; i < count; i++)
+    std::copy(&matrices[12*(size_t)validFrames[i]], &matrices[12*(size_t)validFrames[i]] + 12, &this->poses[12*(size_t)i]);
+  this->computeRectangles();
+
+  // The tree is built on the centers of the rectangles, then the arrays are
+  // put in tree order so that leaves are contiguous
+  std::vector<double> centers(3*(size_t)count);
+  for(int i = 0; i < count; i++)
+  {
+    const double* rectangle = &this->rectangles[9*(size_t)i];
+    for(int j=0; j<3; j++)
+      centers[3*i+j] = rectangle[j] + 0.5*(rectangle[3+j] + rectangle[6+j]);
+  }
+  std::vector<int> order(count);
+  for(int i = 0; i < count; i++)
+    order[i] = i;
+  this->nodes.reserve(2*(count/leafSize + 1));
+  this->buildNode(order, centers, 0, count);
+
+  std::vector<int> sortedFrames(count);
+  std::vector<float> sortedPoses(this->poses.size());
+  std::vector<double> sortedRectangles(this->rectangles.size());
+  for(int i = 0; i < count; i++)
+  {
+    sortedFrames[i] = this->frames[order[i]];
+    std::copy(&this->poses[12*(size_t)order[i]], &this->poses[12*(size_t)order[i]] + 12, &sortedPoses[12*(size_t)i]);
+    std::copy(&this->rectangles[9*(size_t)order[i]], &this->rectangles[9*(size_t)order[i]] + 9, &sortedRectangles[9*(size_t)i]);
+  }
+  this->frames.swap(sortedFrames);
+  this->poses.swap(sortedPoses);
+  this->rectangles.swap(sortedRectangles);
+  this->refit(0);
+}
+
+//----------------------------------------------------------------------------
+int MhaPlaneIndex::buildNode(std::vector<int>& order, const std::vector<double>& centers, int first, int count)
+{
+  int index = (int)this->nodes.size();
+  this->nodes.push_back(Node());
+  this->nodes[index].first = first;
+  this->nodes[index].count = count;
+  this->nodes[index].second = -1;
+  if(count <= leafSize)
+    return index;
+
+  // Median split along the longest extent of the centers
+  double low[3] = { 1e300, 1e300, 1e300 }, high[3] = { -1e300, -1e300, -1e300 };
+  for(int i = first; i < first + count; i++)
+    for(int j=0; j<3; j++)
+    {
+      low[j] = std::min(low[j], centers[3*order[i]+j]);
+      high[j] = std::max(high[j], centers[3*order[i]+j]);
+    }
+  int axis = 0;
+  for(int j=1; j<3; j++)
+    if(high[j] - low[j] > high[axis] - low[axis])
+      axis = j;
+  int middle = first + count/2;
+  std::nth_element(order.begin() + first, order.begin() + middle, order.begin() + first + count,
+    [&](int a, int b) { return centers[3*a+axis] < centers[3*b+axis]; });
+
+  this->nodes[index].count = 0;
+  this->buildNode(order, centers, first, middle - first);
+  int second = this->buildNode(order, centers, middle, first + count - middle);
+  this->nodes[index].second = second;
+  return index;
+}
+
+//----------------------------------------------------------------------------
+void MhaPlaneIndex::computeRectangles()
+{
+  int count = (int)this->frames.size();
+  this->rectangles.resize(9*(size_t)count);
+  const double* calibration = this->imageToProbe;
+  for(int i = 0; i < count; i++)
+  {
+    const float* pose = &this->poses[12*(size_t)i];
+    // Columns 0, 1 and 3 of pose * imageToProbe: pixel axes and origin
+    double matrix[3][4];
+    for(int row=0; row<3; row++)
+      for(int column=0; column<4; column++)
+        matrix[row][column] = pose[4*row]*calibration[column] + pose[4*row+1]*calibration[4+column]
+          + pose[4*row+2]*calibration[8+column] + pose[4*row+3]*calibration[12+column];
+    double* rectangle = &this->rectangles[9*(size_t)i];
+    for(int row=0; row<3; row++)
+    {
+      rectangle[row] = matrix[row][3];
+      rectangle[3+row] = matrix[row][0]*(this->width - 1);
+      rectangle[6+row] = matrix[row][1]*(this->height - 1);
+    }
+  }
+}
+
+//----------------------------------------------------------------------------
+void MhaPlaneIndex::refit(int index)
+{
+  Node& node = this->nodes[index];
+  if(node.count > 0)
+  {
+    for(int j=0; j<3; j++)
+    {
+      node.bounds[2*j] = 1e300;
+      node.bounds[2*j+1] = -1e300;
+    }
+    for(int i = node.first; i < node.first + node.count; i++)
+    {
+      const double* rectangle = &this->rectangles[9*(size_t)i];
+      for(int j=0; j<3; j++)
+      {
+        double corners[4] = { rectangle[j], rectangle[j] + rectangle[3+j], rectangle[j] + rectangle[6+j],
+          rectangle[j] + rectangle[3+j] + rectangle[6+j] };
+        node.bounds[2*j] = std::min(node.bounds[2*j], *std::min_element(corners, corners + 4));
+        node.bounds[2*j+1] = std::max(node.bounds[2*j+1], *std::max_element(corners, corners + 4));
+      }
+    }
+    return;
+  }
+  this->refit(index + 1);
+  this->refit(node.second);
+  const double* a = this->nodes[index + 1].bounds;
+  const double* b = this->nodes[node.second].bounds;
+  for(int j=0; j<3; j++)
+  {
+    node.bounds[2*j] = std::min(a[2*j], b[2*j]);
+    node.bounds[2*j+1] = std::max(a[2*j+1], b[2*j+1]);
+  }
+}
+
+//----------------------------------------------------------------------------
+void MhaPlaneIndex::setCalibration(const double imageToProbe[16])
+{
+  memcpy(this->imageToProbe, imageToProbe, sizeof(this->imageToProbe));
+  if(this->nodes.empty())
+    return;
+  this->computeRectangles();
+  this->refit(0);
+}
+
+//----------------------------------------------------------------------------
+void MhaPlaneIndex::findFramesNearPoint(const double point[3], double distance, std::vector<int>& result) const
+{
+  result.clear();
+  if(this->nodes.empty() || distance < 0.)
+    return;
+  double squaredDistance = distance*distance;
+  // The tree is balanced, 64 levels are never reached
+  int stack[64];
+  int size = 0;
+  stack[size++] = 0;
+  while(size > 0)
+  {
+    int index = stack[--size];
+    const Node& node = this->nodes[index];
+    if(squaredDistanceToBounds(point, node.bounds) > squaredDistance)
+      continue;
+    if(node.count == 0)
+    {
+      stack[size++] = node.second;
+      stack[size++] = index + 1;
+      continue;
+    }
+    for(int i = node.first; i < node.first + node.count; i++)
+      if(squaredDistanceToRectangle(point, &this->rectangles[9*(size_t)i]) <= squaredDistance)
+        result.push_back(this->frames[i]);
+  }
+  std::sort(result.begin(), result.end());
+}
+
+//----------------------------------------------------------------------------
+void MhaPlaneIndex::findFramesInBox(const double bounds[6], std::vector<int>& result) const
+{
+  result.clear();
+  if(this->nodes.empty())
+    return;
+  int stack[64];
+  int size = 0;
+  stack[size++] = 0;
+  while(size > 0)
+  {
+    int index = stack[--size];
+    const Node& node = this->nodes[index];
+    if(!boundsOverlap(node.bounds, bounds))
+      continue;
+    if(node.count == 0)
+    {
+      stack[size++] = node.second;
+      stack[size++] = index + 1;
+      continue;
+    }
+    for(int i = node.first; i < node.first + node.count; i++)
+      if(rectangleIntersectsBox(&this->rectangles[9*(size_t)i], bounds))
+        result.push_back(this->frames[i]);
+  }
+  std::sort(result.begin(), result.end());
+}
+
+//----------------------------------------------------------------------------
+size_t MhaPlaneIndex::getMemorySize() const
+{
+  return this->frames.capacity()*sizeof(int) + this->poses.capacity()*sizeof(float)
+    + this->rectangles.capacity()*sizeof(double) + this->nodes.capacity()*sizeof(Node);
+}
@@ -0,0 +1,90 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+// .NAME MhaPlaneIndex - bounding volume hierarchy over the image planes of a sequence
+// .SECTION Description
+// The image rectangle of every frame with a valid pose is placed in tracker
+// space (pose * imageToProbe * pixel) and indexed by a binary tree of
+// bounding boxes, so that the frames passing near a point or through a box
+// are found without visiting every frame. A new calibration moves every
+// rectangle but keeps the tree: corners are recomputed and the boxes
+// refitted bottom up.
+
+#ifndef __MhaPlaneIndex_h
+#define __MhaPlaneIndex_h
+
+// STD includes
+#include <cstddef>
+#include <vector>
+
+class MhaPoseTrack;
+
+class MhaPlaneIndex
+{
+public:
+  MhaPlaneIndex();
+
+  /// Indexes the width x height pixel rectangle of every valid frame of
+  /// poses. imageToProbe is a 4x4 row major matrix. Frames flagged in
+  /// outliers, as MhaPoseTrack::filter() does, are indexed at the pose
+  /// interpolated over them; other invalid frames are left out.
+  void build(const MhaPoseTrack& poses, int width, int height, const double imageToProbe[16],
+    const std::vector<unsigned char>* outliers = NULL);
+  /// Moves every rectangle to a new image to probe calibration, keeping the tree
+  void setCalibration(const double imageToProbe[16]);
+  void clear();
+
+  bool isEmpty() const { return this->nodes.empty(); }
+  /// Heap bytes of the rectangles and the tree
+  size_t getMemorySize() const;
+  /// Frames with a valid pose
+  int getNumberOfFrames() const { return (int)this->frames.size(); }
+
+  /// Frames whose image rectangle comes within distance of point, in
+  /// increasing order
+  void findFramesNearPoint(const double point[3], double distance, std::vector<int>& result) const;
+  /// Frames whose image rectangle intersects bounds {xmin, xmax, ymin, ymax,
+  /// zmin, zmax}, in increasing order
+  void findFramesInBox(const double bounds[6], std::vector<int>& result) const;
+
+private:
+  /// Leaves hold count > 0 rectangles from first on; an inner node is
+  /// followed by its first child, second is the index of the other one
+  struct Node
+  {
+    double bounds[6];
+    int first;
+    int count;
+    int second;
+  };
+
+  void computeRectangles();
+  int buildNode(std::vector<int>& order, const std::vector<double>& centers, int first, int count);
+  void refit(int node);
+
+  int width;
+  int height;
+  double imageToProbe[16];
+  /// Per indexed rectangle, in tree order: frame number, pose (3x4) and the
+  /// rectangle as a corner and its two edges (9 doubles)
+  std::vector<int> frames;
+  std::vector<float> poses;
+  std::vector<double> rectangles;
+  std::vector<Node> nodes;
+};
+
+#endif
@@ -0,0 +1,557 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+#include "MhaPoseTrack.h"
+#include "MhaSequenceIndex.h"
+
+// STD includes
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace
+{
+// Unit quaternion (w, x, y, z) of the rotation matrix r, row major
+void getQuaternion(const double r[3][3], double q[4])
+{
+  double trace = r[0][0] + r[1][1] + r[2][2];
+  if(trace > 0.)
+  {
+    double s = 2.*sqrt(trace + 1.);
+    q[0] = 0.25*s;
+    q[1] = (r[2][1] - r[1][2])/s;
+    q[2] = (r[0][2] - r[2][0])/s;
+    q[3] = (r[1][0] - r[0][1])/s;
+  }
+  else if(r[0][0] > r[1][1] && r[0][0] > r[2][2])
+  {
+    double s = 2.*sqrt(1. + r[0][0] - r[1][1] - r[2][2]);
+    q[0] = (r[2][1] - r[1][2])/s;
+    q[1] = 0.25*s;
+    q[2] = (r[0][1] + r[1][0])/s;
+    q[3] = (r[0][2] + r[2][0])/s;
+  }
+  else if(r[1][1] > r[2][2])
+  {
+    double s = 2.*sqrt(1. + r[1][1] - r[0][0] - r[2][2]);
+    q[0] = (r[0][2] - r[2][0])/s;
+    q[1] = (r[0][1] + r[1][0])/s;
+    q[2] = 0.25*s;
+    q[3] = (r[1][2] + r[2][1])/s;
+  }
+  else
+  {
+    double s = 2.*sqrt(1. + r[2][2] - r[0][0] - r[1][1]);
+    q[0] = (r[1][0] - r[0][1])/s;
+    q[1] = (r[0][2] + r[2][0])/s;
+    q[2] = (r[1][2] + r[2][1])/s;
+    q[3] = 0.25*s;
+  }
+  double norm = sqrt(q[0]*q[0] + q[1]*q[1] + q[2]*q[2] + q[3]*q[3]);
+  for(int i=0; i<4; i++)
+    q[i] /= norm;
+}
+
+void setIdentity(float* matrix)
+{
+  for(int i=0; i<12; i++)
+    matrix[i] = i % 5 == 0 ? 1.f : 0.f;
+}
+
+// Quadratic Savitzky-Golay smoothing of count samples over 2*halfWidth+1 of
+// them; the window shrinks near the ends so that it stays centred
+void smoothSavitzkyGolay(const float* input, int count, int halfWidth, float* output)
+{
+  halfWidth = std::min(halfWidth, (count - 1)/2);
+  // weights[m] holds the 2m+1 weights of the window of half width m
+  std::vector<std::vector<float> > weights(halfWidth + 1);
+  for(int m = 1; m <= halfWidth; m++)
+  {
+    double norm = (double)(2*m - 1)*(2*m + 1)*(2*m + 3);
+    for(int k = -m; k <= m; k++)
+      weights[m].push_back((float)((3.*(3*m*m + 3*m - 1) - 15.*k*k)/norm));
+  }
+  for(int i = 0; i < count; i++)
+  {
+    int m = std::min(halfWidth, std::min(i, count - 1 - i));
+    if(m < halfWidth || halfWidth == 0)
+    {
+      float sum = m > 0 ? 0.f : input[i];
+      for(int k = -m; k <= m && m > 0; k++)
+        sum += weights[m][k + m]*input[i + k];
+      output[i] = sum;
+    }
+  }
+  if(halfWidth == 0)
+    return;
+  // Interior, one weight at a time over contiguous samples so the compiler
+  // can vectorize the inner loop
+  const std::vector<float>& interior = weights[halfWidth];
+  float* begin = output + halfWidth;
+  int interiorCount = count - 2*halfWidth;
+  std::fill(begin, begin + interiorCount, 0.f);
+  for(int k = 0; k <= 2*halfWidth; k++)
+  {
+    float weight = interior[k];
+    const float* shifted = input + k;
+    for(int i = 0; i < interiorCount; i++)
+      begin[i] += weight*shifted[i];
+  }
+}
+}
+
+//----------------------------------------------------------------------------
+MhaPoseTrack::MhaPoseTrack()
+{
+  this->maximumGap = 0;
+}
+
+//----------------------------------------------------------------------------
+void MhaPoseTrack::build(const MhaTransformStream& stream, const MhaChunkedArray<double>& timestamps)
+{
+  this->translations.clear();
+  this->scales.clear();
+  this->quaternions.clear();
+  this->valid.clear();
+  this->previousValid.clear();
+  this->nextValid.clear();
+  this->frameTimes.clear();
+  this->times.clear();
+  this->timeFrames.clear();
+  this->extend(stream, timestamps);
+}
+
+//----------------------------------------------------------------------------
+void MhaPoseTrack::extend(const MhaTransformStream& stream, const MhaChunkedArray<double>& timestamps)
+{
+  int first = this->getNumberOfFrames();
+  int numberOfFrames = stream.getNumberOfFrames();
+  if(numberOfFrames <= first)
+    return;
+  this->translations.resize(numberOfFrames, 0.f);
+  this->scales.resize(numberOfFrames, 1.f);
+  this->quaternions.resize(numberOfFrames, 0.f);
+
+  this->valid.resize(numberOfFrames, 0);
+  int previous = first > 0 ? this->previousValid[first - 1] : -1;
+  for(int frame = first; frame < numberOfFrames; frame++)
+  {
+    unsigned char flags = stream.flags[frame];
+    if((flags & MhaTransformStream::Present) && !(flags & MhaTransformStream::StatusInvalid))
+    {
+      // Columns of the 3x3 part are the scaled axes
+      const float* matrix = stream.getMatrix(frame);
+      double rotation[3][3], scale[3];
+      for(int j=0; j<3; j++)
+      {
+        scale[j] = sqrt((double)matrix[j]*matrix[j] + (double)matrix[4+j]*matrix[4+j] + (double)matrix[8+j]*matrix[8+j]);
+        for(int i=0; i<3; i++)
+          rotation[i][j] = scale[j] > 0. ? matrix[4*i+j]/scale[j] : 0.;
+      }
+      double determinant = rotation[0][0]*(rotation[1][1]*rotation[2][2] - rotation[1][2]*rotation[2][1])
+        - rotation[0][1]*(rotation[1][0]*rotation[2][2] - rotation[1][2]*rotation[2][0])
+        + rotation[0][2]*(rotation[1][0]*rotation[2][1] - rotation[1][1]*rotation[2][0]);
+      if(scale[0] > 0. && scale[1] > 0. && scale[2] > 0. && determinant != 0.)
+      {
+        // A mirrored frame keeps the mirror in the scale of its first axis
+        if(determinant < 0.)
+        {
+          scale[0] = -scale[0];
+          for(int i=0; i<3; i++)
+            rotation[i][0] = -rotation[i][0];
+        }
+        double q[4];
+        getQuaternion(rotation, q);
+        // q and -q are the same rotation, the one nearer the previous pose
+        // makes SLERP take the short way
+        const float* previousQ = previous >= 0 ? this->quaternions.get(previous) : NULL;
+        if(previousQ && q[0]*previousQ[0] + q[1]*previousQ[1] + q[2]*previousQ[2] + q[3]*previousQ[3] < 0.)
+          for(int i=0; i<4; i++)
+            q[i] = -q[i];
+        float* quaternion = this->quaternions.edit(frame);
+        for(int i=0; i<4; i++)
+          quaternion[i] = (float)q[i];
+        float* translation = this->translations.edit(frame);
+        float* axisScale = this->scales.edit(frame);
+        for(int i=0; i<3; i++)
+        {
+          translation[i] = matrix[4*i+3];
+          axisScale[i] = (float)scale[i];
+        }
+        *this->valid.edit(frame) = 1;
+        previous = frame;
+      }
+    }
+  }
+  this->updateNeighbours(first);
+
+  this->frameTimes.resize(numberOfFrames, std::numeric_limits<double>::quiet_NaN());
+  // Frames without a timestamp, or one that does not increase, cannot be
+  // located in time
+  for(int frame = first; frame < numberOfFrames && frame < (int)timestamps.size(); frame++)
+  {
+    double time = timestamps[frame];
+    *this->frameTimes.edit(frame) = time;
+    if(time == time && (this->times.empty() || time > this->times.back()))
+    {
+      this->times.push_back(time);
+      this->timeFrames.push_back(frame);
+    }
+  }
+}
+
+//----------------------------------------------------------------------------
+double MhaPoseTrack::getFrameAtTime(double time) const
+{
+  if(!this->hasTimestamps() || !(time >= this->times.front() && time <= this->times.back()))
+    return -1.;
+  // First time above time
+  size_t i = 0, end = this->times.size();
+  while(i < end)
+  {
+    size_t middle = (i + end)/2;
+    if(this->times[middle] <= time)
+      i = middle + 1;
+    else
+      end = middle;
+  }
+  i = std::min(std::max(i, (size_t)1), this->times.size() - 1) - 1;
+  double weight = (time - this->times[i])/(this->times[i+1] - this->times[i]);
+  return this->timeFrames[i] + weight*(this->timeFrames[i+1] - this->timeFrames[i]);
+}
+
+//----------------------------------------------------------------------------
+void MhaPoseTrack::interpolateFrames(const double* frames, int count, float* matrices, unsigned char* valid) const
+{
+  for(int i = 0; i < count; i++)
+    this->interpolate(frames[i], matrices + 12*(size_t)i, valid[i]);
+}
+
+//----------------------------------------------------------------------------
+void MhaPoseTrack::interpolateTimes(const double* times, int count, float* matrices, unsigned char* valid) const
+{
+  for(int i = 0; i < count; i++)
+    this->interpolate(this->getFrameAtTime(times[i]), matrices + 12*(size_t)i, valid[i]);
+}
+
+//----------------------------------------------------------------------------
+void MhaPoseTrack::interpolate(double frame, float* matrix, unsigned char& valid) const
+{
+  valid = 0;
+  int numberOfFrames = this->getNumberOfFrames();
+  if(!(frame >= 0. && frame <= numberOfFrames - 1))
+  {
+    setIdentity(matrix);
+    return;
+  }
+  int lower = (int)frame;
+  int first = this->previousValid[lower];
+  int second = first == lower && frame == lower ? lower : (lower + 1 < numberOfFrames ? this->nextValid[lower + 1] : -1);
+  if(first < 0 || second < 0 || (this->maximumGap > 0 && second - first > this->maximumGap))
+  {
+    setIdentity(matrix);
+    return;
+  }
+
+  double weight = second > first ? (frame - first)/(second - first) : 0.;
+  const float* q0 = this->quaternions.get(first);
+  const float* q1 = this->quaternions.get(second);
+  double dot = (double)q0[0]*q1[0] + (double)q0[1]*q1[1] + (double)q0[2]*q1[2] + (double)q0[3]*q1[3];
+  double sign = dot < 0. ? -1. : 1.;
+  dot *= sign;
+  double weight0 = 1. - weight, weight1 = weight;
+  // Nearly identical rotations are blended linearly, where SLERP divides by ~0
+  if(dot < 0.9995)
+  {
+    double angle = acos(dot);
+    double sinAngle = sin(angle);
+    weight0 = sin((1. - weight)*angle)/sinAngle;
+    weight1 = sin(weight*angle)/sinAngle;
+  }
+  weight1 *= sign;
+  double q[4];
+  double norm = 0.;
+  for(int i=0; i<4; i++)
+  {
+    q[i] = weight0*q0[i] + weight1*q1[i];
+    norm += q[i]*q[i];
+  }
+  norm = sqrt(norm);
+  double w = q[0]/norm, x = q[1]/norm, y = q[2]/norm, z = q[3]/norm;
+  double rotation[3][3] = {
+    { 1. - 2.*(y*y + z*z), 2.*(x*y - w*z), 2.*(x*z + w*y) },
+    { 2.*(x*y + w*z), 1. - 2.*(x*x + z*z), 2.*(y*z - w*x) },
+    { 2.*(x*z - w*y), 2.*(y*z + w*x), 1. - 2.*(x*x + y*y) } };
+
+  const float* t0 = this->translations.get(first);
+  const float* t1 = this->translations.get(second);
+  const float* s0 = this->scales.get(first);
+  const float* s1 = this->scales.get(second);
+  for(int i=0; i<3; i++)
+  {
+    for(int j=0; j<3; j++)
+      matrix[4*i+j] = (float)(rotation[i][j]*((1. - weight)*s0[j] + weight*s1[j]));
+    matrix[4*i+3] = (float)((1. - weight)*t0[i] + weight*t1[i]);
+  }
+  valid = 1;
+}
+
+//----------------------------------------------------------------------------
+void MhaPoseTrack::updateNeighbours(int first)
+{
+  int numberOfFrames = this->getNumberOfFrames();
+  this->previousValid.resize(numberOfFrames, -1);
+  this->nextValid.resize(numberOfFrames, -1);
+  int previous = first > 0 ? this->previousValid[first - 1] : -1;
+  for(int frame = first; frame < numberOfFrames; frame++)
+  {
+    if(this->valid[frame])
+      previous = frame;
+    *this->previousValid.edit(frame) = previous;
+  }
+  int next = -1;
+  for(int frame = numberOfFrames - 1; frame >= first; frame--)
+  {
+    if(this->valid[frame])
+      next = frame;
+    *this->nextValid.edit(frame) = next;
+  }
+  // Earlier frames whose next valid frame was not before first, or that
+  // had none, now have the one found from first on
+  for(int frame = first - 1; frame >= 0 && this->nextValid[frame] != next &&
+    (this->nextValid[frame] < 0 || this->nextValid[frame] >= first); frame--)
+    *this->nextValid.edit(frame) = next;
+}
+
+//----------------------------------------------------------------------------
+void MhaPoseTrack::filter(const MhaPoseFilterSettings& settings, MhaPoseTrack& result, std::vector<unsigned char>& outliers) const
+{
+  result = *this;
+  outliers.assign(this->getNumberOfFrames(), 0);
+  this->filterFrames(settings, 0, result, outliers);
+}
+
+//----------------------------------------------------------------------------
+void MhaPoseTrack::extendFilter(const MhaPoseFilterSettings& settings, MhaPoseTrack& result,
+  std::vector<unsigned char>& outliers) const
+{
+  int numberOfFrames = this->getNumberOfFrames();
+  int filtered = result.getNumberOfFrames();
+  if(filtered == 0 || filtered > numberOfFrames || (int)outliers.size() != filtered)
+  {
+    this->filter(settings, result, outliers);
+    return;
+  }
+  if(filtered == numberOfFrames)
+    return;
+  // The last two valid frames filtered had no later neighbours, the frames
+  // after the valid one before them are interpolated between them, and
+  // smoothing reaches halfWidth frames further back
+  int first = filtered;
+  for(int i = 0; i < 2 && first > 0; i++)
+    first = std::max(this->previousValid[first - 1], 0);
+  int previous = first > 0 ? result.previousValid[first - 1] : -1;
+  first = std::max(previous + 1 - std::max(settings.smoothingHalfWidth, 0), 0);
+
+  result.copyFrames(*this, first);
+  outliers.resize(numberOfFrames, 0);
+  this->filterFrames(settings, first, result, outliers);
+}
+
+//----------------------------------------------------------------------------
+void MhaPoseTrack::copyFrames(const MhaPoseTrack& source, int first)
+{
+  int numberOfFrames = source.getNumberOfFrames();
+  this->translations.resize(numberOfFrames);
+  this->scales.resize(numberOfFrames);
+  this->quaternions.resize(numberOfFrames);
+  this->valid.resize(numberOfFrames);
+  for(int frame = first; frame < numberOfFrames; frame++)
+  {
+    std::copy(source.translations.get(frame), source.translations.get(frame) + 3, this->translations.edit(frame));
+    std::copy(source.scales.get(frame), source.scales.get(frame) + 3, this->scales.edit(frame));
+    std::copy(source.quaternions.get(frame), source.quaternions.get(frame) + 4, this->quaternions.edit(frame));
+    *this->valid.edit(frame) = source.valid[frame];
+  }
+  // Shared chunks, not copies
+  this->frameTimes = source.frameTimes;
+  this->times = source.times;
+  this->timeFrames = source.timeFrames;
+  this->maximumGap = source.maximumGap;
+}
+
+//----------------------------------------------------------------------------
+void MhaPoseTrack::filterFrames(const MhaPoseFilterSettings& settings, int first, MhaPoseTrack& result,
+  std::vector<unsigned char>& outliers) const
+{
+  int numberOfFrames = this->getNumberOfFrames();
+  std::fill(outliers.begin() + first, outliers.end(), 0);
+
+  // Valid frames from the second one before first on, the flags of the
+  // frames from first on depend on their speeds and accelerations. Frames
+  // without timestamps are placed at the mean frame interval.
+  int begin = first;
+  for(int i = 0; i < 2 && begin > 0; i++)
+    begin = std::max(this->previousValid[begin - 1], 0);
+  std::vector<int> frames;
+  for(int frame = begin; frame < numberOfFrames; frame++)
+    if(this->valid[frame])
+      frames.push_back(frame);
+  int count = (int)frames.size();
+  double interval = 1., origin = 0.;
+  if(this->hasTimestamps())
+  {
+    interval = (this->times.back() - this->times.front())/(this->timeFrames.back() - this->timeFrames.front());
+    origin = this->times.front() - this->timeFrames.front()*interval;
+  }
+  std::vector<double> frameTime(count);
+  for(int i = 0; i < count; i++)
+  {
+    double time = this->hasTimestamps() ? this->frameTimes[frames[i]] : std::numeric_limits<double>::quiet_NaN();
+    frameTime[i] = time == time ? time : origin + frames[i]*interval;
+  }
+
+  // Speeds of the step from every valid frame to the next one
+  const double radiansToDegrees = 45./atan(1.);
+  std::vector<double> speed(count, 0.), angularSpeed(count, 0.), velocity(3*(size_t)count, 0.);
+  for(int i = 0; i + 1 < count; i++)
+  {
+    const float* t0 = this->translations.get(frames[i]);
+    const float* t1 = this->translations.get(frames[i+1]);
+    const float* q0 = this->quaternions.get(frames[i]);
+    const float* q1 = this->quaternions.get(frames[i+1]);
+    double step = frameTime[i+1] - frameTime[i];
+    if(!(step > 0.))
+      step = (frames[i+1] - frames[i])*interval;
+    double squaredSpeed = 0.;
+    for(int j=0; j<3; j++)
+    {
+      velocity[3*i+j] = (t1[j] - t0[j])/step;
+      squaredSpeed += velocity[3*i+j]*velocity[3*i+j];
+    }
+    speed[i] = sqrt(squaredSpeed);
+    double dot = fabs((double)q0[0]*q1[0] + (double)q0[1]*q1[1] + (double)q0[2]*q1[2] + (double)q0[3]*q1[3]);
+    angularSpeed[i] = 2.*acos(std::min(dot, 1.))*radiansToDegrees/step;
+  }
+  std::vector<double> acceleration(count, 0.);
+  for(int i = 1; i + 1 < count; i++)
+  {
+    double squaredAcceleration = 0.;
+    for(int j=0; j<3; j++)
+    {
+      double change = velocity[3*i+j] - velocity[3*(i-1)+j];
+      squaredAcceleration += change*change;
+    }
+    acceleration[i] = sqrt(squaredAcceleration)/(0.5*(frameTime[i+1] - frameTime[i-1]));
+  }
+
+  for(int i = 0; i < count; i++)
+  {
+    if(frames[i] < first)
+      continue;
+    // The slower of the steps into and out of the frame, the only step at the ends
+    double frameSpeed = i == 0 ? speed[0] : (i + 1 == count ? speed[i-1] : std::min(speed[i-1], speed[i]));
+    double frameAngularSpeed = i == 0 ? angularSpeed[0] :
+      (i + 1 == count ? angularSpeed[i-1] : std::min(angularSpeed[i-1], angularSpeed[i]));
+    unsigned char flags = 0;
+    if(settings.maximumSpeed > 0. && count > 1 && frameSpeed > settings.maximumSpeed)
+      flags |= Speed;
+    if(settings.maximumAngularSpeed > 0. && count > 1 && frameAngularSpeed > settings.maximumAngularSpeed)
+      flags |= AngularSpeed;
+    if(settings.maximumAcceleration > 0. && acceleration[i] > settings.maximumAcceleration
+      && acceleration[i] >= acceleration[i-1] && acceleration[i] >= acceleration[i+1])
+      flags |= Acceleration;
+    outliers[frames[i]] = flags;
+    if(flags)
+      *result.valid.edit(frames[i]) = 0;
+  }
+  result.updateNeighbours(first);
+
+  // Frames are evenly spaced, so the series to smooth runs over every frame
+  // from the first valid one to the last, invalid ones interpolated. It
+  // needs 3 valid frames.
+  int halfWidth = settings.smoothingHalfWidth;
+  int seriesFirst = numberOfFrames > 0 ? result.nextValid[0] : -1;
+  int third = seriesFirst;
+  for(int i = 0; i < 2 && third >= 0; i++)
+    third = third + 1 < numberOfFrames ? result.nextValid[third + 1] : -1;
+  if(halfWidth <= 0 || third < 0)
+    return;
+  int last = result.previousValid[numberOfFrames - 1];
+  // Outputs from first on take the inputs from halfWidth frames before it,
+  // interpolated from the valid frame at or before them on
+  int start = std::max(seriesFirst, first - halfWidth);
+  int from = result.previousValid[start];
+  int length = last - start + 1;
+  // Recorded values of the valid frames, rotations on the hemisphere of the
+  // valid frame before them
+  std::vector<float> values(7*(size_t)(last - from + 1));
+  const float* reference = from > 0 && result.previousValid[from - 1] >= 0 ?
+    result.quaternions.get(result.previousValid[from - 1]) : NULL;
+  for(int frame = from; frame <= last; frame = frame + 1 < numberOfFrames ? result.nextValid[frame + 1] : -1)
+  {
+    float* value = &values[7*(size_t)(frame - from)];
+    std::copy(this->translations.get(frame), this->translations.get(frame) + 3, value);
+    const float* q = this->quaternions.get(frame);
+    float sign = reference && q[0]*reference[0] + q[1]*reference[1] + q[2]*reference[2] + q[3]*reference[3] < 0.f ?
+      -1.f : 1.f;
+    for(int j=0; j<4; j++)
+      value[3+j] = sign*q[j];
+    reference = value + 3;
+    if(frame == last)
+      break;
+  }
+  std::vector<float> input(length), output(length);
+  for(int component = 0; component < 7; component++)
+  {
+    for(int i = 0; i < length; i++)
+    {
+      int frame = start + i;
+      int previous = result.previousValid[frame], next = result.nextValid[frame];
+      float weight = next > previous ? (float)(frame - previous)/(float)(next - previous) : 0.f;
+      input[i] = (1.f - weight)*values[7*(size_t)(previous - from) + component]
+        + weight*values[7*(size_t)(next - from) + component];
+    }
+    smoothSavitzkyGolay(&input[0], length, halfWidth, &output[0]);
+    bool translation = component < 3;
+    for(int frame = std::max(first, start); frame <= last; frame++)
+    {
+      if(!result.valid[frame])
+        continue;
+      float* value = translation ? result.translations.edit(frame) : result.quaternions.edit(frame);
+      value[translation ? component : component - 3] = output[frame - start];
+    }
+  }
+  for(int frame = std::max(first, start); frame <= last; frame++)
+  {
+    if(!result.valid[frame])
+      continue;
+    float* q = result.quaternions.edit(frame);
+    float norm = sqrt(q[0]*q[0] + q[1]*q[1] + q[2]*q[2] + q[3]*q[3]);
+    for(int j=0; j<4; j++)
+      q[j] /= norm;
+  }
+}
+
+//----------------------------------------------------------------------------
+size_t MhaPoseTrack::getMemorySize() const
+{
+  return this->translations.getMemorySize() + this->scales.getMemorySize() + this->quaternions.getMemorySize()
+    + this->valid.getMemorySize()
+    + this->previousValid.getMemorySize() + this->nextValid.getMemorySize() + this->timeFrames.getMemorySize()
+    + this->frameTimes.getMemorySize() + this->times.getMemorySize();
+}
@@ -0,0 +1,140 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+// .NAME MhaPoseTrack - per-frame poses of a transform, interpolable in time
+// .SECTION Description
+// The 3x4 matrices of a transform stream are decomposed once into
+// contiguous translation, axis scale and unit quaternion arrays. Poses
+// between frames are then a linear blend of translation and scale and a
+// SLERP of rotation between the nearest valid frames on either side, frames
+// that are missing or INVALID being skipped. Queries are answered in
+// batches, by fractional frame index or by time on the frame timestamps.
+// filter() makes a copy without the frames whose motion is implausible,
+// optionally smoothed, for display of jittery tracking.
+
+#ifndef __MhaPoseTrack_h
+#define __MhaPoseTrack_h
+
+// STD includes
+#include <cstddef>
+#include <vector>
+
+#include "MhaChunkedArray.h"
+
+struct MhaTransformStream;
+
+/// Limits of plausible motion, per second on the frame timestamps (per frame
+/// without them); 0 disables a limit
+struct MhaPoseFilterSettings
+{
+  /// Translation, in units of the transform
+  double maximumSpeed;
+  double maximumAcceleration;
+  /// Rotation, in degrees
+  double maximumAngularSpeed;
+  /// Quadratic Savitzky-Golay smoothing over 2*halfWidth+1 frames,
+  /// 0 for none
+  int smoothingHalfWidth;
+
+  MhaPoseFilterSettings()
+    : maximumSpeed(0.), maximumAcceleration(0.), maximumAngularSpeed(0.), smoothingHalfWidth(0) {}
+  bool isEnabled() const
+  {
+    return maximumSpeed > 0. || maximumAcceleration > 0. || maximumAngularSpeed > 0. || smoothingHalfWidth > 0;
+  }
+};
+
+class MhaPoseTrack
+{
+public:
+  MhaPoseTrack();
+
+  /// Decomposes the matrices of stream, timestamps has one entry per frame
+  /// (NaN where a frame has none)
+  void build(const MhaTransformStream& stream, const MhaChunkedArray<double>& timestamps);
+  /// Decomposes only the frames of stream after the last one of the track,
+  /// for a sequence that grows. Copies of the track share the frames
+  /// they had.
+  void extend(const MhaTransformStream& stream, const MhaChunkedArray<double>& timestamps);
+
+  int getNumberOfFrames() const { return (int)this->valid.size(); }
+  bool isValid(int frame) const { return this->valid[frame] != 0; }
+  /// Frames whose timestamps increase, query times are mapped through them
+  bool hasTimestamps() const { return this->times.size() >= 2; }
+
+  /// Neighbours further than this many frames apart are not interpolated
+  /// between, 0 (default) for no limit
+  void setMaximumGap(int frames) { this->maximumGap = frames; }
+  int getMaximumGap() const { return this->maximumGap; }
+
+  /// Writes 12 floats (3x4, row major) to matrices and one flag to valid
+  /// for each of the count fractional frame indices. A query is invalid
+  /// outside the first and last valid frame or across a gap that is too long.
+  void interpolateFrames(const double* frames, int count, float* matrices, unsigned char* valid) const;
+  /// Same for times on the frame timestamps, invalid out of their range
+  void interpolateTimes(const double* times, int count, float* matrices, unsigned char* valid) const;
+
+  /// Fractional frame index of time, -1 outside the timestamps
+  double getFrameAtTime(double time) const;
+
+  /// Heap bytes of the decomposed poses and their lookup tables
+  size_t getMemorySize() const;
+
+  /// Outlier flags of filter()
+  enum { Speed = 1, Acceleration = 2, AngularSpeed = 4 };
+  /// Flags valid frames that move faster than the limits both from their
+  /// previous and to their next valid frame, or whose acceleration is above
+  /// the limit and a local peak, so that a single-frame spike flags only
+  /// that frame. result is this track with the flagged frames invalid
+  /// (interpolated over) and smoothed as set.
+  void filter(const MhaPoseFilterSettings& settings, MhaPoseTrack& result, std::vector<unsigned char>& outliers) const;
+  /// Same for this track extended since result and outliers were made
+  /// from it with the same settings: only the frames near the end filtered
+  /// then and the new ones are filtered again. Frames without timestamps
+  /// keep their times of then in a track that has some.
+  void extendFilter(const MhaPoseFilterSettings& settings, MhaPoseTrack& result,
+    std::vector<unsigned char>& outliers) const;
+
+private:
+  void interpolate(double frame, float* matrix, unsigned char& valid) const;
+  /// Neighbours of the frames from first on, and of the earlier ones
+  /// whose next valid frame was not before first
+  void updateNeighbours(int first);
+  /// Takes the size, timestamps and the poses from first on of source
+  void copyFrames(const MhaPoseTrack& source, int first);
+  /// filter() of the frames from first on, into result holding this track
+  /// from first on and its filtered frames before
+  void filterFrames(const MhaPoseFilterSettings& settings, int first, MhaPoseTrack& result,
+    std::vector<unsigned char>& outliers) const;
+
+  MhaChunkedArray<float, 3> translations;
+  MhaChunkedArray<float, 3> scales;
+  /// (w, x, y, z), on the same hemisphere as the previous valid one
+  MhaChunkedArray<float, 4> quaternions;
+  MhaChunkedArray<unsigned char> valid;
+  /// Nearest valid frame at or before / at or after every frame, -1 if none
+  MhaChunkedArray<int> previousValid;
+  MhaChunkedArray<int> nextValid;
+  /// Timestamp of every frame, NaN where there is none
+  MhaChunkedArray<double> frameTimes;
+  /// Increasing timestamps and their frames
+  MhaChunkedArray<double> times;
+  MhaChunkedArray<int> timeFrames;
+  int maximumGap;
+};
+
+#endif
@@ -0,0 +1,79 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+
+// .NAME MhaRandom - small seeded random number generator
+// .SECTION Description
+// SplitMix64: one 64-bit state, fast, and the same sequence for a seed on
+// every platform and standard library, unlike rand() or the distributions
+// of <random>. Not for cryptography.
+
+#ifndef __MhaRandom_h
+#define __MhaRandom_h
+
+// STD includes
+#include <utility>
+
+class MhaRandom
+{
+public:
+  explicit MhaRandom(unsigned long long seed = 0) : state(seed) {}
+
+  void seed(unsigned long long seed) { this->state = seed; }
+
+  unsigned long long next()
+  {
+    unsigned long long z = (this->state += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30))*0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27))*0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+  }
+
+  /// Uniform in [0, count), count > 0
+  int nextInt(int count)
+  {
+    // Multiply-shift of the top 32 bits, the bias is below 2^-32
+    return (int)(((this->next() >> 32)*(unsigned long long)count) >> 32);
+  }
+
+  /// Uniform in [0, 1)
+  double nextDouble()
+  {
+    return (double)(this->next() >> 11)*(1./9007199254740992.);
+  }
+
+  /// Fisher-Yates shuffle of [begin, end)
+  template<typename T>
+  void shuffle(T* begin, T* end)
+  {
+    for(int i = (int)(end - begin) - 1; i > 0; i--)
+      std::swap(begin[i], begin[this->nextInt(i + 1)]);
+  }
+
+  /// Seed of an independent stream derived from seed and key, for results
+  /// that must not depend on the order work is done in
+  static unsigned long long mix(unsigned long long seed, unsigned long long key)
+  {
+    MhaRandom random(seed ^ (key*0xd1b54a32d192ed03ULL));
+    return random.next();
+  }
+
+private:
+  unsigned long long state;
+};
+
+#endif
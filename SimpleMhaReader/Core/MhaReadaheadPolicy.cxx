@@ -0,0 +1,209 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+#include "MhaReadaheadPolicy.h"
+#include "MhaFileUtilities.h"
+#include "MhaFrameCursor.h"
+
+// STD includes
+#include <algorithm>
+
+namespace
+{
+// Weight of the latest interval in the smoothed velocity
+const double velocityWeight = 0.3;
+// A longer pause starts the velocity estimate over
+const double pauseSeconds = 1.;
+// Prefetch request size, the smallest readahead size Linux devices default to
+const long long prefetchChunkSize = 128*1024;
+
+// Prefetches nearest to the play head first, from the end for reverse play
+void prefetchSpan(int fd, long long offset, long long length, bool reverse)
+{
+  long long chunks = (length + prefetchChunkSize - 1)/prefetchChunkSize;
+  for(long long i=0; i<chunks; i++)
+  {
+    long long chunk = reverse ? chunks - 1 - i : i;
+    long long begin = offset + chunk*prefetchChunkSize;
+    prefetchFile(fd, begin, std::min(prefetchChunkSize, offset + length - begin));
+  }
+}
+}
+
+//----------------------------------------------------------------------------
+MhaReadaheadPolicy::MhaReadaheadPolicy()
+{
+  this->playMode = Inferred;
+  this->playStride = 1;
+  this->lookaheadSeconds = 0.5;
+  this->minimumLookaheadBytes = 4*1024*1024;
+  this->maximumLookaheadBytes = 64*1024*1024;
+  this->retainBytes = 64*1024*1024;
+  this->reset();
+}
+
+//----------------------------------------------------------------------------
+void MhaReadaheadPolicy::setPlayMode(PlayMode mode, int stride)
+{
+  this->playMode = mode;
+  this->playStride = std::max(stride, 1);
+}
+
+//----------------------------------------------------------------------------
+void MhaReadaheadPolicy::setLookahead(double seconds, long long minimumBytes, long long maximumBytes)
+{
+  this->lookaheadSeconds = seconds;
+  this->minimumLookaheadBytes = minimumBytes;
+  this->maximumLookaheadBytes = std::max(minimumBytes, maximumBytes);
+}
+
+//----------------------------------------------------------------------------
+void MhaReadaheadPolicy::reset()
+{
+  this->fd = -1;
+  this->advice = -1;
+  this->lastFrame = -1;
+  this->lastDelta = 0;
+  this->step = 0;
+  this->velocity = 0.;
+  this->prefetchedFrame = -1;
+  this->retainedFrame = -1;
+}
+
+//----------------------------------------------------------------------------
+int MhaReadaheadPolicy::inferStep(int delta) const
+{
+  if(this->playMode == Forwards)
+    return this->playStride;
+  if(this->playMode == Backwards)
+    return -this->playStride;
+  if(this->playMode == Random)
+    return 0;
+  // Single steps either way are playback, a repeated jump is strided review
+  if(delta == 1 || delta == -1)
+    return delta;
+  return delta == this->lastDelta ? delta : 0;
+}
+
+//----------------------------------------------------------------------------
+void MhaReadaheadPolicy::frameRead(const MhaFrameCursor& cursor, int frame)
+{
+  // Direct reads do not go through the page cache at all
+  if(cursor.isDirect() || cursor.getFileDescriptor() < 0 || !cursor.getIndex())
+    return;
+  if(cursor.getFileDescriptor() != this->fd)
+  {
+    this->reset();
+    this->fd = cursor.getFileDescriptor();
+  }
+  int delta = this->lastFrame >= 0 ? frame - this->lastFrame : 0;
+  if(this->lastFrame >= 0 && delta == 0)
+    return;
+
+  std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+  if(this->lastFrame >= 0)
+  {
+    double seconds = std::chrono::duration<double>(now - this->lastTime).count();
+    if(seconds >= pauseSeconds)
+      this->velocity = 0.;
+    else if(seconds > 0.)
+      this->velocity = this->velocity > 0. ? (1. - velocityWeight)*this->velocity + velocityWeight/seconds : 1./seconds;
+  }
+  int newStep = this->inferStep(delta);
+  this->lastFrame = frame;
+  this->lastDelta = delta;
+  this->lastTime = now;
+
+  // The kernel follows forward playback by itself and nothing else
+  int access = newStep == 1 ? MhaSequentialAccess : (newStep != 0 || this->playMode == Random ? MhaRandomAccess : MhaNormalAccess);
+  if(access != this->advice)
+  {
+    adviseFileAccess(this->fd, (MhaFileAccess)access);
+    this->advice = access;
+  }
+  if(newStep == 0)
+  {
+    this->step = 0;
+    return;
+  }
+
+  // A new direction or a jump out of the current run, like the wrap-around
+  // of looped playback, starts a new run at frame
+  int direction = newStep > 0 ? 1 : -1;
+  if(newStep != this->step || direction*frame < direction*this->retainedFrame
+    || direction*frame > direction*this->prefetchedFrame + std::abs(newStep))
+  {
+    this->step = newStep;
+    this->prefetchedFrame = frame;
+    this->retainedFrame = frame;
+  }
+
+  long long frameSize = (long long)cursor.getIndex()->getFrameSize();
+  long long windowBytes = std::min(std::max((long long)(this->velocity*this->lookaheadSeconds)*frameSize,
+    this->minimumLookaheadBytes), this->maximumLookaheadBytes);
+  this->prefetch(cursor, frame, std::max((int)(windowBytes/frameSize), 1));
+  this->dropBehind(cursor, frame, (int)(this->retainBytes/frameSize));
+}
+
+//----------------------------------------------------------------------------
+void MhaReadaheadPolicy::prefetch(const MhaFrameCursor& cursor, int frame, int windowFrames)
+{
+  // Topped up in batches once half the window is used, not on every frame
+  int remaining = (this->prefetchedFrame - frame)/this->step;
+  if(2*remaining >= windowFrames)
+    return;
+  const MhaSequenceIndex& index = *cursor.getIndex();
+  long long target = (long long)frame + (long long)this->step*windowFrames;
+  int last = (int)std::min(std::max(target, 0LL), (long long)index.getNumberOfFrames() - 1);
+  int first = this->prefetchedFrame + this->step;
+  if((this->step > 0 && first > last) || (this->step < 0 && first < last))
+    return;
+
+  size_t frameSize = index.getFrameSize();
+  if(std::abs(this->step) == 1)
+  {
+    // One span, reverse spans included
+    int low = std::min(first, last);
+    int count = std::abs(last - first) + 1;
+    prefetchSpan(this->fd, index.getFrameOffset(low), (long long)frameSize*count, this->step < 0);
+  }
+  else
+  {
+    for(int f = first; this->step > 0 ? f <= last : f >= last; f += this->step)
+      prefetchSpan(this->fd, index.getFrameOffset(f), (long long)frameSize, this->step < 0);
+  }
+  this->prefetchedFrame = last;
+}
+
+//----------------------------------------------------------------------------
+void MhaReadaheadPolicy::dropBehind(const MhaFrameCursor& cursor, int frame, int retainFrames)
+{
+  const MhaSequenceIndex& index = *cursor.getIndex();
+  long long frameSize = (long long)index.getFrameSize();
+  if(this->step > 0 && frame - retainFrames > this->retainedFrame)
+  {
+    int count = frame - retainFrames - this->retainedFrame;
+    dropFileCache(this->fd, index.getFrameOffset(this->retainedFrame), frameSize*count);
+    this->retainedFrame = frame - retainFrames;
+  }
+  else if(this->step < 0 && frame + retainFrames < this->retainedFrame)
+  {
+    int count = this->retainedFrame - frame - retainFrames;
+    dropFileCache(this->fd, index.getFrameOffset(frame + retainFrames + 1), frameSize*count);
+    this->retainedFrame = frame + retainFrames;
+  }
+}
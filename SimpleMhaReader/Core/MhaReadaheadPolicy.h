@@ -0,0 +1,87 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+// .NAME MhaReadaheadPolicy - page cache hints that follow the play head
+// .SECTION Description
+// The kernel readahead only recognizes forward sequential reads. This policy
+// watches the frames a cursor reads, together with the play mode when one is
+// known, and works out the step (forwards, backwards or strided) and how many
+// frames per second are visited. It then prefetches the spans of the frames
+// about to be shown, in whichever direction, and drops the pages far behind
+// the play head. For patterns it follows itself, the kernel readahead is
+// turned off so that it does not read in the wrong direction.
+
+#ifndef __MhaReadaheadPolicy_h
+#define __MhaReadaheadPolicy_h
+
+// STD includes
+#include <chrono>
+
+class MhaFrameCursor;
+
+class MhaReadaheadPolicy
+{
+public:
+  /// Inferred from the frames read, or set while playing
+  enum PlayMode { Inferred, Forwards, Backwards, Random };
+
+  MhaReadaheadPolicy();
+
+  void setPlayMode(PlayMode mode, int stride = 1);
+  PlayMode getPlayMode() const { return this->playMode; }
+  /// How far ahead to prefetch, in seconds at the current speed, and the
+  /// bounds of that window in bytes. Frames within retainBytes behind the
+  /// play head stay cached for scrubbing back.
+  void setLookahead(double seconds, long long minimumBytes, long long maximumBytes);
+  void setRetainBytes(long long bytes) { this->retainBytes = bytes; }
+
+  /// Called after cursor read frame, issues the hints for what comes next
+  void frameRead(const MhaFrameCursor& cursor, int frame);
+  /// Forgets the access history, as when another file is opened
+  void reset();
+
+  /// Frame step currently followed, 0 while the access pattern is random
+  int getStep() const { return this->step; }
+  /// Frames visited per second, smoothed
+  double getVelocity() const { return this->velocity; }
+
+private:
+  int inferStep(int delta) const;
+  void prefetch(const MhaFrameCursor& cursor, int frame, int windowFrames);
+  void dropBehind(const MhaFrameCursor& cursor, int frame, int retainFrames);
+
+  PlayMode playMode;
+  int playStride;
+  double lookaheadSeconds;
+  long long minimumLookaheadBytes;
+  long long maximumLookaheadBytes;
+  long long retainBytes;
+
+  int fd;
+  int advice;
+  int lastFrame;
+  int lastDelta;
+  int step;
+  double velocity;
+  std::chrono::steady_clock::time_point lastTime;
+  /// Frames up to here, in the direction of step, are already prefetched
+  int prefetchedFrame;
+  /// Frames from here, against the direction of step, are not dropped yet
+  int retainedFrame;
+};
+
+#endif
@@ -0,0 +1,275 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+#include "MhaSequenceAnalyzer.h"
+#include "MhaFrameCursor.h"
+#include "MhaFrameKernels.h"
+#include "MhaThreadPool.h"
+
+// STD includes
+#include <chrono>
+#include <cstring>
+
+namespace
+{
+// Each worker reads this much per request, the previous frame included
+const size_t chunkSize = 8*1024*1024;
+}
+
+//----------------------------------------------------------------------------
+MhaSequenceAnalyzer::MhaSequenceAnalyzer()
+{
+  this->numberOfFrames = 0;
+  this->tasks = 0;
+  this->blankIntensity = 20;
+  this->blankFraction = 0.02;
+  this->frozenThreshold = 0.01;
+  this->directIO = false;
+  this->running = false;
+  this->complete = false;
+  this->completedTasks = 0;
+  this->cancelled = false;
+  this->framesDone = 0;
+  this->elapsedSeconds = 0.;
+}
+
+//----------------------------------------------------------------------------
+MhaSequenceAnalyzer::~MhaSequenceAnalyzer()
+{
+  this->cancel();
+}
+
+//----------------------------------------------------------------------------
+int MhaSequenceAnalyzer::start(const std::shared_ptr<const MhaSequenceIndex>& index,
+  int tasks, int numberOfThreads)
+{
+  this->cancel();
+  if(!index || index->getNumberOfFrames() <= 0 || !tasks)
+    return 1;
+
+  // Results of earlier passes stay valid for the same frames of the same file
+  const MhaSequenceIndex* previous = this->index.get();
+  if(!previous || index->getPath() != previous->getPath() || index->getDataOffset() != previous->getDataOffset()
+    || index->getFrameSize() != previous->getFrameSize() || index->getNumberOfFrames() != previous->getNumberOfFrames())
+  {
+    this->completedTasks = 0;
+    this->statistics.clear();
+    this->histogram.clear();
+    this->hashes.clear();
+  }
+  this->index = index;
+  int numberOfFrames = index->getNumberOfFrames();
+  this->numberOfFrames = numberOfFrames;
+  this->tasks = tasks;
+  this->completedTasks &= ~tasks;
+  if(tasks & Statistics)
+  {
+    MhaFrameStatistics empty;
+    memset(&empty, 0, sizeof(empty));
+    this->statistics.assign(numberOfFrames, empty);
+    this->histogram.assign(256, 0);
+  }
+  if(tasks & Hashes)
+    this->hashes.assign(numberOfFrames, 0);
+  this->complete = false;
+  this->cancelled = false;
+  this->framesDone = 0;
+  this->elapsedSeconds = 0.;
+  this->running = true;
+  this->thread = std::thread(&MhaSequenceAnalyzer::run, this, numberOfThreads);
+  return 0;
+}
+
+//----------------------------------------------------------------------------
+void MhaSequenceAnalyzer::cancel()
+{
+  this->cancelled = true;
+  if(this->thread.joinable())
+    this->thread.join();
+  this->running = false;
+}
+
+//----------------------------------------------------------------------------
+void MhaSequenceAnalyzer::reset()
+{
+  this->cancel();
+  this->index.reset();
+  this->numberOfFrames = 0;
+  this->tasks = 0;
+  this->complete = false;
+  this->completedTasks = 0;
+  this->framesDone = 0;
+  this->elapsedSeconds = 0.;
+  this->statistics.clear();
+  this->histogram.clear();
+  this->hashes.clear();
+}
+
+//----------------------------------------------------------------------------
+double MhaSequenceAnalyzer::getProgress() const
+{
+  if(this->numberOfFrames <= 0)
+    return 0.;
+  return (double)this->framesDone/(double)this->numberOfFrames;
+}
+
+//----------------------------------------------------------------------------
+void MhaSequenceAnalyzer::setBlankThresholds(int intensity, double fraction)
+{
+  this->blankIntensity = intensity;
+  this->blankFraction = fraction;
+}
+
+//----------------------------------------------------------------------------
+void MhaSequenceAnalyzer::setFrozenThreshold(double meanAbsoluteDifference)
+{
+  this->frozenThreshold = meanAbsoluteDifference;
+}
+
+//----------------------------------------------------------------------------
+unsigned char MhaSequenceAnalyzer::getFrameFlags(int frame) const
+{
+  if(!this->hasResults(Statistics) || frame < 0 || frame >= (int)this->statistics.size())
+    return 0;
+  return this->statistics[frame].flags;
+}
+
+//----------------------------------------------------------------------------
+int MhaSequenceAnalyzer::getNumberOfFlaggedFrames(unsigned char flags) const
+{
+  if(!this->hasResults(Statistics))
+    return 0;
+  int count = 0;
+  for(size_t i=0; i<this->statistics.size(); i++)
+    count += (this->statistics[i].flags & flags) ? 1 : 0;
+  return count;
+}
+
+//----------------------------------------------------------------------------
+int MhaSequenceAnalyzer::getPercentile(double percentile) const
+{
+  unsigned long long total = 0;
+  for(size_t i=0; i<this->histogram.size(); i++)
+    total += this->histogram[i];
+  if(total == 0)
+    return 0;
+  double target = percentile/100.*(double)total;
+  unsigned long long cumulative = 0;
+  for(size_t i=0; i<this->histogram.size(); i++)
+  {
+    cumulative += this->histogram[i];
+    if((double)cumulative >= target)
+      return (int)i;
+  }
+  return 255;
+}
+
+//----------------------------------------------------------------------------
+void MhaSequenceAnalyzer::run(int numberOfThreads)
+{
+  std::chrono::steady_clock::time_point beginTime = std::chrono::steady_clock::now();
+  size_t frameSize = this->index->getFrameSize();
+  int framesPerChunk = chunkSize/frameSize > 1 ? (int)(chunkSize/frameSize) : 1;
+  int numberOfChunks = (this->numberOfFrames + framesPerChunk - 1)/framesPerChunk;
+
+  MhaThreadPool pool(numberOfThreads);
+  int threads = pool.getNumberOfThreads();
+  std::vector<std::unique_ptr<MhaFrameCursor> > cursors(threads);
+  std::vector<std::vector<unsigned char> > buffers(threads);
+  std::vector<std::vector<unsigned long long> > histograms(threads, std::vector<unsigned long long>(256, 0));
+  std::atomic<bool> failed(false);
+
+  pool.parallelFor(numberOfChunks, [&](int chunk, int thread)
+  {
+    if(this->cancelled || failed)
+      return;
+    std::unique_ptr<MhaFrameCursor>& cursor = cursors[thread];
+    if(!cursor)
+      cursor.reset(new MhaFrameCursor(this->index, this->directIO));
+
+    int first = chunk*framesPerChunk;
+    int last = std::min(first + framesPerChunk, this->numberOfFrames);
+    // The frame before the chunk is read too, for the difference of the first one
+    int readFirst = first > 0 && (this->tasks & Statistics) ? first - 1 : first;
+    size_t bytes = (size_t)(last - readFirst)*frameSize;
+    std::vector<unsigned char>& buffer = buffers[thread];
+    if(buffer.size() < bytes)
+      buffer.resize(bytes);
+    if(cursor->readFrames(readFirst, last - readFirst, &buffer[0]))
+    {
+      failed = true;
+      return;
+    }
+
+    unsigned int frameHistogram[256];
+    std::vector<unsigned long long>& threadHistogram = histograms[thread];
+    for(int frame = first; frame < last; frame++)
+    {
+      const unsigned char* pixels = &buffer[(size_t)(frame - readFirst)*frameSize];
+      if(this->tasks & Hashes)
+        this->hashes[frame] = computeFrameHash(pixels, frameSize);
+      if(!(this->tasks & Statistics))
+        continue;
+      MhaFrameStatistics& stats = this->statistics[frame];
+
+      MhaFrameMoments moments;
+      computeFrameMoments(pixels, frameSize, moments);
+      double mean = (double)moments.sum/(double)frameSize;
+      stats.minimum = moments.minimum;
+      stats.maximum = moments.maximum;
+      stats.mean = (float)mean;
+      stats.variance = (float)((double)moments.sumOfSquares/(double)frameSize - mean*mean);
+      stats.meanAbsoluteDifference = frame > 0 ?
+        (float)((double)computeSumOfAbsoluteDifferences(pixels, pixels - frameSize, frameSize)/(double)frameSize) : 0.f;
+
+      memset(frameHistogram, 0, sizeof(frameHistogram));
+      accumulateHistogram(pixels, frameSize, frameHistogram);
+      unsigned long long bright = 0;
+      const int binWidth = 256/MhaFrameStatistics::HistogramBins;
+      for(int value = 0; value < 256; value++)
+      {
+        if(value % binWidth == 0)
+          stats.histogram[value/binWidth] = 0;
+        stats.histogram[value/binWidth] += frameHistogram[value];
+        threadHistogram[value] += frameHistogram[value];
+        if(value > this->blankIntensity)
+          bright += frameHistogram[value];
+      }
+
+      stats.flags = 0;
+      if((double)bright < this->blankFraction*(double)frameSize)
+        stats.flags |= Blank;
+      if(frame > 0 && stats.meanAbsoluteDifference <= this->frozenThreshold)
+        stats.flags |= Frozen;
+    }
+    // Nothing of a single pass is worth keeping in the page cache, direct
+    // reads leave nothing there
+    cursor->dropFrames(readFirst, last - readFirst);
+    this->framesDone += last - first;
+  });
+
+  for(int thread = 0; thread < threads; thread++)
+  {
+    for(int value = 0; value < 256 && (this->tasks & Statistics); value++)
+      this->histogram[value] += histograms[thread][value];
+  }
+  this->elapsedSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - beginTime).count();
+  this->complete = !this->cancelled && !failed;
+  if(this->complete)
+    this->completedTasks |= this->tasks;
+  this->running = false;
+}
@@ -0,0 +1,120 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+// .NAME MhaSequenceAnalyzer - background single pass statistics over a sequence
+// .SECTION Description
+// Streams every frame once on a thread pool and fills a per-frame statistics
+// table (intensity moments, coarse histogram, mean absolute difference from
+// the previous frame) plus a global histogram. Frames where the probe was
+// lifted (Blank) or the grabber stalled (Frozen) are flagged. The same pass
+// can hash every frame to find duplicates.
+
+#ifndef __MhaSequenceAnalyzer_h
+#define __MhaSequenceAnalyzer_h
+
+// STD includes
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+
+class MhaSequenceIndex;
+
+struct MhaFrameStatistics
+{
+  enum { HistogramBins = 16 };
+
+  float mean;
+  float variance;
+  /// Mean absolute difference from the previous frame, 0 for the first one
+  float meanAbsoluteDifference;
+  unsigned char minimum;
+  unsigned char maximum;
+  unsigned char flags;
+  unsigned int histogram[HistogramBins];
+};
+
+class MhaSequenceAnalyzer
+{
+public:
+  /// Frame flags
+  enum { Blank = 1, Frozen = 2 };
+  /// Tasks of a pass
+  enum { Statistics = 1, Hashes = 2 };
+
+  MhaSequenceAnalyzer();
+  ~MhaSequenceAnalyzer();
+
+  /// Starts the analysis of the frames of index in the background,
+  /// cancelling a running one. The index is kept until the next start.
+  int start(const std::shared_ptr<const MhaSequenceIndex>& index,
+    int tasks = Statistics | Hashes, int numberOfThreads = 0);
+  void cancel();
+  /// Cancels a running pass and drops every result, for another file
+  void reset();
+
+  bool isRunning() const { return this->running; }
+  bool isComplete() const { return this->complete; }
+  int getTasks() const { return this->tasks; }
+  /// Results of a task stay available until a pass on another file starts
+  bool hasResults(int task) const { return (this->completedTasks & task) != 0; }
+  double getProgress() const;
+
+  /// A frame is blank when less than fraction of its pixels are above intensity
+  void setBlankThresholds(int intensity, double fraction);
+  /// A frame is frozen when its mean absolute difference is at most this
+  void setFrozenThreshold(double meanAbsoluteDifference);
+  /// Reads bypass the page cache from the next start on, off by default
+  void setDirectIO(bool direct) { this->directIO = direct; }
+
+  /// Results, available once hasResults() of their task
+  const std::vector<MhaFrameStatistics>& getStatistics() const { return this->statistics; }
+  const std::vector<unsigned long long>& getHashes() const { return this->hashes; }
+  unsigned char getFrameFlags(int frame) const;
+  int getNumberOfFlaggedFrames(unsigned char flags) const;
+  /// Intensity below which percentile % of all pixels of the sequence lie
+  int getPercentile(double percentile) const;
+  double getElapsedSeconds() const { return this->elapsedSeconds; }
+
+private:
+  MhaSequenceAnalyzer(const MhaSequenceAnalyzer&); // Not implemented
+  void operator=(const MhaSequenceAnalyzer&);      // Not implemented
+
+  void run(int numberOfThreads);
+
+  std::shared_ptr<const MhaSequenceIndex> index;
+  int numberOfFrames;
+  int tasks;
+  int blankIntensity;
+  double blankFraction;
+  double frozenThreshold;
+  bool directIO;
+
+  std::thread thread;
+  std::atomic<bool> running;
+  std::atomic<bool> complete;
+  std::atomic<int> completedTasks;
+  std::atomic<bool> cancelled;
+  std::atomic<int> framesDone;
+  double elapsedSeconds;
+
+  std::vector<MhaFrameStatistics> statistics;
+  std::vector<unsigned long long> histogram;
+  std::vector<unsigned long long> hashes;
+};
+
+#endif
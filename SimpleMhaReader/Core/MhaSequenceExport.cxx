@@ -0,0 +1,124 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+#include "MhaSequenceExport.h"
+#include "MhaBatchReader.h"
+#include "MhaSequenceIndex.h"
+#include "MhaSequenceWriter.h"
+
+// STD includes
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+//----------------------------------------------------------------------------
+int exportSequence_mha(const std::shared_ptr<const MhaSequenceIndex>& index, const std::string& path,
+  const MhaExportOptions& options, MhaExportResult& result)
+{
+  result = MhaExportResult();
+  if(!index || index->getNumberOfFrames() <= 0)
+    return 1;
+  int numberOfFrames = index->getNumberOfFrames();
+  int width = index->getWidth();
+  int height = index->getHeight();
+  int firstFrame = std::max(options.firstFrame, 0);
+  int lastFrame = options.lastFrame < 0 ? numberOfFrames - 1 : std::min(options.lastFrame, numberOfFrames - 1);
+  int stride = std::max(options.stride, 1);
+  if(lastFrame < firstFrame)
+    return 1;
+  const std::vector<unsigned long long>* hashes = options.frameHashes;
+  if(hashes && hashes->size() != (size_t)numberOfFrames)
+    return 1;
+
+  int extent[4] = { 0, width-1, 0, height-1 };
+  if(options.crop)
+  {
+    extent[0] = std::max(options.cropExtent[0], 0);
+    extent[1] = std::min(options.cropExtent[1], width-1);
+    extent[2] = std::max(options.cropExtent[2], 0);
+    extent[3] = std::min(options.cropExtent[3], height-1);
+    if(extent[1] < extent[0] || extent[3] < extent[2])
+      return 1;
+  }
+  int outWidth = extent[1] - extent[0] + 1;
+  int outHeight = extent[3] - extent[2] + 1;
+
+  std::chrono::steady_clock::time_point beginTime = std::chrono::steady_clock::now();
+  // Frames identical to the one written before, as a stalled grabber delivers
+  // them, are dropped before any read is issued
+  std::vector<int> frames;
+  int previousFrame = -1;
+  for(int frameIndex = firstFrame; frameIndex <= lastFrame; frameIndex += stride)
+  {
+    if(hashes && previousFrame >= 0 && (*hashes)[frameIndex] == (*hashes)[previousFrame])
+    {
+      result.framesSkipped++;
+      continue;
+    }
+    frames.push_back(frameIndex);
+    previousFrame = frameIndex;
+  }
+
+  std::vector<unsigned char> cropped((size_t)outWidth*(size_t)outHeight);
+  const MhaTransformTable& transforms = index->getTransformTable();
+  int bytesPerFrameFields = MhaSequenceWriter::getFrameFieldsSize((int)transforms.streams.size());
+  MhaFilterChain filterChain;
+  configureFilterChain(filterChain, options.filters);
+
+  MhaSequenceWriter writer;
+  int failed = writer.open(path, outWidth, outHeight, (int)frames.size(), bytesPerFrameFields);
+  // Reads stay queued while the frames before them are filtered and written
+  MhaBatchReader reader(index, 32, MhaBatchReader::Automatic, options.directIO);
+  if(!failed && reader.readFrames(frames, [&](int frameIndex, const unsigned char* pixels)
+  {
+    if(failed)
+      return;
+    pixels = filterChain.process(pixels, width, height, frameIndex);
+    if(options.crop)
+    {
+      for(int y=0; y<outHeight; y++)
+        memcpy(&cropped[(size_t)y*outWidth], &pixels[(size_t)(y+extent[2])*width + extent[0]], outWidth);
+      pixels = &cropped[0];
+    }
+    if(frameIndex < (int)transforms.timestamps.size() && !std::isnan(transforms.timestamps[frameIndex]))
+    {
+      char value[32];
+      snprintf(value, sizeof(value), "%.6f", transforms.timestamps[frameIndex]);
+      writer.setFrameField("Timestamp", value);
+    }
+    for(size_t i=0; i<transforms.streams.size(); i++)
+    {
+      const MhaTransformStream& stream = transforms.streams[i];
+      if(frameIndex >= stream.getNumberOfFrames())
+        continue;
+      // A transform without a recorded status is valid, as in MhaPoseTrack
+      unsigned char flags = stream.flags[frameIndex];
+      if(flags & MhaTransformStream::Present)
+        writer.setFrameTransform(stream.name, stream.getMatrix(frameIndex), !(flags & MhaTransformStream::StatusInvalid));
+    }
+    failed = writer.appendFrame(pixels);
+  }, true))
+    failed = 1;
+  if(writer.close())
+    failed = 1;
+
+  result.framesWritten = writer.getNumberOfFrames();
+  result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - beginTime).count();
+  return failed;
+}
@@ -0,0 +1,73 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+// .NAME MhaSequenceExport - copies part of a sequence into a new .mha
+// .SECTION Description
+// Shared by the Slicer module and the command-line tool: frame range and
+// stride, optional crop, the display filters and skipping of duplicate
+// frames. Every transform stream of the source is carried over.
+
+#ifndef __MhaSequenceExport_h
+#define __MhaSequenceExport_h
+
+// STD includes
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "MhaFilterChain.h"
+
+class MhaSequenceIndex;
+
+struct MhaExportOptions
+{
+  MhaExportOptions()
+    : firstFrame(0), lastFrame(-1), stride(1), crop(false), frameHashes(NULL), directIO(false)
+  {
+    cropExtent[0] = cropExtent[1] = cropExtent[2] = cropExtent[3] = 0;
+  }
+
+  int firstFrame;
+  /// -1 for the last frame of the sequence
+  int lastFrame;
+  int stride;
+  bool crop;
+  /// {xmin, xmax, ymin, ymax} in pixels, inclusive
+  int cropExtent[4];
+  MhaFilterSettings filters;
+  /// Hash of every frame; when set, frames identical to the previously
+  /// written one are skipped
+  const std::vector<unsigned long long>* frameHashes;
+  /// Reads bypass the page cache, so a pass over a long sequence does not
+  /// evict what other programs have cached
+  bool directIO;
+};
+
+struct MhaExportResult
+{
+  MhaExportResult() : framesWritten(0), framesSkipped(0), seconds(0.) {}
+
+  int framesWritten;
+  int framesSkipped;
+  double seconds;
+};
+
+/// Reads through its own cursor, so it can run on any thread
+int exportSequence_mha(const std::shared_ptr<const MhaSequenceIndex>& index, const std::string& path,
+  const MhaExportOptions& options, MhaExportResult& result);
+
+#endif
@@ -0,0 +1,348 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+#include "MhaSequenceIndex.h"
+#include "MhaFileUtilities.h"
+
+// STD includes
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <limits>
+
+namespace
+{
+// Returns the stream called name, creating it with room for numberOfFrames
+MhaTransformStream& getTransformStream(MhaTransformTable& table, const std::string& name, int numberOfFrames)
+{
+  int id = table.find(name);
+  if(id < 0)
+  {
+    id = (int)table.streams.size();
+    table.ids[name] = id;
+    table.streams.push_back(MhaTransformStream());
+    MhaTransformStream& stream = table.streams.back();
+    stream.name = name;
+    stream.flags.resize(numberOfFrames, 0);
+    stream.matrices.resize(numberOfFrames, 0.f);
+  }
+  return table.streams[id];
+}
+
+bool endsWith(const char* str, size_t length, const char* suffix, size_t suffixLength)
+{
+  return length > suffixLength && strncmp(str + length - suffixLength, suffix, suffixLength) == 0;
+}
+
+// Whether the ElementDataFile line still ends right at offset, without
+// scanning a header that grows with every frame
+bool hasDataFileLineBefore(const std::string& filename, long long offset)
+{
+  const char dataFileLine[] = "ElementDataFile = LOCAL";
+  char buffer[64];
+  long long start = offset > (long long)sizeof(buffer) - 1 ? offset - (long long)sizeof(buffer) + 1 : 0;
+  size_t size = (size_t)(offset - start);
+  int fd = openFileForReading(filename);
+  if(fd < 0)
+    return false;
+  bool read = readFileAt(fd, start, buffer, size) == 0;
+  closeFile(fd);
+  if(!read || size == 0 || buffer[size - 1] != '\n')
+    return false;
+  buffer[size] = '\0';
+  const char* line = strstr(buffer, dataFileLine);
+  return line && strchr(line, '\n') == &buffer[size - 1];
+}
+}
+
+// =======================================================
+// Reading functions
+// =======================================================
+std::string getDir(const std::string& filename)
+{
+  #ifdef WIN32
+  const char dlmtr = '\\';
+  #else
+  const char dlmtr = '/';
+  #endif
+
+  std::string dirName;
+  size_t pos = filename.rfind(dlmtr);
+  dirName = pos == std::string::npos ? "" : filename.substr(0, pos) + dlmtr;
+  return dirName;
+}
+
+int readImageDimensions_mha(const std::string& filename, int& cols, int& rows, int& count)
+{
+  std::ifstream file( filename.c_str() );
+  if ( !file.is_open() )
+    return 1;
+
+  // Read until get dimensions
+  while( !file.eof() )
+  {
+    std::string str; std::getline( file, str );
+    if( str.empty() ) break;
+    const char *pch = str.c_str();
+
+    if( strstr( pch, "DimSize =" ) )
+    {
+      if( sscanf( pch, "DimSize = %d %d %d", &cols, &rows, &count ) != 3 )
+      {
+        fprintf( stderr, "Error: could not read dimensions\n" );
+        file.close();
+        return 1;
+      }
+      file.close();
+      return 0;
+    }
+  }
+  file.close();
+  return 1;
+}
+
+// Parses every Seq_FrameNNNN_<Name>Transform and Seq_FrameNNNN_<Name>TransformStatus
+// field of the header in a single pass, starting at offset. Only complete lines of
+// frames below numberOfFrames are consumed and offset is left on the first line
+// that was not, so a growing file can be indexed again from there.
+int readImageTransforms_mha(const std::string& filename, int numberOfFrames, MhaTransformTable& table, long long& offset)
+{
+  if(numberOfFrames < 0)
+    numberOfFrames = 0;
+  for(size_t i=0; i<table.streams.size(); i++)
+  {
+    MhaTransformStream& stream = table.streams[i];
+    if(stream.getNumberOfFrames() < numberOfFrames)
+    {
+      stream.flags.resize(numberOfFrames, 0);
+      stream.matrices.resize(numberOfFrames, 0.f);
+    }
+  }
+  if(table.timestamps.size() < (size_t)numberOfFrames)
+    table.timestamps.resize(numberOfFrames, std::numeric_limits<double>::quiet_NaN());
+  // Chunks are written through edit(), which copies those still shared with
+  // an earlier index: only frames not indexed yet are parsed, so that is the
+  // last chunk at most
+
+  std::ifstream file( filename.c_str(), std::ios::binary );
+  if ( !file.is_open() )
+    return 1;
+  file.seekg( offset );
+
+  const char framePrefix[] = "Seq_Frame";
+  const size_t framePrefixLength = sizeof(framePrefix) - 1;
+  const char transformSuffix[] = "Transform";
+  const size_t transformSuffixLength = sizeof(transformSuffix) - 1;
+  const char statusSuffix[] = "TransformStatus";
+  const size_t statusSuffixLength = sizeof(statusSuffix) - 1;
+  const char timestampName[] = "Timestamp";
+  const size_t timestampNameLength = sizeof(timestampName) - 1;
+
+  std::string str;
+  while( std::getline( file, str ) )
+  {
+    // A line without its newline is still being written
+    if( str.empty() || file.eof() ) break;
+    const char *pch = str.c_str();
+
+    if( strncmp( pch, framePrefix, framePrefixLength ) )
+    {
+      if( strstr( pch, "ElementDataFile" ) || !strncmp( pch, "Padding", 7 ) )
+      {
+        // Done reading
+        break;
+      }
+      offset += (long long)str.size() + 1;
+      continue;
+    }
+
+    // Seq_Frame0000_ProbeToTrackerTransform = -0.224009 -0.529064 0.818481 212.75 0.52031 0.6452 0.559459 -14.0417 -0.824074 0.551188 0.130746 -26.1193 0 0 0 1
+    char *fieldName = NULL;
+    long frame = strtol( pch + framePrefixLength, &fieldName, 10 );
+    if( fieldName != pch + framePrefixLength && frame >= numberOfFrames )
+      break;
+    offset += (long long)str.size() + 1;
+    if( fieldName == pch + framePrefixLength || *fieldName != '_' || frame < 0 )
+      continue;
+    fieldName++;
+    const char *equal = strchr( fieldName, '=' );
+    if( !equal )
+      continue;
+    size_t fieldLength = equal - fieldName;
+    while( fieldLength > 0 && fieldName[fieldLength-1] == ' ' )
+      fieldLength--;
+
+    if( fieldLength == timestampNameLength && !strncmp( fieldName, timestampName, timestampNameLength ) )
+    {
+      char *end = NULL;
+      double timestamp = strtod( equal + 1, &end );
+      if( end != equal + 1 )
+        *table.timestamps.edit( frame ) = timestamp;
+      continue;
+    }
+
+    bool isStatus = endsWith( fieldName, fieldLength, statusSuffix, statusSuffixLength );
+    if( !isStatus && !endsWith( fieldName, fieldLength, transformSuffix, transformSuffixLength ) )
+      continue;
+
+    size_t nameLength = fieldLength - (isStatus ? statusSuffixLength : transformSuffixLength);
+    MhaTransformStream& stream = getTransformStream( table, std::string( fieldName, nameLength ), numberOfFrames );
+
+    const char *value = equal + 1;
+    while( *value == ' ' )
+      value++;
+
+    if( isStatus )
+    {
+      if( !strncmp( value, "OK", 2 ) )
+        *stream.flags.edit( frame ) |= MhaTransformStream::StatusOK;
+      else if( !strncmp( value, "INVALID", 7 ) )
+        *stream.flags.edit( frame ) |= MhaTransformStream::StatusInvalid;
+      continue;
+    }
+
+    float *matrix = stream.matrices.edit( frame );
+    char *end = NULL;
+    int j = 0;
+    for( ; j < 12; j++ )
+    {
+      matrix[j] = (float)strtod( value, &end );
+      if( end == value )
+        break;
+      value = end;
+    }
+    if( j == 12 )
+      *stream.flags.edit( frame ) |= MhaTransformStream::Present;
+  }
+  file.close();
+  return 0;
+}
+
+// Offset of the first pixel, right after the ElementDataFile line
+long long readImageDataOffset_mha(const std::string& filename)
+{
+  FILE *infile = fopen( filename.c_str(), "rb" );
+  if( !infile )
+    return -1;
+  char buffer[400];
+  long long offset = -1;
+  while( fgets( buffer, 400, infile ) )
+  {
+    if( strstr( buffer, "ElementDataFile = LOCAL" ) )
+    {
+      #ifdef WIN32
+      offset = _ftelli64( infile );
+      #else
+      offset = ftello( infile );
+      #endif
+      break;
+    }
+  }
+  fclose( infile );
+  return offset;
+}
+
+//----------------------------------------------------------------------------
+MhaSequenceIndex::MhaSequenceIndex()
+{
+  this->width = 0;
+  this->height = 0;
+  this->numberOfFrames = 0;
+  this->dataOffset = -1;
+  this->headerParsedOffset = 0;
+}
+
+//----------------------------------------------------------------------------
+std::shared_ptr<const MhaSequenceIndex> MhaSequenceIndex::load(const std::string& path)
+{
+  int cols = -1, rows = -1, count = -1;
+  if(readImageDimensions_mha(path, cols, rows, count) || cols <= 0 || rows <= 0 || count < 0)
+    return std::shared_ptr<const MhaSequenceIndex>();
+  long long offset = readImageDataOffset_mha(path);
+  if(offset < 0)
+    return std::shared_ptr<const MhaSequenceIndex>();
+
+  std::shared_ptr<MhaSequenceIndex> index(new MhaSequenceIndex);
+  index->path = path;
+  index->width = cols;
+  index->height = rows;
+  index->numberOfFrames = count;
+  index->dataOffset = offset;
+  if(readImageTransforms_mha(path, count, index->transformTable, index->headerParsedOffset))
+    return std::shared_ptr<const MhaSequenceIndex>();
+  index->extendPoseTracks();
+  return index;
+}
+
+//----------------------------------------------------------------------------
+std::shared_ptr<const MhaSequenceIndex> MhaSequenceIndex::extend() const
+{
+  int cols = -1, rows = -1, count = -1;
+  if(readImageDimensions_mha(this->path, cols, rows, count))
+    return std::shared_ptr<const MhaSequenceIndex>();
+  // A writer whose header overflowed rewrites the file with the pixels
+  // further on: offsets and fields parsed so far no longer apply
+  if(cols != this->width || rows != this->height || !hasDataFileLineBefore(this->path, this->dataOffset))
+  {
+    std::shared_ptr<const MhaSequenceIndex> index = MhaSequenceIndex::load(this->path);
+    if(!index || (index->getDataOffset() == this->dataOffset && index->getWidth() == this->width
+      && index->getHeight() == this->height))
+      return std::shared_ptr<const MhaSequenceIndex>();
+    return index;
+  }
+  // DimSize may be ahead of the pixels that actually reached the disk
+  long long framesOnDisk = (getFileSize(this->path) - this->dataOffset)/(long long)this->getFrameSize();
+  if(count > framesOnDisk)
+    count = (int)framesOnDisk;
+  if(count <= this->numberOfFrames)
+    return std::shared_ptr<const MhaSequenceIndex>();
+
+  // Copy on write: the copy shares the chunks of the frames indexed so far
+  // and header parsing resumes where this index stopped
+  std::shared_ptr<MhaSequenceIndex> index(new MhaSequenceIndex(*this));
+  index->numberOfFrames = count;
+  if(readImageTransforms_mha(this->path, count, index->transformTable, index->headerParsedOffset))
+    return std::shared_ptr<const MhaSequenceIndex>();
+  index->extendPoseTracks();
+  return index;
+}
+
+//----------------------------------------------------------------------------
+void MhaSequenceIndex::extendPoseTracks()
+{
+  // Streams first seen in the new frames get a track of their own
+  const MhaTransformTable& table = this->transformTable;
+  this->poseTracks.resize(table.streams.size());
+  for(size_t i=0; i<table.streams.size(); i++)
+    this->poseTracks[i].extend(table.streams[i], table.timestamps);
+}
+
+//----------------------------------------------------------------------------
+size_t MhaSequenceIndex::getMemorySize() const
+{
+  size_t size = this->path.capacity() + this->transformTable.timestamps.getMemorySize();
+  for(size_t i=0; i<this->transformTable.streams.size(); i++)
+  {
+    const MhaTransformStream& stream = this->transformTable.streams[i];
+    // The name is also a key of ids, map nodes take about four pointers more
+    size += sizeof(MhaTransformStream) + 2*stream.name.capacity() + 4*sizeof(void*) + sizeof(int)
+      + stream.matrices.getMemorySize() + stream.flags.getMemorySize();
+  }
+  for(size_t i=0; i<this->poseTracks.size(); i++)
+    size += sizeof(MhaPoseTrack) + this->poseTracks[i].getMemorySize();
+  return size;
+}
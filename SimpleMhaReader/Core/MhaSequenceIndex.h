@@ -0,0 +1,122 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+// .NAME MhaSequenceIndex - immutable index of an uncompressed .mha sequence
+// .SECTION Description
+// Dimensions, pixel data offset and the transforms recorded for every frame,
+// parsed once from the header and decomposed into pose tracks. An index
+// never changes once built, so any number of threads can share it through
+// a shared_ptr without locking; frames are read through MhaFrameCursor.
+// Per-frame values are held in shared chunks, so an extended index shares
+// the frames it already had. Depends on neither Qt, VTK nor MRML, so batch
+// tools can use it without Slicer.
+
+#ifndef __MhaSequenceIndex_h
+#define __MhaSequenceIndex_h
+
+// STD includes
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "MhaChunkedArray.h"
+#include "MhaPoseTrack.h"
+
+/// Per-frame values of one tracked transform (e.g. ProbeToTracker).
+/// Matrices are stored contiguously as 12 floats (3x4, row major) per frame,
+/// flags hold whether the frame had a matrix and its recorded status.
+struct MhaTransformStream
+{
+  enum { Present = 1, StatusOK = 2, StatusInvalid = 4 };
+
+  std::string name;
+  MhaChunkedArray<float, 12> matrices;
+  MhaChunkedArray<unsigned char> flags;
+
+  int getNumberOfFrames() const { return (int)flags.size(); }
+  const float* getMatrix(int frame) const { return matrices.get(frame); }
+};
+
+/// All transform streams of a sequence, interned by name, and the
+/// Seq_FrameNNNN_Timestamp of every frame (NaN where there is none)
+struct MhaTransformTable
+{
+  std::vector<MhaTransformStream> streams;
+  std::map<std::string, int> ids;
+  MhaChunkedArray<double> timestamps;
+
+  void clear() { streams.clear(); ids.clear(); timestamps.clear(); }
+  int find(const std::string& name) const
+  {
+    std::map<std::string, int>::const_iterator it = ids.find(name);
+    return it == ids.end() ? -1 : it->second;
+  }
+};
+
+/// Directory part of filename, with its trailing separator
+std::string getDir(const std::string& filename);
+int readImageDimensions_mha(const std::string& filename, int& cols, int& rows, int& count);
+/// Parses the transform fields of the header from offset on, see the .cxx
+int readImageTransforms_mha(const std::string& filename, int numberOfFrames, MhaTransformTable& table, long long& offset);
+/// Offset of the first pixel, -1 if there is no local pixel data
+long long readImageDataOffset_mha(const std::string& filename);
+
+class MhaSequenceIndex
+{
+public:
+  /// Indexes the sequence at path, NULL if it cannot be read
+  static std::shared_ptr<const MhaSequenceIndex> load(const std::string& path);
+
+  /// Index of the same file including frames appended since this one was
+  /// built, for files that are still being recorded. Only the new frames
+  /// are parsed. A file whose pixel data moved, as when a recording header
+  /// is relocated on close, is indexed again from scratch. NULL if nothing
+  /// changed; this index is left as it is.
+  std::shared_ptr<const MhaSequenceIndex> extend() const;
+
+  const std::string& getPath() const { return this->path; }
+  int getWidth() const { return this->width; }
+  int getHeight() const { return this->height; }
+  int getNumberOfFrames() const { return this->numberOfFrames; }
+  size_t getFrameSize() const { return (size_t)this->width*(size_t)this->height; }
+  long long getDataOffset() const { return this->dataOffset; }
+  long long getFrameOffset(int frame) const { return this->dataOffset + (long long)this->getFrameSize()*frame; }
+  const MhaTransformTable& getTransformTable() const { return this->transformTable; }
+  /// Interpolable poses of transform stream, in the order of the table
+  const MhaPoseTrack& getPoseTrack(int stream) const { return this->poseTracks[stream]; }
+  /// Heap bytes of the transforms, timestamps and pose tracks
+  size_t getMemorySize() const;
+
+private:
+  MhaSequenceIndex();
+
+  /// Decomposes the frames the pose tracks do not have yet
+  void extendPoseTracks();
+
+  std::string path;
+  int width;
+  int height;
+  int numberOfFrames;
+  long long dataOffset;
+  /// Where header parsing resumes in extend()
+  long long headerParsedOffset;
+  MhaTransformTable transformTable;
+  std::vector<MhaPoseTrack> poseTracks;
+};
+
+#endif
@@ -0,0 +1,78 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+#include "MhaSequenceReader.h"
+
+//----------------------------------------------------------------------------
+MhaSequenceReader::MhaSequenceReader()
+{
+}
+
+//----------------------------------------------------------------------------
+MhaSequenceReader::~MhaSequenceReader()
+{
+}
+
+//----------------------------------------------------------------------------
+int MhaSequenceReader::open(const std::string& path)
+{
+  this->close();
+  this->path = path;
+  this->index = MhaSequenceIndex::load(path);
+  if(!this->index)
+    return 1;
+  this->cursor.reset(new MhaFrameCursor(this->index));
+  return 0;
+}
+
+//----------------------------------------------------------------------------
+void MhaSequenceReader::close()
+{
+  this->readahead.reset();
+  this->cursor.reset();
+  this->index.reset();
+}
+
+//----------------------------------------------------------------------------
+int MhaSequenceReader::update()
+{
+  if(!this->index)
+    return 0;
+  std::shared_ptr<const MhaSequenceIndex> extended = this->index->extend();
+  if(!extended)
+    return 0;
+  int newFrames = extended->getNumberOfFrames() - this->index->getNumberOfFrames();
+  this->index = extended;
+  this->cursor.reset(new MhaFrameCursor(this->index));
+  return newFrames;
+}
+
+//----------------------------------------------------------------------------
+int MhaSequenceReader::readFrame(int frame, unsigned char* pixels)
+{
+  if(!this->cursor || this->cursor->readFrames(frame, 1, pixels))
+    return 1;
+  this->readahead.frameRead(*this->cursor, frame);
+  return 0;
+}
+
+//----------------------------------------------------------------------------
+const MhaTransformTable& MhaSequenceReader::getTransformTable() const
+{
+  static const MhaTransformTable empty;
+  return this->index ? this->index->getTransformTable() : empty;
+}
@@ -0,0 +1,79 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+// .NAME MhaSequenceReader - single-owner access to a sequence that may grow
+// .SECTION Description
+// Holds the current MhaSequenceIndex of a file and a cursor on it. update()
+// swaps in an extended index while jobs started earlier keep the snapshot
+// they were given by getIndex(). Frames read through it feed a readahead
+// policy, which keeps the page cache ahead of the play head.
+
+#ifndef __MhaSequenceReader_h
+#define __MhaSequenceReader_h
+
+// STD includes
+#include <memory>
+#include <string>
+
+#include "MhaFrameCursor.h"
+#include "MhaReadaheadPolicy.h"
+#include "MhaSequenceIndex.h"
+
+class MhaSequenceReader
+{
+public:
+  MhaSequenceReader();
+  ~MhaSequenceReader();
+
+  /// Indexes the sequence at path
+  int open(const std::string& path);
+  void close();
+  bool isOpen() const { return this->index != NULL; }
+
+  /// Indexes frames appended since open() or the previous update(), for
+  /// files that are still being recorded. Returns the number of new frames.
+  int update();
+
+  /// Copies frame into pixels, which holds getFrameSize() bytes
+  int readFrame(int frame, unsigned char* pixels);
+
+  /// Play mode and tuning of the page cache hints
+  MhaReadaheadPolicy& getReadaheadPolicy() { return this->readahead; }
+
+  /// Snapshot of the current index, for cursors of other threads
+  std::shared_ptr<const MhaSequenceIndex> getIndex() const { return this->index; }
+
+  const std::string& getPath() const { return this->path; }
+  int getWidth() const { return this->index ? this->index->getWidth() : 0; }
+  int getHeight() const { return this->index ? this->index->getHeight() : 0; }
+  int getNumberOfFrames() const { return this->index ? this->index->getNumberOfFrames() : 0; }
+  size_t getFrameSize() const { return this->index ? this->index->getFrameSize() : 0; }
+  long long getDataOffset() const { return this->index ? this->index->getDataOffset() : -1; }
+  /// Empty while no sequence is open
+  const MhaTransformTable& getTransformTable() const;
+
+private:
+  MhaSequenceReader(const MhaSequenceReader&); // Not implemented
+  void operator=(const MhaSequenceReader&); // Not implemented
+
+  std::string path;
+  std::shared_ptr<const MhaSequenceIndex> index;
+  std::unique_ptr<MhaFrameCursor> cursor;
+  MhaReadaheadPolicy readahead;
+};
+
+#endif
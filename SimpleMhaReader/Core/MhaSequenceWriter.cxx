@@ -0,0 +1,326 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+#include "MhaSequenceWriter.h"
+#include "MhaFileUtilities.h"
+
+// STD includes
+#include <cstring>
+#include <sstream>
+
+namespace
+{
+const char dataFileLine[] = "ElementDataFile = LOCAL\n";
+const char paddingKey[] = "Padding = ";
+// Smallest padding line: key and newline
+const long long minPaddingSize = sizeof(paddingKey);
+// Pixels are written in chunks of at least this size
+const size_t minBufferSize = 32*1024*1024;
+
+// Copies size bytes from the current position of source to target
+bool copyFile(FILE* source, FILE* target, long long size, std::vector<char>& chunk)
+{
+  while(size > 0)
+  {
+    size_t count = size < (long long)chunk.size() ? (size_t)size : chunk.size();
+    if(fread(&chunk[0], 1, count, source) != count || fwrite(&chunk[0], 1, count, target) != count)
+      return true;
+    size -= (long long)count;
+  }
+  return false;
+}
+}
+
+//----------------------------------------------------------------------------
+MhaSequenceWriter::MhaSequenceWriter()
+{
+  this->file = NULL;
+  this->width = 0;
+  this->height = 0;
+  this->frameSize = 0;
+  this->numberOfFrames = 0;
+  this->framesInHeader = 0;
+  this->dimSizeOffset = 0;
+  this->headerCursor = 0;
+  this->reservedEnd = 0;
+  this->dataOffset = 0;
+  this->dataEnd = 0;
+  this->headerOverflow = false;
+  this->bufferUsed = 0;
+}
+
+//----------------------------------------------------------------------------
+MhaSequenceWriter::~MhaSequenceWriter()
+{
+  this->close();
+}
+
+//----------------------------------------------------------------------------
+int MhaSequenceWriter::open(const std::string& path, int width, int height, int reservedFrames, int bytesPerFrameFields)
+{
+  this->close();
+  if(width <= 0 || height <= 0)
+    return 1;
+
+  this->file = fopen(path.c_str(), "wb+");
+  if(!this->file)
+    return 1;
+  // Writes are already large, avoid a second copy through the stdio buffer
+  setvbuf(this->file, NULL, _IONBF, 0);
+
+  this->path = path;
+  this->width = width;
+  this->height = height;
+  this->frameSize = (size_t)width*(size_t)height;
+  this->numberOfFrames = 0;
+  this->framesInHeader = 0;
+  this->headerOverflow = false;
+  this->frameFields.clear();
+  this->pendingFields.clear();
+  this->buffer.resize(this->frameSize > minBufferSize ? this->frameSize : minBufferSize);
+  this->bufferUsed = 0;
+
+  std::ostringstream header;
+  header << "ObjectType = Image\n"
+         << "NDims = 3\n"
+         << "AnatomicalOrientation = RAI\n"
+         << "BinaryData = True\n"
+         << "BinaryDataByteOrderMSB = False\n"
+         << "CenterOfRotation = 0 0 0\n"
+         << "CompressedData = False\n"
+         << "DimSize = " << width << " " << height << " ";
+  this->dimSizeOffset = (long long)header.str().size();
+  // Frame count is patched in place, keep it fixed width
+  header << "0000000000\n"
+         << "ElementNumberOfChannels = 1\n"
+         << "ElementSpacing = 1 1 1\n"
+         << "Offset = 0 0 0\n"
+         << "TransformMatrix = 1 0 0 0 1 0 0 0 1\n"
+         << "UltrasoundImageOrientation = MF\n"
+         << "UltrasoundImageType = BRIGHTNESS\n"
+         << "ElementType = MET_UCHAR\n";
+  std::string headerText = header.str();
+
+  if(reservedFrames < 0)
+    reservedFrames = 0;
+  this->headerCursor = (long long)headerText.size();
+  this->reservedEnd = this->headerCursor + (long long)reservedFrames*bytesPerFrameFields + minPaddingSize;
+  this->dataOffset = this->reservedEnd + (long long)(sizeof(dataFileLine) - 1);
+  this->dataEnd = this->dataOffset;
+
+  if(this->writeAt(0, headerText.c_str(), headerText.size())
+    || this->writePadding()
+    || this->writeAt(this->reservedEnd, dataFileLine, sizeof(dataFileLine) - 1))
+  {
+    fclose(this->file);
+    this->file = NULL;
+    return 1;
+  }
+  return 0;
+}
+
+//----------------------------------------------------------------------------
+void MhaSequenceWriter::setFrameField(const std::string& name, const std::string& value)
+{
+  this->frameFields.push_back(std::make_pair(name, value));
+}
+
+//----------------------------------------------------------------------------
+void MhaSequenceWriter::setFrameTransform(const std::string& name, const float matrix[12], bool valid)
+{
+  // 9 significant digits read back as the same float
+  std::ostringstream oss;
+  oss.precision(9);
+  for(int i=0; i<12; i++)
+    oss << matrix[i] << " ";
+  oss << "0 0 0 1";
+  this->setFrameField(name + "Transform", oss.str());
+  this->setFrameField(name + "TransformStatus", valid ? "OK" : "INVALID");
+}
+
+//----------------------------------------------------------------------------
+bool MhaSequenceWriter::hasHeaderRoomForFrame() const
+{
+  char frameName[32];
+  long long size = (long long)sprintf(frameName, "Seq_Frame%04d_", this->numberOfFrames)*(long long)this->frameFields.size();
+  for(size_t i=0; i<this->frameFields.size(); i++)
+    size += (long long)(this->frameFields[i].first.size() + this->frameFields[i].second.size() + 4);
+  return !this->headerOverflow && this->headerCursor + (long long)this->pendingFields.size() + size + minPaddingSize <= this->reservedEnd;
+}
+
+//----------------------------------------------------------------------------
+int MhaSequenceWriter::appendFrame(const unsigned char* pixels)
+{
+  if(!this->file)
+    return 1;
+
+  // Make room first so a flush never counts a frame whose pixels are not written
+  if(this->bufferUsed + this->frameSize > this->buffer.size())
+  {
+    if(this->flush())
+      return 1;
+  }
+  memcpy(&this->buffer[this->bufferUsed], pixels, this->frameSize);
+  this->bufferUsed += this->frameSize;
+
+  char frameName[32];
+  sprintf(frameName, "Seq_Frame%04d_", this->numberOfFrames);
+  for(size_t i=0; i<this->frameFields.size(); i++)
+  {
+    this->pendingFields += frameName;
+    this->pendingFields += this->frameFields[i].first;
+    this->pendingFields += " = ";
+    this->pendingFields += this->frameFields[i].second;
+    this->pendingFields += "\n";
+  }
+  this->frameFields.clear();
+  this->numberOfFrames++;
+  return 0;
+}
+
+//----------------------------------------------------------------------------
+int MhaSequenceWriter::flush()
+{
+  if(!this->file)
+    return 1;
+  if(this->flushPixels())
+    return 1;
+
+  // Fields go in the reserved area, the padding line shrinks accordingly.
+  // Once it is full they are kept in memory and the header is relocated on close.
+  long long pendingSize = (long long)this->pendingFields.size();
+  if(!this->headerOverflow && pendingSize > 0)
+  {
+    if(this->headerCursor + pendingSize + minPaddingSize <= this->reservedEnd)
+    {
+      if(this->writeAt(this->headerCursor, this->pendingFields.c_str(), this->pendingFields.size()))
+        return 1;
+      this->headerCursor += pendingSize;
+      this->pendingFields.clear();
+      // The rest of the old padding line is already spaces and its newline
+      if(this->writeAt(this->headerCursor, paddingKey, sizeof(paddingKey) - 1))
+        return 1;
+    }
+    else
+      this->headerOverflow = true;
+  }
+
+  // Frame count last, readers never see frames whose pixels or fields are
+  // missing. Frames whose fields did not fit appear once close() relocates
+  // the header.
+  if(!this->headerOverflow)
+    this->framesInHeader = this->numberOfFrames;
+  char count[16];
+  sprintf(count, "%010d", this->framesInHeader);
+  if(this->writeAt(this->dimSizeOffset, count, 10))
+    return 1;
+  return fflush(this->file) ? 1 : 0;
+}
+
+//----------------------------------------------------------------------------
+int MhaSequenceWriter::close()
+{
+  if(!this->file)
+    return 0;
+  int result = this->flush();
+  fclose(this->file);
+  this->file = NULL;
+  if(!result && this->headerOverflow)
+    result = this->relocateHeader();
+  this->buffer.clear();
+  this->pendingFields.clear();
+  return result;
+}
+
+//----------------------------------------------------------------------------
+int MhaSequenceWriter::writeAt(long long offset, const void* data, size_t size)
+{
+  if(seekFile(this->file, offset))
+    return 1;
+  return fwrite(data, 1, size, this->file) == size ? 0 : 1;
+}
+
+//----------------------------------------------------------------------------
+int MhaSequenceWriter::writePadding()
+{
+  // Reservations for long recordings are large, spaces go out in chunks
+  if(this->writeAt(this->headerCursor, paddingKey, sizeof(paddingKey) - 1))
+    return 1;
+  std::string spaces(1024*1024, ' ');
+  long long remaining = this->reservedEnd - this->headerCursor - (long long)(sizeof(paddingKey) - 1) - 1;
+  while(remaining > 0)
+  {
+    size_t count = remaining < (long long)spaces.size() ? (size_t)remaining : spaces.size();
+    if(fwrite(spaces.c_str(), 1, count, this->file) != count)
+      return 1;
+    remaining -= (long long)count;
+  }
+  return fwrite("\n", 1, 1, this->file) == 1 ? 0 : 1;
+}
+
+//----------------------------------------------------------------------------
+int MhaSequenceWriter::flushPixels()
+{
+  if(this->bufferUsed == 0)
+    return 0;
+  if(this->writeAt(this->dataEnd, &this->buffer[0], this->bufferUsed))
+    return 1;
+  this->dataEnd += (long long)this->bufferUsed;
+  this->bufferUsed = 0;
+  return 0;
+}
+
+//----------------------------------------------------------------------------
+int MhaSequenceWriter::relocateHeader()
+{
+  // The reserved header space was too small: copy everything once into a
+  // new file with the complete header
+  FILE* source = fopen(this->path.c_str(), "rb");
+  if(!source)
+    return 1;
+  std::string tmpPath = this->path + ".tmp";
+  FILE* target = fopen(tmpPath.c_str(), "wb");
+  if(!target)
+  {
+    fclose(source);
+    return 1;
+  }
+
+  std::vector<char> chunk(minBufferSize);
+  char count[16];
+  sprintf(count, "%010d", this->numberOfFrames);
+  bool failed = copyFile(source, target, this->dimSizeOffset, chunk)
+    || fwrite(count, 1, 10, target) != 10
+    || seekFile(source, this->dimSizeOffset + 10)
+    || copyFile(source, target, this->headerCursor - this->dimSizeOffset - 10, chunk)
+    || fwrite(this->pendingFields.c_str(), 1, this->pendingFields.size(), target) != this->pendingFields.size()
+    || fwrite(dataFileLine, 1, sizeof(dataFileLine) - 1, target) != sizeof(dataFileLine) - 1
+    || seekFile(source, this->dataOffset)
+    || copyFile(source, target, this->dataEnd - this->dataOffset, chunk);
+  fclose(source);
+  failed = fclose(target) != 0 || failed;
+
+  if(failed)
+  {
+    remove(tmpPath.c_str());
+    return 1;
+  }
+  #ifdef WIN32
+  remove(this->path.c_str());
+  #endif
+  return rename(tmpPath.c_str(), this->path.c_str()) ? 1 : 0;
+}
@@ -0,0 +1,94 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+// .NAME MhaSequenceWriter - streaming writer for Plus compatible .mha sequences
+// .SECTION Description
+// Frames are appended with large sequential writes. Header space is reserved
+// when the file is created so DimSize and the per-frame fields are filled in
+// place and the pixel data is never rewritten.
+
+#ifndef __MhaSequenceWriter_h
+#define __MhaSequenceWriter_h
+
+// STD includes
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+class MhaSequenceWriter
+{
+public:
+  MhaSequenceWriter();
+  ~MhaSequenceWriter();
+
+  /// Creates path for width x height MET_UCHAR frames. The header keeps room
+  /// for reservedFrames frames carrying bytesPerFrameFields bytes of fields.
+  int open(const std::string& path, int width, int height, int reservedFrames, int bytesPerFrameFields = 512);
+  /// Bytes of fields of a frame with a timestamp and numberOfTransforms
+  /// transforms and their status, for names of up to 40 characters
+  static int getFrameFieldsSize(int numberOfTransforms) { return 64 + 320*numberOfTransforms; }
+
+  /// Fields of the next appended frame, written as Seq_FrameNNNN_<name> = <value>
+  void setFrameField(const std::string& name, const std::string& value);
+  void setFrameTransform(const std::string& name, const float matrix[12], bool valid);
+  /// Whether the fields set for the next frame still fit in the reserved
+  /// header. Frames appended past it make close() copy the whole file.
+  bool hasHeaderRoomForFrame() const;
+  int appendFrame(const unsigned char* pixels);
+
+  /// Writes buffered pixels, pending frame fields and DimSize so that
+  /// readers of the file see every frame appended so far. Once the reserved
+  /// header is full, DimSize stays at the frames whose fields it holds.
+  int flush();
+  int close();
+
+  bool isOpen() const { return this->file != NULL; }
+  int getNumberOfFrames() const { return this->numberOfFrames; }
+  long long getDataOffset() const { return this->dataOffset; }
+
+private:
+  MhaSequenceWriter(const MhaSequenceWriter&); // Not implemented
+  void operator=(const MhaSequenceWriter&);    // Not implemented
+
+  int writeAt(long long offset, const void* data, size_t size);
+  int writePadding();
+  int flushPixels();
+  int relocateHeader();
+
+  std::string path;
+  FILE* file;
+  int width;
+  int height;
+  size_t frameSize;
+  int numberOfFrames;
+  /// Frames counted by DimSize in the file
+  int framesInHeader;
+
+  long long dimSizeOffset;
+  long long headerCursor;
+  long long reservedEnd;
+  long long dataOffset;
+  long long dataEnd;
+  bool headerOverflow;
+
+  std::vector<std::pair<std::string, std::string> > frameFields;
+  std::string pendingFields;
+  std::vector<unsigned char> buffer;
+  size_t bufferUsed;
+};
+
+#endif
@@ -0,0 +1,177 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+// .NAME MhaSocket - blocking TCP helpers for the frame stream
+
+#ifndef __MhaSocket_h
+#define __MhaSocket_h
+
+// STD includes
+#include <cstdio>
+#include <cstring>
+#include <string>
+#ifdef WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+typedef SOCKET MhaSocketHandle;
+const MhaSocketHandle invalidSocket = INVALID_SOCKET;
+#else
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+typedef int MhaSocketHandle;
+const MhaSocketHandle invalidSocket = -1;
+#endif
+
+inline void initializeSockets()
+{
+  #ifdef WIN32
+  static bool initialized = false;
+  if(!initialized)
+  {
+    WSADATA data;
+    initialized = WSAStartup(MAKEWORD(2, 2), &data) == 0;
+  }
+  #endif
+}
+
+inline void closeSocket(MhaSocketHandle socket)
+{
+  #ifdef WIN32
+  closesocket(socket);
+  #else
+  close(socket);
+  #endif
+}
+
+/// Unblocks a thread waiting on socket, for closing it from another thread
+inline void shutdownSocket(MhaSocketHandle socket)
+{
+  #ifdef WIN32
+  shutdown(socket, SD_BOTH);
+  #else
+  shutdown(socket, SHUT_RDWR);
+  #endif
+}
+
+/// Frames are large, Nagle only delays the small messages around them
+inline void configureStreamSocket(MhaSocketHandle socket, int bufferSize)
+{
+  int flag = 1;
+  setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, (const char*)&flag, sizeof(flag));
+  setsockopt(socket, SOL_SOCKET, SO_RCVBUF, (const char*)&bufferSize, sizeof(bufferSize));
+  setsockopt(socket, SOL_SOCKET, SO_SNDBUF, (const char*)&bufferSize, sizeof(bufferSize));
+}
+
+/// Connected socket, invalidSocket on failure
+inline MhaSocketHandle connectSocket(const std::string& host, int port)
+{
+  initializeSockets();
+  struct addrinfo hints;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  struct addrinfo* addresses = NULL;
+  char service[16];
+  snprintf(service, sizeof(service), "%d", port);
+  if(getaddrinfo(host.c_str(), service, &hints, &addresses))
+    return invalidSocket;
+  MhaSocketHandle result = invalidSocket;
+  for(struct addrinfo* address = addresses; address && result == invalidSocket; address = address->ai_next)
+  {
+    MhaSocketHandle candidate = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+    if(candidate == invalidSocket)
+      continue;
+    if(connect(candidate, address->ai_addr, (int)address->ai_addrlen) == 0)
+      result = candidate;
+    else
+      closeSocket(candidate);
+  }
+  freeaddrinfo(addresses);
+  return result;
+}
+
+/// Socket listening on port of every interface, invalidSocket on failure
+inline MhaSocketHandle listenSocket(int port)
+{
+  initializeSockets();
+  MhaSocketHandle result = socket(AF_INET, SOCK_STREAM, 0);
+  if(result == invalidSocket)
+    return invalidSocket;
+  int flag = 1;
+  setsockopt(result, SOL_SOCKET, SO_REUSEADDR, (const char*)&flag, sizeof(flag));
+  struct sockaddr_in address;
+  memset(&address, 0, sizeof(address));
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_ANY);
+  address.sin_port = htons((unsigned short)port);
+  if(bind(result, (struct sockaddr*)&address, sizeof(address)) || listen(result, 1))
+  {
+    closeSocket(result);
+    return invalidSocket;
+  }
+  return result;
+}
+
+/// Sends size bytes, 1 if the connection is lost
+inline int sendAll(MhaSocketHandle socket, const void* data, size_t size)
+{
+  const char* source = (const char*)data;
+  while(size > 0)
+  {
+    int chunk = size < (1u << 30) ? (int)size : (1 << 30);
+    #ifdef WIN32
+    int count = send(socket, source, chunk, 0);
+    #else
+    ssize_t count = send(socket, source, chunk, MSG_NOSIGNAL);
+    if(count < 0 && errno == EINTR)
+      continue;
+    #endif
+    if(count <= 0)
+      return 1;
+    source += count;
+    size -= (size_t)count;
+  }
+  return 0;
+}
+
+/// Receives exactly size bytes, 1 if the connection is closed or lost
+inline int receiveAll(MhaSocketHandle socket, void* data, size_t size)
+{
+  char* target = (char*)data;
+  while(size > 0)
+  {
+    int chunk = size < (1u << 30) ? (int)size : (1 << 30);
+    #ifdef WIN32
+    int count = recv(socket, target, chunk, 0);
+    #else
+    ssize_t count = recv(socket, target, chunk, MSG_WAITALL);
+    if(count < 0 && errno == EINTR)
+      continue;
+    #endif
+    if(count <= 0)
+      return 1;
+    target += count;
+    size -= (size_t)count;
+  }
+  return 0;
+}
+
+#endif
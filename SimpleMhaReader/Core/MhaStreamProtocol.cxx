@@ -0,0 +1,144 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+#include "MhaStreamProtocol.h"
+
+// STD includes
+#include <cmath>
+#include <cstring>
+
+namespace
+{
+void putUnsigned(unsigned char* buffer, unsigned long long value, int size)
+{
+  for(int i = size - 1; i >= 0; i--, value >>= 8)
+    buffer[i] = (unsigned char)(value & 0xff);
+}
+
+unsigned long long getUnsigned(const unsigned char* buffer, int size)
+{
+  unsigned long long value = 0;
+  for(int i = 0; i < size; i++)
+    value = (value << 8) | buffer[i];
+  return value;
+}
+
+void putFloat(unsigned char* buffer, float value)
+{
+  unsigned int bits;
+  memcpy(&bits, &value, 4);
+  putUnsigned(buffer, bits, 4);
+}
+
+float getFloat(const unsigned char* buffer)
+{
+  unsigned int bits = (unsigned int)getUnsigned(buffer, 4);
+  float value;
+  memcpy(&value, &bits, 4);
+  return value;
+}
+
+void putString(unsigned char* buffer, const std::string& value, size_t size)
+{
+  memset(buffer, 0, size);
+  memcpy(buffer, value.data(), value.size() < size ? value.size() : size);
+}
+
+std::string getString(const unsigned char* buffer, size_t size)
+{
+  size_t length = 0;
+  while(length < size && buffer[length])
+    length++;
+  return std::string((const char*)buffer, length);
+}
+}
+
+//----------------------------------------------------------------------------
+void packStreamHeader(const MhaStreamHeader& header, unsigned char buffer[58])
+{
+  putUnsigned(buffer, 1, 2);
+  putString(buffer + 2, header.type, 12);
+  putString(buffer + 14, header.deviceName, 20);
+  // 32 bits of seconds and 32 bits of fraction
+  double seconds = floor(header.timestamp);
+  unsigned long long timestamp = ((unsigned long long)seconds << 32) |
+    (unsigned long long)((header.timestamp - seconds)*4294967296.);
+  putUnsigned(buffer + 34, timestamp, 8);
+  putUnsigned(buffer + 42, header.bodySize, 8);
+  putUnsigned(buffer + 50, 0, 8);
+}
+
+//----------------------------------------------------------------------------
+void unpackStreamHeader(const unsigned char buffer[58], MhaStreamHeader& header)
+{
+  header.type = getString(buffer + 2, 12);
+  header.deviceName = getString(buffer + 14, 20);
+  unsigned long long timestamp = getUnsigned(buffer + 34, 8);
+  header.timestamp = (double)(timestamp >> 32) + (double)(timestamp & 0xffffffffull)/4294967296.;
+  header.bodySize = getUnsigned(buffer + 42, 8);
+}
+
+//----------------------------------------------------------------------------
+void packStreamImageHeader(int width, int height, const float matrix[12], unsigned char buffer[72])
+{
+  putUnsigned(buffer, 1, 2);
+  buffer[2] = 1; // components
+  buffer[3] = 3; // unsigned 8-bit
+  buffer[4] = 1; // big endian
+  buffer[5] = 1; // RAS
+  putUnsigned(buffer + 6, (unsigned)width, 2);
+  putUnsigned(buffer + 8, (unsigned)height, 2);
+  putUnsigned(buffer + 10, 1, 2);
+  // Columns i, j, k scaled by the spacing, then the origin
+  for(int column = 0; column < 4; column++)
+    for(int row = 0; row < 3; row++)
+      putFloat(buffer + 12 + 4*(3*column + row), matrix[4*row + column]);
+  // The whole image, no subvolume
+  putUnsigned(buffer + 60, 0, 6);
+  putUnsigned(buffer + 66, (unsigned)width, 2);
+  putUnsigned(buffer + 68, (unsigned)height, 2);
+  putUnsigned(buffer + 70, 1, 2);
+}
+
+//----------------------------------------------------------------------------
+int unpackStreamImageHeader(const unsigned char buffer[72], int& width, int& height)
+{
+  width = (int)getUnsigned(buffer + 6, 2);
+  height = (int)getUnsigned(buffer + 8, 2);
+  int depth = (int)getUnsigned(buffer + 10, 2);
+  if(buffer[2] != 1 || (buffer[3] != 2 && buffer[3] != 3) || depth != 1 || width <= 0 || height <= 0)
+    return 1;
+  // Only whole images
+  return getUnsigned(buffer + 60, 6) != 0 || (int)getUnsigned(buffer + 66, 2) != width ||
+    (int)getUnsigned(buffer + 68, 2) != height ? 1 : 0;
+}
+
+//----------------------------------------------------------------------------
+void packStreamTransform(const float matrix[12], unsigned char buffer[48])
+{
+  for(int column = 0; column < 4; column++)
+    for(int row = 0; row < 3; row++)
+      putFloat(buffer + 4*(3*column + row), matrix[4*row + column]);
+}
+
+//----------------------------------------------------------------------------
+void unpackStreamTransform(const unsigned char buffer[48], float matrix[12])
+{
+  for(int column = 0; column < 4; column++)
+    for(int row = 0; row < 3; row++)
+      matrix[4*row + column] = getFloat(buffer + 4*(3*column + row));
+}
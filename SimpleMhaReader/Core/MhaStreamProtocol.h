@@ -0,0 +1,61 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+// .NAME MhaStreamProtocol - OpenIGTLink style messages of the frame stream
+// .SECTION Description
+// Every message is a 58 byte big-endian header (version, type, device
+// name, timestamp, body size, CRC) followed by its body. IMAGE bodies are
+// a 72 byte image header and 8-bit single component pixels; TRANSFORM
+// bodies are the 3x3 rotation column by column and the translation, as 12
+// floats. The CRC is sent as 0 and not checked, the stream is meant for
+// loopback and local networks.
+
+#ifndef __MhaStreamProtocol_h
+#define __MhaStreamProtocol_h
+
+// STD includes
+#include <cstddef>
+#include <string>
+
+const size_t streamHeaderSize = 58;
+const size_t streamImageHeaderSize = 72;
+const size_t streamTransformSize = 48;
+
+struct MhaStreamHeader
+{
+  /// Message type, IMAGE or TRANSFORM
+  std::string type;
+  std::string deviceName;
+  /// Seconds
+  double timestamp;
+  unsigned long long bodySize;
+};
+
+void packStreamHeader(const MhaStreamHeader& header, unsigned char buffer[58]);
+void unpackStreamHeader(const unsigned char buffer[58], MhaStreamHeader& header);
+
+/// Image header of width x height 8-bit pixels; matrix (3x4, row major) is
+/// the image to world transform, spacing included
+void packStreamImageHeader(int width, int height, const float matrix[12], unsigned char buffer[72]);
+/// 1 for images this stream does not carry (not 2D, 8-bit, one component)
+int unpackStreamImageHeader(const unsigned char buffer[72], int& width, int& height);
+
+/// matrix is 3x4, row major
+void packStreamTransform(const float matrix[12], unsigned char buffer[48]);
+void unpackStreamTransform(const unsigned char buffer[48], float matrix[12]);
+
+#endif
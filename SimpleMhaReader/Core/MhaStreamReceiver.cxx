@@ -0,0 +1,364 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+#include "MhaStreamReceiver.h"
+#include "MhaStreamProtocol.h"
+
+// STD includes
+#include <algorithm>
+#include <cstdio>
+
+namespace
+{
+// path for the first file of a recording, <path>_N.mha for the next ones
+std::string getRecordingFilePath(const std::string& path, int file)
+{
+  if(file <= 1)
+    return path;
+  size_t dot = path.rfind('.');
+  size_t separator = path.find_last_of("/\\");
+  if(dot == std::string::npos || (separator != std::string::npos && dot < separator))
+    dot = path.size();
+  char suffix[16];
+  snprintf(suffix, sizeof(suffix), "_%d", file);
+  return path.substr(0, dot) + suffix + path.substr(dot);
+}
+}
+
+//----------------------------------------------------------------------------
+const float* MhaStreamFrame::getTransform(const std::string& name) const
+{
+  for(size_t i = 0; i < this->transformNames.size(); i++)
+    if(this->transformNames[i] == name)
+      return &this->transforms[12*i];
+  return NULL;
+}
+
+//----------------------------------------------------------------------------
+MhaStreamReceiver::MhaStreamReceiver()
+{
+  this->queueLength = 4;
+  this->overflow = DropOldest;
+  // Half an hour at 60 frames/s
+  this->recordingCapacity = 108000;
+  this->socket = invalidSocket;
+  this->connected = false;
+  this->stopping = false;
+  this->nextNumber = 0;
+  this->recordingFrameSize = 0;
+  this->recordingFiles = 0;
+}
+
+//----------------------------------------------------------------------------
+MhaStreamReceiver::~MhaStreamReceiver()
+{
+  this->disconnect();
+}
+
+//----------------------------------------------------------------------------
+int MhaStreamReceiver::connect(const std::string& host, int port)
+{
+  this->disconnect();
+  this->socket = connectSocket(host, port);
+  if(this->socket == invalidSocket)
+  {
+    this->error = "Could not connect to " + host;
+    return 1;
+  }
+  // Room for a few large frames in flight
+  configureStreamSocket(this->socket, 16 << 20);
+  this->statistics = MhaStreamStatistics();
+  this->error.clear();
+  this->nextNumber = 0;
+  this->recordingFiles = 0;
+  this->streamTransformNames.clear();
+  this->pendingNames.clear();
+  this->pendingTransforms.clear();
+  this->stopping = false;
+  this->connected = true;
+  this->thread = std::thread(&MhaStreamReceiver::receiveLoop, this);
+  return 0;
+}
+
+//----------------------------------------------------------------------------
+void MhaStreamReceiver::disconnect()
+{
+  if(this->thread.joinable())
+  {
+    this->stopping = true;
+    shutdownSocket(this->socket);
+    this->queueSpace.notify_all();
+    this->thread.join();
+  }
+  if(this->socket != invalidSocket)
+    closeSocket(this->socket);
+  this->socket = invalidSocket;
+  this->connected = false;
+  std::lock_guard<std::mutex> lock(this->mutex);
+  for(size_t i = 0; i < this->queue.size(); i++)
+    this->pool.release(this->queue[i].pixels);
+  this->queue.clear();
+}
+
+//----------------------------------------------------------------------------
+void MhaStreamReceiver::fail(const std::string& error)
+{
+  std::lock_guard<std::mutex> lock(this->mutex);
+  if(this->error.empty() && !this->stopping)
+    this->error = error;
+}
+
+//----------------------------------------------------------------------------
+void MhaStreamReceiver::receiveLoop()
+{
+  unsigned char headerBuffer[streamHeaderSize];
+  while(!this->stopping)
+  {
+    if(receiveAll(this->socket, headerBuffer, streamHeaderSize))
+    {
+      this->fail("Connection closed");
+      break;
+    }
+    MhaStreamHeader header;
+    unpackStreamHeader(headerBuffer, header);
+    if(header.type == "IMAGE")
+    {
+      if(this->receiveImage(header.bodySize, header.timestamp))
+        break;
+    }
+    else if(header.type == "TRANSFORM" && header.bodySize >= streamTransformSize)
+    {
+      unsigned char body[streamTransformSize];
+      float matrix[12];
+      if(receiveAll(this->socket, body, streamTransformSize) || this->skip(header.bodySize - streamTransformSize))
+      {
+        this->fail("Connection closed");
+        break;
+      }
+      unpackStreamTransform(body, matrix);
+      // The device name is the transform name, as in ProbeToTracker
+      size_t i = std::find(this->pendingNames.begin(), this->pendingNames.end(), header.deviceName) - this->pendingNames.begin();
+      if(i == this->pendingNames.size())
+      {
+        this->pendingNames.push_back(header.deviceName);
+        this->pendingTransforms.resize(12*this->pendingNames.size());
+        if(std::find(this->streamTransformNames.begin(), this->streamTransformNames.end(), header.deviceName)
+          == this->streamTransformNames.end())
+          this->streamTransformNames.push_back(header.deviceName);
+      }
+      std::copy(matrix, matrix + 12, &this->pendingTransforms[12*i]);
+    }
+    else if(this->skip(header.bodySize))
+    {
+      this->fail("Connection closed");
+      break;
+    }
+  }
+  if(this->writer.isOpen())
+    this->writer.close();
+  this->connected = false;
+}
+
+//----------------------------------------------------------------------------
+int MhaStreamReceiver::receiveImage(unsigned long long bodySize, double timestamp)
+{
+  unsigned char imageHeader[streamImageHeaderSize];
+  int width, height;
+  if(bodySize < streamImageHeaderSize || receiveAll(this->socket, imageHeader, streamImageHeaderSize))
+  {
+    this->fail("Connection closed");
+    return 1;
+  }
+  unsigned long long pixelBytes = bodySize - streamImageHeaderSize;
+  if(unpackStreamImageHeader(imageHeader, width, height) || pixelBytes != (unsigned long long)width*height)
+  {
+    // Images of other kinds are passed over
+    return this->skip(pixelBytes);
+  }
+  size_t frameSize = (size_t)width*height;
+  if(this->pool.getFrameSize() != frameSize)
+    this->pool.setFrameSize(frameSize);
+
+  {
+    std::unique_lock<std::mutex> lock(this->mutex);
+    if(this->overflow == Block)
+    {
+      // Not reading the socket holds the sender back
+      while(!this->stopping && (int)this->queue.size() >= this->queueLength)
+        this->queueSpace.wait(lock);
+      if(this->stopping)
+        return 1;
+    }
+    else if((int)this->queue.size() >= this->queueLength)
+    {
+      this->pool.release(this->queue.front().pixels);
+      this->queue.pop_front();
+      this->statistics.dropped++;
+    }
+  }
+
+  MhaStreamFrame frame;
+  frame.pixels = this->pool.acquire();
+  if(!frame.pixels)
+  {
+    this->fail("Out of memory for frames");
+    return 1;
+  }
+  if(receiveAll(this->socket, frame.pixels, frameSize))
+  {
+    this->pool.release(frame.pixels);
+    this->fail("Connection closed");
+    return 1;
+  }
+  frame.width = width;
+  frame.height = height;
+  frame.timestamp = timestamp;
+  frame.number = this->nextNumber++;
+  frame.transformNames.swap(this->pendingNames);
+  frame.transforms.swap(this->pendingTransforms);
+  this->pendingNames.clear();
+  this->pendingTransforms.clear();
+
+  bool recorded = false;
+  if(!this->recordingPath.empty())
+  {
+    // The file takes the geometry of the first frame
+    if(!this->writer.isOpen() && frame.number == 0 && !this->openRecordingFile(frame))
+      this->recordingFrameSize = frameSize;
+    if(this->writer.isOpen() && frameSize == this->recordingFrameSize)
+    {
+      this->setRecordingFields(frame);
+      // Frames past the reserved header would make disconnect() copy the
+      // whole recording on close: the next file takes them instead, also
+      // if a transform seen late made fields outgrow the reservation
+      if(this->writer.getNumberOfFrames() >= this->recordingCapacity
+        || (!this->writer.hasHeaderRoomForFrame() && this->writer.getNumberOfFrames() > 0))
+      {
+        this->writer.close();
+        if(!this->openRecordingFile(frame))
+          this->setRecordingFields(frame);
+      }
+      recorded = this->writer.isOpen() && this->writer.appendFrame(frame.pixels) == 0;
+    }
+  }
+
+  std::lock_guard<std::mutex> lock(this->mutex);
+  this->queue.push_back(frame);
+  this->statistics.received++;
+  this->statistics.bytes += (long long)(streamHeaderSize + bodySize);
+  this->statistics.recorded += recorded ? 1 : 0;
+  return 0;
+}
+
+//----------------------------------------------------------------------------
+int MhaStreamReceiver::openRecordingFile(const MhaStreamFrame& frame)
+{
+  // Every transform the stream has sent so far, and at least a few: INVALID
+  // transforms are not sent, the first frames may come without them
+  int numberOfTransforms = std::max((int)this->streamTransformNames.size(), 4);
+  int bytesPerFrameFields = MhaSequenceWriter::getFrameFieldsSize(numberOfTransforms);
+  std::string path = getRecordingFilePath(this->recordingPath, this->recordingFiles + 1);
+  if(this->writer.open(path, frame.width, frame.height, this->recordingCapacity, bytesPerFrameFields))
+  {
+    this->fail("Could not record to " + path);
+    return 1;
+  }
+  this->recordingFiles++;
+  std::lock_guard<std::mutex> lock(this->mutex);
+  this->statistics.recordingFiles = this->recordingFiles;
+  return 0;
+}
+
+//----------------------------------------------------------------------------
+void MhaStreamReceiver::setRecordingFields(const MhaStreamFrame& frame)
+{
+  char value[32];
+  snprintf(value, sizeof(value), "%.6f", frame.timestamp);
+  this->writer.setFrameField("Timestamp", value);
+  for(size_t i = 0; i < frame.transformNames.size(); i++)
+    this->writer.setFrameTransform(frame.transformNames[i], &frame.transforms[12*i], true);
+}
+
+//----------------------------------------------------------------------------
+int MhaStreamReceiver::skip(unsigned long long size)
+{
+  unsigned char buffer[65536];
+  while(size > 0)
+  {
+    size_t chunk = size < sizeof(buffer) ? (size_t)size : sizeof(buffer);
+    if(receiveAll(this->socket, buffer, chunk))
+      return 1;
+    size -= chunk;
+  }
+  return 0;
+}
+
+//----------------------------------------------------------------------------
+bool MhaStreamReceiver::takeFrame(MhaStreamFrame& frame)
+{
+  {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    if(this->queue.empty())
+      return false;
+    frame = this->queue.front();
+    this->queue.pop_front();
+  }
+  this->queueSpace.notify_one();
+  return true;
+}
+
+//----------------------------------------------------------------------------
+bool MhaStreamReceiver::takeNewestFrame(MhaStreamFrame& frame)
+{
+  {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    if(this->queue.empty())
+      return false;
+    while(this->queue.size() > 1)
+    {
+      this->pool.release(this->queue.front().pixels);
+      this->queue.pop_front();
+      this->statistics.skipped++;
+    }
+    frame = this->queue.front();
+    this->queue.pop_front();
+  }
+  this->queueSpace.notify_one();
+  return true;
+}
+
+//----------------------------------------------------------------------------
+void MhaStreamReceiver::releaseFrame(MhaStreamFrame& frame)
+{
+  if(frame.pixels)
+    this->pool.release(frame.pixels);
+  frame.pixels = NULL;
+}
+
+//----------------------------------------------------------------------------
+MhaStreamStatistics MhaStreamReceiver::getStatistics() const
+{
+  std::lock_guard<std::mutex> lock(this->mutex);
+  return this->statistics;
+}
+
+//----------------------------------------------------------------------------
+std::string MhaStreamReceiver::getError() const
+{
+  std::lock_guard<std::mutex> lock(this->mutex);
+  return this->error;
+}
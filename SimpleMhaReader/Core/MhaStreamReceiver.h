@@ -0,0 +1,158 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+// .NAME MhaStreamReceiver - frames and transforms from a live socket stream
+// .SECTION Description
+// Connects to a server sending MhaStreamProtocol messages, as Plus does,
+// and decodes on its own thread. Pixels are received straight into slabs
+// of a frame pool, which the consumer gets without a copy and hands back
+// with releaseFrame(). TRANSFORM messages received since the previous
+// image go with the next one. Decoded frames wait in a bounded queue:
+// when it is full the oldest frame is dropped, or with Block the socket is
+// not read until there is room, which holds the sender back through TCP.
+// Frames can also be appended to a sequence file as they arrive; when the
+// header room reserved for their fields runs out, recording goes on in a
+// new file rather than relocating the header of a long recording.
+
+#ifndef __MhaStreamReceiver_h
+#define __MhaStreamReceiver_h
+
+// STD includes
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "MhaFramePool.h"
+#include "MhaSequenceWriter.h"
+#include "MhaSocket.h"
+
+struct MhaStreamFrame
+{
+  MhaStreamFrame() : pixels(NULL), width(0), height(0), timestamp(0.), number(-1) {}
+
+  /// Slab of the pool of the receiver, NULL for no frame
+  unsigned char* pixels;
+  int width;
+  int height;
+  double timestamp;
+  /// Position in the stream, from 0
+  long long number;
+  /// Transforms received with the frame, 12 floats (3x4, row major) each
+  std::vector<std::string> transformNames;
+  std::vector<float> transforms;
+
+  /// Matrix of the named transform, NULL if it did not come with the frame
+  const float* getTransform(const std::string& name) const;
+};
+
+struct MhaStreamStatistics
+{
+  MhaStreamStatistics() : received(0), dropped(0), skipped(0), recorded(0), recordingFiles(0), bytes(0) {}
+
+  long long received;
+  /// Dropped when the queue was full
+  long long dropped;
+  /// Replaced by a newer frame before the consumer took them
+  long long skipped;
+  long long recorded;
+  /// Files the recorded frames went to, see setRecordingCapacity()
+  int recordingFiles;
+  long long bytes;
+};
+
+class MhaStreamReceiver
+{
+public:
+  enum Overflow { DropOldest, Block };
+
+  MhaStreamReceiver();
+  /// Disconnects; every frame taken has to be released before
+  ~MhaStreamReceiver();
+
+  /// Frames are appended to path when not empty; set before connecting
+  void setRecordingPath(const std::string& path) { this->recordingPath = path; }
+  /// Frames per recording file, half an hour at 60 frames/s by default.
+  /// Later frames go to <path>_2.mha and so on; a file also ends early if
+  /// the fields of its frames outgrow the header room reserved for them.
+  void setRecordingCapacity(int frames) { this->recordingCapacity = frames > 1 ? frames : 1; }
+  void setQueueLength(int frames) { this->queueLength = frames > 1 ? frames : 1; }
+  void setOverflow(Overflow overflow) { this->overflow = overflow; }
+
+  /// Connects and starts receiving, 1 if the server cannot be reached
+  int connect(const std::string& host, int port);
+  void disconnect();
+  /// False once the server closed the connection or sent something unreadable
+  bool isConnected() const { return this->connected; }
+
+  /// Oldest queued frame, false if none
+  bool takeFrame(MhaStreamFrame& frame);
+  /// Newest queued frame, the older ones are released and counted as skipped
+  bool takeNewestFrame(MhaStreamFrame& frame);
+  /// Returns the pixels of a taken frame to the pool
+  void releaseFrame(MhaStreamFrame& frame);
+
+  MhaStreamStatistics getStatistics() const;
+  /// Bytes reserved by the frame pool, and returning its unused arenas
+  size_t getMemorySize() const { return (size_t)this->pool.getStatistics().reservedBytes; }
+  void trim() { this->pool.trim(); }
+  std::string getError() const;
+
+private:
+  MhaStreamReceiver(const MhaStreamReceiver&); // Not implemented
+  void operator=(const MhaStreamReceiver&); // Not implemented
+
+  void receiveLoop();
+  int receiveImage(unsigned long long bodySize, double timestamp);
+  int openRecordingFile(const MhaStreamFrame& frame);
+  void setRecordingFields(const MhaStreamFrame& frame);
+  int skip(unsigned long long size);
+  void fail(const std::string& error);
+
+  std::string recordingPath;
+  int recordingCapacity;
+  int queueLength;
+  Overflow overflow;
+
+  MhaSocketHandle socket;
+  std::thread thread;
+  std::atomic<bool> connected;
+  std::atomic<bool> stopping;
+
+  MhaFramePool pool;
+  MhaSequenceWriter writer;
+  /// Frames of another geometry are not recorded
+  size_t recordingFrameSize;
+  int recordingFiles;
+  /// Names of every transform received since connecting
+  std::vector<std::string> streamTransformNames;
+  /// Transforms of the next frame
+  std::vector<std::string> pendingNames;
+  std::vector<float> pendingTransforms;
+  long long nextNumber;
+
+  mutable std::mutex mutex;
+  std::condition_variable queueSpace;
+  std::deque<MhaStreamFrame> queue;
+  MhaStreamStatistics statistics;
+  std::string error;
+};
+
+#endif
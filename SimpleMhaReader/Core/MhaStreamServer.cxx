@@ -0,0 +1,134 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+#include "MhaStreamServer.h"
+#include "MhaFrameCursor.h"
+#include "MhaStreamProtocol.h"
+
+// STD includes
+#include <chrono>
+#include <cmath>
+#include <thread>
+
+//----------------------------------------------------------------------------
+MhaStreamServer::MhaStreamServer()
+{
+  this->listener = invalidSocket;
+  this->client = invalidSocket;
+  this->stopping = false;
+  this->sentFrames = 0;
+}
+
+//----------------------------------------------------------------------------
+MhaStreamServer::~MhaStreamServer()
+{
+  if(this->client != invalidSocket)
+    closeSocket(this->client);
+  if(this->listener != invalidSocket)
+    closeSocket(this->listener);
+}
+
+//----------------------------------------------------------------------------
+int MhaStreamServer::listen(int port)
+{
+  if(this->listener != invalidSocket)
+    closeSocket(this->listener);
+  this->listener = listenSocket(port);
+  return this->listener == invalidSocket ? 1 : 0;
+}
+
+//----------------------------------------------------------------------------
+void MhaStreamServer::stop()
+{
+  this->stopping = true;
+  if(this->client != invalidSocket)
+    shutdownSocket(this->client);
+  if(this->listener != invalidSocket)
+    shutdownSocket(this->listener);
+}
+
+//----------------------------------------------------------------------------
+int MhaStreamServer::serve(const std::shared_ptr<const MhaSequenceIndex>& index, double framesPerSecond, bool loop)
+{
+  if(this->listener == invalidSocket || !index || index->getNumberOfFrames() <= 0)
+    return 1;
+  this->client = accept(this->listener, NULL, NULL);
+  if(this->client == invalidSocket)
+    return 1;
+  configureStreamSocket(this->client, 16 << 20);
+
+  MhaFrameCursor cursor(index);
+  const MhaTransformTable& table = index->getTransformTable();
+  int width = index->getWidth();
+  int height = index->getHeight();
+  size_t frameSize = index->getFrameSize();
+  const float identity[12] = { 1.f, 0.f, 0.f, 0.f, 0.f, 1.f, 0.f, 0.f, 0.f, 0.f, 1.f, 0.f };
+  unsigned char header[streamHeaderSize];
+  unsigned char body[streamImageHeaderSize];
+  std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+  long long sent = 0;
+  int result = 0;
+  do
+  {
+    for(int frame = 0; frame < index->getNumberOfFrames() && result == 0; frame++)
+    {
+      if(this->stopping)
+      {
+        result = 1;
+        break;
+      }
+      if(framesPerSecond > 0.)
+        std::this_thread::sleep_until(startTime + std::chrono::microseconds((long long)(1e6*sent/framesPerSecond)));
+      double timestamp = frame < (int)table.timestamps.size() && !std::isnan(table.timestamps[frame]) ?
+        table.timestamps[frame] : std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+      MhaStreamHeader message;
+      message.timestamp = timestamp;
+      for(size_t i = 0; i < table.streams.size() && result == 0; i++)
+      {
+        const MhaTransformStream& stream = table.streams[i];
+        if(frame >= stream.getNumberOfFrames() || !(stream.flags[frame] & MhaTransformStream::Present) ||
+          (stream.flags[frame] & MhaTransformStream::StatusInvalid))
+          continue;
+        message.type = "TRANSFORM";
+        message.deviceName = stream.name;
+        message.bodySize = streamTransformSize;
+        packStreamHeader(message, header);
+        packStreamTransform(stream.getMatrix(frame), body);
+        result = sendAll(this->client, header, streamHeaderSize) || sendAll(this->client, body, streamTransformSize);
+      }
+      const unsigned char* pixels = cursor.readFrame(frame);
+      if(result || !pixels)
+      {
+        result = 1;
+        break;
+      }
+      message.type = "IMAGE";
+      message.deviceName = "Image";
+      message.bodySize = streamImageHeaderSize + frameSize;
+      packStreamHeader(message, header);
+      packStreamImageHeader(width, height, identity, body);
+      result = sendAll(this->client, header, streamHeaderSize) || sendAll(this->client, body, streamImageHeaderSize) ||
+        sendAll(this->client, pixels, frameSize);
+      if(result == 0)
+        this->sentFrames = ++sent;
+    }
+  }
+  while(loop && result == 0);
+  closeSocket(this->client);
+  this->client = invalidSocket;
+  return result;
+}
@@ -0,0 +1,63 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+// .NAME MhaStreamServer - replays a sequence as a live frame stream
+// .SECTION Description
+// Sends the frames of a sequence to one client with MhaStreamProtocol, at a
+// given frame rate: the transforms of each frame (named after their
+// stream, valid ones only), then the image. Pixels go from the read buffer
+// of a frame cursor to the socket. Meant for testing receivers over
+// loopback.
+
+#ifndef __MhaStreamServer_h
+#define __MhaStreamServer_h
+
+// STD includes
+#include <atomic>
+#include <memory>
+
+#include "MhaSequenceIndex.h"
+#include "MhaSocket.h"
+
+class MhaStreamServer
+{
+public:
+  MhaStreamServer();
+  ~MhaStreamServer();
+
+  /// Listens on port, 1 on failure
+  int listen(int port);
+  /// Waits for a client and sends it the frames of index at framesPerSecond
+  /// (0 for as fast as it reads them), over and over with loop. Returns 0
+  /// once every frame was sent, 1 when the client left or stop() was called.
+  int serve(const std::shared_ptr<const MhaSequenceIndex>& index, double framesPerSecond, bool loop);
+  /// From another thread, ends serve()
+  void stop();
+
+  long long getNumberOfSentFrames() const { return this->sentFrames; }
+
+private:
+  MhaStreamServer(const MhaStreamServer&); // Not implemented
+  void operator=(const MhaStreamServer&); // Not implemented
+
+  MhaSocketHandle listener;
+  MhaSocketHandle client;
+  std::atomic<bool> stopping;
+  std::atomic<long long> sentFrames;
+};
+
+#endif
@@ -0,0 +1,104 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+#include "MhaThreadPool.h"
+
+//----------------------------------------------------------------------------
+MhaThreadPool::MhaThreadPool(int numberOfThreads)
+{
+  if(numberOfThreads <= 0)
+    numberOfThreads = (int)std::thread::hardware_concurrency();
+  if(numberOfThreads <= 0)
+    numberOfThreads = 1;
+
+  this->job = NULL;
+  this->nextIndex = 0;
+  this->count = 0;
+  this->activeWorkers = 0;
+  this->generation = 0;
+  this->stopping = false;
+  for(int i=1; i<numberOfThreads; i++)
+    this->workers.push_back(std::thread(&MhaThreadPool::workerLoop, this, i));
+}
+
+//----------------------------------------------------------------------------
+MhaThreadPool::~MhaThreadPool()
+{
+  {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->stopping = true;
+  }
+  this->wakeUp.notify_all();
+  for(size_t i=0; i<this->workers.size(); i++)
+    this->workers[i].join();
+}
+
+//----------------------------------------------------------------------------
+void MhaThreadPool::parallelFor(int count, const std::function<void(int, int)>& function)
+{
+  if(count <= 0)
+    return;
+  // One loop at a time, callers from several threads queue up here
+  std::lock_guard<std::mutex> callLock(this->callMutex);
+  {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->job = &function;
+    this->count = count;
+    this->nextIndex = 0;
+    this->activeWorkers = (int)this->workers.size();
+    this->generation++;
+  }
+  this->wakeUp.notify_all();
+
+  this->runJob(0);
+
+  std::unique_lock<std::mutex> lock(this->mutex);
+  while(this->activeWorkers > 0)
+    this->finished.wait(lock);
+  this->job = NULL;
+}
+
+//----------------------------------------------------------------------------
+void MhaThreadPool::workerLoop(int thread)
+{
+  unsigned int seenGeneration = 0;
+  while(true)
+  {
+    {
+      std::unique_lock<std::mutex> lock(this->mutex);
+      while(!this->stopping && this->generation == seenGeneration)
+        this->wakeUp.wait(lock);
+      if(this->stopping)
+        return;
+      seenGeneration = this->generation;
+    }
+
+    this->runJob(thread);
+
+    std::lock_guard<std::mutex> lock(this->mutex);
+    if(--this->activeWorkers == 0)
+      this->finished.notify_all();
+  }
+}
+
+//----------------------------------------------------------------------------
+void MhaThreadPool::runJob(int thread)
+{
+  int index;
+  while((index = this->nextIndex++) < this->count)
+    (*this->job)(index, thread);
+}
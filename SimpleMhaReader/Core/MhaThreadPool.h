@@ -0,0 +1,67 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+// .NAME MhaThreadPool - fixed set of worker threads for parallel loops
+// .SECTION Description
+// parallelFor() hands out indices dynamically to the workers and to the
+// calling thread, and returns once every index has been processed.
+
+#ifndef __MhaThreadPool_h
+#define __MhaThreadPool_h
+
+// STD includes
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class MhaThreadPool
+{
+public:
+  /// 0 threads means one per hardware thread
+  explicit MhaThreadPool(int numberOfThreads = 0);
+  ~MhaThreadPool();
+
+  int getNumberOfThreads() const { return (int)this->workers.size() + 1; }
+
+  /// Calls function(index, thread) for every index in [0, count).
+  /// thread is in [0, getNumberOfThreads()), 0 being the calling thread.
+  void parallelFor(int count, const std::function<void(int, int)>& function);
+
+private:
+  MhaThreadPool(const MhaThreadPool&); // Not implemented
+  void operator=(const MhaThreadPool&); // Not implemented
+
+  void workerLoop(int thread);
+  void runJob(int thread);
+
+  std::vector<std::thread> workers;
+  std::mutex callMutex;
+  std::mutex mutex;
+  std::condition_variable wakeUp;
+  std::condition_variable finished;
+  const std::function<void(int, int)>* job;
+  std::atomic<int> nextIndex;
+  int count;
+  int activeWorkers;
+  unsigned int generation;
+  bool stopping;
+};
+
+#endif
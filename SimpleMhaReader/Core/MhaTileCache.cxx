@@ -0,0 +1,286 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+#include "MhaTileCache.h"
+#include "MhaFileUtilities.h"
+#include "MhaFrameCursor.h"
+
+// STD includes
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+
+namespace
+{
+const char magic[8] = { 'M', 'H', 'A', 'T', 'I', 'L', 'E', '1' };
+const long long headerSize = sizeof(magic) + sizeof(MhaFrameHashesKey) + sizeof(long long);
+// Frames transposed per pass of the build
+const size_t buildChunkSize = 32*1024*1024;
+// Bytes of a tile read per request of an extraction
+const size_t extractChunkSize = 4*1024*1024;
+
+struct LineSample
+{
+  int tile;
+  int offset;
+  int sample;
+
+  bool operator<(const LineSample& other) const
+  {
+    return this->tile != other.tile ? this->tile < other.tile : this->offset < other.offset;
+  }
+};
+}
+
+//----------------------------------------------------------------------------
+std::string getTileCachePath(const std::string& path)
+{
+  return path + ".tiles";
+}
+
+//----------------------------------------------------------------------------
+MhaTileCache::MhaTileCache()
+{
+  memset(&this->key, 0, sizeof(this->key));
+  this->width = 0;
+  this->height = 0;
+  this->numberOfFrames = 0;
+  this->tileSize = 0;
+  this->tilesX = 0;
+  this->tilesY = 0;
+  this->directIO = false;
+  this->fd = -1;
+  this->running = false;
+  this->ready = false;
+  this->cancelled = false;
+  this->framesDone = 0;
+  this->elapsedSeconds = 0.;
+}
+
+//----------------------------------------------------------------------------
+MhaTileCache::~MhaTileCache()
+{
+  this->close();
+}
+
+//----------------------------------------------------------------------------
+int MhaTileCache::start(const std::shared_ptr<const MhaSequenceIndex>& index, int tileSize)
+{
+  this->close();
+  if(!index || index->getNumberOfFrames() <= 0 || tileSize < 1)
+    return 1;
+  if(makeFrameHashesKey(index->getPath(), index->getDataOffset(), index->getWidth(), index->getHeight(),
+    index->getNumberOfFrames(), this->key))
+    return 1;
+  this->index = index;
+  this->path = getTileCachePath(index->getPath());
+  this->width = index->getWidth();
+  this->height = index->getHeight();
+  this->numberOfFrames = index->getNumberOfFrames();
+  this->tileSize = tileSize;
+  this->tilesX = (this->width + tileSize - 1)/tileSize;
+  this->tilesY = (this->height + tileSize - 1)/tileSize;
+  // Tiles on the right and bottom edges are cut to the image
+  this->tileOffsets.resize(this->tilesX*this->tilesY + 1);
+  this->tileOffsets[0] = headerSize;
+  for(int tile = 0; tile < this->tilesX*this->tilesY; tile++)
+  {
+    long long tileWidth = std::min(tileSize, this->width - (tile % this->tilesX)*tileSize);
+    long long tileHeight = std::min(tileSize, this->height - (tile / this->tilesX)*tileSize);
+    this->tileOffsets[tile + 1] = this->tileOffsets[tile] + tileWidth*tileHeight*this->numberOfFrames;
+  }
+
+  this->cancelled = false;
+  this->elapsedSeconds = 0.;
+  if(!this->openCache())
+  {
+    this->framesDone = this->numberOfFrames;
+    this->ready = true;
+    return 0;
+  }
+  this->framesDone = 0;
+  this->running = true;
+  this->thread = std::thread(&MhaTileCache::build, this);
+  return 0;
+}
+
+//----------------------------------------------------------------------------
+void MhaTileCache::close()
+{
+  this->cancelled = true;
+  if(this->thread.joinable())
+    this->thread.join();
+  this->running = false;
+  this->ready = false;
+  if(this->fd >= 0)
+    closeFile(this->fd);
+  this->fd = -1;
+}
+
+//----------------------------------------------------------------------------
+double MhaTileCache::getProgress() const
+{
+  if(this->numberOfFrames <= 0)
+    return 0.;
+  return (double)this->framesDone/(double)this->numberOfFrames;
+}
+
+//----------------------------------------------------------------------------
+int MhaTileCache::openCache()
+{
+  if(getFileSize(this->path) != this->tileOffsets.back())
+    return 1;
+  int cacheFd = openFileForReading(this->path);
+  if(cacheFd < 0)
+    return 1;
+  char header[headerSize];
+  MhaFrameHashesKey fileKey;
+  long long fileTileSize = 0;
+  bool failed = readFileAt(cacheFd, 0, header, sizeof(header))
+    || memcmp(header, magic, sizeof(magic));
+  if(!failed)
+  {
+    memcpy(&fileKey, header + sizeof(magic), sizeof(fileKey));
+    memcpy(&fileTileSize, header + sizeof(magic) + sizeof(fileKey), sizeof(fileTileSize));
+    failed = !(fileKey == this->key) || fileTileSize != this->tileSize;
+  }
+  if(failed)
+  {
+    closeFile(cacheFd);
+    return 1;
+  }
+  this->fd = cacheFd;
+  return 0;
+}
+
+//----------------------------------------------------------------------------
+void MhaTileCache::build()
+{
+  std::chrono::steady_clock::time_point beginTime = std::chrono::steady_clock::now();
+  // Written under another name so that an interrupted build is never taken
+  // for a cache
+  std::string partPath = this->path + ".part";
+  FILE* file = fopen(partPath.c_str(), "wb");
+  long long tileSize = this->tileSize;
+  bool failed = !file
+    || fwrite(magic, 1, sizeof(magic), file) != sizeof(magic)
+    || fwrite(&this->key, sizeof(this->key), 1, file) != 1
+    || fwrite(&tileSize, sizeof(tileSize), 1, file) != 1;
+
+  size_t frameSize = this->index->getFrameSize();
+  int framesPerChunk = buildChunkSize/frameSize > 1 ? (int)(buildChunkSize/frameSize) : 1;
+  framesPerChunk = std::min(framesPerChunk, this->numberOfFrames);
+  size_t largestTileBytes = (size_t)std::min(this->tileSize, this->width)*std::min(this->tileSize, this->height);
+  MhaFrameCursor cursor(this->index, this->directIO);
+  std::vector<unsigned char> frames(failed ? 0 : (size_t)framesPerChunk*frameSize);
+  std::vector<unsigned char> tile(failed ? 0 : (size_t)framesPerChunk*largestTileBytes);
+  for(int first = 0; first < this->numberOfFrames && !failed && !this->cancelled; first += framesPerChunk)
+  {
+    int count = std::min(framesPerChunk, this->numberOfFrames - first);
+    if(cursor.readFrames(first, count, &frames[0]))
+    {
+      failed = true;
+      break;
+    }
+    // Every tile of the chunk becomes one write at its place in the column
+    // of that tile
+    for(int tileIndex = 0; tileIndex < this->tilesX*this->tilesY && !failed; tileIndex++)
+    {
+      int x0 = (tileIndex % this->tilesX)*this->tileSize;
+      int y0 = (tileIndex / this->tilesX)*this->tileSize;
+      int tileWidth = std::min(this->tileSize, this->width - x0);
+      int tileHeight = std::min(this->tileSize, this->height - y0);
+      size_t tileBytes = (size_t)tileWidth*tileHeight;
+      unsigned char* output = &tile[0];
+      for(int frame = 0; frame < count; frame++)
+      {
+        const unsigned char* input = &frames[frame*frameSize + (size_t)y0*this->width + x0];
+        for(int row = 0; row < tileHeight; row++, input += this->width, output += tileWidth)
+          memcpy(output, input, tileWidth);
+      }
+      failed = seekFile(file, this->tileOffsets[tileIndex] + (long long)first*tileBytes)
+        || fwrite(&tile[0], 1, count*tileBytes, file) != count*tileBytes;
+    }
+    cursor.dropFrames(first, count);
+    this->framesDone += count;
+  }
+
+  failed = (file && fclose(file) != 0) || failed || this->cancelled;
+  if(!failed)
+  {
+    #ifdef WIN32
+    remove(this->path.c_str());
+    #endif
+    failed = rename(partPath.c_str(), this->path.c_str()) != 0 || this->openCache();
+  }
+  if(failed)
+    remove(partPath.c_str());
+  this->elapsedSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - beginTime).count();
+  this->ready = !failed;
+  this->running = false;
+}
+
+//----------------------------------------------------------------------------
+int MhaTileCache::extractLine(double x0, double y0, double x1, double y1, int numberOfSamples,
+  int firstFrame, int lastFrame, unsigned char* pixels) const
+{
+  if(!this->ready || numberOfSamples < 1 || firstFrame < 0 || lastFrame >= this->numberOfFrames || lastFrame < firstFrame)
+    return 1;
+  int frames = lastFrame - firstFrame + 1;
+
+  // Samples sorted by tile, each tile is then read once
+  std::vector<LineSample> samples(numberOfSamples);
+  for(int i = 0; i < numberOfSamples; i++)
+  {
+    double t = numberOfSamples > 1 ? (double)i/(numberOfSamples - 1) : 0.;
+    int x = std::min(std::max((int)floor(x0 + t*(x1 - x0) + 0.5), 0), this->width - 1);
+    int y = std::min(std::max((int)floor(y0 + t*(y1 - y0) + 0.5), 0), this->height - 1);
+    int tileX = x/this->tileSize;
+    int tileY = y/this->tileSize;
+    int tileWidth = std::min(this->tileSize, this->width - tileX*this->tileSize);
+    samples[i].tile = tileY*this->tilesX + tileX;
+    samples[i].offset = (y - tileY*this->tileSize)*tileWidth + x - tileX*this->tileSize;
+    samples[i].sample = i;
+  }
+  std::sort(samples.begin(), samples.end());
+
+  std::vector<unsigned char> buffer;
+  for(size_t begin = 0, end; begin < samples.size(); begin = end)
+  {
+    int tileIndex = samples[begin].tile;
+    for(end = begin + 1; end < samples.size() && samples[end].tile == tileIndex; end++)
+      ;
+    size_t tileBytes = (size_t)((this->tileOffsets[tileIndex + 1] - this->tileOffsets[tileIndex])/this->numberOfFrames);
+    int framesPerRead = extractChunkSize/tileBytes > 1 ? (int)(extractChunkSize/tileBytes) : 1;
+    buffer.resize(std::min(framesPerRead, frames)*tileBytes);
+    for(int first = firstFrame; first <= lastFrame; first += framesPerRead)
+    {
+      int count = std::min(framesPerRead, lastFrame + 1 - first);
+      if(readFileAt(this->fd, this->tileOffsets[tileIndex] + (long long)first*tileBytes, &buffer[0], count*tileBytes))
+        return 1;
+      for(size_t i = begin; i < end; i++)
+      {
+        const unsigned char* input = &buffer[samples[i].offset];
+        unsigned char* output = pixels + (size_t)samples[i].sample*frames + (first - firstFrame);
+        for(int frame = 0; frame < count; frame++, input += tileBytes)
+          output[frame] = *input;
+      }
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,101 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+// .NAME MhaTileCache - time-major copy of a sequence for lines over time
+// .SECTION Description
+// The frames of a sequence are transposed in the background into
+// <file>.tiles, where each tileSize x tileSize block of the image is stored
+// for every frame one after the other. A line sampled over all frames (an
+// M-mode image) is then read as one contiguous run per tile the line crosses
+// instead of a strided read touching every frame of the sequence. The cache
+// is reused as long as the sequence is unchanged.
+
+#ifndef __MhaTileCache_h
+#define __MhaTileCache_h
+
+// STD includes
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "MhaFrameHashes.h"
+
+class MhaSequenceIndex;
+
+std::string getTileCachePath(const std::string& path);
+
+class MhaTileCache
+{
+public:
+  MhaTileCache();
+  ~MhaTileCache();
+
+  /// Opens the cache of the frames of index when it is up to date, otherwise
+  /// starts building it in the background. Closes the previous cache.
+  int start(const std::shared_ptr<const MhaSequenceIndex>& index, int tileSize = 32);
+  /// Stops a running build and closes the cache
+  void close();
+
+  bool isRunning() const { return this->running; }
+  /// Lines can be extracted
+  bool isReady() const { return this->ready; }
+  double getProgress() const;
+  /// Time spent building the cache, 0 when it was up to date
+  double getElapsedSeconds() const { return this->elapsedSeconds; }
+  /// Frames are read bypassing the page cache from the next start on
+  void setDirectIO(bool direct) { this->directIO = direct; }
+
+  int getNumberOfFrames() const { return this->numberOfFrames; }
+
+  /// Samples the nearest pixel of numberOfSamples points evenly spread from
+  /// (x0, y0) to (x1, y1) in frames firstFrame..lastFrame. pixels holds one
+  /// row per sample with one column per frame.
+  int extractLine(double x0, double y0, double x1, double y1, int numberOfSamples,
+    int firstFrame, int lastFrame, unsigned char* pixels) const;
+
+private:
+  MhaTileCache(const MhaTileCache&); // Not implemented
+  void operator=(const MhaTileCache&); // Not implemented
+
+  int openCache();
+  void build();
+
+  std::shared_ptr<const MhaSequenceIndex> index;
+  std::string path;
+  MhaFrameHashesKey key;
+  int width;
+  int height;
+  int numberOfFrames;
+  int tileSize;
+  int tilesX;
+  int tilesY;
+  /// File offset of the frames of every tile, row by row of tiles
+  std::vector<long long> tileOffsets;
+  bool directIO;
+  int fd;
+
+  std::thread thread;
+  std::atomic<bool> running;
+  std::atomic<bool> ready;
+  std::atomic<bool> cancelled;
+  std::atomic<int> framesDone;
+  double elapsedSeconds;
+};
+
+#endif
@@ -0,0 +1,427 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+
+#include "MhaTrainingLoader.h"
+#include "MhaFileUtilities.h"
+#include "MhaFrameCursor.h"
+#include "MhaRandom.h"
+#include "MhaSequenceIndex.h"
+
+// STD includes
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#ifndef WIN32
+#include <sys/mman.h>
+#endif
+
+namespace
+{
+const float identity[12] = { 1.f, 0.f, 0.f, 0.f, 0.f, 1.f, 0.f, 0.f, 0.f, 0.f, 1.f, 0.f };
+
+// Page-locked memory is never swapped out and can be copied to a GPU
+// without staging; locking fails beyond RLIMIT_MEMLOCK
+bool lockMemory(void* memory, size_t size)
+{
+  #ifdef WIN32
+  (void)memory; (void)size;
+  return false;
+  #else
+  return mlock(memory, size) == 0;
+  #endif
+}
+
+void unlockMemory(void* memory, size_t size)
+{
+  #ifdef WIN32
+  (void)memory; (void)size;
+  #else
+  munlock(memory, size);
+  #endif
+}
+}
+
+struct MhaTrainingLoader::Slot
+{
+  unsigned char* pixels;
+  size_t size;
+  bool locked;
+  std::vector<int> frames;
+  std::vector<float> poses;
+  std::vector<unsigned char> valid;
+  /// Batch number filled into the slot, -1 before the first
+  long long batch;
+  int numberOfSamples;
+  int samplesDone;
+};
+
+//----------------------------------------------------------------------------
+MhaTrainingLoader::MhaTrainingLoader()
+{
+  this->transform = -1;
+  this->sampleWidth = 0;
+  this->sampleHeight = 0;
+  this->batchesPerEpoch = 0;
+  this->pinned = false;
+  this->claimBatch = 0;
+  this->claimSample = 0;
+  this->consumedBatch = 0;
+  this->holdingBatch = false;
+  this->stopping = false;
+  this->failed = false;
+}
+
+//----------------------------------------------------------------------------
+MhaTrainingLoader::~MhaTrainingLoader()
+{
+  this->stop();
+}
+
+//----------------------------------------------------------------------------
+int MhaTrainingLoader::start(const std::shared_ptr<const MhaSequenceIndex>& index, const MhaTrainingOptions& options)
+{
+  this->stop();
+  if(!index || index->getNumberOfFrames() <= 0 || options.batchSize < 1 || options.stride < 1)
+    return 1;
+  int numberOfFrames = index->getNumberOfFrames();
+  int firstFrame = std::max(options.firstFrame, 0);
+  int lastFrame = options.lastFrame < 0 ? numberOfFrames - 1 : std::min(options.lastFrame, numberOfFrames - 1);
+  if(firstFrame > lastFrame)
+    return 1;
+
+  const MhaTransformTable& table = index->getTransformTable();
+  this->transform = options.transformName.empty() ? -1 : table.find(options.transformName);
+  if(options.validOnly && this->transform < 0)
+    return 1;
+  this->samples.clear();
+  for(int frame = firstFrame; frame <= lastFrame; frame += options.stride)
+  {
+    if(options.validOnly)
+    {
+      const MhaTransformStream& stream = table.streams[this->transform];
+      unsigned char flags = frame < stream.getNumberOfFrames() ? stream.flags[frame] : 0;
+      if(!(flags & MhaTransformStream::Present) || !(flags & MhaTransformStream::StatusOK))
+        continue;
+    }
+    this->samples.push_back(frame);
+  }
+  int numberOfSamples = (int)this->samples.size();
+  this->batchesPerEpoch = options.dropLast ? numberOfSamples/options.batchSize
+    : (numberOfSamples + options.batchSize - 1)/options.batchSize;
+  if(this->batchesPerEpoch <= 0)
+    return 1;
+
+  this->options = options;
+  if(options.crop)
+  {
+    this->options.cropExtent[0] = std::min(std::max(options.cropExtent[0], 0), index->getWidth() - 1);
+    this->options.cropExtent[1] = std::min(std::max(options.cropExtent[1], this->options.cropExtent[0]), index->getWidth() - 1);
+    this->options.cropExtent[2] = std::min(std::max(options.cropExtent[2], 0), index->getHeight() - 1);
+    this->options.cropExtent[3] = std::min(std::max(options.cropExtent[3], this->options.cropExtent[2]), index->getHeight() - 1);
+  }
+  else
+  {
+    this->options.cropExtent[0] = 0;
+    this->options.cropExtent[1] = index->getWidth() - 1;
+    this->options.cropExtent[2] = 0;
+    this->options.cropExtent[3] = index->getHeight() - 1;
+  }
+  this->index = index;
+  this->sampleWidth = this->options.cropExtent[1] - this->options.cropExtent[0] + 1;
+  this->sampleHeight = this->options.cropExtent[3] - this->options.cropExtent[2] + 1;
+
+  // One slot is held by the consumer, the others are filled ahead
+  size_t batchBytes = (size_t)options.batchSize*this->sampleWidth*this->sampleHeight;
+  batchBytes = (batchBytes + directIOAlignment - 1)/directIOAlignment*directIOAlignment;
+  int numberOfSlots = std::max(options.prefetchBatches, 1) + 1;
+  this->pinned = true;
+  for(int i = 0; i < numberOfSlots; i++)
+  {
+    Slot* slot = new Slot;
+    this->slots.push_back(slot);
+    slot->pixels = allocateAlignedBuffer(batchBytes);
+    slot->size = batchBytes;
+    if(!slot->pixels)
+    {
+      this->freeSlots();
+      return 1;
+    }
+    slot->locked = lockMemory(slot->pixels, batchBytes);
+    this->pinned = this->pinned && slot->locked;
+    slot->frames.resize(options.batchSize);
+    slot->poses.resize(12*options.batchSize);
+    slot->valid.resize(options.batchSize);
+    slot->batch = -1;
+    slot->numberOfSamples = 0;
+    slot->samplesDone = 0;
+  }
+
+  this->claimBatch = 0;
+  this->claimSample = 0;
+  this->consumedBatch = 0;
+  this->holdingBatch = false;
+  this->stopping = false;
+  this->failed = false;
+  this->statistics = MhaTrainingStatistics();
+  this->startTime = std::chrono::steady_clock::now();
+  int numberOfThreads = options.numberOfThreads > 0 ? options.numberOfThreads
+    : std::max((int)std::thread::hardware_concurrency(), 1);
+  for(int thread = 0; thread < numberOfThreads; thread++)
+    this->workers.push_back(std::thread(&MhaTrainingLoader::workerLoop, this));
+  return 0;
+}
+
+//----------------------------------------------------------------------------
+void MhaTrainingLoader::stop()
+{
+  {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->stopping = true;
+  }
+  this->slotFree.notify_all();
+  this->slotFilled.notify_all();
+  for(size_t i = 0; i < this->workers.size(); i++)
+    this->workers[i].join();
+  this->workers.clear();
+  this->freeSlots();
+  this->orders.clear();
+}
+
+//----------------------------------------------------------------------------
+void MhaTrainingLoader::freeSlots()
+{
+  for(size_t i = 0; i < this->slots.size(); i++)
+  {
+    Slot* slot = this->slots[i];
+    if(slot->pixels && slot->locked)
+      unlockMemory(slot->pixels, slot->size);
+    if(slot->pixels)
+      freeAlignedBuffer(slot->pixels);
+    delete slot;
+  }
+  this->slots.clear();
+}
+
+//----------------------------------------------------------------------------
+int MhaTrainingLoader::getNumberOfBatches() const
+{
+  return this->batchesPerEpoch;
+}
+
+//----------------------------------------------------------------------------
+const std::vector<int>& MhaTrainingLoader::getOrder(int epoch)
+{
+  std::map<int, std::vector<int> >::iterator it = this->orders.find(epoch);
+  if(it != this->orders.end())
+    return it->second;
+  std::vector<int>& order = this->orders[epoch];
+  order = this->samples;
+  MhaRandom random(MhaRandom::mix(this->options.seed, (unsigned long long)epoch));
+  if(this->options.order == MhaTrainingOptions::Shuffled)
+    random.shuffle(&order[0], &order[0] + order.size());
+  else if(this->options.order == MhaTrainingOptions::Stratified)
+  {
+    // Runs of consecutive frames, shuffled on their own, then dealt one
+    // frame of each run per batch
+    int numberOfSamples = (int)order.size();
+    int runs = std::min(this->options.batchSize, numberOfSamples);
+    std::vector<int> bounds(runs + 1);
+    for(int run = 0; run <= runs; run++)
+      bounds[run] = (int)((long long)run*numberOfSamples/runs);
+    for(int run = 0; run < runs; run++)
+      random.shuffle(&order[bounds[run]], &order[0] + bounds[run + 1]);
+    std::vector<int> dealt;
+    dealt.reserve(numberOfSamples);
+    for(int position = 0; (int)dealt.size() < numberOfSamples; position++)
+      for(int run = 0; run < runs; run++)
+        if(bounds[run] + position < bounds[run + 1])
+          dealt.push_back(order[bounds[run] + position]);
+    order.swap(dealt);
+  }
+  return order;
+}
+
+//----------------------------------------------------------------------------
+void MhaTrainingLoader::workerLoop()
+{
+  MhaFrameCursor cursor(this->index, this->options.directIO);
+  bool advised = false;
+  std::unique_lock<std::mutex> lock(this->mutex);
+  while(true)
+  {
+    this->slotFree.wait(lock, [this]()
+    {
+      return this->stopping || this->failed || this->claimBatch < this->consumedBatch + (long long)this->slots.size();
+    });
+    if(this->stopping || this->failed)
+      return;
+
+    // Claim the next sample of the batch being filled
+    long long batch = this->claimBatch;
+    Slot& slot = *this->slots[batch % (long long)this->slots.size()];
+    int epoch = (int)(batch/this->batchesPerEpoch);
+    int first = (int)(batch % this->batchesPerEpoch)*this->options.batchSize;
+    int sample = this->claimSample;
+    if(sample == 0)
+    {
+      slot.batch = batch;
+      slot.numberOfSamples = std::min(this->options.batchSize, (int)this->samples.size() - first);
+      slot.samplesDone = 0;
+    }
+    int frame = this->getOrder(epoch)[first + sample];
+    if(++this->claimSample == slot.numberOfSamples)
+    {
+      this->claimBatch++;
+      this->claimSample = 0;
+    }
+
+    lock.unlock();
+    int result = this->fillSample(cursor, slot, sample, frame, epoch);
+    // Shuffled reads gain nothing from the readahead of the kernel
+    if(!advised && cursor.getFileDescriptor() >= 0 && this->options.order != MhaTrainingOptions::Sequential)
+    {
+      adviseFileAccess(cursor.getFileDescriptor(), MhaRandomAccess);
+      advised = true;
+    }
+    lock.lock();
+
+    this->statistics.bytesRead += (long long)this->index->getFrameSize();
+    if(result)
+      this->failed = true;
+    if(++slot.samplesDone == slot.numberOfSamples || result)
+      this->slotFilled.notify_all();
+  }
+}
+
+//----------------------------------------------------------------------------
+int MhaTrainingLoader::fillSample(MhaFrameCursor& cursor, Slot& slot, int sample, int frame, int epoch)
+{
+  const unsigned char* pixels = cursor.readFrame(frame);
+  if(!pixels)
+    return 1;
+  int width = this->index->getWidth();
+  int height = this->index->getHeight();
+  int sampleWidth = this->sampleWidth;
+  int sampleHeight = this->sampleHeight;
+
+  // Drawn in the same order for every sample, from a seed of its own
+  MhaRandom random(MhaRandom::mix(this->options.seed, ((unsigned long long)epoch << 32) | (unsigned int)frame));
+  int shift = this->options.shiftJitter;
+  int shiftX = random.nextInt(2*shift + 1) - shift;
+  int shiftY = random.nextInt(2*shift + 1) - shift;
+  bool flip = random.nextDouble() < this->options.flipProbability;
+  double gain = 1. + this->options.gainJitter*(2.*random.nextDouble() - 1.);
+  double offset = this->options.offsetJitter*(2.*random.nextDouble() - 1.);
+
+  int x0 = std::min(std::max(this->options.cropExtent[0] + shiftX, 0), width - sampleWidth);
+  int y0 = std::min(std::max(this->options.cropExtent[2] + shiftY, 0), height - sampleHeight);
+  unsigned char* output = slot.pixels + (size_t)sample*sampleWidth*sampleHeight;
+  const unsigned char* input = pixels + (size_t)y0*width + x0;
+  if(!flip && gain == 1. && offset == 0.)
+  {
+    for(int row = 0; row < sampleHeight; row++)
+      memcpy(output + (size_t)row*sampleWidth, input + (size_t)row*width, sampleWidth);
+  }
+  else
+  {
+    unsigned char table[256];
+    for(int value = 0; value < 256; value++)
+      table[value] = (unsigned char)std::min(std::max(floor(value*gain + offset + 0.5), 0.), 255.);
+    for(int row = 0; row < sampleHeight; row++)
+    {
+      const unsigned char* in = input + (size_t)row*width;
+      unsigned char* out = output + (size_t)row*sampleWidth;
+      if(flip)
+        for(int x = 0; x < sampleWidth; x++)
+          out[x] = table[in[sampleWidth - 1 - x]];
+      else
+        for(int x = 0; x < sampleWidth; x++)
+          out[x] = table[in[x]];
+    }
+  }
+
+  const float* matrix = identity;
+  unsigned char valid = 0;
+  if(this->transform >= 0)
+  {
+    const MhaTransformStream& stream = this->index->getTransformTable().streams[this->transform];
+    unsigned char flags = frame < stream.getNumberOfFrames() ? stream.flags[frame] : 0;
+    if(flags & MhaTransformStream::Present)
+      matrix = stream.getMatrix(frame);
+    valid = (flags & MhaTransformStream::Present) && (flags & MhaTransformStream::StatusOK) ? 1 : 0;
+  }
+  memcpy(&slot.poses[12*sample], matrix, 12*sizeof(float));
+  slot.valid[sample] = valid;
+  slot.frames[sample] = frame;
+
+  if(this->options.augmentation)
+    this->options.augmentation(output, sampleWidth, sampleHeight, random.next());
+  return 0;
+}
+
+//----------------------------------------------------------------------------
+int MhaTrainingLoader::nextBatch(MhaTrainingBatch& batch)
+{
+  std::unique_lock<std::mutex> lock(this->mutex);
+  if(this->slots.empty())
+    return 1;
+  if(this->holdingBatch)
+  {
+    this->holdingBatch = false;
+    this->consumedBatch++;
+    int epoch = (int)(this->consumedBatch/this->batchesPerEpoch);
+    while(!this->orders.empty() && this->orders.begin()->first < epoch)
+      this->orders.erase(this->orders.begin());
+    this->slotFree.notify_all();
+  }
+
+  long long number = this->consumedBatch;
+  Slot& slot = *this->slots[number % (long long)this->slots.size()];
+  std::chrono::steady_clock::time_point waitTime = std::chrono::steady_clock::now();
+  this->slotFilled.wait(lock, [&]()
+  {
+    return this->stopping || this->failed || (slot.batch == number && slot.samplesDone == slot.numberOfSamples);
+  });
+  this->statistics.waitSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - waitTime).count();
+  if(this->stopping || this->failed)
+    return 1;
+
+  batch.epoch = (int)(number/this->batchesPerEpoch);
+  batch.index = (int)(number % this->batchesPerEpoch);
+  batch.numberOfSamples = slot.numberOfSamples;
+  batch.width = this->sampleWidth;
+  batch.height = this->sampleHeight;
+  batch.pixels = slot.pixels;
+  batch.frames = &slot.frames[0];
+  batch.poses = &slot.poses[0];
+  batch.valid = &slot.valid[0];
+  this->holdingBatch = true;
+  this->statistics.batches++;
+  this->statistics.samples += slot.numberOfSamples;
+  return 0;
+}
+
+//----------------------------------------------------------------------------
+MhaTrainingStatistics MhaTrainingLoader::getStatistics() const
+{
+  std::lock_guard<std::mutex> lock(this->mutex);
+  MhaTrainingStatistics statistics = this->statistics;
+  statistics.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - this->startTime).count();
+  return statistics;
+}
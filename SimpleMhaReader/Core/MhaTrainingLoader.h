@@ -0,0 +1,191 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+
+// .NAME MhaTrainingLoader - mini-batches of frames for training models
+// .SECTION Description
+// Yields batches of frames with the pose and validity of one transform,
+// epoch after epoch, in sequential, shuffled or stratified order. The order
+// of an epoch and the augmentation of every sample derive from the seed
+// alone, so a run is reproducible whatever the number of threads. Worker
+// threads read their own frames through their own cursors, cut the region
+// of interest and augment it straight into the batch buffers, which are
+// allocated once, page aligned and locked in memory where the system
+// allows. Several batches are filled ahead of the consumer.
+
+#ifndef __MhaTrainingLoader_h
+#define __MhaTrainingLoader_h
+
+// STD includes
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+class MhaFrameCursor;
+class MhaSequenceIndex;
+
+struct MhaTrainingOptions
+{
+  enum Order { Sequential, Shuffled, Stratified };
+  /// Called on a worker thread with the pixels of a sample after the
+  /// built-in augmentation and a seed for that sample
+  typedef std::function<void(unsigned char*, int, int, unsigned long long)> Augmentation;
+
+  MhaTrainingOptions()
+    : batchSize(32), order(Shuffled), seed(0), dropLast(false), validOnly(false), firstFrame(0), lastFrame(-1),
+      stride(1), crop(false), flipProbability(0.), gainJitter(0.), offsetJitter(0.), shiftJitter(0),
+      numberOfThreads(0), prefetchBatches(4), directIO(false)
+  {
+    cropExtent[0] = cropExtent[1] = cropExtent[2] = cropExtent[3] = 0;
+  }
+
+  int batchSize;
+  /// Stratified splits the frames into batchSize runs of consecutive frames
+  /// shuffled on their own, every batch takes one frame of each run
+  Order order;
+  unsigned long long seed;
+  /// The last batch of an epoch is dropped rather than short
+  bool dropLast;
+  /// Stream of the poses, none when empty or missing
+  std::string transformName;
+  /// Only frames whose pose has an OK status
+  bool validOnly;
+  int firstFrame;
+  /// -1 for the last frame of the sequence
+  int lastFrame;
+  int stride;
+  bool crop;
+  /// {xmin, xmax, ymin, ymax} in pixels, inclusive
+  int cropExtent[4];
+  /// Per sample: horizontal mirror with this probability, intensities
+  /// scaled by 1 +- gainJitter and shifted by +- offsetJitter grey levels,
+  /// region of interest moved by up to +- shiftJitter pixels within the image
+  double flipProbability;
+  double gainJitter;
+  double offsetJitter;
+  int shiftJitter;
+  Augmentation augmentation;
+  /// Reading and augmentation threads, 0 for one per hardware thread
+  int numberOfThreads;
+  /// Batches filled ahead of the consumer
+  int prefetchBatches;
+  bool directIO;
+};
+
+struct MhaTrainingBatch
+{
+  int epoch;
+  /// Within the epoch
+  int index;
+  int numberOfSamples;
+  int width;
+  int height;
+  /// numberOfSamples images of width*height bytes one after the other
+  const unsigned char* pixels;
+  const int* frames;
+  /// 12 floats (3x4, row major) per sample, identity without a pose
+  const float* poses;
+  /// 1 where the pose is present with an OK status
+  const unsigned char* valid;
+};
+
+struct MhaTrainingStatistics
+{
+  MhaTrainingStatistics() : batches(0), samples(0), bytesRead(0), waitSeconds(0.), seconds(0.) {}
+
+  long long batches;
+  long long samples;
+  long long bytesRead;
+  /// Time nextBatch() waited for a batch, the consumer outran the workers
+  double waitSeconds;
+  /// Since start()
+  double seconds;
+};
+
+class MhaTrainingLoader
+{
+public:
+  MhaTrainingLoader();
+  ~MhaTrainingLoader();
+
+  /// Selects the frames of index and starts filling batches of epoch 0.
+  /// Stops a running loader.
+  int start(const std::shared_ptr<const MhaSequenceIndex>& index, const MhaTrainingOptions& options);
+  void stop();
+
+  /// Frames of an epoch and batches they make
+  int getNumberOfSamples() const { return (int)this->samples.size(); }
+  int getNumberOfBatches() const;
+  int getSampleWidth() const { return this->sampleWidth; }
+  int getSampleHeight() const { return this->sampleHeight; }
+  /// Batch buffers are locked in memory
+  bool isPinned() const { return this->pinned; }
+
+  /// Hands the previous batch back and waits for the next one, which stays
+  /// valid until the next call or stop(). 1 once stopped or a read failed.
+  /// Batches are taken by one thread, the one that calls stop().
+  int nextBatch(MhaTrainingBatch& batch);
+
+  MhaTrainingStatistics getStatistics() const;
+
+private:
+  MhaTrainingLoader(const MhaTrainingLoader&); // Not implemented
+  void operator=(const MhaTrainingLoader&); // Not implemented
+
+  struct Slot;
+
+  const std::vector<int>& getOrder(int epoch);
+  void workerLoop();
+  int fillSample(MhaFrameCursor& cursor, Slot& slot, int sample, int frame, int epoch);
+  void freeSlots();
+
+  std::shared_ptr<const MhaSequenceIndex> index;
+  MhaTrainingOptions options;
+  /// Frames of an epoch in sequence order
+  std::vector<int> samples;
+  int transform;
+  int sampleWidth;
+  int sampleHeight;
+  int batchesPerEpoch;
+  bool pinned;
+
+  std::vector<Slot*> slots;
+  std::vector<std::thread> workers;
+  mutable std::mutex mutex;
+  std::condition_variable slotFree;
+  std::condition_variable slotFilled;
+  /// Order of the epochs being filled, dropped once consumed
+  std::map<int, std::vector<int> > orders;
+  /// Batches are numbered across epochs; workers claim samples of
+  /// claimBatch while it is fewer than slots ahead of consumedBatch
+  long long claimBatch;
+  int claimSample;
+  long long consumedBatch;
+  bool holdingBatch;
+  bool stopping;
+  bool failed;
+  MhaTrainingStatistics statistics;
+  std::chrono::steady_clock::time_point startTime;
+};
+
+#endif
@@ -19,16 +19,37 @@ limitations under the License.
 #include "vtkSlicerSimpleMhaReaderLogic.h"
 
 // MRML includes
+#include <vtkMRMLScalarVolumeDisplayNode.h>
 
 // VTK includes
 #include <vtkNew.h>
 #include <vtkImageImport.h>
+#include <vtkPointData.h>
+#include <vtkUnsignedCharArray.h>
 #include <vtkTransform.h>
 #include <vtkPngWriter.h>
 
+// SimpleMhaReader includes
+#include "MhaBatchReader.h"
+#include "MhaCineExport.h"
+#include "MhaCompressedFrameCache.h"
+#include "MhaFileUtilities.h"
+#include "MhaFrameHashes.h"
+#include "MhaMultiSequencePlayer.h"
+#include "MhaSequenceAnalyzer.h"
+#include "MhaSequenceExport.h"
+#include "MhaTileCache.h"
+
 // STD includes
+#include <algorithm>
 #include <cassert>
-#include <ctime>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
 
 // vnl include
 #include <vnl/vnl_double_3.h>
@@ -104,34 +125,44 @@ void vnlToVtkMatrix(const vnl_matrix<double> vnlMatrix , vtkMatrix4x4* vtkMatrix
   }
 }
 
-void getVtkMatrixFromVector(const std::vector<float>& vec, vtkMatrix4x4* vtkMatrix)
+void getVtkMatrixFromArray(const float* values, vtkMatrix4x4* vtkMatrix)
 {
   vtkMatrix->Identity();
-  if(vec.size() < 12)
-    return;
   for(int i=0; i<3; i++)
     for(int j=0; j<4; j++)
-    vtkMatrix->SetElement(i,j,vec[i*4+j]);
+    vtkMatrix->SetElement(i,j,values[i*4+j]);
 }
 
-// =======================================================
-// Reading functions
-// =======================================================
-std::string getDir(const std::string& filename)
+void getVtkMatrixFromVector(const std::vector<float>& vec, vtkMatrix4x4* vtkMatrix)
 {
-  #ifdef WIN32
-  const char dlmtr = '\\';
-  #else
-  const char dlmtr = '/';
-  #endif
-
-  std::string dirName;
-  size_t pos = filename.rfind(dlmtr);
-  dirName = pos == string::npos ? "" : filename.substr(0, pos) + dlmtr;
-  return dirName;
+  vtkMatrix->Identity();
+  if(vec.size() < 12)
+    return;
+  getVtkMatrixFromArray(&vec[0], vtkMatrix);
 }
 
+// Pose of frame for display: the filtered track when the filter is set,
+// which interpolates over outliers and INVALID frames, else the recorded
+// matrix unless it is missing or INVALID. NULL if there is none.
+const float* getDisplayPose(const MhaTransformStream& stream, const MhaPoseTrack& filtered, int frame, float* buffer)
+{
+  if(frame < filtered.getNumberOfFrames())
+  {
+    double position = frame;
+    unsigned char valid = 0;
+    filtered.interpolateFrames(&position, 1, buffer, &valid);
+    if(valid)
+      return buffer;
+  }
+  unsigned char flags = frame >= 0 && frame < stream.getNumberOfFrames() ? stream.flags[frame] : 0;
+  if((flags & MhaTransformStream::Present) && !(flags & MhaTransformStream::StatusInvalid))
+    return stream.getMatrix(frame);
+  return NULL;
+}
 
+// =======================================================
+// Reading functions
+// =======================================================
 void readTrainFilenames( const string& filename, string& dirName, vector<string>& trainFilenames )
 {
 
@@ -151,141 +182,675 @@ void readTrainFilenames( const string& filename, string& dirName, vector<string>
   file.close();
 }
 
-int readImageDimensions_mha(const std::string& filename, int& cols, int& rows, int& count)
+void vtkSlicerSimpleMhaReaderLogic::readImage_mha()
 {
-  ifstream file( filename.c_str() );
-  if ( !file.is_open() )
-    return 1;
+  if( !this->dataPointer )
+    return;
+  if( this->frameCache->hasFrame( this->currentFrame ) )
+    this->frameCache->readFrame( this->currentFrame, this->dataPointer );
+  else
+    this->reader.readFrame( this->currentFrame, this->dataPointer );
+}
 
-  // Read until get dimensions
-  while( !file.eof() )
+void vtkSlicerSimpleMhaReaderLogic::startAnalysis()
+{
+  int tasks = MhaSequenceAnalyzer::Statistics;
+  if(this->frameHashes.size() != (size_t)this->numberOfFrames)
+    tasks |= MhaSequenceAnalyzer::Hashes;
+  if(this->analyzer->start(this->reader.getIndex(), tasks))
+    this->log("Could not start the sequence analysis\n", MhaLogError);
+  else
+    this->analysisReported = false;
+}
+
+bool vtkSlicerSimpleMhaReaderLogic::updateAnalysis()
+{
+  if(this->analysisReported || this->analyzer->isRunning())
+    return false;
+  this->analysisReported = true;
+  if(!this->analyzer->isComplete())
   {
-    string str; getline( file, str );
-    if( str.empty() ) break;
-    char *pch = &(str[0]);
-    if( !pch )
-    {
-      return 1;
-      file.close();
-    }
+    this->log("Sequence analysis failed\n", MhaLogError);
+    return true;
+  }
 
-    if( strstr( pch, "DimSize =" ) )
+  double megabytes = (double)this->imageWidth*this->imageHeight*this->numberOfFrames/(1024.*1024.);
+  ostringstream oss;
+  oss << "Pass over the sequence took " << this->analyzer->getElapsedSeconds() << " s ("
+      << megabytes/this->analyzer->getElapsedSeconds() << " MB/s)" << endl;
+
+  if(this->analyzer->getTasks() & MhaSequenceAnalyzer::Statistics)
+  {
+    // Same window/level for every frame, from the whole sequence
+    int low = this->analyzer->getPercentile(1.);
+    int high = this->analyzer->getPercentile(99.);
+    vtkMRMLScalarVolumeDisplayNode* displayNode = vtkMRMLScalarVolumeDisplayNode::SafeDownCast(this->imageNode->GetDisplayNode());
+    if(displayNode && high > low)
     {
-      if( sscanf( pch, "DimSize = %d %d %d", &cols, &rows, &count ) != 3 )
-      {
-        printf( "Error: could not read dimensions\n" );
-        file.close();
-        return 1;
-      }
-      file.close();
-      return 0;
+      displayNode->SetAutoWindowLevel(0);
+      displayNode->SetWindow(high - low);
+      displayNode->SetLevel(0.5*(high + low));
     }
+    oss << "Blank frames: " << this->analyzer->getNumberOfFlaggedFrames(MhaSequenceAnalyzer::Blank)
+        << ", frozen frames: " << this->analyzer->getNumberOfFlaggedFrames(MhaSequenceAnalyzer::Frozen)
+        << ", 1-99% intensity: " << low << "-" << high << endl;
   }
-  file.close();
-  return 1;
+
+  if(this->analyzer->getTasks() & MhaSequenceAnalyzer::Hashes)
+  {
+    this->frameHashes = this->analyzer->getHashes();
+    MhaFrameHashesKey key;
+    if(!makeFrameHashesKey(this->mhaPath, this->reader.getDataOffset(), this->imageWidth, this->imageHeight, this->numberOfFrames, key))
+      saveFrameHashes(getFrameHashesPath(this->mhaPath), key, this->frameHashes);
+  }
+  this->log(oss.str());
+  if(this->analyzer->getTasks() & MhaSequenceAnalyzer::Hashes)
+    this->reportDuplicateFrames();
+  this->Modified();
+  return true;
 }
 
-void readImageTransforms_mha(const std::string& filename, std::vector<std::vector<float> >& transforms, set<string>& availableTransforms,  std::vector<bool>& transformsValidity, std::vector<std::string>& filenames)
+void vtkSlicerSimpleMhaReaderLogic::startDuplicateSearch()
 {
-  std::string dirName = getDir(filename);
-  filenames.clear();
-  transforms.clear();
+  // Hashes persisted by an earlier pass make the search free
+  if(this->frameHashes.size() == (size_t)this->numberOfFrames && this->numberOfFrames > 0)
+  {
+    this->reportDuplicateFrames();
+    return;
+  }
+  if(this->analyzer->start(this->reader.getIndex(), MhaSequenceAnalyzer::Hashes))
+    this->log("Could not start hashing the sequence\n", MhaLogError);
+  else
+    this->analysisReported = false;
+}
 
-  // Vector for reading in transforms
-  vector< float > vfTrans;
-  vfTrans.resize(12);
-  std::string pngFilename;
+void vtkSlicerSimpleMhaReaderLogic::reportDuplicateFrames()
+{
+  vector<pair<int, int> > runs;
+  findDuplicateRuns(this->frameHashes, runs);
+  int duplicates = 0;
+  for(size_t i=0; i<runs.size(); i++)
+    duplicates += runs[i].second - 1;
 
-  ifstream file( filename.c_str() );
-  if ( !file.is_open() )
-    return;
+  ostringstream oss;
+  oss << "Duplicate frames: " << duplicates << " in " << runs.size() << " runs" << endl;
+  for(size_t i=0; i<runs.size() && i<10; i++)
+    oss << "  frames " << runs[i].first << "-" << runs[i].first + runs[i].second - 1 << endl;
+  if(runs.size() > 10)
+    oss << "  ..." << endl;
+  this->log(oss.str());
+}
 
-  while( !file.eof() )
+bool vtkSlicerSimpleMhaReaderLogic::isDuplicateFrame(int frame) const
+{
+  return frame > 0 && frame < (int)this->frameHashes.size()
+    && this->frameHashes[frame] == this->frameHashes[frame - 1];
+}
+
+double vtkSlicerSimpleMhaReaderLogic::getAnalysisProgress()
+{
+  return this->analyzer->getProgress();
+}
+
+string vtkSlicerSimpleMhaReaderLogic::getCurrentFrameStatistics()
+{
+  if(!this->analyzer->hasResults(MhaSequenceAnalyzer::Statistics) || this->currentFrame < 0
+    || this->currentFrame >= (int)this->analyzer->getStatistics().size())
+    return "Not analyzed";
+  const MhaFrameStatistics& stats = this->analyzer->getStatistics()[this->currentFrame];
+  ostringstream oss;
+  oss.precision(4);
+  oss << "min " << (int)stats.minimum << ", max " << (int)stats.maximum
+      << ", mean " << stats.mean << ", std " << sqrt(stats.variance)
+      << ", diff " << stats.meanAbsoluteDifference;
+  if(stats.flags & MhaSequenceAnalyzer::Blank)
+    oss << ", blank";
+  if(stats.flags & MhaSequenceAnalyzer::Frozen)
+    oss << ", frozen";
+  if(this->isDuplicateFrame(this->currentFrame))
+    oss << ", duplicate";
+  return oss.str();
+}
+
+int vtkSlicerSimpleMhaReaderLogic::exportSequence(const string& path, int firstFrame, int lastFrame, int stride, const int* cropExtent, bool skipDuplicates)
+{
+  MhaExportOptions options;
+  options.firstFrame = firstFrame;
+  options.lastFrame = lastFrame;
+  options.stride = stride;
+  if(cropExtent)
   {
-    string str; getline( file, str );
-    if( str.empty() ) break;
-    char *pch = &(str[0]);
-    if( !pch )
-      return;
-      
-    if(strstr(pch, "Seq_Frame") && strstr(pch, "Transform")){
-      char* transformName = strstr(pch, "Seq_Frame")+string("Seq_Frame").size()+5;
-      char* endTransformName = strstr(pch, "Transform");
-      std::string transformNameCpy = string(transformName, endTransformName-transformName);
-      availableTransforms.insert(transformNameCpy);
-    }
+    options.crop = true;
+    for(int i=0; i<4; i++)
+      options.cropExtent[i] = cropExtent[i];
+  }
+  options.filters = this->filterSettings;
+  options.directIO = true;
+  if(skipDuplicates)
+  {
+    if(this->frameHashes.size() == (size_t)this->numberOfFrames)
+      options.frameHashes = &this->frameHashes;
+    else
+      this->log("Find duplicates first to skip them on export\n", MhaLogWarning);
+  }
 
-    if( strstr( pch, "ProbeToTrackerTransform =" )
-      || strstr( pch, "UltrasoundToTrackerTransform =" ) )
-    {
-       // Parse name and transform
-       // Seq_Frame0000_ProbeToTrackerTransform = -0.224009 -0.529064 0.818481 212.75 0.52031 0.6452 0.559459 -14.0417 -0.824074 0.551188 0.130746 -26.1193 0 0 0 1 
+  MhaExportResult result;
+  int failed = exportSequence_mha(this->reader.getIndex(), path, options, result);
+  ostringstream oss;
+  if(failed)
+    oss << "Export to " << path << " failed" << endl;
+  else
+  {
+    oss << "Exported " << result.framesWritten << " frames to " << path << " in " << result.seconds << " s";
+    if(result.framesSkipped)
+      oss << ", " << result.framesSkipped << " duplicates skipped";
+    oss << endl;
+  }
+  this->log(oss.str());
+  return failed;
+}
 
-      char *pcName = pch;
-      char *pcTrans = strstr( pch, "=" );
-      pcTrans[-1] = 0; // End file name string pcName
-       //pcTrans++; // Increment to just after equal sign
+int vtkSlicerSimpleMhaReaderLogic::exportCine(const string& path, int firstFrame, int lastFrame, int stride, double framesPerSecond,
+  const int* cropExtent, bool applyFilters)
+{
+  MhaCineOptions options;
+  options.firstFrame = firstFrame;
+  options.lastFrame = lastFrame;
+  options.stride = stride;
+  options.framesPerSecond = framesPerSecond;
+  if(cropExtent)
+  {
+    options.crop = true;
+    for(int i=0; i<4; i++)
+      options.cropExtent[i] = cropExtent[i];
+  }
+  if(applyFilters)
+    options.filters = this->filterSettings;
+  options.directIO = true;
+
+  MhaCineResult result;
+  int failed = ::exportCine(this->reader.getIndex(), path, options, result);
+  ostringstream oss;
+  if(failed)
+    oss << "Cine export to " << path << " failed" << endl;
+  else
+  {
+    double seconds = result.seconds > 0. ? result.seconds : 1.;
+    oss << "Exported " << result.framesWritten << " frames to " << path << " in " << result.seconds << " s ("
+        << (int)(result.framesWritten/seconds) << " frames/s, " << result.bytesWritten/(1024*1024) << " MB, "
+        << result.numberOfThreads << " encoding threads)" << endl;
+  }
+  this->log(oss.str(), failed ? MhaLogError : MhaLogInfo);
+  return failed;
+}
 
-      pngFilename = dirName + pcName + ".png";// + pcTrans;
+int vtkSlicerSimpleMhaReaderLogic::loadFrameRange(int firstFrame, int lastFrame, int stride)
+{
+  std::shared_ptr<const MhaSequenceIndex> index = this->reader.getIndex();
+  if(!index || stride < 1 || firstFrame < 0 || lastFrame >= index->getNumberOfFrames() || lastFrame < firstFrame)
+  {
+    this->log("Frame range must be within the sequence\n", MhaLogWarning);
+    return 1;
+  }
+  int count = (lastFrame - firstFrame)/stride + 1;
+  std::chrono::steady_clock::time_point beginTime = std::chrono::steady_clock::now();
+
+  // Frames are read straight into the scalars of the volume, z is time
+  vtkSmartPointer<vtkUnsignedCharArray> scalars = vtkSmartPointer<vtkUnsignedCharArray>::New();
+  scalars->SetNumberOfTuples((vtkIdType)index->getFrameSize()*count);
+  MhaBatchReader stackReader(index);
+  if(stackReader.readFrameStack(firstFrame, count, stride, scalars->GetPointer(0)))
+  {
+    this->log("Could not read the frames\n", MhaLogError);
+    return 1;
+  }
+  vtkSmartPointer<vtkImageData> stack = vtkSmartPointer<vtkImageData>::New();
+  stack->SetDimensions(this->imageWidth, this->imageHeight, count);
+  stack->GetPointData()->SetScalars(scalars);
 
-      char *pch = pcTrans;
+  ostringstream oss;
+  oss << "mha frames " << firstFrame << "-" << lastFrame;
+  if(stride > 1)
+    oss << " every " << stride;
+  this->stackNode->SetName(oss.str().c_str());
+  // k of a voxel is its frame number
+  this->stackNode->SetOrigin(0., 0., firstFrame);
+  this->stackNode->SetSpacing(1., 1., stride);
+  this->stackNode->SetAndObserveImageData(stack);
+  if(this->GetMRMLScene() && !this->GetMRMLScene()->IsNodePresent(this->stackNode))
+    this->GetMRMLScene()->AddNode(this->stackNode);
+
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - beginTime).count();
+  oss.clear(); oss.str("");
+  oss << "Loaded " << count << " frames (" << (double)index->getFrameSize()*count/(1024.*1024.)
+      << " MB) into a volume in " << seconds << " s" << endl;
+  this->log(oss.str());
+  this->updateMemory();
+  return 0;
+}
 
-      for( int j =0; j < 12; j++ )
-      {
-        pch = strchr( pch + 1, ' ' );
-        if( !pch )
-          return;
-        vfTrans[j] = atof( pch );
-        pch++;
-      }
-      transforms.push_back( vfTrans );
-      filenames.push_back(pngFilename);
-    }
-    else if(strstr(pch, "UltrasoundToTrackerTransformStatus") || strstr(pch, "ProbeToTrackerTransformStatus")) {
-      if(strstr(pch, "OK")){
-        transformsValidity.push_back(true);
-      }
-      else if(strstr(pch, "INVALID"))
-        transformsValidity.push_back(false);
-    }
-    if( strstr( pch, "ElementDataFile = LOCAL" ) )
-    {
-       // Done reading
-      break;
-    }
+void vtkSlicerSimpleMhaReaderLogic::startTileCache()
+{
+  if(this->tileCache->start(this->reader.getIndex()))
+    this->log("Could not start the M-mode cache\n", MhaLogError);
+  else
+    this->tileCacheReported = false;
+}
+
+bool vtkSlicerSimpleMhaReaderLogic::updateTileCache()
+{
+  if(this->tileCacheReported || this->tileCache->isRunning())
+    return false;
+  this->tileCacheReported = true;
+  if(!this->tileCache->isReady())
+  {
+    this->log("Could not build the M-mode cache\n", MhaLogError);
+    return true;
   }
-  for(set<string>::iterator it=availableTransforms.begin(); it!=availableTransforms.end(); it++)
-    cout << *it << endl;
+  ostringstream oss;
+  if(this->tileCache->getElapsedSeconds() > 0.)
+    oss << "Built the M-mode cache in " << this->tileCache->getElapsedSeconds() << " s" << endl;
+  else
+    oss << "M-mode cache is up to date" << endl;
+  this->log(oss.str());
+  this->Modified();
+  return true;
 }
 
-void vtkSlicerSimpleMhaReaderLogic::readImage_mha()
+double vtkSlicerSimpleMhaReaderLogic::getTileCacheProgress()
 {
-  
-  FILE *infile = fopen( this->mhaPath.c_str(), "rb" );
-  char buffer[400];
-  
-  // Just move the pointer where data starts
-  while( fgets( buffer, 400, infile ) )
+  return this->tileCache->getProgress();
+}
+
+bool vtkSlicerSimpleMhaReaderLogic::isTileCacheReady() const
+{
+  return this->tileCache->isReady();
+}
+
+void vtkSlicerSimpleMhaReaderLogic::startFrameCache()
+{
+  if(this->frameCache->start(this->reader.getIndex()))
+    this->log("Could not start the frame cache\n", MhaLogError);
+  else
+    this->frameCacheReported = false;
+}
+
+void vtkSlicerSimpleMhaReaderLogic::clearFrameCache()
+{
+  this->frameCache->clear();
+  this->frameCacheReported = true;
+  this->updateMemory();
+}
+
+bool vtkSlicerSimpleMhaReaderLogic::updateFrameCache()
+{
+  if(this->frameCacheReported || this->frameCache->isRunning())
+    return false;
+  this->frameCacheReported = true;
+  this->updateMemory();
+  size_t uncompressed = this->frameCache->getUncompressedSize();
+  size_t compressed = this->frameCache->getMemorySize();
+  ostringstream oss;
+  if(this->frameCache->isReady())
+    oss << "Cached " << this->frameCache->getNumberOfFrames() << " frames in memory: ";
+  else
   {
-    if( strstr( buffer, "ElementDataFile = LOCAL" ) )
-    {
-       // Done reading
-      break;
-    }
-  } 
-  
-  #ifdef WIN32
-  _fseeki64(infile, (__int64)this->imageHeight*(__int64)this->imageWidth*(__int64)this->currentFrame, SEEK_CUR);
-  #else
-  fseek(infile, (long int)this->imageHeight*(long int)this->imageWidth*(long int)this->currentFrame, SEEK_CUR);
-  #endif
-  
-  fread( this->dataPointer, 1, this->imageHeight*this->imageWidth, infile );
-  fclose( infile );
+    // Stopped by a read error or by eviction under the memory limit
+    oss << "Frame cache stopped with " << (int)(100.*this->frameCache->getProgress()) << "% of the frames: ";
+  }
+  oss << uncompressed/(1024*1024) << " MB held in " << compressed/(1024*1024) << " MB (ratio "
+      << (compressed > 0 ? (double)uncompressed/(double)compressed : 0.) << ") in "
+      << this->frameCache->getElapsedSeconds() << " s" << endl;
+  this->log(oss.str(), this->frameCache->isReady() ? MhaLogInfo : MhaLogWarning);
+  this->Modified();
+  return true;
+}
+
+double vtkSlicerSimpleMhaReaderLogic::getFrameCacheProgress()
+{
+  return this->frameCache->getProgress();
+}
+
+bool vtkSlicerSimpleMhaReaderLogic::isFrameCacheRunning() const
+{
+  return this->frameCache->isRunning();
+}
+
+int vtkSlicerSimpleMhaReaderLogic::extractTimeLine(double x0, double y0, double x1, double y1)
+{
+  if(!this->tileCache->isReady())
+  {
+    this->log("The M-mode cache is not built\n", MhaLogWarning);
+    return 1;
+  }
+  int frames = this->tileCache->getNumberOfFrames();
+  int samples = (int)std::max(fabs(x1 - x0), fabs(y1 - y0)) + 1;
+
+  // The image is kept while the line has the same number of samples, moving
+  // the line only rewrites its pixels
+  int* dimensions = this->mModeImage->GetDimensions();
+  vtkUnsignedCharArray* scalars = vtkUnsignedCharArray::SafeDownCast(this->mModeImage->GetPointData()->GetScalars());
+  if(!scalars || dimensions[0] != frames || dimensions[1] != samples)
+  {
+    vtkSmartPointer<vtkUnsignedCharArray> newScalars = vtkSmartPointer<vtkUnsignedCharArray>::New();
+    newScalars->SetNumberOfTuples((vtkIdType)frames*samples);
+    this->mModeImage->SetDimensions(frames, samples, 1);
+    this->mModeImage->GetPointData()->SetScalars(newScalars);
+    scalars = newScalars;
+  }
+  if(this->tileCache->extractLine(x0, y0, x1, y1, samples, 0, frames - 1, scalars->GetPointer(0)))
+  {
+    this->log("Could not extract the line\n", MhaLogError);
+    return 1;
+  }
+  scalars->Modified();
+  this->mModeImage->Modified();
+
+  // i is the frame number, j the distance along the line in pixels
+  double length = sqrt((x1 - x0)*(x1 - x0) + (y1 - y0)*(y1 - y0));
+  this->mModeNode->SetSpacing(1., samples > 1 ? length/(samples - 1) : 1., 1.);
+  if(this->mModeNode->GetImageData() != this->mModeImage)
+    this->mModeNode->SetAndObserveImageData(this->mModeImage);
+  if(this->GetMRMLScene() && !this->GetMRMLScene()->IsNodePresent(this->mModeNode))
+    this->GetMRMLScene()->AddNode(this->mModeNode);
+  return 0;
+}
+
+int vtkSlicerSimpleMhaReaderLogic::openSequences(const vector<string>& paths)
+{
+  this->sequencesPlaying = false;
+  if(this->player->open(paths))
+  {
+    this->log("Could not read the sequences\n", MhaLogError);
+    return 1;
+  }
+  // Nodes of sequences that are no longer open are left in the scene
+  int count = this->player->getNumberOfSequences();
+  for(int i=(int)this->sequenceNodes.size(); i<count; i++)
+    this->sequenceNodes.push_back(vtkMRMLScalarVolumeNode::New());
+  this->sequenceImages.resize(count);
+  // Never shrunk, images of nodes left in the scene still wrap these buffers
+  if((int)this->sequencePixels.size() < count)
+    this->sequencePixels.resize(count);
+  this->sequenceFrames.assign(count, -1);
+  this->updateSequencePoses();
+  ostringstream oss;
+  for(int i=0; i<count; i++)
+  {
+    std::shared_ptr<const MhaSequenceIndex> index = this->player->getIndex(i);
+    this->sequenceNodes[i]->SetName(("mha sequence " + paths[i].substr(getDir(paths[i]).size())).c_str());
+    this->sequenceImages[i] = vtkSmartPointer<vtkImageData>::New();
+    this->sequenceImages[i]->SetDimensions(index->getWidth(), index->getHeight(), 1);
+    oss << paths[i] << ": " << index->getNumberOfFrames() << " frames" << endl;
+  }
+  oss << "Clock from " << this->player->getStartTime() << " to " << this->player->getEndTime() << " s" << endl;
+  this->log(oss.str());
+  this->sequencesPlayTime = this->player->getStartTime();
+  this->Modified();
+  return 0;
+}
+
+void vtkSlicerSimpleMhaReaderLogic::setSequencesPlaying(bool playing)
+{
+  if(playing && !this->sequencesPlaying)
+  {
+    this->sequencesPlayTime = this->player->getTime();
+    this->sequencesPlayClock = std::chrono::steady_clock::now();
+  }
+  this->sequencesPlaying = playing && this->player->getNumberOfSequences() > 0;
+}
+
+void vtkSlicerSimpleMhaReaderLogic::setSequencesTime(double time)
+{
+  this->sequencesPlayTime = time;
+  this->sequencesPlayClock = std::chrono::steady_clock::now();
+  this->player->setTime(time);
+}
+
+bool vtkSlicerSimpleMhaReaderLogic::hasSequences() const
+{
+  return this->player->getNumberOfSequences() > 0;
+}
+
+bool vtkSlicerSimpleMhaReaderLogic::updateSequences()
+{
+  if(this->player->getNumberOfSequences() == 0)
+    return false;
+  if(this->sequencesPlaying)
+  {
+    // Real time from where play started, looping over the span of the sequences
+    double time = this->sequencesPlayTime +
+      std::chrono::duration<double>(std::chrono::steady_clock::now() - this->sequencesPlayClock).count();
+    if(time > this->player->getEndTime())
+      this->setSequencesTime(this->player->getStartTime());
+    else
+      this->player->setTime(time);
+  }
+  bool changed = false;
+  for(int i=0; i<this->player->getNumberOfSequences(); i++)
+  {
+    int frame = this->player->takeFrame(i, this->sequencePixels[i]);
+    if(frame < 0)
+      continue;
+    this->publishSequenceFrame(i, frame);
+    changed = true;
+  }
+  return changed;
+}
+
+void vtkSlicerSimpleMhaReaderLogic::publishSequenceFrame(int sequence, int frame)
+{
+  std::shared_ptr<const MhaSequenceIndex> index = this->player->getIndex(sequence);
+  vtkMRMLScalarVolumeNode* node = this->sequenceNodes[sequence];
+  int wasModifying = node->StartModify();
+
+  // The scalars wrap the buffer swapped in by the player, the one they
+  // wrapped before goes back to its loader
+  vtkSmartPointer<vtkUnsignedCharArray> scalars = vtkSmartPointer<vtkUnsignedCharArray>::New();
+  scalars->SetArray(&this->sequencePixels[sequence][0], (vtkIdType)this->sequencePixels[sequence].size(), 1);
+  this->sequenceImages[sequence]->GetPointData()->SetScalars(scalars);
+
+  // Placed like the main image, by the same transform filtered the same
+  // way, and the US to image calibration; frames without a usable pose
+  // keep the previous placement
+  int stream = this->sequenceTransforms[sequence];
+  float filteredPose[12];
+  const float* pose = this->applyTransforms && stream >= 0 ?
+    getDisplayPose(index->getTransformTable().streams[stream], this->sequencePoses[sequence], frame, filteredPose) : NULL;
+  if(pose)
+  {
+    vtkSmartPointer<vtkMatrix4x4> transform = vtkSmartPointer<vtkMatrix4x4>::New();
+    vtkSmartPointer<vtkMatrix4x4> imageToUSTransform = vtkSmartPointer<vtkMatrix4x4>::New();
+    vtkSmartPointer<vtkMatrix4x4> matrix = vtkSmartPointer<vtkMatrix4x4>::New();
+    vtkMatrix4x4::Invert(this->USToImageTransform, imageToUSTransform);
+    getVtkMatrixFromArray(pose, transform);
+    vtkMatrix4x4::Multiply4x4(transform, imageToUSTransform, matrix);
+    node->SetIJKToRASMatrix(matrix);
+  }
+  if(node->GetImageData() != this->sequenceImages[sequence])
+    node->SetAndObserveImageData(this->sequenceImages[sequence]);
+  else
+    this->sequenceImages[sequence]->Modified();
+  node->EndModify(wasModifying);
+  if(this->GetMRMLScene() && !this->GetMRMLScene()->IsNodePresent(node))
+    this->GetMRMLScene()->AddNode(node);
+  this->sequenceFrames[sequence] = frame;
+}
+
+string vtkSlicerSimpleMhaReaderLogic::getSequencesStatus() const
+{
+  if(this->player->getNumberOfSequences() == 0)
+    return "No sequences";
+  ostringstream oss;
+  oss.setf(std::ios::fixed);
+  oss.precision(2);
+  oss << this->player->getTime() - this->player->getStartTime() << " s";
+  for(int i=0; i<this->player->getNumberOfSequences(); i++)
+  {
+    oss << ", " << this->sequenceFrames[i];
+    long long dropped = this->player->getNumberOfDroppedFrames(i);
+    if(dropped > 0)
+      oss << " (" << dropped << " dropped)";
+  }
+  return oss.str();
+}
+
+int vtkSlicerSimpleMhaReaderLogic::startStream(const string& host, int port, const string& recordPath)
+{
+  this->stopStream();
+  this->receiver->setRecordingPath(recordPath);
+  if(this->receiver->connect(host, port))
+  {
+    this->log(this->receiver->getError() + "\n", MhaLogError);
+    return 1;
+  }
+  // Temporal filters must not blend stream frames with sequence frames
+  this->filterChain->reset();
+  this->streaming = true;
+  ostringstream oss;
+  oss << "Receiving from " << host << ":" << port;
+  if(!recordPath.empty())
+    oss << ", recording to " << recordPath;
+  oss << endl;
+  this->log(oss.str());
+  this->Modified();
+  return 0;
+}
+
+void vtkSlicerSimpleMhaReaderLogic::stopStream()
+{
+  if(!this->streaming)
+    return;
+  // The last frame stays in the image node, it is released with the next one
+  this->receiver->disconnect();
+  this->streaming = false;
+  this->filterChain->reset();
+  MhaStreamStatistics statistics = this->receiver->getStatistics();
+  ostringstream oss;
+  oss << "Stream stopped: " << statistics.received << " frames received, " << statistics.dropped << " dropped, "
+      << statistics.skipped << " skipped, " << statistics.recorded << " recorded";
+  if(statistics.recordingFiles > 1)
+    oss << " to " << statistics.recordingFiles << " files";
+  oss << endl;
+  if(!this->receiver->getError().empty())
+    oss << this->receiver->getError() << endl;
+  this->log(oss.str());
+  this->Modified();
+}
 
+bool vtkSlicerSimpleMhaReaderLogic::updateStream()
+{
+  if(!this->streaming)
+    return false;
+  MhaStreamFrame frame;
+  if(!this->receiver->takeNewestFrame(frame))
+  {
+    if(!this->receiver->isConnected())
+      this->stopStream();
+    return false;
+  }
+  // Placed like sequence frames, by the probe pose and the US to image calibration
+  const float* pose = frame.getTransform("ProbeToTracker");
+  if(!pose)
+    pose = frame.getTransform("UltrasoundToTracker");
+  this->publishFrame(frame.pixels, frame.width, frame.height, (int)frame.number, this->applyTransforms ? pose : NULL);
+  // The image now wraps the new frame, the previous one goes back to the pool
+  this->releaseStreamFrame();
+  this->streamFrame = frame;
+  return true;
+}
+
+void vtkSlicerSimpleMhaReaderLogic::releaseStreamFrame()
+{
+  this->receiver->releaseFrame(this->streamFrame);
+}
+
+string vtkSlicerSimpleMhaReaderLogic::getStreamStatus() const
+{
+  if(!this->streaming)
+    return "Not connected";
+  MhaStreamStatistics statistics = this->receiver->getStatistics();
+  ostringstream oss;
+  oss << "Frame " << this->streamFrame.number;
+  if(this->streamFrame.pixels)
+    oss << " (" << this->streamFrame.width << "x" << this->streamFrame.height << ")";
+  oss << ", " << statistics.dropped << " dropped, " << statistics.skipped << " skipped";
+  if(statistics.recorded > 0)
+    oss << ", " << statistics.recorded << " recorded";
+  return oss.str();
+}
+
+void vtkSlicerSimpleMhaReaderLogic::updateMemoryAccounts()
+{
+  // The image data wraps the frame buffer, it is counted with the frames
+  std::shared_ptr<const MhaSequenceIndex> index = this->reader.getIndex();
+  this->metrics.setMemory(this->indexMemory, (index ? (long long)index->getMemorySize() : 0)
+    + (long long)(this->frameHashes.capacity()*sizeof(unsigned long long)));
+  this->metrics.setMemory(this->framesMemory, this->framePool.getStatistics().reservedBytes
+    + (long long)this->filterChain->getMemorySize());
+  this->metrics.setMemory(this->posesMemory, (long long)(this->filteredPoses.getMemorySize()
+    + this->poseOutliers.capacity() + this->planeIndex.getMemorySize()));
+  long long volumes = 1024LL*this->mModeImage->GetActualMemorySize();
+  if(this->stackNode->GetImageData())
+    volumes += 1024LL*this->stackNode->GetImageData()->GetActualMemorySize();
+  this->metrics.setMemory(this->volumesMemory, volumes);
+  long long sequences = (long long)this->player->getMemorySize();
+  for(size_t i=0; i<this->sequencePixels.size(); i++)
+    sequences += (long long)this->sequencePixels[i].capacity();
+  for(size_t i=0; i<this->sequencePoses.size(); i++)
+    sequences += (long long)this->sequencePoses[i].getMemorySize();
+  this->metrics.setMemory(this->sequencesMemory, sequences);
+  this->metrics.setMemory(this->streamMemory, (long long)this->receiver->getMemorySize());
+  this->metrics.setMemory(this->frameCacheMemory, (long long)this->frameCache->getMemorySize());
+}
+
+void vtkSlicerSimpleMhaReaderLogic::updateMemory()
+{
+  this->updateMemoryAccounts();
+  long long limit = this->metrics.getMemorySoftLimit();
+  if(this->metrics.enforceMemoryLimit() == 0 || this->metrics.getTotalMemory() <= limit)
+  {
+    this->memoryLimitReported = false;
+    return;
+  }
+  // What is left cannot be evicted, said once until the total goes back under
+  if(!this->memoryLimitReported)
+  {
+    ostringstream oss;
+    oss << "Memory use of " << this->metrics.getTotalMemory()/(1024*1024) << " MB stays over the soft limit of "
+        << limit/(1024*1024) << " MB after eviction" << endl;
+    this->log(oss.str(), MhaLogWarning);
+    this->memoryLimitReported = true;
+  }
+}
+
+void vtkSlicerSimpleMhaReaderLogic::setMemorySoftLimit(long long bytes)
+{
+  this->metrics.setMemorySoftLimit(bytes);
+  this->memoryLimitReported = false;
+  this->updateMemory();
 }
 
+string vtkSlicerSimpleMhaReaderLogic::getMemoryStatus()
+{
+  vector<MhaMemorySummary> accounts;
+  this->metrics.getMemorySummaries(accounts);
+  ostringstream oss;
+  oss << "Memory " << this->metrics.getTotalMemory()/(1024*1024) << " MB (peak "
+      << this->metrics.getPeakTotalMemory()/(1024*1024) << " MB)";
+  for(size_t i=0; i<accounts.size(); i++)
+    if(accounts[i].bytes > 0)
+      oss << ", " << accounts[i].name << " " << (accounts[i].bytes + 512*1024)/(1024*1024) << " MB";
+  return oss.str();
+}
 
+void vtkSlicerSimpleMhaReaderLogic::setFilterSettings(const MhaFilterSettings& settings)
+{
+  this->filterSettings = settings;
+  configureFilterChain(*this->filterChain, settings);
+  if(this->numberOfFrames > 0)
+    this->updateImage();
+}
 
 //----------------------------------------------------------------------------
 vtkStandardNewMacro(vtkSlicerSimpleMhaReaderLogic);
@@ -295,12 +860,77 @@ vtkSlicerSimpleMhaReaderLogic::vtkSlicerSimpleMhaReaderLogic()
 {
   this->imgData = NULL;
   this->dataPointer = NULL;
+  this->readTimer = this->metrics.getTimer("Read");
+  this->filterTimer = this->metrics.getTimer("Filter");
+  this->importTimer = this->metrics.getTimer("Import");
+  this->publishTimer = this->metrics.getTimer("Publish");
+  this->indexMemory = this->metrics.getMemoryAccount("Index");
+  this->framesMemory = this->metrics.getMemoryAccount("Frames");
+  this->posesMemory = this->metrics.getMemoryAccount("Poses");
+  this->volumesMemory = this->metrics.getMemoryAccount("Volumes");
+  this->sequencesMemory = this->metrics.getMemoryAccount("Sequences");
+  this->streamMemory = this->metrics.getMemoryAccount("Stream");
+  this->frameCacheMemory = this->metrics.getMemoryAccount("Frame cache");
+  this->memoryLimitReported = false;
+  this->followMode = false;
+  this->followFd = -1;
+  this->followFileSize = -1;
+  this->analyzer = new MhaSequenceAnalyzer;
+  // Passes over the whole file bypass the page cache, browsing does not
+  this->analyzer->setDirectIO(true);
+  this->analysisReported = true;
+  this->tileCache = new MhaTileCache;
+  this->tileCache->setDirectIO(true);
+  this->tileCacheReported = true;
+  this->frameCache = new MhaCompressedFrameCache;
+  this->frameCache->setDirectIO(true);
+  this->frameCacheReported = true;
+  this->planeIndexDirty = true;
+  this->planeIndexFrames = 0;
+  this->maximumFrameRate = 60.;
+  this->player = new MhaMultiSequencePlayer;
+  this->receiver = new MhaStreamReceiver;
+  this->streaming = false;
+  // Cheapest to rebuild first: frame buffers not in use, then the plane
+  // index, which the next query rebuilds, then the cached frames, which are
+  // read from the file again
+  this->metrics.addMemoryEvictor([this]()
+  {
+    this->framePool.trim();
+    this->receiver->trim();
+    this->updateMemoryAccounts();
+  });
+  this->metrics.addMemoryEvictor([this]()
+  {
+    this->planeIndex.clear();
+    this->planeIndexDirty = true;
+    this->updateMemoryAccounts();
+  });
+  this->metrics.addMemoryEvictor([this]()
+  {
+    long long excess = this->metrics.getTotalMemory() - this->metrics.getMemorySoftLimit();
+    if(excess > 0)
+      this->frameCache->evict((size_t)excess, this->currentFrame);
+    this->updateMemoryAccounts();
+  });
+  this->sequencesPlaying = false;
+  this->sequencesPlayTime = 0.;
+  this->framePending = false;
+  this->filterChain = new MhaFilterChain;
+  this->framePool.setHugePages(true);
+  this->importer = vtkSmartPointer<vtkImageImport>::New();
+  this->importer->SetDataScalarTypeToUnsignedChar();
   this->imageNode = vtkMRMLScalarVolumeNode::New();
   this->imageNode->SetName("mha image");
+  this->stackNode = vtkMRMLScalarVolumeNode::New();
+  this->mModeImage = vtkSmartPointer<vtkImageData>::New();
+  this->mModeNode = vtkMRMLScalarVolumeNode::New();
+  this->mModeNode->SetName("mha M-mode");
   this->imageWidth = 0;
   this->imageHeight = 0;
   this->numberOfFrames = 0;
   this->applyTransforms = false;
+  this->activeTransform = -1;
   this->playMode = "Forwards";
   
   // Initialize Image to Probe transform
@@ -325,8 +955,19 @@ vtkSlicerSimpleMhaReaderLogic::vtkSlicerSimpleMhaReaderLogic()
 //----------------------------------------------------------------------------
 vtkSlicerSimpleMhaReaderLogic::~vtkSlicerSimpleMhaReaderLogic()
 {
-  if(this->dataPointer)
-    delete [] this->dataPointer;
+  this->unwatchFile();
+  delete this->analyzer;
+  delete this->tileCache;
+  delete this->frameCache;
+  delete this->player;
+  this->releaseStreamFrame();
+  delete this->receiver;
+  for(size_t i=0; i<this->sequenceNodes.size(); i++)
+    this->sequenceNodes[i]->Delete();
+  delete this->filterChain;
+  this->framePool.release(this->dataPointer);
+  this->stackNode->Delete();
+  this->mModeNode->Delete();
 }
 
 //----------------------------------------------------------------------------
@@ -367,7 +1008,13 @@ void vtkSlicerSimpleMhaReaderLogic::ProcessMRMLNodesEvents( vtkObject* caller, u
     vtkMRMLLinearTransformNode* tnode = vtkMRMLLinearTransformNode::SafeDownCast(caller);
     if(!tnode)
       return;
-    this->console->insertPlainText("Changed Transform\n");
+    this->log("Changed Transform\n");
+    if(!this->planeIndexDirty)
+    {
+      double imageToProbe[16];
+      this->getImageToProbe(imageToProbe);
+      this->planeIndex.setCalibration(imageToProbe);
+    }
     this->updateImage();
   }
   else
@@ -389,79 +1036,450 @@ void vtkSlicerSimpleMhaReaderLogic::setMhaPath(string path)
 {
   if(path != this->mhaPath){
     this->mhaPath = path;
-    this->transforms.clear();
-    this->filenames.clear();
-    this->transformsValidity.clear();
+    this->availableTransforms.clear();
+    this->activeTransform = -1;
+    this->analyzer->reset();
+    this->analysisReported = true;
+    this->tileCache->close();
+    this->tileCacheReported = true;
+    this->frameCache->clear();
+    this->frameCacheReported = true;
+    this->planeIndexDirty = true;
+    this->frameHashes.clear();
+    this->filterChain->reset();
     this->currentFrame = 0;
-    int iImgCols = -1;
-    int iImgRows = -1;
-    int iImgCount = -1;
-    if(readImageDimensions_mha(this->mhaPath, iImgCols, iImgRows, iImgCount))
+    if(this->reader.open(this->mhaPath))
+    {
+      this->log("Could not read " + this->mhaPath + "\n", MhaLogError);
+      this->numberOfFrames = 0;
       return;
+    }
+    int iImgCols = this->reader.getWidth();
+    int iImgRows = this->reader.getHeight();
+    int iImgCount = this->reader.getNumberOfFrames();
     this->imageWidth = iImgCols;
     this->imageHeight = iImgRows;
     this->numberOfFrames = iImgCount;
+    MhaFrameHashesKey hashesKey;
+    if(!makeFrameHashesKey(this->mhaPath, this->reader.getDataOffset(), iImgCols, iImgRows, iImgCount, hashesKey))
+      loadFrameHashes(getFrameHashesPath(this->mhaPath), hashesKey, this->frameHashes);
     if(this->GetMRMLScene()) {
       if(!this->GetMRMLScene()->IsNodePresent(this->USToImageTransformNode))
         this->GetMRMLScene()->AddNode(this->USToImageTransformNode);
     }
     this->setUSToImageTransform();
-    if(this->dataPointer)
-      delete [] this->dataPointer;
-    this->dataPointer = new unsigned char[iImgRows*iImgCols];
-    readImageTransforms_mha(this->mhaPath, this->transforms, this->availableTransforms, this->transformsValidity, this->filenames);
+    // The buffer of the previous file is reused when the frames still fit
+    this->framePool.release(this->dataPointer);
+    this->framePool.setFrameSize((size_t)iImgRows*(size_t)iImgCols);
+    this->dataPointer = this->framePool.acquire();
+    this->updateAvailableTransforms();
     std::ostringstream oss;
-    oss << "Number of transforms found: " << this->transforms.size() << endl;
-    oss << "Number of transform validity: " << this->transformsValidity.size() <<endl;
-    this->console->insertPlainText(oss.str().c_str());
+    this->logFramePoolStatistics();
+    for(size_t i=0; i<this->reader.getTransformTable().streams.size(); i++)
+    {
+      const MhaTransformStream& stream = this->reader.getTransformTable().streams[i];
+      int present = 0, valid = 0;
+      for(int frame=0; frame<stream.getNumberOfFrames(); frame++)
+      {
+        present += (stream.flags[frame] & MhaTransformStream::Present) ? 1 : 0;
+        valid += (stream.flags[frame] & MhaTransformStream::StatusOK) ? 1 : 0;
+      }
+      oss << stream.name << ": " << present << " transforms, " << valid << " valid" << endl;
+    }
+    this->log(oss.str());
+    if(this->followMode)
+      this->watchFile();
     this->updateImage();
+    this->updateMemory();
     this->Modified();
   }
 }
 
+void vtkSlicerSimpleMhaReaderLogic::logFramePoolStatistics()
+{
+  MhaFramePoolStatistics statistics = this->framePool.getStatistics();
+  ostringstream oss;
+  oss << "Frame buffers: " << statistics.slabsInUse << " in use (at most " << statistics.highWaterSlabs << "), "
+      << statistics.reservedBytes/(1024*1024) << " MB reserved (at most " << statistics.highWaterBytes/(1024*1024)
+      << " MB), " << (int)(100.*statistics.getFragmentation()) << "% unused, "
+      << statistics.systemAllocations << " system allocations for " << statistics.acquisitions << " buffers";
+  if(statistics.hugePageArenas > 0)
+    oss << ", huge pages";
+  oss << endl;
+  this->log(oss.str());
+}
+
+void vtkSlicerSimpleMhaReaderLogic::updateAvailableTransforms()
+{
+  for(size_t i=0; i<this->reader.getTransformTable().streams.size(); i++)
+    this->availableTransforms.insert(this->reader.getTransformTable().streams[i].name);
+  // Probe pose drives the image by default, as Plus records it
+  int previousTransform = this->activeTransform;
+  const char* defaultTransforms[] = { "ProbeToTracker", "UltrasoundToTracker" };
+  for(int i=0; i<2 && this->activeTransform < 0; i++)
+    this->activeTransform = this->reader.getTransformTable().find(defaultTransforms[i]);
+  if(this->activeTransform < 0 && !this->reader.getTransformTable().streams.empty())
+    this->activeTransform = 0;
+  // Frames appended while following only extend the filtered poses
+  if(this->activeTransform != previousTransform)
+    this->updatePoseFilter();
+  else
+    this->extendPoseFilter();
+}
+
+void vtkSlicerSimpleMhaReaderLogic::setPoseFilterSettings(const MhaPoseFilterSettings& settings)
+{
+  this->poseFilterSettings = settings;
+  this->updatePoseFilter();
+  if(this->applyTransforms && this->numberOfFrames > 0)
+    this->updateImage();
+  this->Modified();
+}
+
+// Flags the outliers of the active transform and smooths it, cheap enough
+// to follow every change of the settings
+void vtkSlicerSimpleMhaReaderLogic::updatePoseFilter()
+{
+  this->planeIndexDirty = true;
+  this->planeIndex.clear();
+  this->updateSequencePoses();
+  std::shared_ptr<const MhaSequenceIndex> index = this->reader.getIndex();
+  if(!index || this->activeTransform < 0 || !this->poseFilterSettings.isEnabled())
+  {
+    this->filteredPoses = MhaPoseTrack();
+    this->poseOutliers.clear();
+    return;
+  }
+  std::chrono::steady_clock::time_point beginTime = std::chrono::steady_clock::now();
+  index->getPoseTrack(this->activeTransform).filter(this->poseFilterSettings, this->filteredPoses, this->poseOutliers);
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - beginTime).count();
+
+  int counts[3] = { 0, 0, 0 };
+  const unsigned char classes[3] = { MhaPoseTrack::Speed, MhaPoseTrack::Acceleration, MhaPoseTrack::AngularSpeed };
+  int outliers = 0;
+  for(size_t frame=0; frame<this->poseOutliers.size(); frame++)
+  {
+    outliers += this->poseOutliers[frame] ? 1 : 0;
+    for(int i=0; i<3; i++)
+      counts[i] += (this->poseOutliers[frame] & classes[i]) ? 1 : 0;
+  }
+  ostringstream oss;
+  oss << "Tracking outliers: " << outliers << " (speed " << counts[0] << ", acceleration " << counts[1]
+      << ", rotation " << counts[2] << "), filtered in " << 1000.*seconds << " ms" << endl;
+  this->log(oss.str());
+}
+
+// Filters the frames the active transform gained since updatePoseFilter(),
+// the earlier ones keep their flags and smoothing. The plane index takes
+// the new frames at its next query.
+void vtkSlicerSimpleMhaReaderLogic::extendPoseFilter()
+{
+  std::shared_ptr<const MhaSequenceIndex> index = this->reader.getIndex();
+  if(!index || this->activeTransform < 0 || !this->poseFilterSettings.isEnabled())
+  {
+    this->filteredPoses = MhaPoseTrack();
+    this->poseOutliers.clear();
+    return;
+  }
+  index->getPoseTrack(this->activeTransform).extendFilter(this->poseFilterSettings, this->filteredPoses,
+    this->poseOutliers);
+}
+
+// Sequences played along follow the transform of the main image, or the
+// probe pose when they did not record it, and its filter settings
+void vtkSlicerSimpleMhaReaderLogic::updateSequencePoses()
+{
+  int count = this->player->getNumberOfSequences();
+  this->sequenceTransforms.assign(count, -1);
+  this->sequencePoses.assign(count, MhaPoseTrack());
+  vector<unsigned char> outliers;
+  for(int i=0; i<count; i++)
+  {
+    const MhaTransformTable& table = this->player->getIndex(i)->getTransformTable();
+    int stream = table.find(this->getActiveTransform());
+    const char* defaultTransforms[] = { "ProbeToTracker", "UltrasoundToTracker" };
+    for(int j=0; j<2 && stream < 0; j++)
+      stream = table.find(defaultTransforms[j]);
+    this->sequenceTransforms[i] = stream;
+    if(stream >= 0 && this->poseFilterSettings.isEnabled())
+      this->player->getIndex(i)->getPoseTrack(stream).filter(this->poseFilterSettings, this->sequencePoses[i], outliers);
+  }
+}
+
+void vtkSlicerSimpleMhaReaderLogic::setFollowMode(bool value)
+{
+  this->followMode = value;
+  if(value)
+    this->watchFile();
+  else
+    this->unwatchFile();
+}
+
+void vtkSlicerSimpleMhaReaderLogic::watchFile()
+{
+  this->unwatchFile();
+  this->followFileSize = getFileSize(this->mhaPath);
+  #ifdef __linux__
+  this->followFd = inotify_init1(IN_NONBLOCK);
+  if(this->followFd >= 0 && inotify_add_watch(this->followFd, this->mhaPath.c_str(), IN_MODIFY | IN_CLOSE_WRITE) < 0)
+  {
+    ::close(this->followFd);
+    this->followFd = -1;
+  }
+  #endif
+}
+
+void vtkSlicerSimpleMhaReaderLogic::unwatchFile()
+{
+  #ifdef __linux__
+  if(this->followFd >= 0)
+    ::close(this->followFd);
+  #endif
+  this->followFd = -1;
+}
+
+bool vtkSlicerSimpleMhaReaderLogic::updateFollow()
+{
+  if(!this->followMode || this->mhaPath.empty())
+    return false;
+
+  // Without inotify the file size tells whether the recorder wrote anything
+  bool changed = false;
+  #ifdef __linux__
+  if(this->followFd >= 0)
+  {
+    char events[4096];
+    while(::read(this->followFd, events, sizeof(events)) > 0)
+      changed = true;
+  }
+  else
+  #endif
+  {
+    long long fileSize = getFileSize(this->mhaPath);
+    changed = fileSize != this->followFileSize;
+    this->followFileSize = fileSize;
+  }
+  if(!changed)
+    return false;
+  return this->indexNewFrames() > 0;
+}
+
+int vtkSlicerSimpleMhaReaderLogic::indexNewFrames()
+{
+  int newFrames = this->reader.update();
+  if(newFrames <= 0)
+    return 0;
+  this->updateAvailableTransforms();
+  this->numberOfFrames = this->reader.getNumberOfFrames();
+  this->Modified();
+  return newFrames;
+}
+
+
+int vtkSlicerSimpleMhaReaderLogic::getInterpolatedPoses(const vector<double>& queries, bool byTime,
+  vector<float>& matrices, vector<unsigned char>& valid) const
+{
+  std::shared_ptr<const MhaSequenceIndex> index = this->reader.getIndex();
+  if(!index || this->activeTransform < 0)
+    return 1;
+  const MhaPoseTrack& track = index->getPoseTrack(this->activeTransform);
+  if(byTime && !track.hasTimestamps())
+    return 1;
+  matrices.resize(12*queries.size());
+  valid.resize(queries.size());
+  if(queries.empty())
+    return 0;
+  if(byTime)
+    track.interpolateTimes(&queries[0], (int)queries.size(), &matrices[0], &valid[0]);
+  else
+    track.interpolateFrames(&queries[0], (int)queries.size(), &matrices[0], &valid[0]);
+  return 0;
+}
+
+void vtkSlicerSimpleMhaReaderLogic::getImageToProbe(double matrix[16]) const
+{
+  vtkSmartPointer<vtkMatrix4x4> imageToUSTransform = vtkSmartPointer<vtkMatrix4x4>::New();
+  vtkMatrix4x4::Invert(this->USToImageTransform, imageToUSTransform);
+  for(int i=0; i<4; i++)
+    for(int j=0; j<4; j++)
+      matrix[4*i+j] = imageToUSTransform->GetElement(i,j);
+}
+
+// Same poses as updateImage(): filtered ones when a pose filter is set
+void vtkSlicerSimpleMhaReaderLogic::updatePlaneIndex()
+{
+  // Rebuilt for another transform or filter, or for frames appended since
+  if(!this->planeIndexDirty && this->planeIndexFrames == this->numberOfFrames)
+    return;
+  this->planeIndexDirty = false;
+  this->planeIndexFrames = this->numberOfFrames;
+  std::shared_ptr<const MhaSequenceIndex> index = this->reader.getIndex();
+  if(!index || this->activeTransform < 0)
+  {
+    this->planeIndex.clear();
+    return;
+  }
+  std::chrono::steady_clock::time_point beginTime = std::chrono::steady_clock::now();
+  double imageToProbe[16];
+  this->getImageToProbe(imageToProbe);
+  bool filtered = this->filteredPoses.getNumberOfFrames() > 0;
+  const MhaPoseTrack& poses = filtered ? this->filteredPoses : index->getPoseTrack(this->activeTransform);
+  this->planeIndex.build(poses, this->imageWidth, this->imageHeight, imageToProbe,
+    filtered ? &this->poseOutliers : NULL);
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - beginTime).count();
+  ostringstream oss;
+  oss << "Indexed " << this->planeIndex.getNumberOfFrames() << " image planes in " << 1000.*seconds << " ms" << endl;
+  this->log(oss.str());
+}
+
+int vtkSlicerSimpleMhaReaderLogic::findFramesNearPoint(const double point[3], double distance, vector<int>& frames)
+{
+  frames.clear();
+  this->updatePlaneIndex();
+  if(this->planeIndex.isEmpty())
+    return 1;
+  std::chrono::steady_clock::time_point beginTime = std::chrono::steady_clock::now();
+  this->planeIndex.findFramesNearPoint(point, distance, frames);
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - beginTime).count();
+  ostringstream oss;
+  oss << frames.size() << " frames within " << distance << " mm of (" << point[0] << ", " << point[1] << ", "
+      << point[2] << "), found in " << 1000.*seconds << " ms" << endl;
+  this->log(oss.str());
+  return 0;
+}
+
+int vtkSlicerSimpleMhaReaderLogic::findFramesInBox(const double bounds[6], vector<int>& frames)
+{
+  frames.clear();
+  this->updatePlaneIndex();
+  if(this->planeIndex.isEmpty())
+    return 1;
+  std::chrono::steady_clock::time_point beginTime = std::chrono::steady_clock::now();
+  this->planeIndex.findFramesInBox(bounds, frames);
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - beginTime).count();
+  ostringstream oss;
+  oss << frames.size() << " frames through the box, found in " << 1000.*seconds << " ms" << endl;
+  this->log(oss.str());
+  return 0;
+}
+
+unsigned char vtkSlicerSimpleMhaReaderLogic::getTransformFlags(int frame) const
+{
+  if(this->activeTransform < 0)
+    return 0;
+  const MhaTransformStream& stream = this->reader.getTransformTable().streams[this->activeTransform];
+  if(frame < 0 || frame >= stream.getNumberOfFrames())
+    return 0;
+  return stream.flags[frame];
+}
 
 string vtkSlicerSimpleMhaReaderLogic::getCurrentTransformStatus()
 {
-  if(this->transformsValidity.size() == 0)
-    return "Unknown";
-  if(this->transformsValidity[this->currentFrame])
+  unsigned char flags = this->getTransformFlags(this->currentFrame);
+  unsigned char outlier = this->currentFrame >= 0 && this->currentFrame < (int)this->poseOutliers.size() ?
+    this->poseOutliers[this->currentFrame] : 0;
+  if(outlier)
+  {
+    string status = "OUTLIER (";
+    if(outlier & MhaPoseTrack::Speed)
+      status += "speed, ";
+    if(outlier & MhaPoseTrack::Acceleration)
+      status += "acceleration, ";
+    if(outlier & MhaPoseTrack::AngularSpeed)
+      status += "rotation, ";
+    return status.substr(0, status.size() - 2) + ")";
+  }
+  if(flags & MhaTransformStream::StatusOK)
     return "OK";
-  else
+  else if(flags & MhaTransformStream::StatusInvalid)
     return "INVALID";
+  else
+    return "Unknown";
+}
+
+void vtkSlicerSimpleMhaReaderLogic::setActiveTransform(string name)
+{
+  int id = this->reader.getTransformTable().find(name);
+  if(id < 0 || id == this->activeTransform)
+    return;
+  this->activeTransform = id;
+  this->updatePoseFilter();
+  if(this->applyTransforms)
+    this->updateImage();
+  this->Modified();
+}
+
+string vtkSlicerSimpleMhaReaderLogic::getActiveTransform()
+{
+  if(this->activeTransform < 0)
+    return "";
+  return this->reader.getTransformTable().streams[this->activeTransform].name;
+}
+
+// File name of a frame snapshot, built on demand instead of stored per frame
+string vtkSlicerSimpleMhaReaderLogic::getFramePngFilename(int frame)
+{
+  char frameName[32];
+  sprintf(frameName, "Seq_Frame%04d_", frame);
+  return getDir(this->mhaPath) + frameName + this->getActiveTransform() + "Transform.png";
 }
 
 void vtkSlicerSimpleMhaReaderLogic::updateImage()
 {
   checkFrame();
   
-  ostringstream oss;
-  clock_t beginTime = clock();
+  // Per frame timings go to the metrics, the log would fill up with them
+  std::chrono::steady_clock::time_point beginTime = std::chrono::steady_clock::now();
 
   readImage_mha();
 
-  clock_t endTime = clock();
-  double intervalInMiliSeconds = (double)(endTime - beginTime)/(double) CLOCKS_PER_SEC * 1000.;
-  oss << "Reading took: " << intervalInMiliSeconds << " ms" << endl;
-  this->console->insertPlainText(oss.str().c_str());
-  oss.clear(); oss.str("");
+  std::chrono::steady_clock::time_point endTime = std::chrono::steady_clock::now();
+  this->metrics.record(this->readTimer, std::chrono::duration<double, std::milli>(endTime - beginTime).count());
   beginTime = endTime;
 
+  // Filtered poses replace the recorded ones, outliers being interpolated over
+  float filteredPose[12];
+  const float* pose = NULL;
+  if(this->applyTransforms && this->activeTransform >= 0)
+    pose = getDisplayPose(this->reader.getTransformTable().streams[this->activeTransform], this->filteredPoses,
+      this->currentFrame, filteredPose);
+  this->publishFrame(this->dataPointer, this->imageWidth, this->imageHeight, this->currentFrame, pose);
+  // A stream frame shown last is no longer wrapped by the image
+  this->releaseStreamFrame();
+}
+
+void vtkSlicerSimpleMhaReaderLogic::publishFrame(const unsigned char* framePixels, int width, int height, int frame, const float* pose)
+{
+  std::chrono::steady_clock::time_point beginTime = std::chrono::steady_clock::now();
+  std::chrono::steady_clock::time_point endTime;
+
+  const unsigned char* pixels = framePixels;
+  if(!this->filterChain->isEmpty())
+  {
+    pixels = this->filterChain->process(framePixels, width, height, frame);
+    endTime = std::chrono::steady_clock::now();
+    this->metrics.record(this->filterTimer, std::chrono::duration<double, std::milli>(endTime - beginTime).count());
+    beginTime = endTime;
+  }
 
-  vtkSmartPointer<vtkImageImport> importer = vtkSmartPointer<vtkImageImport>::New();
-  importer->SetDataScalarTypeToUnsignedChar();
-  importer->SetImportVoidPointer(dataPointer,1); // Save argument to 1 won't destroy the pointer when importer destroyed
-  importer->SetWholeExtent(0,this->imageWidth-1,0, this->imageHeight-1, 0, 0);
-  importer->SetDataExtentToWholeExtent();
-  importer->Update();
-  this->imgData = importer->GetOutput();
+  // One importer for all frames, its output wraps the frame buffer without a copy
+  this->importer->SetImportVoidPointer(const_cast<unsigned char*>(pixels),1); // Save argument to 1 won't destroy the pointer when importer destroyed
+  this->importer->SetWholeExtent(0,width-1,0, height-1, 0, 0);
+  this->importer->SetDataExtentToWholeExtent();
+  this->importer->Modified();
+  this->importer->Update();
+  this->imgData = this->importer->GetOutput();
   
-  if(this->transforms.size() > 0 && this->applyTransforms)
+  // Geometry and pixels reach the scene as one modification of the node
+  int wasModifying = this->imageNode->StartModify();
+
+  if(pose)
   {
     vtkSmartPointer<vtkMatrix4x4> transform = vtkSmartPointer<vtkMatrix4x4>::New();
     vtkSmartPointer<vtkTransform> combinedTransform = vtkSmartPointer<vtkTransform>::New();
     vtkSmartPointer<vtkMatrix4x4> imageToUSTransform = vtkSmartPointer<vtkMatrix4x4>::New();
     vtkMatrix4x4::Invert(this->USToImageTransform, imageToUSTransform);
-    getVtkMatrixFromVector(this->transforms[this->currentFrame], transform);
+    getVtkMatrixFromArray(pose, transform);
     combinedTransform->Concatenate(transform);
     combinedTransform->Concatenate(imageToUSTransform);
     vtkSmartPointer<vtkMatrix4x4> matrix = combinedTransform->GetMatrix();
@@ -469,46 +1487,39 @@ void vtkSlicerSimpleMhaReaderLogic::updateImage()
     this->imageNode->SetIJKToRASMatrix(matrix);
   }
 
-  endTime = clock();
-  intervalInMiliSeconds = (double)(endTime - beginTime)/(double) CLOCKS_PER_SEC * 1000.;
-  oss << "Importing to vtk took : " << intervalInMiliSeconds << " ms" << endl;
-  this->console->insertPlainText(oss.str().c_str());
-  oss.clear(); oss.str("");
+  endTime = std::chrono::steady_clock::now();
+  this->metrics.record(this->importTimer, std::chrono::duration<double, std::milli>(endTime - beginTime).count());
   beginTime = endTime;
   
   this->imageNode->SetAndObserveImageData(this->imgData);
+  this->imageNode->EndModify(wasModifying);
   if(this->GetMRMLScene()) {
     if(!this->GetMRMLScene()->IsNodePresent(this->imageNode))
       this->GetMRMLScene()->AddNode(this->imageNode);
   }
   
-  endTime = clock();
-  intervalInMiliSeconds = (double)(endTime - beginTime)/(double) CLOCKS_PER_SEC * 1000.;
-  oss << "Setting node's data took: " << intervalInMiliSeconds << " ms" << endl;
-  this->console->insertPlainText(oss.str().c_str());
-  oss.clear(); oss.str("");
-  beginTime = endTime;
+  endTime = std::chrono::steady_clock::now();
+  this->metrics.record(this->publishTimer, std::chrono::duration<double, std::milli>(endTime - beginTime).count());
 }
 
 void vtkSlicerSimpleMhaReaderLogic::nextImage()
 {
   this->currentFrame += 1;
-  this->updateImage();
-  this->Modified();
+  this->requestFrame();
 }
 
 void vtkSlicerSimpleMhaReaderLogic::previousImage()
 {
   this->currentFrame -= 1;
-  this->updateImage();
-  this->Modified();
+  this->requestFrame();
 }
 
 void vtkSlicerSimpleMhaReaderLogic::goToFrame(int frame)
 {
+  // Scrubbing with the slider, the readahead follows what it observes
+  this->reader.getReadaheadPolicy().setPlayMode(MhaReadaheadPolicy::Inferred);
   this->currentFrame = frame;
-  this->updateImage();
-  this->Modified();
+  this->requestFrame();
 }
 
 void vtkSlicerSimpleMhaReaderLogic::nextValidFrame()
@@ -517,12 +1528,11 @@ void vtkSlicerSimpleMhaReaderLogic::nextValidFrame()
   for(int i=0; i<this->getNumberOfFrames(); i++)
   {
     frame = (this->currentFrame + i + 1)%this->getNumberOfFrames();
-    if(this->transformsValidity[frame])
+    if(this->getTransformFlags(frame) & MhaTransformStream::StatusOK)
       break;
   }
   this->currentFrame = frame;
-  this->updateImage();
-  this->Modified();
+  this->requestFrame();
 }
 
 void vtkSlicerSimpleMhaReaderLogic::previousValidFrame()
@@ -533,12 +1543,11 @@ void vtkSlicerSimpleMhaReaderLogic::previousValidFrame()
     frame = this->currentFrame-i-1;
     if(frame < 0)
       frame = this->getNumberOfFrames() + frame;
-    if(this->transformsValidity[frame])
+    if(this->getTransformFlags(frame) & MhaTransformStream::StatusOK)
       break;
   }
   this->currentFrame = frame;
-  this->updateImage();
-  this->Modified();
+  this->requestFrame();
 }
 
 void vtkSlicerSimpleMhaReaderLogic::nextInvalidFrame()
@@ -547,12 +1556,11 @@ void vtkSlicerSimpleMhaReaderLogic::nextInvalidFrame()
   for(int i=0; i<this->getNumberOfFrames(); i++)
   {
     frame = (this->currentFrame + i + 1)%this->getNumberOfFrames();
-    if(!this->transformsValidity[frame])
+    if(this->getTransformFlags(frame) & MhaTransformStream::StatusInvalid)
       break;
   }
   this->currentFrame = frame;
-  this->updateImage();
-  this->Modified();
+  this->requestFrame();
 }
 
 void vtkSlicerSimpleMhaReaderLogic::previousInvalidFrame()
@@ -563,21 +1571,97 @@ void vtkSlicerSimpleMhaReaderLogic::previousInvalidFrame()
     frame = this->currentFrame-i-1;
     if(frame < 0)
       frame = this->getNumberOfFrames() + frame;
-    if(!this->transformsValidity[frame])
+    if(this->getTransformFlags(frame) & MhaTransformStream::StatusInvalid)
       break;
   }
   this->currentFrame = frame;
-  this->updateImage();
-  this->Modified();
+  this->requestFrame();
 }
 
 void vtkSlicerSimpleMhaReaderLogic::randomFrame()
 {
-  this->currentFrame = rand()%this->getNumberOfFrames();
+  if(this->getNumberOfFrames() <= 0)
+    return;
+  this->currentFrame = this->random.nextInt(this->getNumberOfFrames());
+  this->requestFrame();
+}
+
+void vtkSlicerSimpleMhaReaderLogic::goToFlaggedFrame(unsigned char flags, int direction)
+{
+  int frame = this->currentFrame;
+  for(int i=0; i<this->getNumberOfFrames(); i++)
+  {
+    frame = (this->currentFrame + direction*(i + 1))%this->getNumberOfFrames();
+    if(frame < 0)
+      frame = this->getNumberOfFrames() + frame;
+    if(this->analyzer->getFrameFlags(frame) & flags)
+      break;
+  }
+  this->currentFrame = frame;
+  this->requestFrame();
+}
+
+void vtkSlicerSimpleMhaReaderLogic::nextBlankFrame()
+{
+  this->goToFlaggedFrame(MhaSequenceAnalyzer::Blank, 1);
+}
+
+void vtkSlicerSimpleMhaReaderLogic::previousBlankFrame()
+{
+  this->goToFlaggedFrame(MhaSequenceAnalyzer::Blank, -1);
+}
+
+void vtkSlicerSimpleMhaReaderLogic::nextFrozenFrame()
+{
+  this->goToFlaggedFrame(MhaSequenceAnalyzer::Frozen, 1);
+}
+
+void vtkSlicerSimpleMhaReaderLogic::previousFrozenFrame()
+{
+  this->goToFlaggedFrame(MhaSequenceAnalyzer::Frozen, -1);
+}
+
+// Navigation publishes at most one frame per refresh of the display, frames
+// requested in between are replaced by the last one
+void vtkSlicerSimpleMhaReaderLogic::requestFrame()
+{
+  this->checkFrame();
+  std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+  double interval = this->maximumFrameRate > 0. ? 1./this->maximumFrameRate : 0.;
+  if(std::chrono::duration<double>(now - this->lastPublishTime).count() < interval)
+  {
+    // Observers schedule the publication once, later requests replace the frame
+    bool wasPending = this->framePending;
+    this->framePending = true;
+    if(!wasPending)
+      this->InvokeEvent(FramePendingEvent);
+    return;
+  }
+  this->lastPublishTime = now;
+  this->framePending = false;
   this->updateImage();
   this->Modified();
 }
 
+bool vtkSlicerSimpleMhaReaderLogic::publishPendingFrame()
+{
+  if(!this->framePending)
+    return false;
+  // Called early, the frame is deferred again and the event invoked anew
+  this->framePending = false;
+  this->requestFrame();
+  return !this->framePending;
+}
+
+double vtkSlicerSimpleMhaReaderLogic::getPendingFrameDelay() const
+{
+  if(!this->framePending)
+    return 0.;
+  double interval = this->maximumFrameRate > 0. ? 1./this->maximumFrameRate : 0.;
+  double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - this->lastPublishTime).count();
+  return std::max(interval - elapsed, 0.);
+}
+
 void vtkSlicerSimpleMhaReaderLogic::checkFrame()
 {
   if(this->currentFrame >= this->numberOfFrames)
@@ -589,13 +1673,22 @@ void vtkSlicerSimpleMhaReaderLogic::checkFrame()
 
 void vtkSlicerSimpleMhaReaderLogic::playNext()
 {
-  cout << this->playMode;
+  MhaReadaheadPolicy& readahead = this->reader.getReadaheadPolicy();
   if(this->playMode == "Forwards")
+  {
+    readahead.setPlayMode(MhaReadaheadPolicy::Forwards);
     this->nextImage();
+  }
   else if(this->playMode == "Backwards")
+  {
+    readahead.setPlayMode(MhaReadaheadPolicy::Backwards);
     this->previousImage();
+  }
   else if(this->playMode == "Random")
+  {
+    readahead.setPlayMode(MhaReadaheadPolicy::Random);
     this->randomFrame();
+  }
 }
 
 void vtkSlicerSimpleMhaReaderLogic::setTransformToIdentity()
@@ -691,7 +1784,7 @@ void vtkSlicerSimpleMhaReaderLogic::printUSToImageTransform()
       oss <<this->USToImageTransform->GetElement(i,j) << " ";
     }
     oss << "\n";
-    this->console->insertPlainText(oss.str().c_str());
+    this->log(oss.str());
   }
 }
 
@@ -710,6 +1803,11 @@ string vtkSlicerSimpleMhaReaderLogic::getMhaPath()
   return this->mhaPath;
 }
 
+void vtkSlicerSimpleMhaReaderLogic::log(const string& message, MhaLogLevel level)
+{
+  this->logChannel.write(level, message);
+}
+
 void vtkSlicerSimpleMhaReaderLogic::saveToPng(const std::string filepath)
 {
   if(!this->imgData)
@@ -32,23 +32,40 @@
 #include <vtkMRMLLinearTransformNode.h>
 
 // STD includes
+#include <chrono>
 #include <cstdlib>
 #include <stdio.h>
 #include <set>
+#include <map>
+#include <vector>
 
 // VTK includes
+#include <vtkCommand.h>
 #include <vtkImageData.h>
 #include <vtkMatrix4x4.h>
 
-// QT includes
-#include <QTextEdit>
-
 #include "vtkSlicerSimpleMhaReaderModuleLogicExport.h"
 
 #include "util_macros.h"
 
 using namespace std;
 
+// SimpleMhaReader core includes
+#include "MhaFilterChain.h"
+#include "MhaFramePool.h"
+#include "MhaLog.h"
+#include "MhaMetrics.h"
+#include "MhaPlaneIndex.h"
+#include "MhaRandom.h"
+#include "MhaSequenceReader.h"
+#include "MhaStreamReceiver.h"
+
+class MhaCompressedFrameCache;
+class MhaMultiSequencePlayer;
+class MhaSequenceAnalyzer;
+class MhaTileCache;
+class vtkImageImport;
+
 /// \ingroup Slicer_QtModules_ExtensionTemplate
 class VTK_SLICER_SIMPLEMHAREADER_MODULE_LOGIC_EXPORT vtkSlicerSimpleMhaReaderLogic :
   public vtkSlicerModuleLogic
@@ -59,6 +76,9 @@ public:
   vtkTypeMacro(vtkSlicerSimpleMhaReaderLogic, vtkSlicerModuleLogic);
   void PrintSelf(ostream& os, vtkIndent indent);
 
+  /// Invoked when navigation defers a frame, see publishPendingFrame()
+  enum { FramePendingEvent = vtkCommand::UserEvent + 1 };
+
 protected:
   vtkSlicerSimpleMhaReaderLogic();
   virtual ~vtkSlicerSimpleMhaReaderLogic();
@@ -76,28 +96,115 @@ private:
   void operator=(const vtkSlicerSimpleMhaReaderLogic&);               // Not implemented
   void printUSToImageTransform();
   void checkFrame();
+  void requestFrame();
+  unsigned char getTransformFlags(int frame) const;
+  void updateAvailableTransforms();
+  void watchFile();
+  void unwatchFile();
+  void goToFlaggedFrame(unsigned char flags, int direction);
+  void reportDuplicateFrames();
+  /// Queued for the UI, which drains getLog()
+  void log(const string& message, MhaLogLevel level = MhaLogInfo);
+  void logFramePoolStatistics();
+  void publishSequenceFrame(int sequence, int frame);
+  /// Filters the frame and shows it in imageNode, placed by pose when not NULL
+  void publishFrame(const unsigned char* pixels, int width, int height, int frame, const float* pose);
+  void releaseStreamFrame();
+  void updateMemoryAccounts();
+  void updatePoseFilter();
+  void extendPoseFilter();
+  void updateSequencePoses();
+  void updatePlaneIndex();
+  void getImageToProbe(double matrix[16]) const;
   
   // Attributes
 private:
   string mhaPath;
-  vector<vector<float> > transforms;
-  vector<string> filenames;
-  vector<bool> transformsValidity;
+  MhaSequenceReader reader;
+  int activeTransform;
   set<string> availableTransforms;
   
   vtkMRMLLinearTransformNode* USToImageTransformNode;
   vtkSmartPointer<vtkMatrix4x4> USToImageTransform;
   vtkSmartPointer<vtkImageData> imgData;
+  vtkSmartPointer<vtkImageImport> importer;
+  /// Slab of framePool
   unsigned char* dataPointer;
+  MhaFramePool framePool;
   vtkMRMLScalarVolumeNode* imageNode;
+  /// Volume of the frames of loadFrameRange()
+  vtkMRMLScalarVolumeNode* stackNode;
+  /// Line over time of extractTimeLine()
+  vtkSmartPointer<vtkImageData> mModeImage;
+  vtkMRMLScalarVolumeNode* mModeNode;
   int imageWidth;
   int imageHeight;
   int currentFrame;
   int numberOfFrames;
   bool applyTransforms;
   string playMode;
+  bool followMode;
+  int followFd;
+  long long followFileSize;
+  MhaSequenceAnalyzer* analyzer;
+  bool analysisReported;
+  MhaTileCache* tileCache;
+  bool tileCacheReported;
+  MhaCompressedFrameCache* frameCache;
+  bool frameCacheReported;
+  /// Frames of randomFrame(), the same series for the same seed
+  MhaRandom random;
+  vector<unsigned long long> frameHashes;
+  MhaFilterSettings filterSettings;
+  MhaFilterChain* filterChain;
+  MhaPoseFilterSettings poseFilterSettings;
+  /// Active transform without its outliers, empty while no filter is set
+  MhaPoseTrack filteredPoses;
+  vector<unsigned char> poseOutliers;
+  /// Image planes of the poses used for display, built on the first query
+  MhaPlaneIndex planeIndex;
+  bool planeIndexDirty;
+  /// Frames of the sequence when the plane index was built
+  int planeIndexFrames;
+  
+  /// Sequences played together, one volume node each
+  MhaMultiSequencePlayer* player;
+  vector<vtkMRMLScalarVolumeNode*> sequenceNodes;
+  vector<vtkSmartPointer<vtkImageData> > sequenceImages;
+  vector<vector<unsigned char> > sequencePixels;
+  vector<int> sequenceFrames;
+  /// Transform placing every sequence, -1 for none, and its poses filtered
+  /// like filteredPoses, empty while no filter is set
+  vector<int> sequenceTransforms;
+  vector<MhaPoseTrack> sequencePoses;
+  bool sequencesPlaying;
+  double sequencesPlayTime;
+  std::chrono::steady_clock::time_point sequencesPlayClock;
+  /// Live stream shown in imageNode instead of the sequence; streamFrame
+  /// holds the pixels the image wraps until another frame replaces them
+  MhaStreamReceiver* receiver;
+  MhaStreamFrame streamFrame;
+  bool streaming;
+  /// Rate limit of navigation, lastPublishTime is when a frame last reached the scene
+  double maximumFrameRate;
+  std::chrono::steady_clock::time_point lastPublishTime;
+  bool framePending;
   
-  QTextEdit* console;
+  MhaLog logChannel;
+  MhaMetrics metrics;
+  int readTimer;
+  int filterTimer;
+  int importTimer;
+  int publishTimer;
+  /// Memory accounts of the metrics, see updateMemoryAccounts()
+  int indexMemory;
+  int framesMemory;
+  int posesMemory;
+  int volumesMemory;
+  int sequencesMemory;
+  int streamMemory;
+  int frameCacheMemory;
+  bool memoryLimitReported;
   
 public:
   // Read image logic
@@ -107,6 +214,9 @@ public:
   void setUSToImageTransform();
   void setMhaPath(string path);
   string getCurrentTransformStatus();
+  void setActiveTransform(string name);
+  string getActiveTransform();
+  string getFramePngFilename(int frame);
   void updateImage();
   void nextImage();
   void nextValidFrame();
@@ -115,9 +225,124 @@ public:
   void nextInvalidFrame();
   void previousInvalidFrame();
   void randomFrame();
+  void setRandomSeed(unsigned long long seed) { this->random.seed(seed); }
   void previousImage();
   void playNext();
   void saveToPng(const std::string filepath);
+  /// Navigation faster than maximumFrameRate (frames per second, 0 for no
+  /// limit) defers the frame and invokes FramePendingEvent. The frame is
+  /// due getPendingFrameDelay() seconds later; publishPendingFrame() then
+  /// shows it and returns true.
+  bool publishPendingFrame();
+  double getPendingFrameDelay() const;
+  /// Plays the sequences at paths together, each in its own volume node
+  /// placed by its probe pose, on one clock aligned on their timestamps.
+  /// updateSequences() is meant to be polled at the display rate and returns
+  /// true when a node changed; sequences falling behind skip frames.
+  int openSequences(const vector<string>& paths);
+  void setSequencesPlaying(bool playing);
+  bool getSequencesPlaying() const { return this->sequencesPlaying; }
+  void setSequencesTime(double time);
+  bool updateSequences();
+  bool hasSequences() const;
+  string getSequencesStatus() const;
+  /// Shows the frames of a live stream (OpenIGTLink style IMAGE and
+  /// TRANSFORM messages, as sent by Plus) in the image node through the same
+  /// filters, appending them to recordPath when not empty. updateStream() is
+  /// meant to be polled at the display rate and returns true when it shows a
+  /// new frame, frames that arrive faster are skipped.
+  int startStream(const string& host, int port, const string& recordPath = "");
+  void stopStream();
+  bool updateStream();
+  bool isStreaming() const { return this->streaming; }
+  string getStreamStatus() const;
+  /// Messages of the logic, safe to write from worker threads; a single
+  /// consumer drains them
+  MhaLog& getLog() { return this->logChannel; }
+  /// Read, Filter, Import and Publish timings of displayed frames, and the
+  /// bytes held by the index, frame buffers, poses, volumes, sequences, stream
+  /// and frame cache
+  MhaMetrics& getMetrics() { return this->metrics; }
+  /// Refreshes the memory accounts and, over the soft limit (bytes, 0 for
+  /// none), evicts what can be rebuilt: unused frame buffers, then the plane
+  /// index, then the cached frames farthest from the current one. Meant to
+  /// be polled.
+  void updateMemory();
+  void setMemorySoftLimit(long long bytes);
+  string getMemoryStatus();
+  /// Follow mode indexes frames appended to the file while it is recorded.
+  /// updateFollow() is meant to be polled, it returns true if frames were added.
+  void setFollowMode(bool);
+  bool updateFollow();
+  int indexNewFrames();
+  /// Background statistics pass, updateAnalysis() is polled and returns true
+  /// once when results become available
+  void startAnalysis();
+  bool updateAnalysis();
+  double getAnalysisProgress();
+  string getCurrentFrameStatistics();
+  /// Hashes every frame (or reuses persisted hashes) and reports duplicate runs
+  void startDuplicateSearch();
+  bool isDuplicateFrame(int frame) const;
+  void nextBlankFrame();
+  void previousBlankFrame();
+  void nextFrozenFrame();
+  void previousFrozenFrame();
+  /// Writes frames firstFrame..lastFrame (every stride-th) with their transforms
+  /// to a new .mha; cropExtent {xmin, xmax, ymin, ymax} is optional. Frames go
+  /// through the same filters as the display.
+  int exportSequence(const string& path, int firstFrame, int lastFrame, int stride = 1, const int* cropExtent = NULL, bool skipDuplicates = false);
+  /// Writes frames firstFrame..lastFrame (every stride-th) as a Motion JPEG
+  /// AVI playing at framesPerSecond, or as numbered .jpg files for other
+  /// extensions, encoded on every core. Frames go through the display filters
+  /// when applyFilters.
+  int exportCine(const string& path, int firstFrame, int lastFrame, int stride, double framesPerSecond,
+    const int* cropExtent = NULL, bool applyFilters = true);
+  /// Reads frames firstFrame..lastFrame (every stride-th) into one volume
+  /// with time along k, published as its own node next to the frame image.
+  /// Frames are loaded unfiltered.
+  int loadFrameRange(int firstFrame, int lastFrame, int stride = 1);
+  /// Builds the time-major tile cache (or reuses the one saved next to the
+  /// sequence) in the background, updateTileCache() is polled and returns
+  /// true once when it is done
+  void startTileCache();
+  bool updateTileCache();
+  double getTileCacheProgress();
+  bool isTileCacheReady() const;
+  /// Compresses every frame into memory in the background, frames are then
+  /// decoded from memory instead of read from the file as soon as they are
+  /// in. updateFrameCache() is polled and returns true once when the build
+  /// ends; the cache is freed by clearFrameCache() or another sequence.
+  void startFrameCache();
+  void clearFrameCache();
+  bool updateFrameCache();
+  double getFrameCacheProgress();
+  bool isFrameCacheRunning() const;
+  /// Samples the line from (x0, y0) to (x1, y1), in pixels, in every frame
+  /// into an M-mode image with time along i, published as its own node.
+  /// Needs the tile cache and is fast enough to follow a dragged line.
+  int extractTimeLine(double x0, double y0, double x1, double y1);
+  /// Poses of the active transform at fractional frame indices, or at times
+  /// of the frame timestamps when byTime: 12 floats (3x4, row major) and a
+  /// valid flag per query. Frames with an INVALID status are interpolated over.
+  int getInterpolatedPoses(const vector<double>& queries, bool byTime,
+    vector<float>& matrices, vector<unsigned char>& valid) const;
+  /// Snapshot of the sequence index, for cursors reading from other threads
+  /// and for MhaTrainingLoader batches
+  std::shared_ptr<const MhaSequenceIndex> getSequenceIndex() const { return this->reader.getIndex(); }
+  /// Filters applied to displayed and exported frames
+  void setFilterSettings(const MhaFilterSettings& settings);
+  MhaFilterSettings getFilterSettings() const { return this->filterSettings; }
+  /// Outlier limits and smoothing of the active transform; outliers show in
+  /// the transform status and applied transforms use the filtered poses
+  void setPoseFilterSettings(const MhaPoseFilterSettings& settings);
+  MhaPoseFilterSettings getPoseFilterSettings() const { return this->poseFilterSettings; }
+  /// Frames whose image plane, placed by the active transform and the
+  /// US to image calibration, passes within distance (mm) of a RAS point or
+  /// through bounds {xmin, xmax, ymin, ymax, zmin, zmax}. The index is built
+  /// on the first query and follows calibration changes without a rebuild.
+  int findFramesNearPoint(const double point[3], double distance, vector<int>& frames);
+  int findFramesInBox(const double bounds[6], vector<int>& frames);
   
   // Getters and Setters
   string getMhaPath();
@@ -127,9 +352,10 @@ public:
   GET(int, numberOfFrames, NumberOfFrames);
   GET(set<string>, availableTransforms, AvailableTransforms);
   GET(vtkMatrix4x4*, USToImageTransform, USToImageTransform);
-  GETSET(QTextEdit*, console, Console);
   GETSET(string, playMode, PlayMode);
   GET(bool, applyTransforms, ApplyTransforms);
+  GET(bool, followMode, FollowMode);
+  GETSET(double, maximumFrameRate, MaximumFrameRate);
   
 };
 
@@ -0,0 +1,79 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+// MhaReaderCore includes
+#include "MhaChunkedArray.h"
+#include "MhaTestUtilities.h"
+
+//----------------------------------------------------------------------------
+int MhaChunkedArrayTest(int, char*[])
+{
+  typedef MhaChunkedArray<float, 3> ArrayType;
+  const size_t count = 2*ArrayType::ChunkItems + 100;
+
+  ArrayType array;
+  MHA_CHECK(array.empty());
+  for(size_t i = 0; i < count; i++)
+  {
+    array.push_back(0.f);
+    float* item = array.edit(i);
+    item[0] = (float)i;
+    item[1] = -(float)i;
+    item[2] = 1.f;
+  }
+  MHA_CHECK(array.size() == count);
+  MHA_CHECK(array.get(count - 1)[1] == -(float)(count - 1));
+  // Items are contiguous within a chunk
+  MHA_CHECK(array.get(5) + 3 == array.get(6));
+
+  // A copy shares every chunk until it is written
+  ArrayType copy(array);
+  MHA_CHECK(copy.get(0) == array.get(0));
+  MHA_CHECK(copy.get(count - 1) == array.get(count - 1));
+
+  // Appending copies the last chunk only
+  copy.push_back(7.f);
+  MHA_CHECK(copy.size() == count + 1 && array.size() == count);
+  MHA_CHECK(copy.get(0) == array.get(0));
+  MHA_CHECK(copy.get(count - 1) != array.get(count - 1));
+  MHA_CHECK(copy.get(count)[2] == 7.f);
+
+  // Writing either array leaves the other as it was
+  copy.edit(1)[0] = 42.f;
+  MHA_CHECK(copy[1] == 42.f && array[1] == 1.f);
+  MHA_CHECK(copy.get(ArrayType::ChunkItems) == array.get(ArrayType::ChunkItems));
+  array.edit(ArrayType::ChunkItems)[0] = -1.f;
+  MHA_CHECK(array[ArrayType::ChunkItems] == -1.f);
+  MHA_CHECK(copy[ArrayType::ChunkItems] == (float)ArrayType::ChunkItems);
+
+  // Shrinking into a shared chunk and growing again fills with the value
+  ArrayType shrunk(array);
+  shrunk.resize(ArrayType::ChunkItems + 10);
+  shrunk.resize(ArrayType::ChunkItems + 20, 5.f);
+  MHA_CHECK(shrunk.size() == ArrayType::ChunkItems + 20);
+  MHA_CHECK(shrunk[ArrayType::ChunkItems + 9] == (float)(ArrayType::ChunkItems + 9));
+  MHA_CHECK(shrunk[ArrayType::ChunkItems + 10] == 5.f);
+  MHA_CHECK(array.size() == count);
+  MHA_CHECK(array[ArrayType::ChunkItems + 10] == (float)(ArrayType::ChunkItems + 10));
+
+  array.assign(3, 2.f);
+  MHA_CHECK(array.size() == 3 && array.back() == 2.f);
+  MHA_CHECK(copy.size() == count + 1 && copy.front() == 0.f);
+  array.clear();
+  MHA_CHECK(array.empty());
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,177 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+// MhaReaderCore includes
+#include "MhaFrameCodec.h"
+#include "MhaRandom.h"
+#include "MhaTestUtilities.h"
+
+// STD includes
+#include <cstring>
+#include <vector>
+
+namespace
+{
+
+//----------------------------------------------------------------------------
+// Fan-like frame: black borders, a noisy sector, and a bright region that
+// moves with the frame number
+void makeFrame(int width, int height, int number, MhaRandom& random, std::vector<unsigned char>& frame)
+{
+  frame.assign((size_t)width*height, 0);
+  for(int y = 0; y < height; y++)
+    for(int x = width/2 - y/2; x < width/2 + y/2; x++)
+      frame[(size_t)y*width + x] = (unsigned char)(64 + random.nextInt(32));
+  for(int y = height/4; y < height/2; y++)
+    for(int x = number; x < number + 8 && x < width; x++)
+      frame[(size_t)y*width + x] = 250;
+}
+
+//----------------------------------------------------------------------------
+int testBytesRoundTrip()
+{
+  MhaRandom random(1);
+  std::vector<unsigned int> hashTable(1 << 16);
+  // Empty, shorter than a match, runs, and incompressible noise
+  size_t sizes[] = { 0, 1, 7, 100, 4096, 100000 };
+  for(size_t i = 0; i < sizeof(sizes)/sizeof(sizes[0]); i++)
+  {
+    size_t size = sizes[i];
+    std::vector<unsigned char> input(size);
+    for(size_t j = 0; j < size; j++)
+      input[j] = (unsigned char)(j < size/2 ? j/64 : random.nextInt(256));
+    std::vector<unsigned char> compressed(getCompressBound(size) + 1);
+    size_t compressedSize = compressBytes(size ? &input[0] : NULL, size, &compressed[0], &hashTable[0]);
+    MHA_CHECK(compressedSize <= getCompressBound(size));
+    std::vector<unsigned char> output(size + 1, 0xcd);
+    MHA_CHECK(decompressBytes(&compressed[0], compressedSize, &output[0], size) == 0);
+    MHA_CHECK(std::equal(input.begin(), input.end(), output.begin()));
+    // Nothing written past size
+    MHA_CHECK(output[size] == 0xcd);
+  }
+  return EXIT_SUCCESS;
+}
+
+//----------------------------------------------------------------------------
+int testDamagedBytes()
+{
+  size_t size = 8192;
+  std::vector<unsigned char> input(size);
+  for(size_t j = 0; j < size; j++)
+    input[j] = (unsigned char)(j/16);
+  std::vector<unsigned int> hashTable(1 << 16);
+  std::vector<unsigned char> compressed(getCompressBound(size));
+  size_t compressedSize = compressBytes(&input[0], size, &compressed[0], &hashTable[0]);
+  std::vector<unsigned char> output(size);
+
+  // Wrong expected size, either way
+  MHA_CHECK(decompressBytes(&compressed[0], compressedSize, &output[0], size - 1) == 1);
+  std::vector<unsigned char> larger(size + 1);
+  MHA_CHECK(decompressBytes(&compressed[0], compressedSize, &larger[0], size + 1) == 1);
+  // Every truncation
+  for(size_t truncated = 0; truncated < compressedSize; truncated++)
+    MHA_CHECK(decompressBytes(&compressed[0], truncated, &output[0], size) == 1);
+  // Random bytes must be rejected or decode within size, never overrun
+  MhaRandom random(2);
+  for(int trial = 0; trial < 2000; trial++)
+  {
+    std::vector<unsigned char> damaged(compressed.begin(), compressed.begin() + compressedSize);
+    for(int k = 0; k < 4; k++)
+      damaged[random.nextInt((int)compressedSize)] = (unsigned char)random.nextInt(256);
+    std::vector<unsigned char> guarded(size + 64, 0xcd);
+    decompressBytes(&damaged[0], damaged.size(), &guarded[0], size);
+    for(size_t j = size; j < guarded.size(); j++)
+      MHA_CHECK(guarded[j] == 0xcd);
+  }
+  return EXIT_SUCCESS;
+}
+
+//----------------------------------------------------------------------------
+int testFrameRoundTrip()
+{
+  int width = 160, height = 120;
+  MhaRandom random(3);
+  MhaFrameCodec encoder, decoder;
+  std::vector<unsigned char> previous, frame, encoded, decoded((size_t)width*height);
+  bool frameDelta = false;
+  for(int number = 0; number < 10; number++)
+  {
+    // Frame 5 is frozen, the best case for frame deltas
+    if(number != 5)
+      makeFrame(width, height, number, random, frame);
+    encoder.encode(&frame[0], number ? &previous[0] : NULL, width, height, encoded);
+    MHA_CHECK(number || MhaFrameCodec::getFrameType(&encoded[0]) != MhaFrameCodec::FrameDelta);
+    frameDelta |= MhaFrameCodec::getFrameType(&encoded[0]) == MhaFrameCodec::FrameDelta;
+    // Decoding in place over the previous frame, as the cache does
+    if(number)
+      decoded = previous;
+    MHA_CHECK(decoder.decode(&encoded[0], encoded.size(), number ? &decoded[0] : NULL, width, height,
+      &decoded[0]) == 0);
+    MHA_CHECK(decoded == frame);
+    previous = frame;
+  }
+  MHA_CHECK(frameDelta);
+
+  // Stored frames: noise does not compress
+  for(size_t j = 0; j < frame.size(); j++)
+    frame[j] = (unsigned char)random.nextInt(256);
+  encoder.encode(&frame[0], NULL, width, height, encoded);
+  MHA_CHECK(MhaFrameCodec::getFrameType(&encoded[0]) == MhaFrameCodec::Stored);
+  MHA_CHECK(decoder.decode(&encoded[0], encoded.size(), NULL, width, height, &decoded[0]) == 0);
+  MHA_CHECK(decoded == frame);
+  return EXIT_SUCCESS;
+}
+
+//----------------------------------------------------------------------------
+int testDamagedFrames()
+{
+  int width = 64, height = 48;
+  MhaRandom random(4);
+  MhaFrameCodec codec;
+  std::vector<unsigned char> previous, frame, encoded, decoded((size_t)width*height);
+  makeFrame(width, height, 0, random, previous);
+  makeFrame(width, height, 1, random, frame);
+  codec.encode(&frame[0], &previous[0], width, height, encoded);
+
+  MHA_CHECK(codec.decode(&encoded[0], 0, NULL, width, height, &decoded[0]) == 1);
+  MHA_CHECK(codec.decode(&encoded[0], encoded.size() - 1, &previous[0], width, height, &decoded[0]) == 1);
+  // Wrong frame size for the data
+  MHA_CHECK(codec.decode(&encoded[0], encoded.size(), &previous[0], width, height + 1, &decoded[0]) == 1);
+  std::vector<unsigned char> damaged(encoded);
+  damaged[0] = 7;
+  MHA_CHECK(codec.decode(&damaged[0], damaged.size(), &previous[0], width, height, &decoded[0]) == 1);
+  if(MhaFrameCodec::getFrameType(&encoded[0]) == MhaFrameCodec::FrameDelta)
+    MHA_CHECK(codec.decode(&encoded[0], encoded.size(), NULL, width, height, &decoded[0]) == 1);
+  // A stored frame of the wrong length
+  damaged.assign((size_t)width*height, 0);
+  damaged[0] = MhaFrameCodec::Stored;
+  MHA_CHECK(codec.decode(&damaged[0], damaged.size(), NULL, width, height, &decoded[0]) == 1);
+  return EXIT_SUCCESS;
+}
+
+}
+
+//----------------------------------------------------------------------------
+int MhaFrameCodecTest(int, char*[])
+{
+  if(testBytesRoundTrip() != EXIT_SUCCESS
+    || testDamagedBytes() != EXIT_SUCCESS
+    || testFrameRoundTrip() != EXIT_SUCCESS
+    || testDamagedFrames() != EXIT_SUCCESS)
+    return EXIT_FAILURE;
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,113 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+// MhaReaderCore includes
+#include "MhaMultiSequencePlayer.h"
+#include "MhaTestUtilities.h"
+
+// STD includes
+#include <chrono>
+#include <thread>
+
+namespace
+{
+
+const int Width = 16;
+const int Height = 8;
+const int NumberOfFrames = 30;
+
+//----------------------------------------------------------------------------
+// Frame the loader hands over next, -1 if none comes within 5 s
+int waitForFrame(MhaMultiSequencePlayer& player, std::vector<unsigned char>& pixels)
+{
+  for(int attempt = 0; attempt < 5000; attempt++)
+  {
+    int frame = player.takeFrame(0, pixels);
+    if(frame >= 0)
+      return frame;
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  return -1;
+}
+
+//----------------------------------------------------------------------------
+// Clock time within frame
+double getTime(const MhaMultiSequencePlayer& player, int frame)
+{
+  return player.getStartTime() + (getTestTimestamp(frame) - getTestTimestamp(0)) + 0.01;
+}
+
+}
+
+//----------------------------------------------------------------------------
+int MhaMultiSequencePlayerTest(int argc, char* argv[])
+{
+  if(argc < 2)
+  {
+    std::cerr << "Usage: MhaMultiSequencePlayerTest <temporary directory>" << std::endl;
+    return EXIT_FAILURE;
+  }
+  std::string path = std::string(argv[1]) + "/MhaMultiSequencePlayerTest.mha";
+  MhaSequenceWriter writer;
+  MHA_CHECK(writer.open(path, Width, Height, NumberOfFrames) == 0);
+  MHA_CHECK(appendTestFrames(writer, 0, NumberOfFrames, Width, Height) == 0);
+  MHA_CHECK(writer.close() == 0);
+
+  MhaMultiSequencePlayer player;
+  MHA_CHECK(player.open(std::vector<std::string>(1, path)) == 0);
+  MHA_CHECK(player.getFrameAtTime(0, getTime(player, NumberOfFrames - 1)) == NumberOfFrames - 1);
+
+  // Every frame taken before the clock moves on: none dropped, whether or
+  // not the loader was done when the next request came
+  std::vector<unsigned char> pixels;
+  for(int frame = 0; frame < NumberOfFrames; frame++)
+  {
+    player.setTime(getTime(player, frame));
+    // Same frame again, not a new request
+    player.setTime(getTime(player, frame) + 0.001);
+    MHA_CHECK(waitForFrame(player, pixels) == frame);
+    MHA_CHECK(pixels.size() == (size_t)Width*Height && pixels[0] == frame);
+    MHA_CHECK(player.getNumberOfLoadedFrames(0) == frame + 1);
+    MHA_CHECK(player.getNumberOfDroppedFrames(0) == 0);
+  }
+  MHA_CHECK(player.takeFrame(0, pixels) == -1);
+
+  // Back to frames read before: read again, still none dropped
+  player.setTime(getTime(player, 3));
+  MHA_CHECK(waitForFrame(player, pixels) == 3 && pixels[0] == 3);
+  MHA_CHECK(player.getNumberOfLoadedFrames(0) == NumberOfFrames + 1);
+  MHA_CHECK(player.getNumberOfDroppedFrames(0) == 0);
+
+  // The clock runs through the other frames faster than they are taken:
+  // every request is either dropped, before it was read or when a newer
+  // frame replaced it, or taken
+  for(int frame = 4; frame < NumberOfFrames; frame++)
+    player.setTime(getTime(player, frame));
+  int taken = 0;
+  int frame = -1;
+  while(frame != NumberOfFrames - 1)
+  {
+    frame = waitForFrame(player, pixels);
+    MHA_CHECK(frame >= 4 && pixels[0] == frame);
+    taken++;
+  }
+  MHA_CHECK(player.takeFrame(0, pixels) == -1);
+  MHA_CHECK(player.getNumberOfDroppedFrames(0) + taken == NumberOfFrames - 4);
+
+  player.close();
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,248 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+// MhaReaderCore includes
+#include "MhaPoseTrack.h"
+#include "MhaRandom.h"
+#include "MhaSequenceIndex.h"
+#include "MhaTestUtilities.h"
+
+// STD includes
+#include <vector>
+
+namespace
+{
+
+const unsigned char OK = MhaTransformStream::Present | MhaTransformStream::StatusOK;
+
+//----------------------------------------------------------------------------
+// Frames every 0.1 s, rotated by angles[frame] degrees about z and
+// translated by x[frame]
+void makeStream(const std::vector<double>& angles, const std::vector<double>& x,
+  MhaTransformStream& stream, MhaChunkedArray<double>& timestamps)
+{
+  int numberOfFrames = (int)x.size();
+  stream.matrices.resize(numberOfFrames);
+  stream.flags.assign(numberOfFrames, OK);
+  timestamps.clear();
+  for(int frame = 0; frame < numberOfFrames; frame++)
+  {
+    double radians = angles[frame]*atan(1.)/45.;
+    float matrix[12] = { (float)cos(radians), (float)-sin(radians), 0.f, (float)x[frame],
+      (float)sin(radians), (float)cos(radians), 0.f, 0.f,
+      0.f, 0.f, 1.f, 0.f };
+    std::copy(matrix, matrix + 12, stream.matrices.edit(frame));
+    timestamps.push_back(frame*0.1);
+  }
+}
+
+//----------------------------------------------------------------------------
+double getX(const MhaPoseTrack& track, double frame)
+{
+  float matrix[12];
+  unsigned char valid = 0;
+  track.interpolateFrames(&frame, 1, matrix, &valid);
+  return valid ? matrix[3] : -1e9;
+}
+
+//----------------------------------------------------------------------------
+double getAngle(const MhaPoseTrack& track, double frame)
+{
+  float matrix[12];
+  unsigned char valid = 0;
+  track.interpolateFrames(&frame, 1, matrix, &valid);
+  return valid ? atan2((double)matrix[4], (double)matrix[0])*45./atan(1.) : -1e9;
+}
+
+//----------------------------------------------------------------------------
+// Steady motion of 10 mm/s and 10 degrees/s with a position spike at frame
+// 20 and a rotation spike at frame 30
+int testOutliers()
+{
+  std::vector<double> angles, x;
+  for(int frame = 0; frame < 40; frame++)
+  {
+    angles.push_back(frame);
+    x.push_back(frame);
+  }
+  x[20] += 50.;
+  angles[30] += 60.;
+  MhaTransformStream stream;
+  MhaChunkedArray<double> timestamps;
+  makeStream(angles, x, stream, timestamps);
+  MhaPoseTrack track;
+  track.build(stream, timestamps);
+
+  MhaPoseFilterSettings settings;
+  MHA_CHECK(!settings.isEnabled());
+  MhaPoseTrack result;
+  std::vector<unsigned char> outliers;
+  track.filter(settings, result, outliers);
+  MHA_CHECK(outliers == std::vector<unsigned char>(40, 0));
+
+  // Only the spikes, not the frames before and after them
+  settings.maximumSpeed = 100.;
+  settings.maximumAngularSpeed = 100.;
+  track.filter(settings, result, outliers);
+  for(int frame = 0; frame < 40; frame++)
+  {
+    unsigned char expected = frame == 20 ? MhaPoseTrack::Speed : (frame == 30 ? MhaPoseTrack::AngularSpeed : 0);
+    MHA_CHECK(outliers[frame] == expected);
+    MHA_CHECK(result.isValid(frame) == !expected);
+  }
+  // Flagged frames are interpolated over, the input is left as it was
+  MHA_CHECK(fabs(getX(result, 20.) - 20.) < 1e-4);
+  MHA_CHECK(fabs(getAngle(result, 30.) - 30.) < 1e-3);
+  MHA_CHECK(track.isValid(20) && fabs(getX(track, 20.) - 70.) < 1e-4);
+
+  // The acceleration peak is at the spike alone
+  settings = MhaPoseFilterSettings();
+  settings.maximumAcceleration = 1000.;
+  track.filter(settings, result, outliers);
+  for(int frame = 0; frame < 40; frame++)
+    MHA_CHECK(outliers[frame] == (frame == 20 ? MhaPoseTrack::Acceleration : 0));
+
+  // Limits are per second on the timestamps: 10 mm/s is within 20 mm/s
+  settings = MhaPoseFilterSettings();
+  settings.maximumSpeed = 20.;
+  x[20] -= 50.;
+  makeStream(angles, x, stream, timestamps);
+  track.build(stream, timestamps);
+  track.filter(settings, result, outliers);
+  for(int frame = 0; frame < 40; frame++)
+    MHA_CHECK(outliers[frame] == 0);
+  return EXIT_SUCCESS;
+}
+
+//----------------------------------------------------------------------------
+// Quadratic Savitzky-Golay smoothing keeps a parabola and evens out
+// alternating noise
+int testSmoothing()
+{
+  std::vector<double> angles, x;
+  for(int frame = 0; frame < 50; frame++)
+  {
+    angles.push_back(0.5*frame + (frame % 2 ? 2. : -2.));
+    x.push_back(0.05*frame*frame + (frame % 2 ? 1. : -1.));
+  }
+  MhaTransformStream stream;
+  MhaChunkedArray<double> timestamps;
+  makeStream(angles, x, stream, timestamps);
+  MhaPoseTrack track;
+  track.build(stream, timestamps);
+
+  MhaPoseFilterSettings settings;
+  settings.smoothingHalfWidth = 4;
+  MHA_CHECK(settings.isEnabled());
+  MhaPoseTrack result;
+  std::vector<unsigned char> outliers;
+  track.filter(settings, result, outliers);
+  for(int frame = 10; frame < 40; frame++)
+  {
+    MHA_CHECK(result.isValid(frame));
+    MHA_CHECK(fabs(getX(result, frame) - 0.05*frame*frame) < 0.3);
+    MHA_CHECK(fabs(getAngle(result, frame) - 0.5*frame) < 0.6);
+  }
+  MHA_CHECK(fabs(getX(track, 25.) - (0.05*25*25 + 1.)) < 1e-4);
+  return EXIT_SUCCESS;
+}
+
+
+//----------------------------------------------------------------------------
+// A track filtered as it grows, as when following a recording, matches
+// the whole track filtered at once
+int testExtendFilter()
+{
+  MhaRandom random(5);
+  std::vector<double> angles, x;
+  for(int frame = 0; frame < 400; frame++)
+  {
+    angles.push_back(0.3*frame + random.nextDouble());
+    x.push_back(frame + random.nextDouble());
+    if(random.nextInt(20) == 0)
+      x.back() += 30.;
+  }
+  MhaTransformStream stream;
+  MhaChunkedArray<double> timestamps;
+  makeStream(angles, x, stream, timestamps);
+  // Missing and INVALID frames, and a long gap
+  for(int frame = 50; frame < 80; frame++)
+    *stream.flags.edit(frame) = 0;
+  for(int frame = 0; frame < 400; frame += 37)
+    *stream.flags.edit(frame) = MhaTransformStream::Present | MhaTransformStream::StatusInvalid;
+
+  MhaPoseFilterSettings settings;
+  settings.maximumSpeed = 100.;
+  settings.maximumAcceleration = 2000.;
+  settings.maximumAngularSpeed = 20.;
+  settings.smoothingHalfWidth = 5;
+  MhaTransformStream partial;
+  MhaChunkedArray<double> partialTimestamps;
+  MhaPoseTrack track, extended, expected;
+  std::vector<unsigned char> outliers, expectedOutliers;
+  int steps[] = { 3, 1, 1, 10, 40, 2, 77, 1, 100, 165 };
+  int numberOfFrames = 0;
+  for(size_t step = 0; step < sizeof(steps)/sizeof(steps[0]); step++)
+  {
+    for(int frame = numberOfFrames; frame < numberOfFrames + steps[step]; frame++)
+    {
+      partial.matrices.resize(frame + 1);
+      std::copy(stream.getMatrix(frame), stream.getMatrix(frame) + 12, partial.matrices.edit(frame));
+      partial.flags.push_back(stream.flags[frame]);
+      partialTimestamps.push_back(timestamps[frame]);
+    }
+    numberOfFrames += steps[step];
+    track.extend(partial, partialTimestamps);
+    track.extendFilter(settings, extended, outliers);
+    track.filter(settings, expected, expectedOutliers);
+    MHA_CHECK(outliers == expectedOutliers);
+    MHA_CHECK(extended.getNumberOfFrames() == numberOfFrames);
+    for(int frame = 0; frame < numberOfFrames; frame++)
+    {
+      MHA_CHECK(extended.isValid(frame) == expected.isValid(frame));
+      for(int i = 0; i < 4; i++)
+      {
+        double position = frame + 0.25*i;
+        float matrix[12], expectedMatrix[12];
+        unsigned char valid = 0, expectedValid = 0;
+        extended.interpolateFrames(&position, 1, matrix, &valid);
+        expected.interpolateFrames(&position, 1, expectedMatrix, &expectedValid);
+        MHA_CHECK(valid == expectedValid);
+        for(int j = 0; j < 12; j++)
+          MHA_CHECK(fabs(matrix[j] - expectedMatrix[j]) < 1e-5);
+      }
+    }
+  }
+  MHA_CHECK(numberOfFrames == 400);
+  int flagged = 0;
+  for(int frame = 0; frame < numberOfFrames; frame++)
+    flagged += outliers[frame] ? 1 : 0;
+  MHA_CHECK(flagged > 5);
+  return EXIT_SUCCESS;
+}
+
+}
+
+//----------------------------------------------------------------------------
+int MhaPoseFilterTest(int, char*[])
+{
+  if(testOutliers() != EXIT_SUCCESS
+    || testSmoothing() != EXIT_SUCCESS
+    || testExtendFilter() != EXIT_SUCCESS)
+    return EXIT_FAILURE;
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,152 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+// MhaReaderCore includes
+#include "MhaPoseTrack.h"
+#include "MhaSequenceIndex.h"
+#include "MhaTestUtilities.h"
+
+namespace
+{
+
+//----------------------------------------------------------------------------
+// Appends a frame rotated by angle degrees about z and translated by x
+void addFrame(MhaTransformStream& stream, MhaChunkedArray<double>& timestamps, double angle, float x,
+  unsigned char flags)
+{
+  int frame = stream.getNumberOfFrames();
+  stream.matrices.resize(frame + 1);
+  stream.flags.push_back(flags);
+  timestamps.push_back(frame*0.1);
+  if(!(flags & MhaTransformStream::Present))
+    return;
+  double radians = angle*atan(1.)/45.;
+  float matrix[12] = { (float)cos(radians), (float)-sin(radians), 0.f, x,
+    (float)sin(radians), (float)cos(radians), 0.f, 0.f,
+    0.f, 0.f, 1.f, 0.f };
+  std::copy(matrix, matrix + 12, stream.matrices.edit(frame));
+}
+
+//----------------------------------------------------------------------------
+// Rotation about z of matrix, in degrees
+double getAngle(const float matrix[12])
+{
+  return atan2((double)matrix[4], (double)matrix[0])*45./atan(1.);
+}
+
+//----------------------------------------------------------------------------
+int checkPose(const MhaPoseTrack& track, double frame, double angle, double x)
+{
+  float matrix[12];
+  unsigned char valid = 0;
+  track.interpolateFrames(&frame, 1, matrix, &valid);
+  MHA_CHECK(valid);
+  double difference = fmod(getAngle(matrix) - angle + 540., 360.) - 180.;
+  MHA_CHECK(fabs(difference) < 1e-3);
+  MHA_CHECK(fabs(matrix[3] - x) < 1e-4);
+  // SLERP keeps the rotation a rotation
+  MHA_CHECK(fabs(matrix[0]*matrix[0] + matrix[4]*matrix[4] - 1.) < 1e-5);
+  MHA_CHECK(fabs(matrix[10] - 1.) < 1e-6);
+  return EXIT_SUCCESS;
+}
+
+//----------------------------------------------------------------------------
+int checkInvalid(const MhaPoseTrack& track, double frame)
+{
+  float matrix[12];
+  unsigned char valid = 1;
+  track.interpolateFrames(&frame, 1, matrix, &valid);
+  MHA_CHECK(!valid);
+  return EXIT_SUCCESS;
+}
+
+}
+
+//----------------------------------------------------------------------------
+int MhaPoseTrackTest(int, char*[])
+{
+  const unsigned char ok = MhaTransformStream::Present | MhaTransformStream::StatusOK;
+  const unsigned char invalid = MhaTransformStream::Present | MhaTransformStream::StatusInvalid;
+  MhaTransformStream stream;
+  MhaChunkedArray<double> timestamps;
+  addFrame(stream, timestamps, 0., 0.f, ok);
+  // No matrix recorded
+  addFrame(stream, timestamps, 0., 0.f, 0);
+  addFrame(stream, timestamps, 90., 20.f, ok);
+  // Recorded INVALID, skipped whatever its matrix
+  addFrame(stream, timestamps, -45., 100.f, invalid);
+  addFrame(stream, timestamps, 170., 40.f, ok);
+  // -170 is 20 degrees on from 170 through 180, not 340 back through 0
+  addFrame(stream, timestamps, -170., 50.f, ok);
+
+  MhaPoseTrack track;
+  track.build(stream, timestamps);
+  MHA_CHECK(track.getNumberOfFrames() == 6);
+  MHA_CHECK(track.isValid(0) && !track.isValid(1) && track.isValid(2) && !track.isValid(3));
+  MHA_CHECK(track.hasTimestamps());
+
+  // Recorded frames as they are, others on the shortest arc between the
+  // valid frames on either side, translation linearly
+  MHA_CHECK(checkPose(track, 0., 0., 0.) == EXIT_SUCCESS);
+  MHA_CHECK(checkPose(track, 2., 90., 20.) == EXIT_SUCCESS);
+  MHA_CHECK(checkPose(track, 0.5, 22.5, 5.) == EXIT_SUCCESS);
+  MHA_CHECK(checkPose(track, 1., 45., 10.) == EXIT_SUCCESS);
+  MHA_CHECK(checkPose(track, 3., 130., 30.) == EXIT_SUCCESS);
+  MHA_CHECK(checkPose(track, 4.5, 180., 45.) == EXIT_SUCCESS);
+  MHA_CHECK(checkPose(track, 5., -170., 50.) == EXIT_SUCCESS);
+  MHA_CHECK(checkInvalid(track, -0.1) == EXIT_SUCCESS);
+  MHA_CHECK(checkInvalid(track, 5.1) == EXIT_SUCCESS);
+
+  // Same through the timestamps
+  double time = 0.15;
+  float matrix[12];
+  unsigned char valid = 0;
+  track.interpolateTimes(&time, 1, matrix, &valid);
+  MHA_CHECK(valid && fabs(getAngle(matrix) - 67.5) < 1e-3);
+  MHA_CHECK(fabs(track.getFrameAtTime(0.45) - 4.5) < 1e-9);
+  MHA_CHECK(track.getFrameAtTime(0.6) == -1.);
+
+  // Gaps longer than the maximum are not interpolated across
+  track.setMaximumGap(1);
+  MHA_CHECK(checkInvalid(track, 1.) == EXIT_SUCCESS);
+  MHA_CHECK(checkInvalid(track, 3.) == EXIT_SUCCESS);
+  MHA_CHECK(checkPose(track, 2., 90., 20.) == EXIT_SUCCESS);
+  MHA_CHECK(checkPose(track, 4.5, 180., 45.) == EXIT_SUCCESS);
+  track.setMaximumGap(0);
+
+  // A track extended frame by frame is the track built at once
+  MhaPoseTrack extended;
+  MhaTransformStream partial;
+  MhaChunkedArray<double> partialTimestamps;
+  for(int frame = 0; frame < stream.getNumberOfFrames(); frame++)
+  {
+    partial.matrices.resize(frame + 1);
+    std::copy(stream.getMatrix(frame), stream.getMatrix(frame) + 12, partial.matrices.edit(frame));
+    partial.flags.push_back(stream.flags[frame]);
+    partialTimestamps.push_back(timestamps[frame]);
+    extended.extend(partial, partialTimestamps);
+  }
+  for(double frame = 0.; frame <= 5.; frame += 0.25)
+  {
+    float expected[12];
+    unsigned char expectedValid = 0;
+    track.interpolateFrames(&frame, 1, expected, &expectedValid);
+    extended.interpolateFrames(&frame, 1, matrix, &valid);
+    MHA_CHECK(valid == expectedValid && std::equal(matrix, matrix + 12, expected));
+  }
+  return EXIT_SUCCESS;
+}
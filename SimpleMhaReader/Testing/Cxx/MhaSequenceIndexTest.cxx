@@ -0,0 +1,160 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+// MhaReaderCore includes
+#include "MhaSequenceIndex.h"
+#include "MhaTestUtilities.h"
+
+// STD includes
+#include <vector>
+
+namespace
+{
+
+const int Width = 16;
+const int Height = 8;
+
+//----------------------------------------------------------------------------
+int checkFrames(const MhaSequenceIndex& index, int numberOfFrames)
+{
+  MHA_CHECK(index.getNumberOfFrames() == numberOfFrames);
+  MHA_CHECK(index.getWidth() == Width && index.getHeight() == Height);
+  const MhaTransformTable& table = index.getTransformTable();
+  int stream = table.find("ProbeToTracker");
+  MHA_CHECK(stream >= 0);
+  MHA_CHECK(table.streams[stream].getNumberOfFrames() == numberOfFrames);
+  MHA_CHECK((int)table.timestamps.size() == numberOfFrames);
+  for(int frame = 0; frame < numberOfFrames; frame++)
+  {
+    float expected[12];
+    getTestPose(frame, expected);
+    const float* matrix = table.streams[stream].getMatrix(frame);
+    for(int i = 0; i < 12; i++)
+      MHA_CHECK(matrix[i] == expected[i]);
+    MHA_CHECK(table.streams[stream].flags[frame] & MhaTransformStream::StatusOK);
+    MHA_CHECK(fabs(table.timestamps[frame] - getTestTimestamp(frame)) < 1e-6);
+  }
+  MHA_CHECK(index.getPoseTrack(stream).getNumberOfFrames() == numberOfFrames);
+  return EXIT_SUCCESS;
+}
+
+//----------------------------------------------------------------------------
+// Poses of an extended index must be those of the file loaded afresh
+int checkSamePoses(const MhaSequenceIndex& extended, const MhaSequenceIndex& loaded)
+{
+  const MhaPoseTrack& track = extended.getPoseTrack(0);
+  const MhaPoseTrack& expected = loaded.getPoseTrack(0);
+  MHA_CHECK(track.getNumberOfFrames() == expected.getNumberOfFrames());
+  std::vector<double> frames;
+  for(int frame = 0; frame < track.getNumberOfFrames(); frame++)
+    frames.push_back(frame + 0.25);
+  int count = (int)frames.size();
+  std::vector<float> matrices(12*count), expectedMatrices(12*count);
+  std::vector<unsigned char> valid(count), expectedValid(count);
+  track.interpolateFrames(&frames[0], count, &matrices[0], &valid[0]);
+  expected.interpolateFrames(&frames[0], count, &expectedMatrices[0], &expectedValid[0]);
+  MHA_CHECK(matrices == expectedMatrices);
+  MHA_CHECK(valid == expectedValid);
+  MHA_CHECK(track.hasTimestamps() && track.getFrameAtTime(getTestTimestamp(10)) == 10.);
+  return EXIT_SUCCESS;
+}
+
+//----------------------------------------------------------------------------
+int testExtend(const std::string& path)
+{
+  MhaSequenceWriter writer;
+  MHA_CHECK(writer.open(path, Width, Height, 5000) == 0);
+  MHA_CHECK(appendTestFrames(writer, 0, 1500, Width, Height) == 0);
+  MHA_CHECK(writer.flush() == 0);
+
+  std::shared_ptr<const MhaSequenceIndex> index = MhaSequenceIndex::load(path);
+  MHA_CHECK(index);
+  MHA_CHECK(checkFrames(*index, 1500) == EXIT_SUCCESS);
+  MHA_CHECK(!index->extend());
+
+  // Frames appended across a chunk boundary
+  MHA_CHECK(appendTestFrames(writer, 1500, 700, Width, Height) == 0);
+  MHA_CHECK(writer.flush() == 0);
+  std::shared_ptr<const MhaSequenceIndex> extended = index->extend();
+  MHA_CHECK(extended);
+  MHA_CHECK(extended->getDataOffset() == index->getDataOffset());
+  MHA_CHECK(checkFrames(*extended, 2200) == EXIT_SUCCESS);
+  // The original index is left as it was and shares its full chunks
+  MHA_CHECK(checkFrames(*index, 1500) == EXIT_SUCCESS);
+  MHA_CHECK(extended->getTransformTable().streams[0].getMatrix(0) == index->getTransformTable().streams[0].getMatrix(0));
+  MHA_CHECK(!extended->extend());
+
+  // Frames extended one at a time read as the whole file does
+  std::shared_ptr<const MhaSequenceIndex> followed = extended;
+  for(int frame = 2200; frame < 2210; frame++)
+  {
+    MHA_CHECK(appendTestFrames(writer, frame, 1, Width, Height) == 0);
+    MHA_CHECK(writer.flush() == 0);
+    followed = followed->extend();
+    MHA_CHECK(followed);
+  }
+  MHA_CHECK(writer.close() == 0);
+  std::shared_ptr<const MhaSequenceIndex> loaded = MhaSequenceIndex::load(path);
+  MHA_CHECK(loaded);
+  MHA_CHECK(checkFrames(*followed, 2210) == EXIT_SUCCESS);
+  MHA_CHECK(checkSamePoses(*followed, *loaded) == EXIT_SUCCESS);
+  return EXIT_SUCCESS;
+}
+
+//----------------------------------------------------------------------------
+int testRelocatedHeader(const std::string& path)
+{
+  // Room for the fields of about 10 frames, flushed one by one as a
+  // recording does: DimSize stays at those that fit, and close() moves the
+  // pixel data behind a larger header
+  MhaSequenceWriter writer;
+  MHA_CHECK(writer.open(path, Width, Height, 10, MhaSequenceWriter::getFrameFieldsSize(1)) == 0);
+  for(int frame = 0; frame < 40; frame++)
+  {
+    MHA_CHECK(appendTestFrames(writer, frame, 1, Width, Height) == 0);
+    MHA_CHECK(writer.flush() == 0);
+  }
+  std::shared_ptr<const MhaSequenceIndex> index = MhaSequenceIndex::load(path);
+  MHA_CHECK(index);
+  int indexed = index->getNumberOfFrames();
+  MHA_CHECK(indexed >= 10 && indexed < 40);
+  MHA_CHECK(checkFrames(*index, indexed) == EXIT_SUCCESS);
+
+  MHA_CHECK(writer.close() == 0);
+  std::shared_ptr<const MhaSequenceIndex> extended = index->extend();
+  MHA_CHECK(extended);
+  MHA_CHECK(extended->getDataOffset() != index->getDataOffset());
+  MHA_CHECK(checkFrames(*extended, 40) == EXIT_SUCCESS);
+  return EXIT_SUCCESS;
+}
+
+}
+
+//----------------------------------------------------------------------------
+int MhaSequenceIndexTest(int argc, char* argv[])
+{
+  if(argc < 2)
+  {
+    std::cerr << "Usage: MhaSequenceIndexTest <temporary directory>" << std::endl;
+    return EXIT_FAILURE;
+  }
+  std::string directory = argv[1];
+  if(testExtend(directory + "/MhaSequenceIndexTestExtend.mha") != EXIT_SUCCESS
+    || testRelocatedHeader(directory + "/MhaSequenceIndexTestRelocated.mha") != EXIT_SUCCESS)
+    return EXIT_FAILURE;
+  return EXIT_SUCCESS;
+}
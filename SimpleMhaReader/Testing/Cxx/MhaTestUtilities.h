@@ -0,0 +1,82 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+// .NAME MhaTestUtilities - helpers of the MhaReaderCore tests
+// .SECTION Description
+// A failed check reports its file, line and condition and makes the test
+// function return EXIT_FAILURE. Test sequences are written with
+// MhaSequenceWriter, with poses and timestamps known from the frame number.
+
+#ifndef __MhaTestUtilities_h
+#define __MhaTestUtilities_h
+
+// MhaReaderCore includes
+#include "MhaSequenceWriter.h"
+
+// STD includes
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+#define MHA_CHECK(condition) \
+  if(!(condition)) \
+  { \
+    std::cerr << __FILE__ << ":" << __LINE__ << ": check failed: " #condition << std::endl; \
+    return EXIT_FAILURE; \
+  }
+
+/// Rigid ProbeToTracker pose of frame: a rotation of frame degrees about z
+/// and a translation of frame mm along x
+inline void getTestPose(int frame, float matrix[12])
+{
+  double angle = frame*atan(1.)/45.;
+  float pose[12] = { (float)cos(angle), (float)-sin(angle), 0.f, (float)frame,
+    (float)sin(angle), (float)cos(angle), 0.f, 0.f,
+    0.f, 0.f, 1.f, 0.f };
+  std::copy(pose, pose + 12, matrix);
+}
+
+/// Timestamp of frame, in seconds at 10 frames per second
+inline double getTestTimestamp(int frame)
+{
+  return 100. + frame*0.1;
+}
+
+/// Appends frames [first, first + count), each filled with its number and
+/// carrying its test timestamp and pose, 1 on error
+inline int appendTestFrames(MhaSequenceWriter& writer, int first, int count, int width, int height)
+{
+  std::string pixels((size_t)width*height, '\0');
+  for(int frame = first; frame < first + count; frame++)
+  {
+    char timestamp[32];
+    snprintf(timestamp, sizeof(timestamp), "%.6f", getTestTimestamp(frame));
+    writer.setFrameField("Timestamp", timestamp);
+    float matrix[12];
+    getTestPose(frame, matrix);
+    writer.setFrameTransform("ProbeToTracker", matrix, true);
+    pixels.assign(pixels.size(), (char)frame);
+    if(writer.appendFrame((const unsigned char*)pixels.data()))
+      return 1;
+  }
+  return 0;
+}
+
+#endif
@@ -0,0 +1,223 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+// Frame read throughput of the reading paths of the SimpleMhaReader core on
+// sequential, backward, strided and random access: one fopen/fseek/fread per
+// frame as the module originally did, positioned reads through a frame
+// cursor, the same with the readahead policy of interactive browsing, and
+// batched reads with many requests in flight. The page cache of the file is
+// dropped before every run so that the device is measured, not memory.
+
+// SimpleMhaReader core includes
+#include "MhaBatchReader.h"
+#include "MhaFileUtilities.h"
+#include "MhaFrameCursor.h"
+#include "MhaReadaheadPolicy.h"
+#include "MhaSequenceIndex.h"
+
+// STD includes
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace
+{
+void printUsage()
+{
+  fprintf(stderr,
+    "Usage:\n"
+    "  MhaReadBenchmark <sequence.mha> [--frames N] [--stride N] [--depth N] [--work us] [--cached] [--direct]\n"
+    "      reads N frames (default 1000) per workload, strided workload every\n"
+    "      Nth frame (default 7), depth reads in flight for the batched path\n"
+    "      (default 32), --cached keeps the page cache between runs\n");
+}
+
+void dropCache(const std::string& path)
+{
+  int fd = openFileForReading(path);
+  if(fd < 0)
+    return;
+  dropFileCache(fd, 0, getFileSize(path));
+  closeFile(fd);
+}
+
+// Stands in for filtering and rendering between reads
+void process(int microseconds)
+{
+  if(microseconds > 0)
+    std::this_thread::sleep_for(std::chrono::microseconds(microseconds));
+}
+
+// Frame numbers of a workload, wrapping around at the end of the sequence
+std::vector<int> makeWorkload(const std::string& name, int count, int stride, int numberOfFrames)
+{
+  std::vector<int> frames(count);
+  std::mt19937 generator(12345);
+  std::uniform_int_distribution<int> distribution(0, numberOfFrames - 1);
+  for(int i=0; i<count; i++)
+  {
+    if(name == "random")
+      frames[i] = distribution(generator);
+    else if(name == "backward")
+      frames[i] = numberOfFrames - 1 - i % numberOfFrames;
+    else if(name == "strided")
+      frames[i] = (int)(((long long)i*stride) % numberOfFrames);
+    else
+      frames[i] = i % numberOfFrames;
+  }
+  return frames;
+}
+
+int readWithStdio(const MhaSequenceIndex& index, const std::vector<int>& frames, int work, unsigned long long& checksum)
+{
+  std::vector<unsigned char> pixels(index.getFrameSize());
+  for(size_t i=0; i<frames.size(); i++)
+  {
+    // Opened per frame, as the module did before the frame cursor
+    FILE* file = fopen(index.getPath().c_str(), "rb");
+    if(!file)
+      return 1;
+    int failed = seekFile(file, index.getFrameOffset(frames[i])) || fread(&pixels[0], 1, pixels.size(), file) != pixels.size();
+    fclose(file);
+    if(failed)
+      return 1;
+    checksum += pixels[pixels.size()/2];
+    process(work);
+  }
+  return 0;
+}
+
+int readWithCursor(const std::shared_ptr<const MhaSequenceIndex>& index, bool direct, MhaReadaheadPolicy* readahead,
+  const std::vector<int>& frames, int work, unsigned long long& checksum)
+{
+  MhaFrameCursor cursor(index, direct);
+  for(size_t i=0; i<frames.size(); i++)
+  {
+    const unsigned char* pixels = cursor.readFrame(frames[i]);
+    if(!pixels)
+      return 1;
+    if(readahead)
+      readahead->frameRead(cursor, frames[i]);
+    checksum += pixels[index->getFrameSize()/2];
+    process(work);
+  }
+  return 0;
+}
+
+int readWithBatch(MhaBatchReader& reader, size_t frameSize, const std::vector<int>& frames, int work,
+  unsigned long long& checksum)
+{
+  return reader.readFrames(frames, [&](int, const unsigned char* pixels)
+  {
+    checksum += pixels[frameSize/2];
+    process(work);
+  });
+}
+}
+
+int main(int argc, char* argv[])
+{
+  if(argc < 2)
+  {
+    printUsage();
+    return 1;
+  }
+  int count = 1000;
+  int stride = 7;
+  int depth = 32;
+  int work = 0;
+  bool cached = false;
+  bool direct = false;
+  for(int i=2; i<argc; i++)
+  {
+    std::string option = argv[i];
+    if(option == "--frames" && i+1 < argc)
+      count = atoi(argv[++i]);
+    else if(option == "--stride" && i+1 < argc)
+      stride = atoi(argv[++i]);
+    else if(option == "--depth" && i+1 < argc)
+      depth = atoi(argv[++i]);
+    else if(option == "--work" && i+1 < argc)
+      work = atoi(argv[++i]);
+    else if(option == "--cached")
+      cached = true;
+    else if(option == "--direct")
+      direct = true;
+    else
+    {
+      printUsage();
+      return 1;
+    }
+  }
+
+  std::shared_ptr<const MhaSequenceIndex> index = MhaSequenceIndex::load(argv[1]);
+  if(!index || index->getNumberOfFrames() <= 0 || count <= 0)
+  {
+    fprintf(stderr, "Could not read %s\n", argv[1]);
+    return 1;
+  }
+  size_t frameSize = index->getFrameSize();
+  MhaBatchReader batchReader(index, depth, MhaBatchReader::Automatic, direct);
+  printf("%d x %d, %d frames, batched reads use %s%s\n", index->getWidth(), index->getHeight(),
+    index->getNumberOfFrames(), batchReader.getBackend() == MhaBatchReader::IoUring ? "io_uring" : "positioned reads",
+    batchReader.isDirect() ? ", direct I/O" : "");
+  printf("%-12s %-10s %12s %10s\n", "workload", "path", "frames/s", "MB/s");
+
+  const char* workloads[] = { "sequential", "backward", "strided", "random" };
+  const char* paths[] = { "stdio", "cursor", "readahead", "batch" };
+  for(int w=0; w<4; w++)
+  {
+    std::vector<int> frames = makeWorkload(workloads[w], count, std::max(stride, 1), index->getNumberOfFrames());
+    unsigned long long reference = 0;
+    for(int p=0; p<4; p++)
+    {
+      if(!cached)
+        dropCache(index->getPath());
+      unsigned long long checksum = 0;
+      std::chrono::steady_clock::time_point beginTime = std::chrono::steady_clock::now();
+      int failed = 0;
+      if(p == 0)
+        failed = readWithStdio(*index, frames, work, checksum);
+      else if(p == 1)
+        failed = readWithCursor(index, direct, NULL, frames, work, checksum);
+      else if(p == 2)
+      {
+        MhaReadaheadPolicy readahead;
+        failed = readWithCursor(index, direct, &readahead, frames, work, checksum);
+      }
+      else
+        failed = readWithBatch(batchReader, frameSize, frames, work, checksum);
+      double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - beginTime).count();
+      if(p == 0)
+        reference = checksum;
+      if(failed || checksum != reference)
+      {
+        fprintf(stderr, "%s reads of the %s workload failed\n", paths[p], workloads[w]);
+        return 1;
+      }
+      printf("%-12s %-10s %12.0f %10.1f\n", workloads[w], paths[p], count/seconds,
+        (double)count*(double)frameSize/seconds/1e6);
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,792 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+// Command-line access to the SimpleMhaReader core, for batch jobs that do
+// not need Slicer: sequence summary, frame extraction, statistics, export,
+// cine clips, M-mode lines, interpolated poses, frames near a point, replay of a
+// sequence as a live frame stream, sizing of the compressed frame cache and
+// training batches.
+
+// SimpleMhaReader core includes
+#include "MhaCineExport.h"
+#include "MhaCompressedFrameCache.h"
+#include "MhaFrameHashes.h"
+#include "MhaFrameKernels.h"
+#include "MhaPlaneIndex.h"
+#include "MhaSequenceAnalyzer.h"
+#include "MhaSequenceExport.h"
+#include "MhaSequenceReader.h"
+#include "MhaStreamReceiver.h"
+#include "MhaStreamServer.h"
+#include "MhaTileCache.h"
+#include "MhaTrainingLoader.h"
+
+// STD includes
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace
+{
+void printUsage()
+{
+  fprintf(stderr,
+    "Usage:\n"
+    "  MhaTool info <sequence.mha>\n"
+    "  MhaTool extract <sequence.mha> <first> <last> <output prefix>\n"
+    "      writes frames first..last as <output prefix>NNNN.pgm\n"
+    "  MhaTool mmode <sequence.mha> <x0> <y0> <x1> <y1> <output.pgm>\n"
+    "      writes the line from (x0, y0) to (x1, y1) over all frames, time along x\n"
+    "  MhaTool poses <sequence.mha> <transform> [--times] [--max-speed V] [--max-acceleration A]\n"
+    "      [--max-rotation W] [--smooth N]\n"
+    "      reads fractional frame indices (or times) from stdin, one per line, and\n"
+    "      writes the interpolated transform as query,valid,m00,...,m23; poses beyond\n"
+    "      the limits are dropped as outliers and the rest smoothed over 2N+1 frames\n"
+    "  MhaTool near <sequence.mha> <transform> <x> <y> <z> <distance> [--spacing S]\n"
+    "      lists the frames whose image, S mm per pixel (default 1), passes within\n"
+    "      distance of the point in tracker coordinates\n"
+    "  MhaTool serve <sequence.mha> <port> [--fps N] [--loop]\n"
+    "      sends the frames and transforms to one client as an OpenIGTLink style stream\n"
+    "  MhaTool receive <host> <port> [--seconds N] [--record <output.mha>] [--capacity N]\n"
+    "      [--block]\n"
+    "      receives a stream and reports the frame rate, dropped frames and bandwidth;\n"
+    "      a recording moves on to <output>_2.mha and so on every N frames, or\n"
+    "      sooner if the fields of the frames outgrow the header room of the file\n"
+    "  MhaTool stats <sequence.mha> [--threads N] [--csv <file>] [--direct]\n"
+    "  MhaTool export <sequence.mha> <output.mha> [--first N] [--last N] [--stride N]\n"
+    "      [--crop xmin xmax ymin ymax] [--median] [--gaussian] [--average N]\n"
+    "      [--gain near far] [--skip-duplicates] [--threads N] [--direct]\n"
+    "  MhaTool cine <sequence.mha> <output.avi | output prefix> [--first N] [--last N]\n"
+    "      [--stride N] [--fps F] [--quality Q] [--crop xmin xmax ymin ymax] [--median]\n"
+    "      [--gaussian] [--average N] [--gain near far] [--threads N] [--direct]\n"
+    "      writes a Motion JPEG AVI, or <output prefix>NNNN.jpg, encoded on N threads\n"
+    "  MhaTool cache <sequence.mha> [--threads N] [--keyframes K] [--direct]\n"
+    "      compresses the sequence into memory and reports the ratio, build time and\n"
+    "      decode time per frame, checking every decoded frame against the file\n"
+    "  MhaTool batches <sequence.mha> [--batch N] [--epochs E] [--seed S]\n"
+    "      [--order sequential|shuffled|stratified] [--transform <name>] [--valid-only]\n"
+    "      [--first N] [--last N] [--stride N] [--crop xmin xmax ymin ymax] [--drop-last]\n"
+    "      [--flip P] [--gain-jitter G] [--offset-jitter O] [--shift-jitter S]\n"
+    "      [--work ms] [--threads N] [--direct]\n"
+    "      loads training batches for E epochs, ms of work per batch standing for the\n"
+    "      training step, and reports the throughput, the time the loop waited and a\n"
+    "      checksum that only changes with the seed and options\n"
+    "  --direct reads around the page cache, for sequences larger than memory\n");
+}
+
+// Runs the analyzer to completion, reporting progress on stderr
+int runAnalysis(MhaSequenceReader& reader, MhaSequenceAnalyzer& analyzer, int tasks, int numberOfThreads)
+{
+  if(analyzer.start(reader.getIndex(), tasks, numberOfThreads))
+    return 1;
+  while(analyzer.isRunning())
+  {
+    fprintf(stderr, "\r%3d%%", (int)(100.*analyzer.getProgress()));
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+  }
+  fprintf(stderr, "\r     \r");
+  return analyzer.isComplete() ? 0 : 1;
+}
+
+// Hashes from the sidecar file, computed and saved if missing or stale
+int getFrameHashes(MhaSequenceReader& reader, int numberOfThreads, bool direct, std::vector<unsigned long long>& hashes)
+{
+  MhaFrameHashesKey key;
+  if(makeFrameHashesKey(reader.getPath(), reader.getDataOffset(), reader.getWidth(), reader.getHeight(),
+    reader.getNumberOfFrames(), key))
+    return 1;
+  std::string hashesPath = getFrameHashesPath(reader.getPath());
+  if(!loadFrameHashes(hashesPath, key, hashes))
+    return 0;
+  MhaSequenceAnalyzer analyzer;
+  analyzer.setDirectIO(direct);
+  if(runAnalysis(reader, analyzer, MhaSequenceAnalyzer::Hashes, numberOfThreads))
+    return 1;
+  hashes = analyzer.getHashes();
+  saveFrameHashes(hashesPath, key, hashes);
+  return 0;
+}
+
+int info(MhaSequenceReader& reader)
+{
+  printf("File: %s\n", reader.getPath().c_str());
+  printf("Dimensions: %d x %d, %d frames\n", reader.getWidth(), reader.getHeight(), reader.getNumberOfFrames());
+  printf("Pixel data offset: %lld\n", reader.getDataOffset());
+  printf("Index memory: %.2f MB\n", reader.getIndex()->getMemorySize()/(1024.*1024.));
+  const MhaTransformTable& table = reader.getTransformTable();
+  for(size_t i=0; i<table.streams.size(); i++)
+  {
+    const MhaTransformStream& stream = table.streams[i];
+    int present = 0, valid = 0;
+    for(int frame=0; frame<stream.getNumberOfFrames(); frame++)
+    {
+      present += (stream.flags[frame] & MhaTransformStream::Present) ? 1 : 0;
+      valid += (stream.flags[frame] & MhaTransformStream::StatusOK) ? 1 : 0;
+    }
+    printf("%s: %d transforms, %d valid\n", stream.name.c_str(), present, valid);
+  }
+  return 0;
+}
+
+int extract(MhaSequenceReader& reader, int firstFrame, int lastFrame, const std::string& prefix)
+{
+  if(firstFrame < 0 || lastFrame >= reader.getNumberOfFrames() || lastFrame < firstFrame)
+  {
+    fprintf(stderr, "Frame range must be within 0..%d\n", reader.getNumberOfFrames() - 1);
+    return 1;
+  }
+  std::vector<unsigned char> pixels(reader.getFrameSize());
+  for(int frame = firstFrame; frame <= lastFrame; frame++)
+  {
+    char fileName[32];
+    sprintf(fileName, "%04d.pgm", frame);
+    std::string path = prefix + fileName;
+    if(reader.readFrame(frame, &pixels[0]))
+    {
+      fprintf(stderr, "Could not read frame %d\n", frame);
+      return 1;
+    }
+    FILE* file = fopen(path.c_str(), "wb");
+    if(!file)
+    {
+      fprintf(stderr, "Could not write %s\n", path.c_str());
+      return 1;
+    }
+    fprintf(file, "P5\n%d %d\n255\n", reader.getWidth(), reader.getHeight());
+    bool failed = fwrite(&pixels[0], 1, pixels.size(), file) != pixels.size();
+    failed = fclose(file) != 0 || failed;
+    if(failed)
+    {
+      fprintf(stderr, "Could not write %s\n", path.c_str());
+      return 1;
+    }
+  }
+  printf("Extracted %d frames\n", lastFrame - firstFrame + 1);
+  return 0;
+}
+
+int mmode(MhaSequenceReader& reader, double x0, double y0, double x1, double y1, const std::string& path)
+{
+  // The tile cache is built on the first line of a sequence and reused after
+  MhaTileCache cache;
+  if(cache.start(reader.getIndex()))
+    return 1;
+  while(cache.isRunning())
+  {
+    fprintf(stderr, "\r%3d%%", (int)(100.*cache.getProgress()));
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+  }
+  fprintf(stderr, "\r     \r");
+  if(!cache.isReady())
+  {
+    fprintf(stderr, "Could not build the tile cache\n");
+    return 1;
+  }
+  if(cache.getElapsedSeconds() > 0.)
+    printf("Built the tile cache in %g s\n", cache.getElapsedSeconds());
+
+  int frames = cache.getNumberOfFrames();
+  int samples = (int)std::max(fabs(x1 - x0), fabs(y1 - y0)) + 1;
+  std::vector<unsigned char> pixels((size_t)samples*frames);
+  std::chrono::steady_clock::time_point beginTime = std::chrono::steady_clock::now();
+  if(cache.extractLine(x0, y0, x1, y1, samples, 0, frames - 1, &pixels[0]))
+  {
+    fprintf(stderr, "Could not extract the line\n");
+    return 1;
+  }
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - beginTime).count();
+  FILE* file = fopen(path.c_str(), "wb");
+  if(!file)
+  {
+    fprintf(stderr, "Could not write %s\n", path.c_str());
+    return 1;
+  }
+  fprintf(file, "P5\n%d %d\n255\n", frames, samples);
+  bool failed = fwrite(&pixels[0], 1, pixels.size(), file) != pixels.size();
+  failed = fclose(file) != 0 || failed;
+  if(failed)
+  {
+    fprintf(stderr, "Could not write %s\n", path.c_str());
+    return 1;
+  }
+  printf("Extracted %d samples over %d frames in %g s\n", samples, frames, seconds);
+  return 0;
+}
+
+int poses(MhaSequenceReader& reader, const std::string& transformName, bool times, const MhaPoseFilterSettings& settings)
+{
+  int stream = reader.getTransformTable().find(transformName);
+  if(stream < 0)
+  {
+    fprintf(stderr, "No %sTransform in the sequence\n", transformName.c_str());
+    return 1;
+  }
+  MhaPoseTrack filtered;
+  if(settings.isEnabled())
+  {
+    std::vector<unsigned char> outliers;
+    reader.getIndex()->getPoseTrack(stream).filter(settings, filtered, outliers);
+    int count = 0;
+    for(size_t frame=0; frame<outliers.size(); frame++)
+      count += outliers[frame] ? 1 : 0;
+    fprintf(stderr, "%d tracking outliers\n", count);
+  }
+  const MhaPoseTrack& track = settings.isEnabled() ? filtered : reader.getIndex()->getPoseTrack(stream);
+  if(times && !track.hasTimestamps())
+  {
+    fprintf(stderr, "The sequence has no frame timestamps\n");
+    return 1;
+  }
+  std::vector<double> queries;
+  double query;
+  while(scanf("%lf", &query) == 1)
+    queries.push_back(query);
+  if(queries.empty())
+    return 0;
+
+  std::vector<float> matrices(12*queries.size());
+  std::vector<unsigned char> valid(queries.size());
+  if(times)
+    track.interpolateTimes(&queries[0], (int)queries.size(), &matrices[0], &valid[0]);
+  else
+    track.interpolateFrames(&queries[0], (int)queries.size(), &matrices[0], &valid[0]);
+  for(size_t i=0; i<queries.size(); i++)
+  {
+    printf("%.17g,%d", queries[i], valid[i]);
+    for(int j=0; j<12; j++)
+      printf(",%g", matrices[12*i+j]);
+    printf("\n");
+  }
+  return 0;
+}
+
+int near(MhaSequenceReader& reader, const std::string& transformName, const double point[3], double distance, double spacing)
+{
+  int stream = reader.getTransformTable().find(transformName);
+  if(stream < 0)
+  {
+    fprintf(stderr, "No %sTransform in the sequence\n", transformName.c_str());
+    return 1;
+  }
+  double imageToProbe[16] = { spacing, 0., 0., 0., 0., spacing, 0., 0., 0., 0., spacing, 0., 0., 0., 0., 1. };
+  std::chrono::steady_clock::time_point beginTime = std::chrono::steady_clock::now();
+  MhaPlaneIndex index;
+  index.build(reader.getIndex()->getPoseTrack(stream), reader.getWidth(), reader.getHeight(), imageToProbe);
+  std::chrono::steady_clock::time_point builtTime = std::chrono::steady_clock::now();
+  std::vector<int> frames;
+  index.findFramesNearPoint(point, distance, frames);
+  std::chrono::steady_clock::time_point endTime = std::chrono::steady_clock::now();
+  for(size_t i=0; i<frames.size(); i++)
+    printf("%d\n", frames[i]);
+  fprintf(stderr, "%d frames of %d, index built in %g ms, query took %g ms\n", (int)frames.size(), index.getNumberOfFrames(),
+    std::chrono::duration<double, std::milli>(builtTime - beginTime).count(),
+    std::chrono::duration<double, std::milli>(endTime - builtTime).count());
+  return 0;
+}
+
+int serve(MhaSequenceReader& reader, int port, double framesPerSecond, bool loop)
+{
+  MhaStreamServer server;
+  if(server.listen(port))
+  {
+    fprintf(stderr, "Could not listen on port %d\n", port);
+    return 1;
+  }
+  fprintf(stderr, "Waiting for a client on port %d\n", port);
+  std::chrono::steady_clock::time_point beginTime = std::chrono::steady_clock::now();
+  int result = server.serve(reader.getIndex(), framesPerSecond, loop);
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - beginTime).count();
+  fprintf(stderr, "Sent %lld frames in %g s\n", server.getNumberOfSentFrames(), seconds);
+  return result;
+}
+
+int receive(const std::string& host, int port, double duration, const std::string& recordPath, int capacity, bool block)
+{
+  MhaStreamReceiver receiver;
+  receiver.setRecordingPath(recordPath);
+  if(capacity > 0)
+    receiver.setRecordingCapacity(capacity);
+  receiver.setOverflow(block ? MhaStreamReceiver::Block : MhaStreamReceiver::DropOldest);
+  if(receiver.connect(host, port))
+  {
+    fprintf(stderr, "%s\n", receiver.getError().c_str());
+    return 1;
+  }
+  std::chrono::steady_clock::time_point beginTime = std::chrono::steady_clock::now();
+  std::chrono::steady_clock::time_point reportTime = beginTime;
+  MhaStreamStatistics reported;
+  double seconds = 0.;
+  MhaStreamFrame frame;
+  while(seconds < duration)
+  {
+    bool received = false;
+    while(receiver.takeFrame(frame))
+    {
+      receiver.releaseFrame(frame);
+      received = true;
+    }
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    seconds = std::chrono::duration<double>(now - beginTime).count();
+    if(std::chrono::duration<double>(now - reportTime).count() >= 1.)
+    {
+      MhaStreamStatistics statistics = receiver.getStatistics();
+      double interval = std::chrono::duration<double>(now - reportTime).count();
+      printf("%.1f s: %.1f frames/s, %.1f MB/s, %lld dropped, %lld recorded\n", seconds,
+        (statistics.received - reported.received)/interval, (statistics.bytes - reported.bytes)/(interval*1024.*1024.),
+        statistics.dropped, statistics.recorded);
+      reported = statistics;
+      reportTime = now;
+    }
+    if(!received)
+    {
+      if(!receiver.isConnected())
+        break;
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+  }
+  receiver.disconnect();
+  MhaStreamStatistics statistics = receiver.getStatistics();
+  printf("Received %lld frames (%lld dropped) in %g s\n", statistics.received, statistics.dropped, seconds);
+  if(statistics.recordingFiles > 1)
+    printf("Recorded %lld frames to %d files\n", statistics.recorded, statistics.recordingFiles);
+  if(!receiver.getError().empty())
+    fprintf(stderr, "%s\n", receiver.getError().c_str());
+  return 0;
+}
+
+int cine(MhaSequenceReader& reader, const std::string& path, const MhaCineOptions& options)
+{
+  MhaCineResult result;
+  if(exportCine(reader.getIndex(), path, options, result))
+  {
+    fprintf(stderr, "Cine export to %s failed\n", path.c_str());
+    return 1;
+  }
+  double seconds = std::max(result.seconds, 1e-9);
+  printf("Wrote %d frames to %s in %g s: %.1f frames/s, %.1f MB/s of pixels in, %.1f MB out\n",
+    result.framesWritten, path.c_str(), result.seconds, result.framesWritten/seconds,
+    (double)result.framesWritten*reader.getFrameSize()/(seconds*1024.*1024.), result.bytesWritten/(1024.*1024.));
+  printf("Read and filter %.2f s, encode %.2f s on %d threads, write %.2f s\n",
+    result.filterSeconds, result.encodeSeconds, result.numberOfThreads, result.writeSeconds);
+  return 0;
+}
+
+int cache(MhaSequenceReader& reader, int numberOfThreads, int keyframeInterval, bool direct)
+{
+  MhaCompressedFrameCache frameCache;
+  frameCache.setDirectIO(direct);
+  if(frameCache.start(reader.getIndex(), numberOfThreads, keyframeInterval))
+    return 1;
+  while(frameCache.isRunning())
+  {
+    fprintf(stderr, "\r%3d%%", (int)(100.*frameCache.getProgress()));
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+  }
+  fprintf(stderr, "\r     \r");
+  if(!frameCache.isReady())
+  {
+    fprintf(stderr, "Could not read %s\n", reader.getPath().c_str());
+    return 1;
+  }
+  double megabytes = (double)frameCache.getUncompressedSize()/(1024.*1024.);
+  double compressedMegabytes = (double)frameCache.getMemorySize()/(1024.*1024.);
+  printf("Compressed %g MB into %g MB (ratio %.2f) in %g s (%g MB/s)\n", megabytes, compressedMegabytes,
+    megabytes/compressedMegabytes, frameCache.getElapsedSeconds(), megabytes/frameCache.getElapsedSeconds());
+
+  // Forward playback, then jumps to random frames, each checked against the file
+  int numberOfFrames = reader.getNumberOfFrames();
+  std::vector<unsigned char> decoded(reader.getFrameSize());
+  std::vector<unsigned char> original(reader.getFrameSize());
+  std::vector<int> order(numberOfFrames);
+  for(int frame = 0; frame < numberOfFrames; frame++)
+    order[frame] = frame;
+  srand(1);
+  for(int frame = numberOfFrames - 1; frame > 0; frame--)
+    std::swap(order[frame], order[rand() % (frame + 1)]);
+  const char* passes[2] = { "Sequential", "Random" };
+  for(int pass = 0; pass < 2; pass++)
+  {
+    double seconds = 0.;
+    double worstSeconds = 0.;
+    for(int i = 0; i < numberOfFrames; i++)
+    {
+      int frame = pass == 0 ? i : order[i];
+      std::chrono::steady_clock::time_point beginTime = std::chrono::steady_clock::now();
+      if(frameCache.readFrame(frame, &decoded[0]))
+      {
+        fprintf(stderr, "Could not decode frame %d\n", frame);
+        return 1;
+      }
+      double frameSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - beginTime).count();
+      seconds += frameSeconds;
+      worstSeconds = std::max(worstSeconds, frameSeconds);
+      if(reader.readFrame(frame, &original[0]) || memcmp(&decoded[0], &original[0], decoded.size()))
+      {
+        fprintf(stderr, "Frame %d does not match the file\n", frame);
+        return 1;
+      }
+    }
+    printf("%s decode: %.3f ms per frame, %.3f ms at most\n", passes[pass], 1000.*seconds/numberOfFrames,
+      1000.*worstSeconds);
+  }
+  return 0;
+}
+
+int batches(MhaSequenceReader& reader, const MhaTrainingOptions& options, int epochs, double workMilliseconds)
+{
+  MhaTrainingLoader loader;
+  if(loader.start(reader.getIndex(), options))
+  {
+    fprintf(stderr, "No frames to load\n");
+    return 1;
+  }
+  printf("%d samples of %dx%d in %d batches per epoch, buffers %s\n", loader.getNumberOfSamples(),
+    loader.getSampleWidth(), loader.getSampleHeight(), loader.getNumberOfBatches(),
+    loader.isPinned() ? "pinned" : "not pinned");
+  unsigned long long checksum = 0;
+  int validSamples = 0;
+  MhaTrainingBatch batch;
+  for(int i = 0; i < epochs*loader.getNumberOfBatches(); i++)
+  {
+    if(loader.nextBatch(batch))
+    {
+      fprintf(stderr, "Could not read %s\n", reader.getPath().c_str());
+      return 1;
+    }
+    checksum = computeFrameHash(batch.pixels, (size_t)batch.numberOfSamples*batch.width*batch.height, checksum);
+    checksum = computeFrameHash((const unsigned char*)batch.frames, batch.numberOfSamples*sizeof(int), checksum);
+    for(int sample = 0; sample < batch.numberOfSamples; sample++)
+      validSamples += batch.valid[sample];
+    if(workMilliseconds > 0.)
+      std::this_thread::sleep_for(std::chrono::duration<double, std::milli>(workMilliseconds));
+  }
+  MhaTrainingStatistics statistics = loader.getStatistics();
+  printf("%lld batches, %lld samples (%d with a valid pose) in %g s: %g samples/s, %g MB/s read\n",
+    statistics.batches, statistics.samples, validSamples, statistics.seconds,
+    (double)statistics.samples/statistics.seconds, (double)statistics.bytesRead/(1024.*1024.)/statistics.seconds);
+  printf("Waited %g s for batches (%.1f%%)\n", statistics.waitSeconds, 100.*statistics.waitSeconds/statistics.seconds);
+  printf("Checksum %016llx\n", checksum);
+  return 0;
+}
+
+int stats(MhaSequenceReader& reader, int numberOfThreads, bool direct, const std::string& csvPath)
+{
+  MhaSequenceAnalyzer analyzer;
+  analyzer.setDirectIO(direct);
+  if(runAnalysis(reader, analyzer, MhaSequenceAnalyzer::Statistics | MhaSequenceAnalyzer::Hashes, numberOfThreads))
+  {
+    fprintf(stderr, "Sequence analysis failed\n");
+    return 1;
+  }
+  std::vector<std::pair<int, int> > runs;
+  findDuplicateRuns(analyzer.getHashes(), runs);
+  int duplicates = 0;
+  for(size_t i=0; i<runs.size(); i++)
+    duplicates += runs[i].second - 1;
+
+  double megabytes = (double)reader.getFrameSize()*reader.getNumberOfFrames()/(1024.*1024.);
+  printf("Pass over the sequence took %g s (%g MB/s)\n", analyzer.getElapsedSeconds(), megabytes/analyzer.getElapsedSeconds());
+  printf("Blank frames: %d, frozen frames: %d, duplicate frames: %d\n",
+    analyzer.getNumberOfFlaggedFrames(MhaSequenceAnalyzer::Blank),
+    analyzer.getNumberOfFlaggedFrames(MhaSequenceAnalyzer::Frozen), duplicates);
+  printf("1-99%% intensity: %d-%d\n", analyzer.getPercentile(1.), analyzer.getPercentile(99.));
+
+  if(csvPath.empty())
+    return 0;
+  FILE* csv = fopen(csvPath.c_str(), "w");
+  if(!csv)
+  {
+    fprintf(stderr, "Could not write %s\n", csvPath.c_str());
+    return 1;
+  }
+  fprintf(csv, "frame,min,max,mean,std,diff,blank,frozen,hash\n");
+  const std::vector<MhaFrameStatistics>& statistics = analyzer.getStatistics();
+  const std::vector<unsigned long long>& hashes = analyzer.getHashes();
+  for(size_t frame=0; frame<statistics.size(); frame++)
+  {
+    const MhaFrameStatistics& frameStatistics = statistics[frame];
+    fprintf(csv, "%d,%d,%d,%g,%g,%g,%d,%d,%016llx\n", (int)frame, frameStatistics.minimum, frameStatistics.maximum,
+      frameStatistics.mean, sqrt(frameStatistics.variance), frameStatistics.meanAbsoluteDifference,
+      (frameStatistics.flags & MhaSequenceAnalyzer::Blank) ? 1 : 0,
+      (frameStatistics.flags & MhaSequenceAnalyzer::Frozen) ? 1 : 0, hashes[frame]);
+  }
+  return fclose(csv) ? 1 : 0;
+}
+}
+
+int main(int argc, char* argv[])
+{
+  if(argc < 3)
+  {
+    printUsage();
+    return 1;
+  }
+  std::string command = argv[1];
+  if(command == "receive" && argc >= 4)
+  {
+    double duration = 10.;
+    std::string recordPath;
+    int capacity = 0;
+    bool block = false;
+    for(int i = 4; i < argc; i++)
+    {
+      std::string option = argv[i];
+      if(option == "--seconds" && i + 1 < argc)
+        duration = atof(argv[++i]);
+      else if(option == "--record" && i + 1 < argc)
+        recordPath = argv[++i];
+      else if(option == "--capacity" && i + 1 < argc)
+        capacity = atoi(argv[++i]);
+      else if(option == "--block")
+        block = true;
+      else
+      {
+        fprintf(stderr, "Unknown option %s\n", option.c_str());
+        printUsage();
+        return 1;
+      }
+    }
+    return receive(argv[2], atoi(argv[3]), duration, recordPath, capacity, block);
+  }
+  MhaSequenceReader reader;
+  if(reader.open(argv[2]))
+  {
+    fprintf(stderr, "Could not read %s\n", argv[2]);
+    return 1;
+  }
+
+  if(command == "info" && argc == 3)
+    return info(reader);
+  if(command == "extract" && argc == 6)
+    return extract(reader, atoi(argv[3]), atoi(argv[4]), argv[5]);
+  if(command == "poses" && argc >= 4)
+  {
+    bool times = false;
+    MhaPoseFilterSettings settings;
+    for(int i = 4; i < argc; i++)
+    {
+      std::string option = argv[i];
+      int remaining = argc - i - 1;
+      if(option == "--times")
+        times = true;
+      else if(option == "--max-speed" && remaining >= 1)
+        settings.maximumSpeed = atof(argv[++i]);
+      else if(option == "--max-acceleration" && remaining >= 1)
+        settings.maximumAcceleration = atof(argv[++i]);
+      else if(option == "--max-rotation" && remaining >= 1)
+        settings.maximumAngularSpeed = atof(argv[++i]);
+      else if(option == "--smooth" && remaining >= 1)
+        settings.smoothingHalfWidth = atoi(argv[++i]);
+      else
+      {
+        fprintf(stderr, "Unknown option %s\n", option.c_str());
+        printUsage();
+        return 1;
+      }
+    }
+    return poses(reader, argv[3], times, settings);
+  }
+  if(command == "near" && (argc == 8 || (argc == 10 && std::string(argv[8]) == "--spacing")))
+  {
+    double point[3] = { atof(argv[4]), atof(argv[5]), atof(argv[6]) };
+    return near(reader, argv[3], point, atof(argv[7]), argc == 10 ? atof(argv[9]) : 1.);
+  }
+  if(command == "serve" && argc >= 4)
+  {
+    double framesPerSecond = 30.;
+    bool loop = false;
+    for(int i = 4; i < argc; i++)
+    {
+      std::string option = argv[i];
+      if(option == "--fps" && i + 1 < argc)
+        framesPerSecond = atof(argv[++i]);
+      else if(option == "--loop")
+        loop = true;
+      else
+      {
+        fprintf(stderr, "Unknown option %s\n", option.c_str());
+        printUsage();
+        return 1;
+      }
+    }
+    return serve(reader, atoi(argv[3]), framesPerSecond, loop);
+  }
+  if(command == "mmode" && argc == 8)
+    return mmode(reader, atof(argv[3]), atof(argv[4]), atof(argv[5]), atof(argv[6]), argv[7]);
+
+  // Remaining commands take options
+  int firstOption = command == "stats" || command == "cache" || command == "batches" ? 3 : 4;
+  if((command != "stats" && command != "export" && command != "cine" && command != "cache" && command != "batches")
+    || argc < firstOption)
+  {
+    printUsage();
+    return 1;
+  }
+  MhaExportOptions options;
+  MhaCineOptions cineOptions;
+  bool skipDuplicates = false;
+  int numberOfThreads = 0;
+  int keyframeInterval = 8;
+  MhaTrainingOptions trainingOptions;
+  int epochs = 1;
+  double workMilliseconds = 0.;
+  std::string csvPath;
+  for(int i = firstOption; i < argc; i++)
+  {
+    std::string option = argv[i];
+    int remaining = argc - i - 1;
+    if(option == "--threads" && remaining >= 1)
+      numberOfThreads = atoi(argv[++i]);
+    else if(option == "--csv" && remaining >= 1 && command == "stats")
+      csvPath = argv[++i];
+    else if(option == "--first" && remaining >= 1)
+      options.firstFrame = atoi(argv[++i]);
+    else if(option == "--last" && remaining >= 1)
+      options.lastFrame = atoi(argv[++i]);
+    else if(option == "--stride" && remaining >= 1)
+      options.stride = atoi(argv[++i]);
+    else if(option == "--crop" && remaining >= 4)
+    {
+      options.crop = true;
+      for(int j=0; j<4; j++)
+        options.cropExtent[j] = atoi(argv[++i]);
+    }
+    else if(option == "--median")
+      options.filters.median = true;
+    else if(option == "--gaussian")
+      options.filters.gaussian = true;
+    else if(option == "--average" && remaining >= 1)
+      options.filters.temporalAverageFrames = atoi(argv[++i]);
+    else if(option == "--gain" && remaining >= 2)
+    {
+      options.filters.nearGain = atof(argv[++i]);
+      options.filters.farGain = atof(argv[++i]);
+    }
+    else if(option == "--fps" && remaining >= 1 && command == "cine")
+      cineOptions.framesPerSecond = atof(argv[++i]);
+    else if(option == "--quality" && remaining >= 1 && command == "cine")
+      cineOptions.quality = atoi(argv[++i]);
+    else if(option == "--keyframes" && remaining >= 1 && command == "cache")
+      keyframeInterval = atoi(argv[++i]);
+    else if(option == "--batch" && remaining >= 1 && command == "batches")
+      trainingOptions.batchSize = atoi(argv[++i]);
+    else if(option == "--epochs" && remaining >= 1 && command == "batches")
+      epochs = atoi(argv[++i]);
+    else if(option == "--seed" && remaining >= 1 && command == "batches")
+      trainingOptions.seed = strtoull(argv[++i], NULL, 10);
+    else if(option == "--order" && remaining >= 1 && command == "batches")
+    {
+      std::string order = argv[++i];
+      if(order == "sequential")
+        trainingOptions.order = MhaTrainingOptions::Sequential;
+      else if(order == "stratified")
+        trainingOptions.order = MhaTrainingOptions::Stratified;
+      else if(order == "shuffled")
+        trainingOptions.order = MhaTrainingOptions::Shuffled;
+      else
+      {
+        fprintf(stderr, "Unknown option %s %s\n", option.c_str(), order.c_str());
+        printUsage();
+        return 1;
+      }
+    }
+    else if(option == "--transform" && remaining >= 1 && command == "batches")
+      trainingOptions.transformName = argv[++i];
+    else if(option == "--valid-only" && command == "batches")
+      trainingOptions.validOnly = true;
+    else if(option == "--drop-last" && command == "batches")
+      trainingOptions.dropLast = true;
+    else if(option == "--flip" && remaining >= 1 && command == "batches")
+      trainingOptions.flipProbability = atof(argv[++i]);
+    else if(option == "--gain-jitter" && remaining >= 1 && command == "batches")
+      trainingOptions.gainJitter = atof(argv[++i]);
+    else if(option == "--offset-jitter" && remaining >= 1 && command == "batches")
+      trainingOptions.offsetJitter = atof(argv[++i]);
+    else if(option == "--shift-jitter" && remaining >= 1 && command == "batches")
+      trainingOptions.shiftJitter = atoi(argv[++i]);
+    else if(option == "--work" && remaining >= 1 && command == "batches")
+      workMilliseconds = atof(argv[++i]);
+    else if(option == "--skip-duplicates")
+      skipDuplicates = true;
+    else if(option == "--direct")
+      options.directIO = true;
+    else
+    {
+      fprintf(stderr, "Unknown option %s\n", option.c_str());
+      printUsage();
+      return 1;
+    }
+  }
+
+  if(command == "stats")
+    return stats(reader, numberOfThreads, options.directIO, csvPath);
+  if(command == "batches")
+  {
+    trainingOptions.firstFrame = options.firstFrame;
+    trainingOptions.lastFrame = options.lastFrame;
+    trainingOptions.stride = options.stride;
+    trainingOptions.crop = options.crop;
+    for(int j=0; j<4; j++)
+      trainingOptions.cropExtent[j] = options.cropExtent[j];
+    trainingOptions.numberOfThreads = numberOfThreads;
+    trainingOptions.directIO = options.directIO;
+    return batches(reader, trainingOptions, epochs, workMilliseconds);
+  }
+  if(command == "cache")
+    return cache(reader, numberOfThreads, keyframeInterval, options.directIO);
+  if(command == "cine")
+  {
+    cineOptions.firstFrame = options.firstFrame;
+    cineOptions.lastFrame = options.lastFrame;
+    cineOptions.stride = options.stride;
+    cineOptions.crop = options.crop;
+    for(int j=0; j<4; j++)
+      cineOptions.cropExtent[j] = options.cropExtent[j];
+    cineOptions.filters = options.filters;
+    cineOptions.numberOfThreads = numberOfThreads;
+    cineOptions.directIO = options.directIO;
+    return cine(reader, argv[3], cineOptions);
+  }
+
+  std::vector<unsigned long long> hashes;
+  if(skipDuplicates)
+  {
+    if(getFrameHashes(reader, numberOfThreads, options.directIO, hashes))
+    {
+      fprintf(stderr, "Could not hash the sequence\n");
+      return 1;
+    }
+    options.frameHashes = &hashes;
+  }
+  MhaExportResult result;
+  if(exportSequence_mha(reader.getIndex(), argv[3], options, result))
+  {
+    fprintf(stderr, "Export to %s failed\n", argv[3]);
+    return 1;
+  }
+  printf("Exported %d frames to %s in %g s", result.framesWritten, argv[3], result.seconds);
+  if(result.framesSkipped)
+    printf(", %d duplicates skipped", result.framesSkipped);
+  printf("\n");
+  return 0;
+}
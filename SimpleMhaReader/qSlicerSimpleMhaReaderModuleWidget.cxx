@@ -19,6 +19,9 @@
 #include <QDebug>
 #include <QTimer>
 #include <QFileDialog>
+#include <QSpinBox>
+#include <QTextCursor>
+#include <QTextDocument>
 
 // SlicerQt includes
 #include "qSlicerSimpleMhaReaderModuleWidget.h"
@@ -27,7 +30,10 @@
 #include "vtkSlicerSimpleMhaReaderLogic.h"
 
 // STL includes
+#include <algorithm>
+#include <cmath>
 #include <set>
+#include <vector>
 
 //-----------------------------------------------------------------------------
 /// \ingroup Slicer_QtModules_ExtensionTemplate
@@ -37,6 +43,20 @@ class qSlicerSimpleMhaReaderModuleWidgetPrivate: public Ui_qSlicerSimpleMhaReade
 protected:
   qSlicerSimpleMhaReaderModuleWidget* const q_ptr;
   QTimer* timer;
+  QTimer* followTimer;
+  QTimer* analysisTimer;
+  QTimer* mModeTimer;
+  QTimer* frameCacheTimer;
+  QTimer* publishTimer;
+  QTimer* pollTimer;
+  QTimer* logTimer;
+  /// What updateState() last displayed, fields are only refreshed on change
+  int shownFrame;
+  int shownNumberOfFrames;
+  int shownWidth;
+  int shownHeight;
+  std::set<std::string> shownTransforms;
+  std::string shownActiveTransform;
 public:
   ~qSlicerSimpleMhaReaderModuleWidgetPrivate();
   qSlicerSimpleMhaReaderModuleWidgetPrivate(qSlicerSimpleMhaReaderModuleWidget& object);
@@ -50,12 +70,40 @@ public:
 qSlicerSimpleMhaReaderModuleWidgetPrivate::~qSlicerSimpleMhaReaderModuleWidgetPrivate()
 {
   delete timer;
+  delete followTimer;
+  delete analysisTimer;
+  delete mModeTimer;
+  delete frameCacheTimer;
+  delete publishTimer;
+  delete pollTimer;
+  delete logTimer;
 }
 
 qSlicerSimpleMhaReaderModuleWidgetPrivate::qSlicerSimpleMhaReaderModuleWidgetPrivate(qSlicerSimpleMhaReaderModuleWidget& object): q_ptr(&object)
 {
   timer = new QTimer;
   timer->setInterval(100);
+  followTimer = new QTimer;
+  followTimer->setInterval(250);
+  analysisTimer = new QTimer;
+  analysisTimer->setInterval(200);
+  mModeTimer = new QTimer;
+  mModeTimer->setInterval(200);
+  frameCacheTimer = new QTimer;
+  frameCacheTimer->setInterval(200);
+  // Started for each frame navigation defers, when it is due
+  publishTimer = new QTimer;
+  publishTimer->setSingleShot(true);
+  // Sequences and the stream are taken at the display refresh rate, only
+  // while there are some
+  pollTimer = new QTimer;
+  pollTimer->setInterval(16);
+  logTimer = new QTimer;
+  logTimer->setInterval(250);
+  shownFrame = -1;
+  shownNumberOfFrames = -1;
+  shownWidth = -1;
+  shownHeight = -1;
 }
 
 vtkSlicerSimpleMhaReaderLogic* qSlicerSimpleMhaReaderModuleWidgetPrivate::logic() const
@@ -99,19 +147,61 @@ void qSlicerSimpleMhaReaderModuleWidget::setup()
   connect(d->playIntervalSpinBox, SIGNAL(valueChanged(int)), this, SLOT(onPlayIntervalChanged(int)));
   connect(d->playModeComboBox, SIGNAL(currentIndexChanged(const QString&)), this, SLOT(onPlayModeChanged(const QString&)));
   connect(d->applyTransformsCheckBox, SIGNAL(stateChanged(int)), this, SLOT(onApplyTransformsChanged(int)));
+  connect(d->activeTransformComboBox, SIGNAL(currentIndexChanged(const QString&)), this, SLOT(onActiveTransformChanged(const QString&)));
   connect(d->saveToPngButton, SIGNAL(clicked()), this, SLOT(onSaveToPng()));
+  connect(d->exportSequenceButton, SIGNAL(clicked()), this, SLOT(onExportSequence()));
+  connect(d->exportCineButton, SIGNAL(clicked()), this, SLOT(onExportCine()));
+  connect(d->memoryLimitSpinBox, SIGNAL(valueChanged(int)), this, SLOT(onMemoryLimitChanged(int)));
+  connect(d->followCheckBox, SIGNAL(stateChanged(int)), this, SLOT(onFollowChanged(int)));
+  connect(d->followTimer, SIGNAL(timeout()), this, SLOT(onFollowUpdate()));
+  connect(d->analyzeButton, SIGNAL(clicked()), this, SLOT(onAnalyze()));
+  connect(d->findDuplicatesButton, SIGNAL(clicked()), this, SLOT(onFindDuplicates()));
+  connect(d->analysisTimer, SIGNAL(timeout()), this, SLOT(onAnalysisUpdate()));
+  connect(d->previousBlankFrameButton, SIGNAL(clicked()), this, SLOT(onPreviousBlankFrame()));
+  connect(d->nextBlankFrameButton, SIGNAL(clicked()), this, SLOT(onNextBlankFrame()));
+  connect(d->previousFrozenFrameButton, SIGNAL(clicked()), this, SLOT(onPreviousFrozenFrame()));
+  connect(d->nextFrozenFrameButton, SIGNAL(clicked()), this, SLOT(onNextFrozenFrame()));
+  connect(d->medianFilterCheckBox, SIGNAL(stateChanged(int)), this, SLOT(onFiltersChanged()));
+  connect(d->gaussianFilterCheckBox, SIGNAL(stateChanged(int)), this, SLOT(onFiltersChanged()));
+  connect(d->temporalAverageSpinBox, SIGNAL(valueChanged(int)), this, SLOT(onFiltersChanged()));
+  connect(d->nearGainSpinBox, SIGNAL(valueChanged(double)), this, SLOT(onFiltersChanged()));
+  connect(d->farGainSpinBox, SIGNAL(valueChanged(double)), this, SLOT(onFiltersChanged()));
+  connect(d->maximumSpeedSpinBox, SIGNAL(valueChanged(double)), this, SLOT(onPoseFilterChanged()));
+  connect(d->maximumAccelerationSpinBox, SIGNAL(valueChanged(double)), this, SLOT(onPoseFilterChanged()));
+  connect(d->maximumAngularSpeedSpinBox, SIGNAL(valueChanged(double)), this, SLOT(onPoseFilterChanged()));
+  connect(d->poseSmoothingSpinBox, SIGNAL(valueChanged(int)), this, SLOT(onPoseFilterChanged()));
+  connect(d->mModeCacheButton, SIGNAL(clicked()), this, SLOT(onBuildMModeCache()));
+  connect(d->mModeTimer, SIGNAL(timeout()), this, SLOT(onMModeCacheUpdate()));
+  connect(d->frameCacheButton, SIGNAL(toggled(bool)), this, SLOT(onFrameCacheToggled(bool)));
+  connect(d->frameCacheTimer, SIGNAL(timeout()), this, SLOT(onFrameCacheUpdate()));
+  connect(d->publishTimer, SIGNAL(timeout()), this, SLOT(onPublishFrame()));
+  connect(d->logTimer, SIGNAL(timeout()), this, SLOT(onDrainLog()));
+  connect(d->pollTimer, SIGNAL(timeout()), this, SLOT(onSequencesUpdate()));
+  connect(d->openSequencesButton, SIGNAL(clicked()), this, SLOT(onOpenSequences()));
+  connect(d->pollTimer, SIGNAL(timeout()), this, SLOT(onStreamUpdate()));
+  connect(d->connectStreamButton, SIGNAL(clicked()), this, SLOT(onStreamToggle()));
+  connect(d->playSequencesButton, SIGNAL(clicked()), this, SLOT(onPlaySequencesToggle()));
+  connect(d->mModeX0SpinBox, SIGNAL(valueChanged(int)), this, SLOT(onMModeLineChanged()));
+  connect(d->mModeY0SpinBox, SIGNAL(valueChanged(int)), this, SLOT(onMModeLineChanged()));
+  connect(d->mModeX1SpinBox, SIGNAL(valueChanged(int)), this, SLOT(onMModeLineChanged()));
+  connect(d->mModeY1SpinBox, SIGNAL(valueChanged(int)), this, SLOT(onMModeLineChanged()));
   
   connect(d->frameSlider, SIGNAL(valueChanged(int)), this, SLOT(onFrameSliderChanged(int)));
   
-  d->logic()->setConsole(d->consoleTextEdit);
+  // Oldest lines go once the console holds this many
+  d->consoleTextEdit->document()->setMaximumBlockCount(1000);
   
   qvtkConnect(d->logic(), vtkCommand::ModifiedEvent, this, SLOT(updateState()));
+  qvtkConnect(d->logic(), vtkSlicerSimpleMhaReaderLogic::FramePendingEvent, this, SLOT(onFramePending()));
+  d->logTimer->start();
 }
 
 void qSlicerSimpleMhaReaderModuleWidget::onFileChanged(const QString& path)
 {
   Q_D(qSlicerSimpleMhaReaderModuleWidget);
   vtkSlicerSimpleMhaReaderLogic* logic = d->logic();
+  // The cache holds the frames of one file
+  d->frameCacheButton->setChecked(false);
   logic->setMhaPath(path.toStdString());
 }
 
@@ -119,24 +209,54 @@ void qSlicerSimpleMhaReaderModuleWidget::updateState()
 {
   Q_D(qSlicerSimpleMhaReaderModuleWidget);
   vtkSlicerSimpleMhaReaderLogic* logic = d->logic();
-  ostringstream oss;
-  oss << logic->getCurrentFrame() << "/" << logic->getNumberOfFrames();
-  d->currentFrameLabel->setText(oss.str().c_str());
+  // Status text depends on more than the frame (analysis, pose filter), the
+  // labels skip identical text themselves
   d->transformStatusLabel->setText(logic->getCurrentTransformStatus().c_str());
-  oss.clear(); oss.str("");
-  oss << logic->getImageWidth() << "x" << logic->getImageHeight();
-  d->imageDimensionsLabel->setText(oss.str().c_str());
-  d->frameSlider->blockSignals(true);
-  d->frameSlider->setMaximum(logic->getNumberOfFrames());
-  d->frameSlider->setValue(logic->getCurrentFrame());
-  d->frameSlider->blockSignals(false);
+  d->frameStatisticsLabel->setText(logic->getCurrentFrameStatistics().c_str());
+  ostringstream oss;
+  if(logic->getCurrentFrame() != d->shownFrame || logic->getNumberOfFrames() != d->shownNumberOfFrames)
+  {
+    oss << logic->getCurrentFrame() << "/" << logic->getNumberOfFrames();
+    d->currentFrameLabel->setText(oss.str().c_str());
+    oss.clear(); oss.str("");
+    d->frameSlider->blockSignals(true);
+    d->frameSlider->setMaximum(logic->getNumberOfFrames());
+    d->frameSlider->setValue(logic->getCurrentFrame());
+    d->frameSlider->blockSignals(false);
+    d->shownFrame = logic->getCurrentFrame();
+    d->shownNumberOfFrames = logic->getNumberOfFrames();
+  }
+  if(logic->getImageWidth() != d->shownWidth || logic->getImageHeight() != d->shownHeight)
+  {
+    oss << logic->getImageWidth() << "x" << logic->getImageHeight();
+    d->imageDimensionsLabel->setText(oss.str().c_str());
+    QSpinBox* mModeSpinBoxes[4] = { d->mModeX0SpinBox, d->mModeY0SpinBox, d->mModeX1SpinBox, d->mModeY1SpinBox };
+    for(int i=0; i<4; i++)
+    {
+      mModeSpinBoxes[i]->blockSignals(true);
+      mModeSpinBoxes[i]->setMaximum(std::max((i % 2 ? logic->getImageHeight() : logic->getImageWidth()) - 1, 0));
+      mModeSpinBoxes[i]->blockSignals(false);
+    }
+    d->shownWidth = logic->getImageWidth();
+    d->shownHeight = logic->getImageHeight();
+  }
   std::set<std::string> availableTransforms = logic->getAvailableTransforms();
+  std::string activeTransform = logic->getActiveTransform();
+  if(availableTransforms == d->shownTransforms && activeTransform == d->shownActiveTransform)
+    return;
   std::string avTransText;
+  d->activeTransformComboBox->blockSignals(true);
+  d->activeTransformComboBox->clear();
   for(std::set<std::string>::iterator it=availableTransforms.begin(); it!=availableTransforms.end(); it++)
   {
     avTransText+=*it + ", ";
+    d->activeTransformComboBox->addItem(it->c_str());
   }
+  d->activeTransformComboBox->setCurrentIndex(d->activeTransformComboBox->findText(activeTransform.c_str()));
+  d->activeTransformComboBox->blockSignals(false);
   d->availableTransformsLabel->setText(avTransText.c_str());
+  d->shownTransforms.swap(availableTransforms);
+  d->shownActiveTransform = activeTransform;
 }
 
 // SLOTDEF_0(onNextImage, nextImage);
@@ -179,20 +299,285 @@ void qSlicerSimpleMhaReaderModuleWidget::onApplyTransformsChanged(int state){
   }
 }
 
+void qSlicerSimpleMhaReaderModuleWidget::onFollowChanged(int state){
+  Q_D(qSlicerSimpleMhaReaderModuleWidget);
+  d->logic()->setFollowMode(state == Qt::Checked);
+  if(state == Qt::Checked)
+    d->followTimer->start();
+  else
+    d->followTimer->stop();
+}
+
+void qSlicerSimpleMhaReaderModuleWidget::onAnalyze(){
+  Q_D(qSlicerSimpleMhaReaderModuleWidget);
+  d->analysisProgressBar->setValue(0);
+  d->logic()->startAnalysis();
+  d->analysisTimer->start();
+}
+
+void qSlicerSimpleMhaReaderModuleWidget::onFindDuplicates(){
+  Q_D(qSlicerSimpleMhaReaderModuleWidget);
+  d->analysisProgressBar->setValue(0);
+  d->logic()->startDuplicateSearch();
+  d->analysisTimer->start();
+}
+
+void qSlicerSimpleMhaReaderModuleWidget::onAnalysisUpdate(){
+  Q_D(qSlicerSimpleMhaReaderModuleWidget);
+  vtkSlicerSimpleMhaReaderLogic* logic = d->logic();
+  d->analysisProgressBar->setValue((int)(100.*logic->getAnalysisProgress()));
+  if(logic->updateAnalysis())
+    d->analysisTimer->stop();
+}
+
+void qSlicerSimpleMhaReaderModuleWidget::onPoseFilterChanged(){
+  Q_D(qSlicerSimpleMhaReaderModuleWidget);
+  MhaPoseFilterSettings settings;
+  settings.maximumSpeed = d->maximumSpeedSpinBox->value();
+  settings.maximumAcceleration = d->maximumAccelerationSpinBox->value();
+  settings.maximumAngularSpeed = d->maximumAngularSpeedSpinBox->value();
+  settings.smoothingHalfWidth = d->poseSmoothingSpinBox->value();
+  d->logic()->setPoseFilterSettings(settings);
+}
+
+void qSlicerSimpleMhaReaderModuleWidget::onBuildMModeCache(){
+  Q_D(qSlicerSimpleMhaReaderModuleWidget);
+  d->mModeProgressBar->setValue(0);
+  d->logic()->startTileCache();
+  d->mModeTimer->start();
+}
+
+void qSlicerSimpleMhaReaderModuleWidget::onMModeCacheUpdate(){
+  Q_D(qSlicerSimpleMhaReaderModuleWidget);
+  vtkSlicerSimpleMhaReaderLogic* logic = d->logic();
+  d->mModeProgressBar->setValue((int)(100.*logic->getTileCacheProgress()));
+  if(!logic->updateTileCache())
+    return;
+  d->mModeTimer->stop();
+  this->onMModeLineChanged();
+}
+
+void qSlicerSimpleMhaReaderModuleWidget::onFrameCacheToggled(bool checked){
+  Q_D(qSlicerSimpleMhaReaderModuleWidget);
+  d->frameCacheProgressBar->setValue(0);
+  if(checked)
+  {
+    d->logic()->startFrameCache();
+    d->frameCacheTimer->start();
+  }
+  else
+  {
+    d->frameCacheTimer->stop();
+    d->logic()->clearFrameCache();
+  }
+}
+
+void qSlicerSimpleMhaReaderModuleWidget::onFrameCacheUpdate(){
+  Q_D(qSlicerSimpleMhaReaderModuleWidget);
+  vtkSlicerSimpleMhaReaderLogic* logic = d->logic();
+  d->frameCacheProgressBar->setValue((int)(100.*logic->getFrameCacheProgress()));
+  if(logic->updateFrameCache())
+    d->frameCacheTimer->stop();
+}
+
+void qSlicerSimpleMhaReaderModuleWidget::onMModeLineChanged(){
+  Q_D(qSlicerSimpleMhaReaderModuleWidget);
+  // Every step of a spin box resamples the line, the cache makes that cheap
+  if(d->logic()->isTileCacheReady())
+    d->logic()->extractTimeLine(d->mModeX0SpinBox->value(), d->mModeY0SpinBox->value(),
+      d->mModeX1SpinBox->value(), d->mModeY1SpinBox->value());
+}
+
+void qSlicerSimpleMhaReaderModuleWidget::onFiltersChanged(){
+  Q_D(qSlicerSimpleMhaReaderModuleWidget);
+  MhaFilterSettings settings;
+  settings.median = d->medianFilterCheckBox->isChecked();
+  settings.gaussian = d->gaussianFilterCheckBox->isChecked();
+  settings.temporalAverageFrames = d->temporalAverageSpinBox->value();
+  settings.nearGain = d->nearGainSpinBox->value();
+  settings.farGain = d->farGainSpinBox->value();
+  d->logic()->setFilterSettings(settings);
+}
+
+void qSlicerSimpleMhaReaderModuleWidget::onActiveTransformChanged(const QString& text){
+  Q_D(qSlicerSimpleMhaReaderModuleWidget);
+  d->logic()->setActiveTransform(text.toStdString());
+}
+
+void qSlicerSimpleMhaReaderModuleWidget::onDrainLog(){
+  Q_D(qSlicerSimpleMhaReaderModuleWidget);
+  vtkSlicerSimpleMhaReaderLogic* logic = d->logic();
+  std::vector<MhaLogEntry> entries;
+  logic->getLog().drain(entries);
+  long long dropped = logic->getLog().takeNumberOfDropped();
+  ostringstream oss;
+  for(size_t i=0; i<entries.size(); i++)
+  {
+    if(entries[i].level >= MhaLogWarning)
+      oss << MhaLog::getLevelName(entries[i].level) << ": ";
+    oss << entries[i].message << "\n";
+  }
+  if(dropped > 0)
+    oss << dropped << " messages dropped\n";
+  if(!oss.str().empty())
+  {
+    // One insertion per drain, at the end whatever the user selected
+    d->consoleTextEdit->moveCursor(QTextCursor::End);
+    d->consoleTextEdit->insertPlainText(oss.str().c_str());
+  }
+
+  // Accounts and eviction follow the log, four times per second
+  logic->updateMemory();
+  d->memoryLabel->setText(logic->getMemoryStatus().c_str());
+
+  std::vector<MhaTimerSummary> timings;
+  logic->getMetrics().getSummaries(timings, true);
+  if(timings.empty())
+    return;
+  oss.clear(); oss.str("");
+  oss.precision(3);
+  for(size_t i=0; i<timings.size(); i++)
+    oss << (i ? ", " : "") << timings[i].name << " " << timings[i].meanMilliseconds << " ms (max "
+        << timings[i].maximumMilliseconds << ")";
+  oss << " over " << timings[0].count << " frames";
+  d->frameTimingLabel->setText(oss.str().c_str());
+}
+
+void qSlicerSimpleMhaReaderModuleWidget::onOpenSequences()
+{
+  Q_D(qSlicerSimpleMhaReaderModuleWidget);
+  QStringList fileNames = QFileDialog::getOpenFileNames(this, tr("Open Sequences"), "", tr("Sequence Files (*.mha)"));
+  if(fileNames.isEmpty())
+    return;
+  std::vector<std::string> paths;
+  for(int i=0; i<fileNames.size(); i++)
+    paths.push_back(fileNames[i].toStdString());
+  d->logic()->openSequences(paths);
+  d->playSequencesButton->setText(QString("Play Sequences"));
+  d->sequencesStatusLabel->setText(d->logic()->getSequencesStatus().c_str());
+  this->updatePollTimer();
+}
+
+void qSlicerSimpleMhaReaderModuleWidget::onPlaySequencesToggle()
+{
+  Q_D(qSlicerSimpleMhaReaderModuleWidget);
+  vtkSlicerSimpleMhaReaderLogic* logic = d->logic();
+  logic->setSequencesPlaying(!logic->getSequencesPlaying());
+  d->playSequencesButton->setText(QString(logic->getSequencesPlaying() ? "Stop Sequences" : "Play Sequences"));
+}
+
+void qSlicerSimpleMhaReaderModuleWidget::onSequencesUpdate()
+{
+  Q_D(qSlicerSimpleMhaReaderModuleWidget);
+  if(d->logic()->updateSequences())
+    d->sequencesStatusLabel->setText(d->logic()->getSequencesStatus().c_str());
+}
+
+void qSlicerSimpleMhaReaderModuleWidget::onStreamToggle()
+{
+  Q_D(qSlicerSimpleMhaReaderModuleWidget);
+  vtkSlicerSimpleMhaReaderLogic* logic = d->logic();
+  if(logic->isStreaming())
+    logic->stopStream();
+  else
+  {
+    std::string recordPath;
+    if(d->recordStreamCheckBox->isChecked())
+    {
+      QString fileName = QFileDialog::getSaveFileName(this, tr("Record Stream"), "", tr("Sequence Files (*.mha)"));
+      if(fileName.isEmpty())
+        return;
+      recordPath = fileName.toStdString();
+    }
+    logic->startStream(d->streamHostLineEdit->text().toStdString(), d->streamPortSpinBox->value(), recordPath);
+  }
+  d->connectStreamButton->setText(QString(logic->isStreaming() ? "Disconnect" : "Connect"));
+  d->streamStatusLabel->setText(logic->getStreamStatus().c_str());
+  this->updatePollTimer();
+}
+
+void qSlicerSimpleMhaReaderModuleWidget::onStreamUpdate()
+{
+  Q_D(qSlicerSimpleMhaReaderModuleWidget);
+  vtkSlicerSimpleMhaReaderLogic* logic = d->logic();
+  if(!logic->isStreaming())
+    return;
+  logic->updateStream();
+  // The stream may have ended during the update
+  d->connectStreamButton->setText(QString(logic->isStreaming() ? "Disconnect" : "Connect"));
+  d->streamStatusLabel->setText(logic->getStreamStatus().c_str());
+  this->updatePollTimer();
+}
+
+void qSlicerSimpleMhaReaderModuleWidget::updatePollTimer()
+{
+  Q_D(qSlicerSimpleMhaReaderModuleWidget);
+  bool polling = d->logic()->hasSequences() || d->logic()->isStreaming();
+  if(polling && !d->pollTimer->isActive())
+    d->pollTimer->start();
+  else if(!polling)
+    d->pollTimer->stop();
+}
+
+void qSlicerSimpleMhaReaderModuleWidget::onFramePending()
+{
+  Q_D(qSlicerSimpleMhaReaderModuleWidget);
+  // Rounded up, a timer firing before the frame is due defers it once more
+  d->publishTimer->start((int)ceil(1000.*d->logic()->getPendingFrameDelay()));
+}
+
 void qSlicerSimpleMhaReaderModuleWidget::onSaveToPng()
 {
   Q_D(qSlicerSimpleMhaReaderModuleWidget);
+  vtkSlicerSimpleMhaReaderLogic* logic = d->logic();
   //get a filename to open
-  QString fileName = QFileDialog::getSaveFileName(this, tr("Open Image"), "/home/doriad", tr("Image Files (*.png *.jpg *.bmp)"));
-  d->logic()->saveToPng(fileName.toStdString());
+  QString defaultName = logic->getFramePngFilename(logic->getCurrentFrame()).c_str();
+  QString fileName = QFileDialog::getSaveFileName(this, tr("Open Image"), defaultName, tr("Image Files (*.png *.jpg *.bmp)"));
+  logic->saveToPng(fileName.toStdString());
 
 }
 
+void qSlicerSimpleMhaReaderModuleWidget::onMemoryLimitChanged(int megabytes)
+{
+  Q_D(qSlicerSimpleMhaReaderModuleWidget);
+  d->logic()->setMemorySoftLimit(1024LL*1024LL*megabytes);
+}
+
+void qSlicerSimpleMhaReaderModuleWidget::onExportCine()
+{
+  Q_D(qSlicerSimpleMhaReaderModuleWidget);
+  vtkSlicerSimpleMhaReaderLogic* logic = d->logic();
+  QString fileName = QFileDialog::getSaveFileName(this, tr("Export Cine"), "",
+    tr("Motion JPEG (*.avi);;JPEG Series (*.jpg)"));
+  if(fileName.isEmpty())
+    return;
+  // Clips play at the speed of the play button
+  double framesPerSecond = 1000./std::max(d->playIntervalSpinBox->value(), 1);
+  logic->exportCine(fileName.toStdString(), 0, logic->getNumberOfFrames()-1, 1, framesPerSecond);
+}
+
+void qSlicerSimpleMhaReaderModuleWidget::onExportSequence()
+{
+  Q_D(qSlicerSimpleMhaReaderModuleWidget);
+  vtkSlicerSimpleMhaReaderLogic* logic = d->logic();
+  QString fileName = QFileDialog::getSaveFileName(this, tr("Export Sequence"), "", tr("Sequence Files (*.mha)"));
+  if(fileName.isEmpty())
+    return;
+  logic->exportSequence(fileName.toStdString(), 0, logic->getNumberOfFrames()-1, 1, NULL,
+    d->skipDuplicatesCheckBox->isChecked());
+}
+
 SLOTDEF_0(onPreviousImage, previousImage);
 SLOTDEF_0(onPreviousValidFrame, previousValidFrame);
 SLOTDEF_0(onNextValidFrame, nextValidFrame);
 SLOTDEF_0(onPreviousInvalidFrame, previousInvalidFrame);
 SLOTDEF_0(onNextInvalidFrame, nextInvalidFrame);
 SLOTDEF_0(onPlayNext, playNext);
+SLOTDEF_0(onPublishFrame, publishPendingFrame);
+SLOTDEF_0(onFollowUpdate, updateFollow);
+SLOTDEF_0(onNextBlankFrame, nextBlankFrame);
+SLOTDEF_0(onPreviousBlankFrame, previousBlankFrame);
+SLOTDEF_0(onNextFrozenFrame, nextFrozenFrame);
+SLOTDEF_0(onPreviousFrozenFrame, previousFrozenFrame);
 SLOTDEF_1(int, onFrameSliderChanged, goToFrame);
 
@@ -52,13 +52,43 @@ public slots:
   void onPlayToggle();
   void onPlayModeChanged(const QString&);
   void onPlayNext();
+  void onPublishFrame();
+  void onFramePending();
+  void onDrainLog();
+  void onMemoryLimitChanged(int);
+  void onOpenSequences();
+  void onPlaySequencesToggle();
+  void onSequencesUpdate();
+  void onStreamToggle();
+  void onStreamUpdate();
   void onApplyTransformsChanged(int);
+  void onActiveTransformChanged(const QString&);
   void onSaveToPng();
+  void onExportSequence();
+  void onExportCine();
+  void onFollowChanged(int);
+  void onFollowUpdate();
+  void onAnalyze();
+  void onFindDuplicates();
+  void onAnalysisUpdate();
+  void onNextBlankFrame();
+  void onPreviousBlankFrame();
+  void onNextFrozenFrame();
+  void onPreviousFrozenFrame();
+  void onFiltersChanged();
+  void onPoseFilterChanged();
+  void onBuildMModeCache();
+  void onMModeCacheUpdate();
+  void onMModeLineChanged();
+  void onFrameCacheToggled(bool);
+  void onFrameCacheUpdate();
 
 protected:
   QScopedPointer<qSlicerSimpleMhaReaderModuleWidgetPrivate> d_ptr;
   
   virtual void setup();
+  /// Polls sequences and the stream only while there are some
+  void updatePollTimer();
 
 private:
   Q_DECLARE_PRIVATE(qSlicerSimpleMhaReaderModuleWidget);